@@ -87,7 +87,9 @@ void init_adns(meshlink_handle_t *mesh) {
 	meshlink_queue_init(&mesh->adns_queue);
 	meshlink_queue_init(&mesh->adns_done_queue);
 	signal_add(&mesh->loop, &mesh->adns_signal, adns_cb_handler, mesh, 1);
-	pthread_create(&mesh->adns_thread, NULL, adns_loop, mesh);
+
+	// The thread is only started when the first request is queued
+	mesh->adns_thread_started = false;
 }
 
 void exit_adns(meshlink_handle_t *mesh) {
@@ -103,13 +105,17 @@ void exit_adns(meshlink_handle_t *mesh) {
 	}
 
 	/* Signal the ADNS thread to stop */
-	if(!meshlink_queue_push(&mesh->adns_queue, NULL)) {
-		abort();
-	}
+	if(mesh->adns_thread_started) {
+		if(!meshlink_queue_push(&mesh->adns_queue, NULL)) {
+			abort();
+		}
 
-	pthread_cond_signal(&mesh->adns_cond);
+		pthread_cond_signal(&mesh->adns_cond);
+
+		pthread_join(mesh->adns_thread, NULL);
+		mesh->adns_thread_started = false;
+	}
 
-	pthread_join(mesh->adns_thread, NULL);
 	meshlink_queue_exit(&mesh->adns_queue);
 	signal_del(&mesh->loop, &mesh->adns_signal);
 }
@@ -128,6 +134,14 @@ void adns_queue(meshlink_handle_t *mesh, char *host, char *serv, adns_cb_t cb, v
 		abort();
 	}
 
+	if(!mesh->adns_thread_started) {
+		if(pthread_create(&mesh->adns_thread, NULL, adns_loop, mesh) != 0) {
+			abort();
+		}
+
+		mesh->adns_thread_started = true;
+	}
+
 	pthread_cond_signal(&mesh->adns_cond);
 }
 
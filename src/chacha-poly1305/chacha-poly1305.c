@@ -28,6 +28,11 @@ bool chacha_poly1305_set_key(chacha_poly1305_ctx_t *ctx, const void *key)
 	return true;
 }
 
+void chacha_poly1305_copy(chacha_poly1305_ctx_t *dst, const chacha_poly1305_ctx_t *src)
+{
+	*dst = *src;
+}
+
 static void put_u64(void *vp, uint64_t v)
 {
 	uint8_t *p = (uint8_t *) vp;
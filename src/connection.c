@@ -25,6 +25,7 @@
 #include "list.h"
 #include "logger.h"
 #include "meshlink_internal.h"
+#include "splay_tree.h"
 #include "utils.h"
 #include "xalloc.h"
 
@@ -33,6 +34,7 @@ void init_connections(meshlink_handle_t *mesh) {
 	assert(!mesh->everyone);
 
 	mesh->connections = list_alloc((list_action_t) free_connection);
+	mesh->core_connections = list_alloc(NULL);
 	mesh->everyone = new_connection();
 	mesh->everyone->name = xstrdup("mesh->everyone");
 }
@@ -42,11 +44,16 @@ void exit_connections(meshlink_handle_t *mesh) {
 		list_delete_list(mesh->connections);
 	}
 
+	if(mesh->core_connections) {
+		list_delete_list(mesh->core_connections);
+	}
+
 	if(mesh->everyone) {
 		free_connection(mesh->everyone);
 	}
 
 	mesh->connections = NULL;
+	mesh->core_connections = NULL;
 	mesh->everyone = NULL;
 }
 
@@ -63,6 +70,10 @@ void free_connection(connection_t *c) {
 	buffer_clear(&c->inbuf);
 	buffer_clear(&c->outbuf);
 
+	if(c->sync_queried) {
+		splay_delete_tree(c->sync_queried);
+	}
+
 	if(c->io.cb) {
 		abort();
 	}
@@ -86,6 +97,38 @@ void connection_add(meshlink_handle_t *mesh, connection_t *c) {
 void connection_del(meshlink_handle_t *mesh, connection_t *c) {
 	assert(c);
 
+	connection_deactivate(mesh, c);
 	io_del(&mesh->loop, &c->io);
 	list_delete(mesh->connections, c);
 }
+
+/* Mark a connection as active, and add it to the list of active connections of the submesh its node is in,
+   so requests for a submesh only have to be sent to the connections in that list and to those with core nodes.
+   Active connections are also counted per device class for the autoconnect algorithm. */
+void connection_activate(meshlink_handle_t *mesh, connection_t *c) {
+	assert(c);
+	assert(c->node);
+	assert(!c->submesh_node);
+
+	c->status.active = true;
+	c->devclass = c->node->devclass;
+	mesh->autoconnect_connects[c->devclass]++;
+	c->submesh_index = c->node->submesh ? c->node->submesh->connections : mesh->core_connections;
+	c->submesh_node = list_insert_tail(c->submesh_index, c);
+}
+
+void connection_deactivate(meshlink_handle_t *mesh, connection_t *c) {
+	assert(c);
+
+	if(c->status.active) {
+		mesh->autoconnect_connects[c->devclass]--;
+	}
+
+	c->status.active = false;
+
+	if(c->submesh_node) {
+		list_delete_node(c->submesh_index, c->submesh_node);
+		c->submesh_index = NULL;
+		c->submesh_node = NULL;
+	}
+}
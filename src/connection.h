@@ -29,12 +29,13 @@
 #define OPTION_PMTU_DISCOVERY   0x0004
 #define OPTION_CLAMP_MSS        0x0008
 #define OPTION_VERSION(x) ((x) >> 24) /* Top 8 bits are for protocol minor version */
+#define OPTION_FLAGS(x) ((x) & 0x00ffffff) /* The remaining bits are option flags */
 
 typedef struct connection_status_t {
 	uint16_t pinged: 1;                 /* sent ping */
 	uint16_t active: 1;                 /* 1 if active.. */
 	uint16_t connecting: 1;             /* 1 if we are waiting for a non-blocking connect() to finish */
-	uint16_t unused: 1;
+	uint16_t mst: 1;                    /* 1 if this connection is part of the minimum spanning tree */
 	uint16_t control: 1;                /* 1 if this is a control connection */
 	uint16_t pcap: 1;                   /* 1 if this is a control connection requesting packet capture */
 	uint16_t log: 1;                    /* 1 if this is a control connection requesting log dump */
@@ -42,6 +43,9 @@ typedef struct connection_status_t {
 	uint16_t invitation_used: 1;        /* 1 if the invitation has been consumed */
 	uint16_t initiator: 1;              /* 1 if we initiated this connection */
 	uint16_t raw_packet: 1;             /* 1 if we are expecting a raw packet next */
+	uint16_t binary: 1;                 /* 1 if the peer understands binary requests */
+	uint16_t binary_relay: 1;           /* 1 if the peer understands binary relayed SPTPS data */
+	uint16_t rtt_seeded: 1;             /* 1 if the RTT has been seeded from the first two samples */
 } connection_status_t;
 
 #include "ecdsa.h"
@@ -69,11 +73,17 @@ typedef struct connection_t {
 	int allow_request;              /* defined if there's only one request possible */
 	time_t last_ping_time;          /* last time we saw some activity from the other end or pinged them */
 	time_t last_key_renewal;        /* last time we renewed the SPTPS key */
+	struct timespec ping_sent;      /* when the outstanding PING was sent */
+	int rtt;                        /* smoothed round trip time in milliseconds, 0 if not measured yet */
 
 	struct outgoing_t *outgoing;    /* used to keep track of outgoing connections */
 
 	struct edge_t *edge;            /* edge associated with this connection */
 	struct submesh_t *submesh;      /* his submesh handle if available in invitation file */
+	struct list_t *submesh_index;   /* list of active connections of his submesh this connection is in */
+	struct list_node_t *submesh_node; /* position of this connection in submesh_index */
+	int devclass;                   /* device class his node had when this connection was activated */
+	struct splay_tree_t *sync_queried; /* names of the nodes we sent NODE_DIGEST queries for */
 
 	// Only used during authentication
 	ecdsa_t *ecdsa;                 /* his public ECDSA key */
@@ -88,5 +98,7 @@ connection_t *new_connection(void) __attribute__((__malloc__));
 void free_connection(connection_t *);
 void connection_add(struct meshlink_handle *mesh, connection_t *);
 void connection_del(struct meshlink_handle *mesh, connection_t *);
+void connection_activate(struct meshlink_handle *mesh, connection_t *);
+void connection_deactivate(struct meshlink_handle *mesh, connection_t *);
 
 #endif
@@ -0,0 +1,403 @@
+/*
+    crypto_pool.c -- worker threads for SPTPS datagram encryption
+    Copyright (C) 2026 Guus Sliepen <guus@meshlink.io>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include <pthread.h>
+
+#include "crypto_pool.h"
+#include "logger.h"
+#include "net.h"
+#include "sptps.h"
+#include "xalloc.h"
+
+/* Jobs live in a ring, and are retired by MeshLink's thread strictly in the order they were submitted.
+   Sequence numbers are assigned and the replay window is applied on MeshLink's thread,
+   only the cipher work is done by the workers, using a private copy of the session's cipher.
+   That way per-node ordering and replay protection are the same as without the pool.
+   If the incoming key changes while a datagram is being opened, it is opened again with the new key when it is retired.
+   Records that are sealed without the pool, like probes and handshake records, are queued behind the datagrams for the same node
+   that are still in the pool, otherwise they could overtake them, and during a key renewal datagrams sealed with the old key
+   could go out after the new one is used.
+
+   If the ring is full, MeshLink's own thread waits for the oldest job to finish, which the workers do without needing the mesh lock.
+   Other threads, like application threads sending on a channel, do the work inline instead, since retiring jobs might call
+   the application's callbacks. Their datagrams can then overtake pooled ones, which the receiver's replay window tolerates. */
+
+#define CRYPTO_POOL_JOBS 256 // must be a power of two
+#define CRYPTO_POOL_BATCH 8  // number of jobs a worker claims at once
+
+typedef struct crypto_job {
+	node_t *node;              // NULL if the node was freed while the job was in flight
+	uint32_t generation;       // the SPTPS session the job belongs to
+	uint32_t inkey;            // the incoming key the job was opened with
+	bool seal;
+	bool sealed;               // the record was already sealed, it only has to be sent in order
+	bool done;
+	bool verified;
+	uint8_t type;
+	uint16_t len;              // size of the datagram on the wire
+	chacha_poly1305_ctx_t *cipher;
+	uint8_t data[MAXSIZE + SPTPS_DATAGRAM_OVERHEAD];
+} crypto_job_t;
+
+struct crypto_pool {
+	meshlink_handle_t *mesh;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;  // signalled when jobs are submitted
+	pthread_cond_t done_cond;  // signalled when jobs are done
+	bool stop;
+	int nthreads;
+	pthread_t *threads;
+
+	unsigned int head;         // oldest job that has not been retired yet
+	unsigned int next;         // next job to be claimed by a worker
+	unsigned int tail;         // next free slot
+	crypto_job_t jobs[CRYPTO_POOL_JOBS];
+};
+
+static void *crypto_worker(void *arg) {
+	crypto_pool_t *pool = arg;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while(true) {
+		while(!pool->stop && pool->next == pool->tail) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		}
+
+		if(pool->stop) {
+			break;
+		}
+
+		unsigned int first = pool->next;
+		unsigned int count = pool->tail - first;
+
+		if(count > CRYPTO_POOL_BATCH) {
+			count = CRYPTO_POOL_BATCH;
+		}
+
+		pool->next += count;
+		pthread_mutex_unlock(&pool->mutex);
+
+		for(unsigned int i = first; i != first + count; i++) {
+			crypto_job_t *job = &pool->jobs[i % CRYPTO_POOL_JOBS];
+
+			if(job->sealed) {
+				continue;
+			} else if(job->seal) {
+				sptps_seal_datagram(job->cipher, job->data, job->len);
+			} else {
+				job->verified = sptps_open_datagram(job->cipher, job->data, job->len);
+			}
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+
+		for(unsigned int i = first; i != first + count; i++) {
+			pool->jobs[i % CRYPTO_POOL_JOBS].done = true;
+		}
+
+		pthread_cond_broadcast(&pool->done_cond);
+
+		// Only wake up MeshLink's thread if the oldest job can be retired now
+		if(pool->jobs[pool->head % CRYPTO_POOL_JOBS].done) {
+			signal_trigger(&pool->mesh->loop, &pool->mesh->crypto_signal);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static void retire_job(meshlink_handle_t *mesh, crypto_job_t *job) {
+	node_t *n = job->node;
+
+	if(n && job->seal) {
+		n->pending_seals--;
+	}
+
+	if(!n || n->sptps.generation != job->generation) {
+		logger(mesh, MESHLINK_DEBUG, "Dropping SPTPS datagram from a previous session");
+		return;
+	}
+
+	if(job->seal) {
+		send_sptps_data_now(n, job->type, job->data, job->len);
+	} else if(!sptps_receive_opened_datagram(&n->sptps, job->inkey, job->verified, job->data, job->len)) {
+		logger(mesh, MESHLINK_ERROR, "Could not process SPTPS data from %s: %s", n->name, strerror(errno));
+	}
+}
+
+/* Retire the oldest job if it is done. The slot is released before the job is handled,
+   since handling it might submit new jobs. */
+static bool retire_one(meshlink_handle_t *mesh, crypto_pool_t *pool) {
+	pthread_mutex_lock(&pool->mutex);
+	crypto_job_t *oldest = &pool->jobs[pool->head % CRYPTO_POOL_JOBS];
+
+	if(pool->head == pool->tail || !oldest->done) {
+		pthread_mutex_unlock(&pool->mutex);
+		return false;
+	}
+
+	crypto_job_t local;
+	local.node = oldest->node;
+	local.generation = oldest->generation;
+	local.inkey = oldest->inkey;
+	local.seal = oldest->seal;
+	local.verified = oldest->verified;
+	local.type = oldest->type;
+	local.len = oldest->len;
+	memcpy(local.data, oldest->data, oldest->len);
+
+	oldest->done = false;
+	pool->head++;
+	pthread_mutex_unlock(&pool->mutex);
+
+	retire_job(mesh, &local);
+	return true;
+}
+
+static void crypto_pool_handler(event_loop_t *loop, void *data) {
+	(void)loop;
+	meshlink_handle_t *mesh = data;
+
+	while(mesh->crypto_pool && retire_one(mesh, mesh->crypto_pool));
+}
+
+/* Reserve a slot for a new job. If the ring is full, MeshLink's own thread retires old jobs itself,
+   other threads fall back to doing the work inline. */
+static crypto_job_t *reserve_job(meshlink_handle_t *mesh, crypto_pool_t *pool) {
+	bool own_thread = mesh->threadstarted && pthread_equal(mesh->thread, pthread_self());
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while(pool->tail - pool->head == CRYPTO_POOL_JOBS) {
+		if(!own_thread) {
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+
+		while(!pool->jobs[pool->head % CRYPTO_POOL_JOBS].done) {
+			pthread_cond_wait(&pool->done_cond, &pool->mutex);
+		}
+
+		pthread_mutex_unlock(&pool->mutex);
+		retire_one(mesh, pool);
+		pthread_mutex_lock(&pool->mutex);
+	}
+
+	crypto_job_t *job = &pool->jobs[pool->tail % CRYPTO_POOL_JOBS];
+	pthread_mutex_unlock(&pool->mutex);
+	return job;
+}
+
+static void submit_job(crypto_pool_t *pool) {
+	pthread_mutex_lock(&pool->mutex);
+	pool->tail++;
+	pthread_cond_signal(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+bool crypto_pool_seal(meshlink_handle_t *mesh, node_t *n, uint8_t type, const void *data, uint16_t len) {
+	crypto_pool_t *pool = mesh->crypto_pool;
+
+	if(!pool || len > MAXSIZE) {
+		return false;
+	}
+
+	crypto_job_t *job = reserve_job(mesh, pool);
+
+	if(!job) {
+		return false;
+	}
+
+	if(!sptps_prepare_datagram(&n->sptps, type, data, len, job->data, job->cipher)) {
+		return false;
+	}
+
+	job->node = n;
+	job->generation = n->sptps.generation;
+	job->seal = true;
+	job->sealed = false;
+	job->type = type;
+	job->len = len + SPTPS_DATAGRAM_OVERHEAD;
+
+	submit_job(pool);
+	n->pending_seals++;
+	return true;
+}
+
+bool crypto_pool_open(meshlink_handle_t *mesh, node_t *n, const void *data, uint16_t len) {
+	crypto_pool_t *pool = mesh->crypto_pool;
+
+	if(!pool || len > MAXSIZE) {
+		return false;
+	}
+
+	crypto_job_t *job = reserve_job(mesh, pool);
+
+	if(!job || !sptps_prepare_open(&n->sptps, len, job->cipher)) {
+		return false;
+	}
+
+	job->node = n;
+	job->generation = n->sptps.generation;
+	job->inkey = n->sptps.inkey;
+	job->seal = false;
+	job->sealed = false;
+	job->verified = false;
+	job->len = len;
+	memcpy(job->data, data, len);
+
+	submit_job(pool);
+	return true;
+}
+
+/* Queue an already sealed record behind the datagrams for n that are still in the pool.
+   Returns false if there are none, or if the record could not be queued, in which case it should be sent right away. */
+bool crypto_pool_send(meshlink_handle_t *mesh, node_t *n, uint8_t type, const void *data, size_t len) {
+	crypto_pool_t *pool = mesh->crypto_pool;
+
+	if(!pool || !n->pending_seals || len > sizeof(pool->jobs[0].data)) {
+		return false;
+	}
+
+	crypto_job_t *job = reserve_job(mesh, pool);
+
+	if(!job) {
+		return false;
+	}
+
+	job->node = n;
+	job->generation = n->sptps.generation;
+	job->seal = true;
+	job->sealed = true;
+	job->type = type;
+	job->len = len;
+	memcpy(job->data, data, len);
+
+	submit_job(pool);
+	n->pending_seals++;
+	return true;
+}
+
+void crypto_pool_forget_node(meshlink_handle_t *mesh, node_t *n) {
+	crypto_pool_t *pool = mesh->crypto_pool;
+
+	if(!pool) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+
+	for(unsigned int i = pool->head; i != pool->tail; i++) {
+		if(pool->jobs[i % CRYPTO_POOL_JOBS].node == n) {
+			pool->jobs[i % CRYPTO_POOL_JOBS].node = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void init_crypto_pool(meshlink_handle_t *mesh) {
+	if(mesh->crypto_pool || mesh->crypto_threads <= 0) {
+		return;
+	}
+
+	crypto_pool_t *pool = xzalloc(sizeof(*pool));
+	pool->mesh = mesh;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for(int i = 0; i < CRYPTO_POOL_JOBS; i++) {
+		pool->jobs[i].cipher = chacha_poly1305_init();
+	}
+
+	pool->threads = xzalloc(mesh->crypto_threads * sizeof(*pool->threads));
+
+	for(int i = 0; i < mesh->crypto_threads; i++) {
+		if(pthread_create(&pool->threads[i], NULL, crypto_worker, pool) != 0) {
+			logger(mesh, MESHLINK_ERROR, "Could not start crypto worker thread: %s", strerror(errno));
+			break;
+		}
+
+		pool->nthreads++;
+	}
+
+	if(!pool->nthreads) {
+		mesh->crypto_pool = pool;
+		exit_crypto_pool(mesh);
+		return;
+	}
+
+	signal_add(&mesh->loop, &mesh->crypto_signal, crypto_pool_handler, mesh, 4);
+	mesh->crypto_pool = pool;
+	logger(mesh, MESHLINK_DEBUG, "Started %d crypto worker threads", pool->nthreads);
+}
+
+/* Stop the workers. Outgoing jobs that have not been retired yet are finished and sent,
+   so records queued behind them are not lost. Incoming jobs are dropped, which looks like packet loss to the rest of MeshLink. */
+void exit_crypto_pool(meshlink_handle_t *mesh) {
+	crypto_pool_t *pool = mesh->crypto_pool;
+
+	if(!pool) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for(int i = 0; i < pool->nthreads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	if(mesh->crypto_signal.cb) {
+		signal_del(&mesh->loop, &mesh->crypto_signal);
+	}
+
+	mesh->crypto_pool = NULL;
+
+	for(unsigned int i = pool->head; i != pool->tail; i++) {
+		crypto_job_t *job = &pool->jobs[i % CRYPTO_POOL_JOBS];
+
+		if(!job->node || !job->seal) {
+			continue;
+		}
+
+		if(!job->done && !job->sealed) {
+			sptps_seal_datagram(job->cipher, job->data, job->len);
+		}
+
+		retire_job(mesh, job);
+	}
+
+	for(int i = 0; i < CRYPTO_POOL_JOBS; i++) {
+		chacha_poly1305_exit(pool->jobs[i].cipher);
+	}
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
@@ -0,0 +1,37 @@
+#ifndef MESHLINK_CRYPTO_POOL_H
+#define MESHLINK_CRYPTO_POOL_H
+
+/*
+    crypto_pool.h -- header file for crypto_pool.c
+    Copyright (C) 2026 Guus Sliepen <guus@meshlink.io>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "meshlink_internal.h"
+#include "node.h"
+
+#define CRYPTO_POOL_MAX_THREADS 64
+
+typedef struct crypto_pool crypto_pool_t;
+
+void init_crypto_pool(meshlink_handle_t *mesh);
+void exit_crypto_pool(meshlink_handle_t *mesh);
+bool crypto_pool_seal(meshlink_handle_t *mesh, node_t *n, uint8_t type, const void *data, uint16_t len) __attribute__((__warn_unused_result__));
+bool crypto_pool_open(meshlink_handle_t *mesh, node_t *n, const void *data, uint16_t len) __attribute__((__warn_unused_result__));
+bool crypto_pool_send(meshlink_handle_t *mesh, node_t *n, uint8_t type, const void *data, size_t len) __attribute__((__warn_unused_result__));
+void crypto_pool_forget_node(meshlink_handle_t *mesh, node_t *n);
+
+#endif
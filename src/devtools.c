@@ -20,11 +20,14 @@
 #include "system.h"
 #include <assert.h>
 
+#include "connection.h"
 #include "logger.h"
 #include "meshlink_internal.h"
 #include "node.h"
+#include "shard.h"
 #include "submesh.h"
 #include "splay_tree.h"
+#include "net.h"
 #include "netutl.h"
 #include "xalloc.h"
 
@@ -65,9 +68,7 @@ devtool_edge_t *devtool_get_all_edges(meshlink_handle_t *mesh, devtool_edge_t *e
 		return NULL;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	devtool_edge_t *result = NULL;
 	unsigned int result_size = 0;
@@ -107,15 +108,21 @@ devtool_edge_t *devtool_get_all_edges(meshlink_handle_t *mesh, devtool_edge_t *e
 			p++;
 		}
 
-		// shrink result to the actual amount of memory used
-		result = xrealloc(result, n * sizeof(*result));
+		// shrink result to the actual amount of memory used, realloc() might return NULL for zero bytes
+		if(n) {
+			result = xrealloc(result, n * sizeof(*result));
+		} else {
+			free(result);
+			result = NULL;
+		}
+
 		*nmemb = n;
 	} else {
 		*nmemb = 0;
 		meshlink_errno = MESHLINK_ENOMEM;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return result;
 }
@@ -137,9 +144,7 @@ bool devtool_export_json_all_edges_state(meshlink_handle_t *mesh, FILE *stream)
 
 	bool result = true;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	// export edges and nodes
 	size_t node_count = 0;
@@ -254,48 +259,50 @@ done:
 	free(nodes);
 	free(edges);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return result;
 }
 
+static void fill_node_status(meshlink_handle_t *mesh, node_t *internal, devtool_node_status_t *status) {
+	memcpy(&status->status, &internal->status, sizeof status->status);
+	memcpy(&status->address, &internal->address, sizeof status->address);
+	status->mtu = internal->mtu;
+	status->minmtu = internal->minmtu;
+	status->maxmtu = internal->maxmtu;
+	status->mtuprobes = internal->mtuprobes;
+	status->in_data = internal->in_data;
+	status->out_data = internal->out_data;
+	status->in_forward = internal->in_forward;
+	status->out_forward = internal->out_forward;
+	status->in_meta = internal->in_meta;
+	status->out_meta = internal->out_meta;
+
+	// Derive UDP connection status
+	if(internal == mesh->self) {
+		status->udp_status = DEVTOOL_UDP_WORKING;
+	} else if(!internal->status.reachable) {
+		status->udp_status = DEVTOOL_UDP_IMPOSSIBLE;
+	} else if(!internal->status.validkey) {
+		status->udp_status = DEVTOOL_UDP_UNKNOWN;
+	} else if(internal->status.udp_confirmed) {
+		status->udp_status = DEVTOOL_UDP_WORKING;
+	} else if(internal->mtuprobes > 30) {
+		status->udp_status = DEVTOOL_UDP_FAILED;
+	} else if(internal->mtuprobes > 0) {
+		status->udp_status = DEVTOOL_UDP_TRYING;
+	} else {
+		status->udp_status = DEVTOOL_UDP_UNKNOWN;
+	}
+}
+
 static void devtool_get_reset_node_status(meshlink_handle_t *mesh, meshlink_node_t *node, devtool_node_status_t *status, bool reset) {
 	node_t *internal = (node_t *)node;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(status) {
-		memcpy(&status->status, &internal->status, sizeof status->status);
-		memcpy(&status->address, &internal->address, sizeof status->address);
-		status->mtu = internal->mtu;
-		status->minmtu = internal->minmtu;
-		status->maxmtu = internal->maxmtu;
-		status->mtuprobes = internal->mtuprobes;
-		status->in_data = internal->in_data;
-		status->out_data = internal->out_data;
-		status->in_forward = internal->in_forward;
-		status->out_forward = internal->out_forward;
-		status->in_meta = internal->in_meta;
-		status->out_meta = internal->out_meta;
-
-		// Derive UDP connection status
-		if(internal == mesh->self) {
-			status->udp_status = DEVTOOL_UDP_WORKING;
-		} else if(!internal->status.reachable) {
-			status->udp_status = DEVTOOL_UDP_IMPOSSIBLE;
-		} else if(!internal->status.validkey) {
-			status->udp_status = DEVTOOL_UDP_UNKNOWN;
-		} else if(internal->status.udp_confirmed) {
-			status->udp_status = DEVTOOL_UDP_WORKING;
-		} else if(internal->mtuprobes > 30) {
-			status->udp_status = DEVTOOL_UDP_FAILED;
-		} else if(internal->mtuprobes > 0) {
-			status->udp_status = DEVTOOL_UDP_TRYING;
-		} else {
-			status->udp_status = DEVTOOL_UDP_UNKNOWN;
-		}
+		fill_node_status(mesh, internal, status);
 	}
 
 	if(reset) {
@@ -307,7 +314,7 @@ static void devtool_get_reset_node_status(meshlink_handle_t *mesh, meshlink_node
 		internal->out_meta = 0;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void devtool_get_node_status(meshlink_handle_t *mesh, meshlink_node_t *node, devtool_node_status_t *status) {
@@ -328,6 +335,32 @@ void devtool_reset_node_counters(meshlink_handle_t *mesh, meshlink_node_t *node,
 	devtool_get_reset_node_status(mesh, node, status, true);
 }
 
+devtool_shard_stats_t *devtool_get_shard_stats(meshlink_handle_t *mesh, size_t *nmemb) {
+	if(!mesh || !nmemb) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return NULL;
+	}
+
+	devtool_shard_stats_t *stats = NULL;
+
+	meshlink_lock(mesh);
+
+	*nmemb = mesh->nshards;
+
+	if(mesh->nshards) {
+		stats = xzalloc(mesh->nshards * sizeof(*stats));
+
+		for(int i = 0; i < mesh->nshards; i++) {
+			stats[i].in_packets = mesh->shards[i].in_packets;
+			stats[i].handled_packets = mesh->shards[i].handled_packets;
+		}
+	}
+
+	meshlink_unlock(mesh);
+
+	return stats;
+}
+
 meshlink_submesh_t **devtool_get_all_submeshes(meshlink_handle_t *mesh, meshlink_submesh_t **submeshes, size_t *nmemb) {
 	if(!mesh || !nmemb || (*nmemb && !submeshes)) {
 		meshlink_errno = MESHLINK_EINVAL;
@@ -337,9 +370,7 @@ meshlink_submesh_t **devtool_get_all_submeshes(meshlink_handle_t *mesh, meshlink
 	meshlink_submesh_t **result;
 
 	//lock mesh->nodes
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	*nmemb = mesh->submeshes->count;
 	result = realloc(submeshes, *nmemb * sizeof(*submeshes));
@@ -356,7 +387,7 @@ meshlink_submesh_t **devtool_get_all_submeshes(meshlink_handle_t *mesh, meshlink
 		meshlink_errno = MESHLINK_ENOMEM;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return result;
 }
@@ -400,10 +431,407 @@ void devtool_set_meta_status_cb(meshlink_handle_t *mesh, meshlink_node_status_cb
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->meta_status_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
+}
+
+void devtool_set_meta_text_only(meshlink_handle_t *mesh, bool text_only) {
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	meshlink_lock(mesh);
+	mesh->meta_text_only = text_only;
+	meshlink_unlock(mesh);
+}
+
+void devtool_set_transport(meshlink_handle_t *mesh, const devtool_transport_t *transport) {
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return;
+	}
+
+	meshlink_lock(mesh);
+
+	mesh->transport = transport;
+	meshlink_unlock(mesh);
+}
+
+static bool queue_transport_item(meshlink_handle_t *mesh, int fd, const struct sockaddr *from, const void *data, size_t len) {
+	if(!mesh || !from || (!data && len) || len > MAXSIZE) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	socklen_t salen;
+
+	switch(from->sa_family) {
+	case AF_INET:
+		salen = sizeof(struct sockaddr_in);
+		break;
+
+	case AF_INET6:
+		salen = sizeof(struct sockaddr_in6);
+		break;
+
+	default:
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	transport_item_t *item = xzalloc(sizeof(*item) + len);
+	item->fd = fd;
+	memcpy(&item->from, from, salen);
+	item->len = len;
+
+	if(len) {
+		memcpy(item->data, data, len);
+	}
+
+	if(!meshlink_queue_push(&mesh->transport_queue, item)) {
+		free(item);
+		meshlink_errno = MESHLINK_ENOMEM;
+		return false;
+	}
+
+	signal_trigger(&mesh->loop, &mesh->transport_signal);
+	return true;
+}
+
+bool devtool_transport_receive(meshlink_handle_t *mesh, const struct sockaddr *from, const void *data, size_t len) {
+	return queue_transport_item(mesh, -1, from, data, len);
+}
+
+bool devtool_transport_accept(meshlink_handle_t *mesh, int fd, const struct sockaddr *from) {
+	if(fd < 0) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	return queue_transport_item(mesh, fd, from, NULL, 0);
+}
+
+devtool_metrics_t *devtool_get_metrics(meshlink_handle_t *mesh) {
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return NULL;
+	}
+
+	meshlink_lock(mesh);
+
+	size_t nnodes = mesh->nodes->count;
+	size_t nconnections = mesh->connections->count;
+	devtool_metrics_t *metrics = calloc(1, sizeof(*metrics) + nnodes * sizeof(*metrics->nodes) + nconnections * sizeof(*metrics->connections));
+
+	if(!metrics) {
+		meshlink_unlock(mesh);
+		meshlink_errno = MESHLINK_ENOMEM;
+		return NULL;
+	}
+
+	metrics->loop_iterations = mesh->loop.iterations;
+	metrics->loop_busy_usec = mesh->loop.busy_usec;
+	metrics->loop_max_busy_usec = mesh->loop.max_busy_usec;
+	metrics->topology_edges_sent = mesh->topology_edges_sent;
+
+	metrics->nnodes = nnodes;
+	metrics->nodes = (devtool_node_metrics_t *)(metrics + 1);
+	devtool_node_metrics_t *nm = metrics->nodes;
+
+	for splay_each(node_t, n, mesh->nodes) {
+		nm->node = (meshlink_node_t *)n;
+		nm->reachable = n->status.reachable;
+		fill_node_status(mesh, n, &nm->status);
+		nm->in_packets = n->in_packets;
+		nm->out_packets = n->out_packets;
+		nm->in_udp = n->in_udp;
+		nm->out_udp = n->out_udp;
+		nm->in_relayed = n->in_relayed;
+		nm->out_relayed = n->out_relayed;
+		nm->decrypt_failures = n->sptps.decrypt_failures;
+		nm->replay_drops = n->sptps.replay_drops;
+		nm->try_harder_hits = n->try_harder_hits;
+		nm++;
+	}
+
+	metrics->nconnections = nconnections;
+	metrics->connections = (devtool_connection_metrics_t *)(metrics->nodes + nnodes);
+	devtool_connection_metrics_t *cm = metrics->connections;
+
+	for list_each(connection_t, c, mesh->connections) {
+		cm->node = (meshlink_node_t *)c->node;
+		memcpy(&cm->address, &c->address, sizeof(c->address));
+		cm->active = c->status.active;
+		cm->initiator = c->status.initiator;
+		cm->outbuf = c->outbuf.len - c->outbuf.offset;
+		cm->last_ping = mesh->loop.now.tv_sec - c->last_ping_time;
+		cm->rtt = c->rtt;
+		cm->mst = c->status.mst;
+		cm++;
+	}
+
+	meshlink_unlock(mesh);
+
+	return metrics;
+}
+
+static const char *const event_kind_names[DEVTOOL_EVENT_KINDS] = {
+	[DEVTOOL_EVENT_WAIT] = "wait",
+	[DEVTOOL_EVENT_LOCK] = "lock",
+	[DEVTOOL_EVENT_HOLD] = "hold",
+	[DEVTOOL_EVENT_TIMEOUT] = "timeout",
+	[DEVTOOL_EVENT_IDLE] = "idle",
+	[DEVTOOL_EVENT_SIGNAL] = "signal",
+	[DEVTOOL_EVENT_META_IO] = "meta_io",
+	[DEVTOOL_EVENT_VPN_IO] = "vpn_io",
+	[DEVTOOL_EVENT_LISTEN_IO] = "listen_io",
+	[DEVTOOL_EVENT_OTHER_IO] = "other_io",
+};
+
+const char *devtool_event_kind_name(devtool_event_kind_t kind) {
+	if((unsigned int)kind >= DEVTOOL_EVENT_KINDS) {
+		return NULL;
+	}
+
+	return event_kind_names[kind];
+}
+
+bool devtool_get_event_stats(meshlink_handle_t *mesh, devtool_event_stats_t *stats, bool reset) {
+	if(!mesh || !stats) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+#ifdef MESHLINK_EVENT_STATS
+	_Static_assert((int)DEVTOOL_EVENT_KINDS == (int)EVENT_STATS_KINDS, "event stats kinds must match");
+	_Static_assert(DEVTOOL_EVENT_STATS_BUCKETS == EVENT_STATS_BUCKETS, "event stats buckets must match");
+
+	meshlink_lock(mesh);
+
+	event_loop_t *loop = &mesh->loop;
+	memset(stats, 0, sizeof(*stats));
+	stats->iterations = loop->iterations;
+	stats->stall_usec = loop->stall_usec;
+	stats->stall_kind = (devtool_event_kind_t)loop->stall_kind;
+
+	for(int i = 0; i < EVENT_STATS_KINDS; i++) {
+		stats->kinds[i].count = loop->stats[i].count;
+		stats->kinds[i].total_usec = loop->stats[i].total_usec;
+		stats->kinds[i].max_usec = loop->stats[i].max_usec;
+		memcpy(stats->kinds[i].buckets, loop->stats[i].buckets, sizeof(stats->kinds[i].buckets));
+	}
+
+	if(reset) {
+		memset(loop->stats, 0, sizeof(loop->stats));
+		loop->stall_usec = 0;
+		loop->stall_kind = EVENT_STATS_WAIT;
+	}
+
+	meshlink_unlock(mesh);
+
+	return true;
+#else
+	(void)reset;
+	meshlink_errno = MESHLINK_ENOTSUP;
+	return false;
+#endif
+}
+
+devtool_lock_stats_t *devtool_get_lock_stats(meshlink_handle_t *mesh, size_t *nmemb, bool reset) {
+	if(!mesh || !nmemb) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return NULL;
+	}
+
+#ifdef MESHLINK_LOCK_STATS
+	devtool_lock_stats_t *stats = xzalloc(LOCK_STATS_SITES * sizeof(*stats));
+	size_t count = 0;
+
+	meshlink_lock(mesh);
+
+	for(int i = 0; i < LOCK_STATS_SITES; i++) {
+		struct lock_stats *ls = &mesh->lock_stats[i];
+
+		if(!ls->site || !ls->count) {
+			continue;
+		}
+
+		stats[count].function = ls->site;
+		stats[count].count = ls->count;
+		stats[count].wait_usec = ls->wait_usec;
+		stats[count].hold_usec = ls->hold_usec;
+		stats[count].max_wait_usec = ls->max_wait_usec;
+		stats[count].max_hold_usec = ls->max_hold_usec;
+		count++;
+
+		if(reset) {
+			const char *site = ls->site;
+			memset(ls, 0, sizeof(*ls));
+			ls->site = site;
+		}
+	}
+
+	meshlink_unlock(mesh);
+
+	*nmemb = count;
+	return stats;
+#else
+	(void)reset;
+	*nmemb = 0;
+	meshlink_errno = MESHLINK_ENOTSUP;
+	return NULL;
+#endif
+}
+
+static bool write_metric(meshlink_handle_t *mesh, devtool_metrics_write_cb_t cb, void *priv, const char *format, ...) __attribute__((__format__(printf, 4, 5)));
+static bool write_metric(meshlink_handle_t *mesh, devtool_metrics_write_cb_t cb, void *priv, const char *format, ...) {
+	char *text;
+	va_list ap;
+	va_start(ap, format);
+	int len = xvasprintf(&text, format, ap);
+	va_end(ap);
+
+	bool result = cb(mesh, text, len, priv);
+	free(text);
+	return result;
+}
+
+static const struct {
+	const char *name;
+	const char *help;
+	size_t offset;
+} node_counters[] = {
+	{"in_data_bytes_total", "Bytes received from channels.", offsetof(devtool_node_metrics_t, status.in_data)},
+	{"out_data_bytes_total", "Bytes sent via channels.", offsetof(devtool_node_metrics_t, status.out_data)},
+	{"in_forward_bytes_total", "Bytes received that were forwarded to other nodes.", offsetof(devtool_node_metrics_t, status.in_forward)},
+	{"out_forward_bytes_total", "Bytes forwarded from other nodes.", offsetof(devtool_node_metrics_t, status.out_forward)},
+	{"in_meta_bytes_total", "Bytes received from meta-connections, heartbeat packets etc.", offsetof(devtool_node_metrics_t, status.in_meta)},
+	{"out_meta_bytes_total", "Bytes sent on meta-connections, heartbeat packets etc.", offsetof(devtool_node_metrics_t, status.out_meta)},
+	{"in_packets_total", "SPTPS packets received via UDP.", offsetof(devtool_node_metrics_t, in_packets)},
+	{"out_packets_total", "SPTPS packets sent via UDP.", offsetof(devtool_node_metrics_t, out_packets)},
+	{"in_udp_bytes_total", "Bytes of SPTPS packets received via UDP.", offsetof(devtool_node_metrics_t, in_udp)},
+	{"out_udp_bytes_total", "Bytes of SPTPS packets sent via UDP.", offsetof(devtool_node_metrics_t, out_udp)},
+	{"in_relayed_bytes_total", "Bytes of SPTPS packets received via meta-connections.", offsetof(devtool_node_metrics_t, in_relayed)},
+	{"out_relayed_bytes_total", "Bytes of SPTPS packets sent via meta-connections.", offsetof(devtool_node_metrics_t, out_relayed)},
+	{"decrypt_failures_total", "SPTPS packets that failed to decrypt.", offsetof(devtool_node_metrics_t, decrypt_failures)},
+	{"replay_drops_total", "SPTPS packets dropped because they were replayed or too late.", offsetof(devtool_node_metrics_t, replay_drops)},
+	{"try_harder_hits_total", "UDP packets from an unknown address that were matched to this node.", offsetof(devtool_node_metrics_t, try_harder_hits)},
+};
+
+bool devtool_export_metrics(meshlink_handle_t *mesh, devtool_metrics_write_cb_t cb, void *priv) {
+	if(!mesh || !cb) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	devtool_metrics_t *metrics = devtool_get_metrics(mesh);
+
+	if(!metrics) {
+		return false;
+	}
+
+	const char *name = mesh->name;
+	bool result =
+	        write_metric(mesh, cb, priv, "# HELP meshlink_loop_iterations_total Event loop iterations.\n# TYPE meshlink_loop_iterations_total counter\nmeshlink_loop_iterations_total{mesh=\"%s\"} %" PRIu64 "\n", name, metrics->loop_iterations) &&
+	        write_metric(mesh, cb, priv, "# HELP meshlink_loop_busy_seconds_total Time spent running event loop callbacks.\n# TYPE meshlink_loop_busy_seconds_total counter\nmeshlink_loop_busy_seconds_total{mesh=\"%s\"} %.6f\n", name, metrics->loop_busy_usec / 1e6) &&
+	        write_metric(mesh, cb, priv, "# HELP meshlink_loop_max_busy_seconds Longest time spent running callbacks in a single event loop iteration.\n# TYPE meshlink_loop_max_busy_seconds gauge\nmeshlink_loop_max_busy_seconds{mesh=\"%s\"} %.6f\n", name, metrics->loop_max_busy_usec / 1e6) &&
+	        write_metric(mesh, cb, priv, "# HELP meshlink_topology_edges_sent_total Edges sent to newly activated meta-connections.\n# TYPE meshlink_topology_edges_sent_total counter\nmeshlink_topology_edges_sent_total{mesh=\"%s\"} %" PRIu64 "\n", name, metrics->topology_edges_sent);
+
+	devtool_event_stats_t *event_stats = xzalloc(sizeof(*event_stats));
+
+	if(result && devtool_get_event_stats(mesh, event_stats, false)) {
+		result = write_metric(mesh, cb, priv, "# HELP meshlink_loop_stall_seconds Longest time spent in a single event loop callback.\n# TYPE meshlink_loop_stall_seconds gauge\nmeshlink_loop_stall_seconds{mesh=\"%s\",kind=\"%s\"} %.6f\n", name, devtool_event_kind_name(event_stats->stall_kind), event_stats->stall_usec / 1e6);
+
+		if(result) {
+			result = write_metric(mesh, cb, priv, "# HELP meshlink_loop_seconds Time spent by the event loop per kind of work.\n# TYPE meshlink_loop_seconds histogram\n");
+		}
+
+		for(int i = 0; result && i < DEVTOOL_EVENT_KINDS; i++) {
+			const devtool_histogram_t *h = &event_stats->kinds[i];
+			const char *kind = devtool_event_kind_name(i);
+			uint64_t cumulative = 0;
+
+			for(int j = 0; result && j < DEVTOOL_EVENT_STATS_BUCKETS - 1; j++) {
+				cumulative += h->buckets[j];
+				result = write_metric(mesh, cb, priv, "meshlink_loop_seconds_bucket{mesh=\"%s\",kind=\"%s\",le=\"%g\"} %" PRIu64 "\n", name, kind, (1u << j) / 1e6, cumulative);
+			}
+
+			if(result) {
+				result = write_metric(mesh, cb, priv, "meshlink_loop_seconds_bucket{mesh=\"%s\",kind=\"%s\",le=\"+Inf\"} %" PRIu64 "\nmeshlink_loop_seconds_sum{mesh=\"%s\",kind=\"%s\"} %.6f\nmeshlink_loop_seconds_count{mesh=\"%s\",kind=\"%s\"} %" PRIu64 "\n", name, kind, h->count, name, kind, h->total_usec / 1e6, name, kind, h->count);
+			}
+		}
+	}
+
+	free(event_stats);
+
+	size_t nlock_stats;
+	devtool_lock_stats_t *lock_stats = result ? devtool_get_lock_stats(mesh, &nlock_stats, false) : NULL;
+
+	if(lock_stats) {
+		result = write_metric(mesh, cb, priv, "# HELP meshlink_lock_acquisitions_total Number of times the mesh lock was taken.\n# TYPE meshlink_lock_acquisitions_total counter\n");
+
+		for(size_t i = 0; result && i < nlock_stats; i++) {
+			result = write_metric(mesh, cb, priv, "meshlink_lock_acquisitions_total{mesh=\"%s\",function=\"%s\"} %" PRIu64 "\n", name, lock_stats[i].function, lock_stats[i].count);
+		}
+
+		if(result) {
+			result = write_metric(mesh, cb, priv, "# HELP meshlink_lock_wait_seconds_total Time spent waiting for the mesh lock.\n# TYPE meshlink_lock_wait_seconds_total counter\n");
+		}
+
+		for(size_t i = 0; result && i < nlock_stats; i++) {
+			result = write_metric(mesh, cb, priv, "meshlink_lock_wait_seconds_total{mesh=\"%s\",function=\"%s\"} %.6f\n", name, lock_stats[i].function, lock_stats[i].wait_usec / 1e6);
+		}
+
+		if(result) {
+			result = write_metric(mesh, cb, priv, "# HELP meshlink_lock_hold_seconds_total Time the mesh lock was held.\n# TYPE meshlink_lock_hold_seconds_total counter\n");
+		}
+
+		for(size_t i = 0; result && i < nlock_stats; i++) {
+			result = write_metric(mesh, cb, priv, "meshlink_lock_hold_seconds_total{mesh=\"%s\",function=\"%s\"} %.6f\n", name, lock_stats[i].function, lock_stats[i].hold_usec / 1e6);
+		}
+
+		free(lock_stats);
+	}
+
+	for(size_t i = 0; result && i < sizeof(node_counters) / sizeof(*node_counters); i++) {
+		result = write_metric(mesh, cb, priv, "# HELP meshlink_node_%s %s\n# TYPE meshlink_node_%s counter\n", node_counters[i].name, node_counters[i].help, node_counters[i].name);
+
+		for(size_t j = 0; result && j < metrics->nnodes; j++) {
+			const devtool_node_metrics_t *nm = &metrics->nodes[j];
+			uint64_t value;
+			memcpy(&value, (const char *)nm + node_counters[i].offset, sizeof(value));
+			result = write_metric(mesh, cb, priv, "meshlink_node_%s{mesh=\"%s\",node=\"%s\"} %" PRIu64 "\n", node_counters[i].name, name, nm->node->name, value);
+		}
+	}
+
+	if(result) {
+		result = write_metric(mesh, cb, priv, "# HELP meshlink_node_reachable Whether a node is reachable.\n# TYPE meshlink_node_reachable gauge\n");
+	}
+
+	for(size_t j = 0; result && j < metrics->nnodes; j++) {
+		const devtool_node_metrics_t *nm = &metrics->nodes[j];
+		result = write_metric(mesh, cb, priv, "meshlink_node_reachable{mesh=\"%s\",node=\"%s\"} %d\n", name, nm->node->name, nm->reachable);
+	}
+
+	if(result) {
+		result = write_metric(mesh, cb, priv, "# HELP meshlink_connections Number of meta-connections.\n# TYPE meshlink_connections gauge\nmeshlink_connections{mesh=\"%s\"} %zu\n", name, metrics->nconnections);
+	}
+
+	if(result) {
+		result = write_metric(mesh, cb, priv, "# HELP meshlink_connection_outbuf_bytes Bytes queued for sending on a meta-connection.\n# TYPE meshlink_connection_outbuf_bytes gauge\n");
+	}
+
+	for(size_t j = 0; result && j < metrics->nconnections; j++) {
+		const devtool_connection_metrics_t *cm = &metrics->connections[j];
+
+		if(cm->node && cm->active) {
+			result = write_metric(mesh, cb, priv, "meshlink_connection_outbuf_bytes{mesh=\"%s\",node=\"%s\"} %zu\n", name, cm->node->name, cm->outbuf);
+		}
+	}
+
+	free(metrics);
+	return result;
 }
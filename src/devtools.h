@@ -136,6 +136,205 @@ void devtool_get_node_status(meshlink_handle_t *mesh, meshlink_node_t *node, dev
  */
 void devtool_reset_node_counters(meshlink_handle_t *mesh, meshlink_node_t *node, devtool_node_status_t *status);
 
+/// Metrics of a node.
+typedef struct devtool_node_metrics devtool_node_metrics_t;
+
+/// Metrics of a node.
+struct devtool_node_metrics {
+	meshlink_node_t *node;
+	bool reachable;                      /// True if the node is currently reachable
+	devtool_node_status_t status;        /// Status and byte counters, as returned by devtool_get_node_status()
+
+	uint64_t in_packets;                 /// SPTPS packets received via UDP
+	uint64_t out_packets;                /// SPTPS packets sent via UDP
+	uint64_t in_udp;                     /// Bytes of SPTPS packets received via UDP
+	uint64_t out_udp;                    /// Bytes of SPTPS packets sent via UDP
+	uint64_t in_relayed;                 /// Bytes of SPTPS packets received via meta-connections
+	uint64_t out_relayed;                /// Bytes of SPTPS packets sent via meta-connections
+	uint64_t decrypt_failures;           /// SPTPS packets that failed to decrypt
+	uint64_t replay_drops;               /// SPTPS packets dropped because they were replayed or too late
+	uint64_t try_harder_hits;            /// UDP packets from an unknown address that were matched to this node
+};
+
+/// Metrics of a meta-connection.
+typedef struct devtool_connection_metrics devtool_connection_metrics_t;
+
+/// Metrics of a meta-connection.
+struct devtool_connection_metrics {
+	meshlink_node_t *node;               /// The node at the other end, or NULL if it is not known yet
+	struct sockaddr_storage address;
+	bool active;                         /// True if the connection has been fully established
+	bool initiator;                      /// True if we made this connection
+	size_t outbuf;                       /// Bytes queued for sending
+	int last_ping;                       /// Seconds since we last saw activity from the other end
+	int rtt;                             /// Smoothed round trip time in milliseconds, 0 if not measured yet
+	bool mst;                            /// True if this connection is part of the minimum spanning tree used for flooding requests
+};
+
+/// A snapshot of the metrics of a mesh.
+typedef struct devtool_metrics devtool_metrics_t;
+
+/// A snapshot of the metrics of a mesh.
+struct devtool_metrics {
+	uint64_t loop_iterations;            /// Number of event loop iterations
+	uint64_t loop_busy_usec;             /// Time spent running event loop callbacks
+	uint32_t loop_max_busy_usec;         /// Longest time spent running callbacks in a single event loop iteration
+	uint64_t topology_edges_sent;        /// Edges sent to newly activated meta-connections to bring their view of the topology up to date
+
+	size_t nnodes;
+	devtool_node_metrics_t *nodes;       /// Metrics of all nodes, including ourself
+
+	size_t nconnections;
+	devtool_connection_metrics_t *connections;
+};
+
+/// Get a snapshot of the metrics of all nodes and connections.
+/** This function returns the counters of all nodes and meta-connections at once,
+ *  while holding the lock of the mesh only once.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *
+ *  @return             A pointer to a snapshot of the metrics, or NULL in case of an error.
+ *                      The snapshot is allocated as a single block of memory, and must be freed by the application using free().
+ */
+devtool_metrics_t *devtool_get_metrics(meshlink_handle_t *mesh);
+
+/// A callback for writing out metrics in text format.
+/** @param mesh         A handle which represents an instance of MeshLink.
+ *  @param text         A pointer to a chunk of text, which is not NUL-terminated.
+ *  @param len          The length of the text.
+ *  @param priv         The private pointer that was passed to devtool_export_metrics().
+ *
+ *  @return             This function should return true if the text was written, false to abort the export.
+ */
+typedef bool (*devtool_metrics_write_cb_t)(meshlink_handle_t *mesh, const char *text, size_t len, void *priv);
+
+/// Export a snapshot of the metrics in text format.
+/** This takes a snapshot with devtool_get_metrics(), and writes it out in the Prometheus text exposition format,
+ *  by calling the callback repeatedly with consecutive chunks of text.
+ *  The callback is called from the thread calling this function, without the lock of the mesh being held.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param cb           A pointer to the function which will be called with chunks of text.
+ *  @param priv         A private pointer which will be passed to the callback.
+ *
+ *  @return             True in case of success, false otherwise.
+ */
+bool devtool_export_metrics(meshlink_handle_t *mesh, devtool_metrics_write_cb_t cb, void *priv);
+
+/// The number of buckets in an event loop histogram.
+#define DEVTOOL_EVENT_STATS_BUCKETS 24
+
+/// The kinds of work measured by the event loop statistics.
+typedef enum devtool_event_kind {
+	DEVTOOL_EVENT_WAIT,                  ///< Time spent waiting in poll()
+	DEVTOOL_EVENT_LOCK,                  ///< Time spent reacquiring the mesh lock after poll() returned
+	DEVTOOL_EVENT_HOLD,                  ///< Time the mesh lock was held by the event loop during a single iteration
+	DEVTOOL_EVENT_TIMEOUT,               ///< Timeout callbacks
+	DEVTOOL_EVENT_IDLE,                  ///< The idle callback
+	DEVTOOL_EVENT_SIGNAL,                ///< Signal callbacks, such as the application's data queue
+	DEVTOOL_EVENT_META_IO,               ///< I/O on meta-connections
+	DEVTOOL_EVENT_VPN_IO,                ///< Incoming UDP packets
+	DEVTOOL_EVENT_LISTEN_IO,             ///< Accepting incoming meta-connections
+	DEVTOOL_EVENT_OTHER_IO,              ///< All other I/O callbacks, such as local discovery
+	DEVTOOL_EVENT_KINDS
+} devtool_event_kind_t;
+
+/// A histogram of durations.
+typedef struct devtool_histogram devtool_histogram_t;
+
+/// A histogram of durations.
+/** Bucket 0 counts durations below 1 microsecond, bucket i > 0 counts durations of [2^(i-1), 2^i) microseconds,
+ *  and the last bucket also counts all durations longer than that.
+ */
+struct devtool_histogram {
+	uint64_t count;                      /// Number of samples
+	uint64_t total_usec;                 /// Sum of all samples
+	uint32_t max_usec;                   /// Longest sample
+	uint64_t buckets[DEVTOOL_EVENT_STATS_BUCKETS];
+};
+
+/// Event loop latency statistics.
+typedef struct devtool_event_stats devtool_event_stats_t;
+
+/// Event loop latency statistics.
+struct devtool_event_stats {
+	uint64_t iterations;                 /// Number of event loop iterations
+	uint32_t stall_usec;                 /// Longest time spent in a single callback, or holding the lock between two calls to poll()
+	devtool_event_kind_t stall_kind;     /// The kind of work that caused the longest stall
+	devtool_histogram_t kinds[DEVTOOL_EVENT_KINDS];
+};
+
+/// Get the event loop latency statistics.
+/** This function returns histograms of the time spent by the event loop on each kind of work.
+ *  These statistics are only collected if MeshLink was configured with --enable-event-stats,
+ *  otherwise this function fails and sets meshlink_errno to MESHLINK_ENOTSUP.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param stats        A pointer to a devtool_event_stats_t variable that will be filled in.
+ *  @param reset        If true, the statistics are reset to zero after they have been copied.
+ *
+ *  @return             True if the statistics were copied, false otherwise.
+ */
+bool devtool_get_event_stats(meshlink_handle_t *mesh, devtool_event_stats_t *stats, bool reset);
+
+/// Get the name of an event loop statistics kind.
+/** @param kind         The kind of work.
+ *
+ *  @return             A pointer to a static string describing the kind of work, or NULL if the kind is invalid.
+ */
+const char *devtool_event_kind_name(devtool_event_kind_t kind);
+
+/// Contention statistics of the mesh lock.
+typedef struct devtool_lock_stats devtool_lock_stats_t;
+
+/// Contention statistics of the mesh lock, for a single function that takes it.
+struct devtool_lock_stats {
+	const char *function;                /// The name of the function that took the lock
+	uint64_t count;                      /// Number of times the lock was taken
+	uint64_t wait_usec;                  /// Total time spent waiting for the lock
+	uint64_t hold_usec;                  /// Total time the lock was held
+	uint32_t max_wait_usec;              /// Longest time spent waiting for the lock
+	uint32_t max_hold_usec;              /// Longest time the lock was held
+};
+
+/// Get the contention statistics of the mesh lock.
+/** This function returns, for every function that took the lock of the mesh, how often it did so,
+ *  and how long it had to wait for and held the lock. Nested locking is accounted to the outermost function.
+ *  The library thread shows up as event_loop_run.
+ *  These statistics are only collected if MeshLink was configured with --enable-lock-stats,
+ *  otherwise this function fails and sets meshlink_errno to MESHLINK_ENOTSUP.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param nmemb        A pointer to a variable that will be filled with the number of entries in the returned array.
+ *  @param reset        If true, the statistics are reset to zero after they have been copied.
+ *
+ *  @return             An array of statistics, or NULL in case of an error.
+ *                      The array must be freed by the application using free().
+ */
+devtool_lock_stats_t *devtool_get_lock_stats(meshlink_handle_t *mesh, size_t *nmemb, bool reset);
+
+/// Statistics of a single UDP shard.
+typedef struct devtool_shard_stats devtool_shard_stats_t;
+
+/// Statistics of a single UDP shard.
+struct devtool_shard_stats {
+	uint64_t in_packets;                 /// Number of UDP packets received by the shard
+	uint64_t handled_packets;            /// Number of those packets the shard decrypted itself
+};
+
+/// Get the statistics of the UDP shards.
+/** This function returns the packet counters of all UDP shard threads that are currently running,
+ *  see meshlink_open_params_set_udp_shards(). The counters start at zero whenever the shards are started.
+ *
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param nmemb        A pointer to a variable that will be filled with the number of entries in the returned array.
+ *
+ *  @return             An array of statistics, or NULL in case of an error or if no shards are running.
+ *                      The array must be freed by the application using free().
+ */
+devtool_shard_stats_t *devtool_get_shard_stats(meshlink_handle_t *mesh, size_t *nmemb);
+
 /// Get the list of all submeshes of a meshlink instance.
 /** This function returns an array of submesh handles.
  *  These pointers are the same pointers that are present in the submeshes list
@@ -227,4 +426,84 @@ extern void (*devtool_set_inviter_commits_first)(bool inviter_commited_first);
  */
 void devtool_set_meta_status_cb(struct meshlink_handle *mesh, meshlink_node_status_cb_t cb);
 
+/// Only use text requests on meta-connections.
+/** This makes the local node behave like a node that does not understand binary requests
+ *  and does not route on edge weights, so interoperability with older versions of MeshLink can be tested.
+ *  It only affects meta-connections that are made after this function is called.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh       A handle which represents an instance of MeshLink.
+ *  @param text_only  If true, only text requests are sent and binary requests are not advertised.
+ */
+void devtool_set_meta_text_only(struct meshlink_handle *mesh, bool text_only);
+
+/// A virtual transport.
+/** A virtual transport replaces the UDP and TCP sockets MeshLink uses to talk to other nodes.
+ *  This allows many instances of MeshLink to be run inside a single process over simulated links,
+ *  for example for benchmarking, without needing any special privileges.
+ *
+ *  The callbacks are run in MeshLink's own thread, with the mesh's lock held.
+ *  They must not call any function that takes the lock of another mesh;
+ *  use devtool_transport_receive() and devtool_transport_accept() to hand data to other meshes.
+ */
+typedef struct devtool_transport devtool_transport_t;
+
+/// A virtual transport.
+struct devtool_transport {
+	/// Called instead of sendto() to send a UDP packet.
+	/** @param mesh  A handle which represents an instance of MeshLink.
+	 *  @param to    The address the packet should be sent to.
+	 *  @param data  A pointer to the packet.
+	 *  @param len   The length of the packet.
+	 *
+	 *  @return      This function should return true if the packet was sent or deliberately dropped, false on an error.
+	 */
+	bool (*send)(struct meshlink_handle *mesh, const struct sockaddr *to, const void *data, size_t len);
+
+	/// Called instead of connect() to make a meta-connection.
+	/** @param mesh  A handle which represents an instance of MeshLink.
+	 *  @param to    The address to connect to.
+	 *
+	 *  @return      A file descriptor of a connected stream socket, for example one end of a socketpair(), or -1 on an error.
+	 *               The other end should be passed to devtool_transport_accept() of the mesh that has the given address.
+	 */
+	int (*connect)(struct meshlink_handle *mesh, const struct sockaddr *to);
+};
+
+/// Set a virtual transport.
+/** This function must be called before meshlink_start().
+ *  The sockets MeshLink normally listens on are still opened, but MeshLink will not send anything on them.
+ *
+ *  @param mesh       A handle which represents an instance of MeshLink.
+ *  @param transport  A pointer to a virtual transport, or NULL to use the normal sockets.
+ *                    The pointer must remain valid until meshlink_close() is called or another transport is set.
+ */
+void devtool_set_transport(struct meshlink_handle *mesh, const devtool_transport_t *transport);
+
+/// Inject a UDP packet received via a virtual transport.
+/** This function can be called from any thread, and does not block on the mesh's lock.
+ *  The packet is processed asynchronously by MeshLink's own thread.
+ *
+ *  @param mesh  A handle which represents an instance of MeshLink.
+ *  @param from  The address the packet was sent from.
+ *  @param data  A pointer to the packet.
+ *  @param len   The length of the packet.
+ *
+ *  @return      This function returns true if the packet was queued, false otherwise.
+ */
+bool devtool_transport_receive(struct meshlink_handle *mesh, const struct sockaddr *from, const void *data, size_t len);
+
+/// Inject an incoming meta-connection via a virtual transport.
+/** This function can be called from any thread, and does not block on the mesh's lock.
+ *  The connection is processed asynchronously by MeshLink's own thread.
+ *
+ *  @param mesh  A handle which represents an instance of MeshLink.
+ *  @param fd    A file descriptor of a connected stream socket. MeshLink takes ownership of it.
+ *  @param from  The address the connection was made from.
+ *
+ *  @return      This function returns true if the connection was queued, false otherwise.
+ *               In the latter case, the file descriptor is not closed.
+ */
+bool devtool_transport_accept(struct meshlink_handle *mesh, int fd, const struct sockaddr *from);
+
 #endif
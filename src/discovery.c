@@ -330,6 +330,7 @@ static void mdns_io_handler(event_loop_t *loop, void *data, int flags) {
 			if(sa.sa.sa_family != AF_UNKNOWN) {
 				n->catta_address = sa;
 				n->last_connect_try = 0;
+				update_node_autoconnect(mesh, n);
 				node_add_recent_address(mesh, n, &sa);
 
 				if(n->connection) {
@@ -760,7 +761,7 @@ static void reachability_change_callback(SCNetworkReachabilityRef reachability,
 
 	meshlink_handle_t *mesh = info;
 
-	pthread_mutex_lock(&mesh->mutex);
+	meshlink_lock(mesh);
 
 	scan_ifaddrs(mesh);
 
@@ -770,7 +771,7 @@ static void reachability_change_callback(SCNetworkReachabilityRef reachability,
 		handle_network_change(mesh, true);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 static void *network_change_handler(void *arg) {
@@ -57,3 +57,68 @@ int vasprintf(char **buf, const char *fmt, va_list ap) {
 	return status;
 }
 #endif
+
+#ifndef HAVE_POLL_H
+/* Emulate poll() with select(). This only works for descriptors below FD_SETSIZE. */
+int poll(struct pollfd *fds, unsigned long nfds, int timeout) {
+	fd_set readfds;
+	fd_set writefds;
+	FD_ZERO(&readfds);
+	FD_ZERO(&writefds);
+	int maxfd = -1;
+
+	for(unsigned long i = 0; i < nfds; i++) {
+		fds[i].revents = 0;
+
+		if(fds[i].fd < 0) {
+			continue;
+		}
+
+		if(fds[i].fd >= FD_SETSIZE) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		if(fds[i].events & POLLIN) {
+			FD_SET(fds[i].fd, &readfds);
+		}
+
+		if(fds[i].events & POLLOUT) {
+			FD_SET(fds[i].fd, &writefds);
+		}
+
+		if(fds[i].fd > maxfd) {
+			maxfd = fds[i].fd;
+		}
+	}
+
+	struct timeval tv = {timeout / 1000, (timeout % 1000) * 1000};
+	int n = select(maxfd + 1, &readfds, &writefds, NULL, timeout < 0 ? NULL : &tv);
+
+	if(n <= 0) {
+		return n;
+	}
+
+	n = 0;
+
+	for(unsigned long i = 0; i < nfds; i++) {
+		if(fds[i].fd < 0) {
+			continue;
+		}
+
+		if(FD_ISSET(fds[i].fd, &readfds)) {
+			fds[i].revents |= POLLIN;
+		}
+
+		if(FD_ISSET(fds[i].fd, &writefds)) {
+			fds[i].revents |= POLLOUT;
+		}
+
+		if(fds[i].revents) {
+			n++;
+		}
+	}
+
+	return n;
+}
+#endif
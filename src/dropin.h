@@ -25,6 +25,22 @@ int asprintf(char **, const char *, ...);
 int vasprintf(char **, const char *, va_list ap);
 #endif
 
+#ifndef HAVE_POLL_H
+#define POLLIN 0x001
+#define POLLOUT 0x004
+#define POLLERR 0x008
+#define POLLHUP 0x010
+#define POLLNVAL 0x020
+
+struct pollfd {
+	int fd;
+	short events;
+	short revents;
+};
+
+int poll(struct pollfd *fds, unsigned long nfds, int timeout);
+#endif
+
 #ifdef HAVE_MINGW
 #define mkdir(a, b) mkdir(a)
 
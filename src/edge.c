@@ -21,10 +21,14 @@
 
 #include "splay_tree.h"
 #include "edge.h"
+#include "ed25519/sha512.h"
+#include "graph.h"
+#include "list.h"
 #include "logger.h"
 #include "meshlink_internal.h"
 #include "netutl.h"
 #include "node.h"
+#include "submesh.h"
 #include "utils.h"
 #include "xalloc.h"
 
@@ -68,6 +72,8 @@ void exit_edges(meshlink_handle_t *mesh) {
 	}
 
 	mesh->edges = NULL;
+	mesh->mst_valid = false;
+	mesh->mst_dirty = false;
 }
 
 /* Creation and deletion of connection elements */
@@ -82,7 +88,106 @@ void free_edge(edge_t *e) {
 	free(e);
 }
 
+/* Topology digests.
+   Every edge has a 64 bit digest of everything an ADD_EDGE request carries about it, including the devclass and submesh of both nodes.
+   Each node keeps the XOR of the digests of its edges, and the mesh keeps the XOR of the node digests per bucket.
+   The digest an edge was added with is stored in the edge, so it can be removed again even if a node's devclass changed since.
+   Edges are only modified in place by edge_set_weight(), which updates the digest as well. */
+
+static void digest_node(sha512_context *ctx, const node_t *n) {
+	const char *submesh_name = n->submesh ? n->submesh->name : CORE_MESH;
+	uint32_t devclass = htonl(n->devclass);
+
+	sha512_update(ctx, n->name, strlen(n->name) + 1);
+	sha512_update(ctx, &devclass, sizeof(devclass));
+	sha512_update(ctx, submesh_name, strlen(submesh_name) + 1);
+}
+
+static uint64_t edge_digest(const edge_t *e) {
+	sha512_context ctx;
+	sha512_init(&ctx);
+	digest_node(&ctx, e->from);
+	digest_node(&ctx, e->to);
+
+	/* Only use the parts of the address that survive being sent to other nodes,
+	   and make sure all platforms calculate the same digest */
+
+	uint8_t family;
+
+	switch(e->address.sa.sa_family) {
+	case AF_INET:
+		family = 4;
+		sha512_update(&ctx, &family, sizeof(family));
+		sha512_update(&ctx, &e->address.in.sin_port, sizeof(e->address.in.sin_port));
+		sha512_update(&ctx, &e->address.in.sin_addr, sizeof(e->address.in.sin_addr));
+		break;
+
+	case AF_INET6:
+		family = 6;
+		sha512_update(&ctx, &family, sizeof(family));
+		sha512_update(&ctx, &e->address.in6.sin6_port, sizeof(e->address.in6.sin6_port));
+		sha512_update(&ctx, &e->address.in6.sin6_addr, sizeof(e->address.in6.sin6_addr));
+		break;
+
+	case AF_UNKNOWN:
+		family = 255;
+		sha512_update(&ctx, &family, sizeof(family));
+		sha512_update(&ctx, e->address.unknown.address, strlen(e->address.unknown.address) + 1);
+		sha512_update(&ctx, e->address.unknown.port, strlen(e->address.unknown.port) + 1);
+		break;
+
+	default:
+		family = 0;
+		sha512_update(&ctx, &family, sizeof(family));
+		break;
+	}
+
+	uint32_t words[3] = {htonl(e->weight), htonl(e->options), htonl(e->session_id)};
+	sha512_update(&ctx, words, sizeof(words));
+
+	uint8_t hash[64];
+	sha512_final(&ctx, hash);
+
+	uint64_t digest = 0;
+
+	for(int i = 0; i < 8; i++) {
+		digest = digest << 8 | hash[i];
+	}
+
+	return digest;
+}
+
+/* FNV-1a, which is good enough to spread node names over the buckets */
+
+unsigned int topology_bucket(const node_t *n) {
+	uint32_t hash = 2166136261U;
+
+	for(const char *p = n->name; *p; p++) {
+		hash = (hash ^ (uint8_t)*p) * 16777619U;
+	}
+
+	return hash % TOPOLOGY_BUCKETS;
+}
+
+static void toggle_digest(meshlink_handle_t *mesh, const edge_t *e) {
+	e->from->edge_digest ^= e->digest;
+	mesh->topology_digest[topology_bucket(e->from)] ^= e->digest;
+}
+
+/* Recalculate the digests of all edges from and to a node after its devclass or submesh changed */
+void update_edge_digests(meshlink_handle_t *mesh, node_t *n) {
+	for splay_each(edge_t, e, mesh->edges) {
+		if(e->from == n || e->to == n) {
+			toggle_digest(mesh, e);
+			e->digest = edge_digest(e);
+			toggle_digest(mesh, e);
+		}
+	}
+}
+
 void edge_add(meshlink_handle_t *mesh, edge_t *e) {
+	e->digest = edge_digest(e);
+	toggle_digest(mesh, e);
 	splay_insert(mesh->edges, e);
 	splay_insert(e->from->edge_tree, e);
 
@@ -91,15 +196,37 @@ void edge_add(meshlink_handle_t *mesh, edge_t *e) {
 	if(e->reverse) {
 		e->reverse->reverse = e;
 	}
+
+	graph_add_edge(mesh, e);
 }
 
 void edge_del(meshlink_handle_t *mesh, edge_t *e) {
+	list_t *orphans = graph_detach_edge(mesh, e);
+
 	if(e->reverse) {
 		e->reverse->reverse = NULL;
 	}
 
+	toggle_digest(mesh, e);
 	splay_delete(mesh->edges, e);
 	splay_delete(e->from->edge_tree, e);
+
+	graph_reattach(mesh, orphans);
+}
+
+/* Change the weight of an edge without removing it from the graph */
+void edge_set_weight(meshlink_handle_t *mesh, edge_t *e, int weight) {
+	int old_weight = e->weight;
+
+	/* mesh->edges is sorted on weight */
+	splay_delete(mesh->edges, e);
+	toggle_digest(mesh, e);
+	e->weight = weight;
+	e->digest = edge_digest(e);
+	toggle_digest(mesh, e);
+	splay_insert(mesh->edges, e);
+
+	graph_reweight_edge(mesh, e, old_weight);
 }
 
 edge_t *lookup_edge(node_t *from, node_t *to) {
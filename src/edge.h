@@ -34,7 +34,10 @@ typedef struct edge_t {
 	struct edge_t *reverse;                 /* edge in the opposite direction, if available */
 
 	int weight;                             /* weight of this edge */
+	uint32_t options;                       /* options of the "to" node, as sent in its ACK */
 	uint32_t session_id;                     /* the session_id of the from node */
+	bool mst;                               /* true if this edge is part of the minimum spanning tree */
+	uint64_t digest;                        /* topology digest of this edge, see edge_add() */
 } edge_t;
 
 void init_edges(struct meshlink_handle *mesh);
@@ -45,6 +48,9 @@ struct splay_tree_t *new_edge_tree(void) __attribute__((__malloc__));
 void free_edge_tree(struct splay_tree_t *);
 void edge_add(struct meshlink_handle *mesh, edge_t *);
 void edge_del(struct meshlink_handle *mesh, edge_t *);
+void edge_set_weight(struct meshlink_handle *mesh, edge_t *, int weight);
 edge_t *lookup_edge(struct node_t *, struct node_t *) __attribute__((__warn_unused_result__));
+void update_edge_digests(struct meshlink_handle *mesh, struct node_t *);
+unsigned int topology_bucket(const struct node_t *) __attribute__((__warn_unused_result__));
 
 #endif
@@ -28,14 +28,6 @@
 #include "utils.h"
 #include "xalloc.h"
 
-#ifndef EVENT_CLOCK
-#if defined(CLOCK_MONOTONIC_RAW) && defined(__x86_64__)
-#define EVENT_CLOCK CLOCK_MONOTONIC_RAW
-#else
-#define EVENT_CLOCK CLOCK_MONOTONIC
-#endif
-#endif
-
 static void timespec_add(const struct timespec *a, const struct timespec *b, struct timespec *r) {
 	r->tv_sec = a->tv_sec + b->tv_sec;
 	r->tv_nsec = a->tv_nsec + b->tv_nsec;
@@ -66,6 +58,63 @@ static void timespec_clear(struct timespec *a) {
 	a->tv_sec = 0;
 }
 
+#ifdef MESHLINK_EVENT_STATS
+static void event_stats_add(event_loop_t *loop, enum event_stats_kind kind, const struct timespec *start, const struct timespec *end) {
+	struct timespec diff;
+	timespec_sub(end, start, &diff);
+	uint32_t usec = diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+
+	event_histogram_t *h = &loop->stats[kind];
+	h->count++;
+	h->total_usec += usec;
+
+	if(usec > h->max_usec) {
+		h->max_usec = usec;
+	}
+
+	unsigned int bucket = 0;
+
+	for(uint32_t v = usec; v && bucket < EVENT_STATS_BUCKETS - 1; v >>= 1) {
+		bucket++;
+	}
+
+	h->buckets[bucket]++;
+
+	if(kind != EVENT_STATS_WAIT && usec > loop->stall_usec) {
+		loop->stall_usec = usec;
+		loop->stall_kind = kind;
+	}
+}
+
+static void event_stats_end(event_loop_t *loop, enum event_stats_kind kind, const struct timespec *start) {
+	struct timespec end;
+	clock_gettime(EVENT_CLOCK, &end);
+	event_stats_add(loop, kind, start, &end);
+}
+
+static void signalio_handler(event_loop_t *loop, void *data, int flags);
+
+static enum event_stats_kind io_stats_kind(const io_t *io) {
+	if(io->cb == signalio_handler) {
+		return EVENT_STATS_SIGNAL;
+	} else if(io->cb == handle_meta_io) {
+		return EVENT_STATS_META_IO;
+	} else if(io->cb == handle_incoming_vpn_data) {
+		return EVENT_STATS_VPN_IO;
+	} else if(io->cb == handle_new_meta_connection) {
+		return EVENT_STATS_LISTEN_IO;
+	} else {
+		return EVENT_STATS_OTHER_IO;
+	}
+}
+
+#define EVENT_STATS_BEGIN(start) struct timespec start; clock_gettime(EVENT_CLOCK, &start)
+#define EVENT_STATS_END(loop, kind, start) event_stats_end(loop, kind, &start)
+#else
+#define EVENT_STATS_BEGIN(start)
+#define EVENT_STATS_END(loop, kind, start)
+#endif
+
 static int io_compare(const io_t *a, const io_t *b) {
 	return a->fd - b->fd;
 }
@@ -92,6 +141,7 @@ void io_add(event_loop_t *loop, io_t *io, io_cb_t cb, void *data, int fd, int fl
 	assert(!io->cb);
 
 	io->fd = fd;
+	io->id = ++loop->next_io_id;
 	io->cb = cb;
 	io->data = data;
 	io->node.data = io;
@@ -104,21 +154,10 @@ void io_add(event_loop_t *loop, io_t *io, io_cb_t cb, void *data, int fd, int fl
 }
 
 void io_set(event_loop_t *loop, io_t *io, int flags) {
+	(void)loop;
 	assert(io->cb);
 
 	io->flags = flags;
-
-	if(flags & IO_READ) {
-		FD_SET(io->fd, &loop->readfds);
-	} else {
-		FD_CLR(io->fd, &loop->readfds);
-	}
-
-	if(flags & IO_WRITE) {
-		FD_SET(io->fd, &loop->writefds);
-	} else {
-		FD_CLR(io->fd, &loop->writefds);
-	}
 }
 
 void io_del(event_loop_t *loop, io_t *io) {
@@ -284,7 +323,23 @@ void idle_set(event_loop_t *loop, idle_cb_t cb, void *data) {
 	loop->idle_data = data;
 }
 
-static void check_bad_fds(event_loop_t *loop, meshlink_handle_t *mesh) {
+static bool fd_is_valid(int fd) {
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+	if(poll(&pfd, 1, 0) < 0) {
+		return errno != EBADF;
+	}
+
+	return !(pfd.revents & POLLNVAL);
+}
+
+/* Stop waiting for an io whose descriptor was closed without removing the io, otherwise poll() keeps returning right away. */
+static void io_invalidate(event_loop_t *loop, io_t *io) {
+	logger(loop->data, MESHLINK_WARNING, "File descriptor %d was closed while still in use, ignoring it", io->fd);
+	io_set(loop, io, 0);
+}
+
+void event_loop_check_fds(event_loop_t *loop) {
 	// Just call all registered callbacks and have them check their fds
 
 	do {
@@ -309,93 +364,195 @@ static void check_bad_fds(event_loop_t *loop, meshlink_handle_t *mesh) {
 		}
 	} while(loop->deletion);
 
-	// Rebuild the fdsets
-
-	fd_set old_readfds;
-	fd_set old_writefds;
-	memcpy(&old_readfds, &loop->readfds, sizeof(old_readfds));
-	memcpy(&old_writefds, &loop->writefds, sizeof(old_writefds));
-
-	memset(&loop->readfds, 0, sizeof(loop->readfds));
-	memset(&loop->writefds, 0, sizeof(loop->writefds));
+	// Whatever is still invalid is not waited for anymore
 
 	for splay_each(io_t, io, &loop->ios) {
-		if(io->flags & IO_READ) {
-			FD_SET(io->fd, &loop->readfds);
-			io->cb(loop, io->data, IO_READ);
+		if(io->flags && !fd_is_valid(io->fd)) {
+			io_invalidate(loop, io);
 		}
+	}
+}
 
-		if(io->flags & IO_WRITE) {
-			FD_SET(io->fd, &loop->writefds);
-			io->cb(loop, io->data, IO_WRITE);
+struct timespec event_loop_prepare(event_loop_t *loop) {
+	clock_gettime(EVENT_CLOCK, &loop->now);
+	struct timespec it, ts = {3600, 0};
+
+	while(loop->timeouts.head) {
+		timeout_t *timeout = loop->timeouts.head->data;
+
+		if(timespec_lt(&timeout->tv, &loop->now)) {
+			timeout_disable(loop, timeout);
+			EVENT_STATS_BEGIN(start);
+			timeout->cb(loop, timeout->data);
+			EVENT_STATS_END(loop, EVENT_STATS_TIMEOUT, start);
+		} else {
+			timespec_sub(&timeout->tv, &loop->now, &ts);
+			break;
+		}
+	}
+
+	if(loop->idle_cb) {
+		EVENT_STATS_BEGIN(start);
+		it = loop->idle_cb(loop, loop->idle_data);
+		EVENT_STATS_END(loop, EVENT_STATS_IDLE, start);
+
+		if(it.tv_sec >= 0 && timespec_lt(&it, &ts)) {
+			ts = it;
 		}
 	}
 
-	if(memcmp(&old_readfds, &loop->readfds, sizeof(old_readfds))) {
-		logger(mesh, MESHLINK_WARNING, "Incorrect readfds fixed");
+	return ts;
+}
+
+/* Append a pollfd for every io that waits for something to pfds, growing it if necessary, and return the new number of entries.
+   The entries from n onwards belong to this loop, and are passed to event_loop_dispatch() after polling. */
+size_t event_loop_get_pollfds(event_loop_t *loop, struct pollfd **pfds, size_t *size, size_t n) {
+	if(*size < n + loop->ios.count) {
+		*size = (n + loop->ios.count) * 2;
+		*pfds = xrealloc(*pfds, *size * sizeof(**pfds));
+	}
+
+	if(loop->poll_ids_size < loop->ios.count) {
+		loop->poll_ids_size = loop->ios.count * 2;
+		loop->poll_ids = xrealloc(loop->poll_ids, loop->poll_ids_size * sizeof(*loop->poll_ids));
 	}
 
-	if(memcmp(&old_writefds, &loop->writefds, sizeof(old_writefds))) {
-		logger(mesh, MESHLINK_WARNING, "Incorrect writefds fixed");
+	loop->poll_first = n;
+
+	for splay_each(io_t, io, &loop->ios) {
+		if(!io->flags) {
+			continue;
+		}
+
+		loop->poll_ids[n - loop->poll_first] = io->id;
+
+		struct pollfd *pfd = &(*pfds)[n++];
+		pfd->fd = io->fd;
+		pfd->events = ((io->flags & IO_READ) ? POLLIN : 0) | ((io->flags & IO_WRITE) ? POLLOUT : 0);
+		pfd->revents = 0;
 	}
+
+	loop->poll_count = n - loop->poll_first;
+	return n;
 }
 
-bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
-	assert(mesh);
+/* Find the io that was waited for, unless it was deleted in the meantime, even if its descriptor has been reused since. */
+static io_t *io_lookup(event_loop_t *loop, int fd, unsigned int id) {
+	io_t *io = splay_search(&loop->ios, &(io_t) {
+		.fd = fd
+	});
 
-	fd_set readable;
-	fd_set writable;
-	int errors = 0;
+	return io && io->id == id ? io : NULL;
+}
 
-	while(loop->running) {
-		clock_gettime(EVENT_CLOCK, &loop->now);
-		struct timespec it, ts = {3600, 0};
+void event_loop_dispatch(event_loop_t *loop, const struct pollfd *pfds, size_t n) {
+	// A callback can delete any io, not just its own, so look each one up again before calling it.
+	// Errors are reported as whatever the io waits for, its callback will find out what is wrong.
 
-		while(loop->timeouts.head) {
-			timeout_t *timeout = loop->timeouts.head->data;
+	assert(n <= loop->poll_count);
 
-			if(timespec_lt(&timeout->tv, &loop->now)) {
-				timeout_disable(loop, timeout);
-				timeout->cb(loop, timeout->data);
-			} else {
-				timespec_sub(&timeout->tv, &loop->now, &ts);
-				break;
-			}
+	for(size_t i = 0; i < n; i++) {
+		const struct pollfd *pfd = &pfds[i];
+		unsigned int id = loop->poll_ids[i];
+		io_t *io;
+
+		if(!pfd->revents || !(io = io_lookup(loop, pfd->fd, id))) {
+			continue;
 		}
 
-		if(loop->idle_cb) {
-			it = loop->idle_cb(loop, loop->idle_data);
+#ifdef MESHLINK_EVENT_STATS
+		// The callback might free io, so classify it up front
+		enum event_stats_kind kind = io_stats_kind(io);
+#endif
+
+		if((pfd->events & POLLOUT) && (pfd->revents & (POLLOUT | POLLERR | POLLHUP | POLLNVAL))) {
+			EVENT_STATS_BEGIN(start);
+			io->cb(loop, io->data, IO_WRITE);
+			EVENT_STATS_END(loop, kind, start);
 
-			if(it.tv_sec >= 0 && timespec_lt(&it, &ts)) {
-				ts = it;
+			if(!(io = io_lookup(loop, pfd->fd, id))) {
+				continue;
 			}
 		}
 
-		memcpy(&readable, &loop->readfds, sizeof(readable));
-		memcpy(&writable, &loop->writefds, sizeof(writable));
-
-		int fds = 0;
+		if((pfd->events & POLLIN) && (pfd->revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL))) {
+			EVENT_STATS_BEGIN(start);
+			io->cb(loop, io->data, IO_READ);
+			EVENT_STATS_END(loop, kind, start);
 
-		if(loop->ios.tail) {
-			io_t *last = loop->ios.tail->data;
-			fds = last->fd + 1;
+			if(!(io = io_lookup(loop, pfd->fd, id))) {
+				continue;
+			}
 		}
 
-		// release mesh mutex during select
-		pthread_mutex_unlock(&mesh->mutex);
+		if((pfd->revents & POLLNVAL) && io->flags && !fd_is_valid(io->fd)) {
+			io_invalidate(loop, io);
+		}
+	}
+}
 
-#ifdef HAVE_PSELECT
-		int n = pselect(fds, &readable, &writable, NULL, &ts, NULL);
+/* Wait for pfds, with a timeout of ts. Unlike select(), poll() works for file descriptors of any value. */
+int event_poll(struct pollfd *pfds, size_t n, const struct timespec *ts) {
+#ifdef HAVE_PPOLL
+	return ppoll(pfds, n, ts, NULL);
 #else
-		struct timeval tv = {ts.tv_sec, ts.tv_nsec / 1000};
-		int n = select(fds, &readable, &writable, NULL, (struct timeval *)&tv);
+	// Round up, otherwise we would wake up just before a timeout expires and spin until it does
+	long ms = ts->tv_sec * 1000 + (ts->tv_nsec + 999999) / 1000000;
+	return poll(pfds, n, ms > INT_MAX ? INT_MAX : (int)ms);
 #endif
+}
 
-		if(pthread_mutex_lock(&mesh->mutex) != 0) {
-			abort();
-		}
+void event_loop_account(event_loop_t *loop, const struct timespec *woken, const struct timespec *sleeping) {
+	struct timespec busy;
+	timespec_sub(sleeping, woken, &busy);
+	uint32_t busy_usec = busy.tv_sec * 1000000 + busy.tv_nsec / 1000;
+	loop->iterations++;
+	loop->busy_usec += busy_usec;
+
+	if(busy_usec > loop->max_busy_usec) {
+		loop->max_busy_usec = busy_usec;
+	}
+
+#ifdef MESHLINK_EVENT_STATS
+	event_stats_add(loop, EVENT_STATS_HOLD, woken, sleeping);
+#endif
+}
+
+bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
+	assert(mesh);
+
+	int errors = 0;
+
+	clock_gettime(EVENT_CLOCK, &loop->now);
+	struct timespec woken = loop->now;
+
+	while(loop->running) {
+		struct timespec ts = event_loop_prepare(loop);
+		size_t nfds = event_loop_get_pollfds(loop, &loop->pollfds, &loop->pollfds_size, 0);
+
+		struct timespec sleeping;
+		clock_gettime(EVENT_CLOCK, &sleeping);
+		event_loop_account(loop, &woken, &sleeping);
+
+		// release mesh mutex during poll
+		meshlink_unlock(mesh);
+
+		int n = event_poll(loop->pollfds, nfds, &ts);
+
+#ifdef MESHLINK_EVENT_STATS
+		struct timespec polled;
+		clock_gettime(EVENT_CLOCK, &polled);
+		event_stats_add(loop, EVENT_STATS_WAIT, &sleeping, &polled);
+#endif
+
+		meshlink_lock(mesh);
 
 		clock_gettime(EVENT_CLOCK, &loop->now);
+		woken = loop->now;
+
+#ifdef MESHLINK_EVENT_STATS
+		event_stats_add(loop, EVENT_STATS_LOCK, &polled, &woken);
+#endif
 
 		if(n < 0) {
 			if(sockwouldblock(errno)) {
@@ -404,12 +561,12 @@ bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
 				errors++;
 
 				if(errors > 10) {
-					logger(mesh, MESHLINK_ERROR, "Unrecoverable error from select(): %s", strerror(errno));
+					logger(mesh, MESHLINK_ERROR, "Unrecoverable error from poll(): %s", strerror(errno));
 					return false;
 				}
 
-				logger(mesh, MESHLINK_WARNING, "Error from select(), checking for bad fds: %s", strerror(errno));
-				check_bad_fds(loop, mesh);
+				logger(mesh, MESHLINK_WARNING, "Error from poll(), checking for bad fds: %s", strerror(errno));
+				event_loop_check_fds(loop);
 				continue;
 			}
 		}
@@ -420,29 +577,7 @@ bool event_loop_run(event_loop_t *loop, meshlink_handle_t *mesh) {
 			continue;
 		}
 
-		// Normally, splay_each allows the current node to be deleted. However,
-		// it can be that one io callback triggers the deletion of another io,
-		// so we have to detect this and break the loop.
-
-		loop->deletion = false;
-
-		for splay_each(io_t, io, &loop->ios) {
-			if(FD_ISSET(io->fd, &writable) && io->cb) {
-				io->cb(loop, io->data, IO_WRITE);
-			}
-
-			if(loop->deletion) {
-				break;
-			}
-
-			if(FD_ISSET(io->fd, &readable) && io->cb) {
-				io->cb(loop, io->data, IO_READ);
-			}
-
-			if(loop->deletion) {
-				break;
-			}
-		}
+		event_loop_dispatch(loop, loop->pollfds, nfds);
 	}
 
 	return true;
@@ -481,4 +616,12 @@ void event_loop_exit(event_loop_t *loop) {
 	for splay_each(signal_t, signal, &loop->signals) {
 		splay_unlink_node(&loop->signals, splay_node);
 	}
+
+	free(loop->pollfds);
+	loop->pollfds = NULL;
+	loop->pollfds_size = 0;
+
+	free(loop->poll_ids);
+	loop->poll_ids = NULL;
+	loop->poll_ids_size = 0;
 }
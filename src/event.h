@@ -27,6 +27,14 @@
 #define IO_READ 1
 #define IO_WRITE 2
 
+#ifndef EVENT_CLOCK
+#if defined(CLOCK_MONOTONIC_RAW) && defined(__x86_64__)
+#define EVENT_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define EVENT_CLOCK CLOCK_MONOTONIC
+#endif
+#endif
+
 typedef struct event_loop_t event_loop_t;
 struct meshlink_handle;
 
@@ -35,10 +43,38 @@ typedef void (*timeout_cb_t)(event_loop_t *loop, void *data);
 typedef void (*signal_cb_t)(event_loop_t *loop, void *data);
 typedef struct timespec(*idle_cb_t)(event_loop_t *loop, void *data);
 
+#ifdef MESHLINK_EVENT_STATS
+#define EVENT_STATS_BUCKETS 24
+
+enum event_stats_kind {
+	EVENT_STATS_WAIT,               /* Time spent in poll() */
+	EVENT_STATS_LOCK,               /* Time spent reacquiring the mesh mutex after poll() returns */
+	EVENT_STATS_HOLD,               /* Time the mesh mutex is held during a single iteration */
+	EVENT_STATS_TIMEOUT,
+	EVENT_STATS_IDLE,
+	EVENT_STATS_SIGNAL,
+	EVENT_STATS_META_IO,
+	EVENT_STATS_VPN_IO,
+	EVENT_STATS_LISTEN_IO,
+	EVENT_STATS_OTHER_IO,
+	EVENT_STATS_KINDS
+};
+
+/* Bucket 0 counts durations below 1 microsecond, bucket i > 0 counts durations
+ * of [2^(i-1), 2^i) microseconds, and the last bucket counts everything longer. */
+typedef struct event_histogram_t {
+	uint64_t count;
+	uint64_t total_usec;
+	uint32_t max_usec;
+	uint64_t buckets[EVENT_STATS_BUCKETS];
+} event_histogram_t;
+#endif
+
 typedef struct io_t {
 	struct splay_node_t node;
 	int fd;
 	int flags;
+	unsigned int id;                /* Tells this io apart from a later one that reuses the same descriptor */
 	io_cb_t cb;
 	void *data;
 } io_t;
@@ -74,11 +110,26 @@ struct event_loop_t {
 	splay_tree_t ios;
 	splay_tree_t signals;
 
-	fd_set readfds;
-	fd_set writefds;
+	struct pollfd *pollfds;         /* The descriptors event_loop_run() waits for */
+	size_t pollfds_size;
+	size_t poll_first;              /* The part of the shared loop's descriptors that belongs to this loop */
+	size_t poll_count;
+	unsigned int *poll_ids;         /* The ids of the ios that were waited for, in the same order */
+	size_t poll_ids_size;
+	unsigned int next_io_id;
 
 	io_t signalio;
 	int pipefd[2];
+
+	// Statistics
+	uint64_t iterations;
+	uint64_t busy_usec;             /* Time spent running callbacks */
+	uint32_t max_busy_usec;         /* Longest time spent running callbacks in a single iteration */
+#ifdef MESHLINK_EVENT_STATS
+	event_histogram_t stats[EVENT_STATS_KINDS];
+	uint32_t stall_usec;            /* Longest time spent in a single callback */
+	enum event_stats_kind stall_kind;
+#endif
 };
 
 void io_add(event_loop_t *loop, io_t *io, io_cb_t cb, void *data, int fd, int flags);
@@ -98,6 +149,14 @@ void idle_set(event_loop_t *loop, idle_cb_t cb, void *data);
 void event_loop_init(event_loop_t *loop);
 void event_loop_exit(event_loop_t *loop);
 bool event_loop_run(event_loop_t *loop, struct meshlink_handle *mesh) __attribute__((__warn_unused_result__));
+
+// The steps of a single iteration of event_loop_run(), for driving an event loop from another thread.
+struct timespec event_loop_prepare(event_loop_t *loop);
+size_t event_loop_get_pollfds(event_loop_t *loop, struct pollfd **pfds, size_t *size, size_t n);
+void event_loop_dispatch(event_loop_t *loop, const struct pollfd *pfds, size_t n);
+void event_loop_account(event_loop_t *loop, const struct timespec *woken, const struct timespec *sleeping);
+void event_loop_check_fds(event_loop_t *loop);
+int event_poll(struct pollfd *pfds, size_t n, const struct timespec *ts);
 void event_loop_flush_output(event_loop_t *loop);
 void event_loop_start(event_loop_t *loop);
 void event_loop_stop(event_loop_t *loop);
@@ -29,12 +29,17 @@
    favour Kruskal's, because we make an extra AVL tree of edges sorted on
    weights (metric). That tree only has to be updated when an edge is added or
    removed, and during the MST algorithm we just have go linearly through that
-   tree, adding safe edges until #edges = #nodes - 1. The implementation here
-   however is not so fast, because I tried to avoid having to make a forest and
-   merge trees.
+   tree, adding safe edges until #edges = #nodes - 1. Since both directions of
+   an edge can have different weights, the implementation here sorts the
+   bidirectional edges on the sum of their weights instead, and uses a
+   union-find forest to check whether an edge is safe.
 
-   For the SSSP algorithm Dijkstra's seems to be a nice choice. Currently a
-   simple breadth-first search is presented here.
+   The MST is only used to limit the flooding of meta-protocol requests.
+   All nodes must agree on it, so it is only computed once the topology has
+   settled, and flooding falls back to all connections whenever it is in doubt.
+
+   For the SSSP algorithm Dijkstra's seems to be a nice choice. An incremental
+   version of it is presented here, using the edge weights as distances.
 
    The SSSP algorithm will also be used to determine whether nodes are
    reachable from the source. It will also set the correct destination address
@@ -52,163 +57,392 @@
 #include "netutl.h"
 #include "node.h"
 #include "protocol.h"
+#include "splay_tree.h"
 #include "utils.h"
 #include "xalloc.h"
 #include "graph.h"
 
-/* Implementation of a simple breadth-first search algorithm.
-   Running time: O(E)
+/* Implementation of an incremental shortest path algorithm.
+
+   Only edges that have a reverse edge are used. Every node in the shortest path tree has a distance from ourself,
+   which is the sum of the weights of the edges on its path, and prevedge points to the edge through which it is reached.
+   Ties are broken by the lowest weight of the last edge.
+   When an edge is added, only the nodes that it gives a better path are relabelled, and from there the improvement is propagated,
+   always continuing from the node with the lowest distance like Dijkstra's algorithm does.
+   When an edge of the tree is deleted, the subtree behind it is detached and reattached to the rest of the tree.
+   So the work done is proportional to the number of nodes whose path changes, instead of O(V + E) for every change.
+
+   Nodes whose path changed are marked dirty. graph() checks their reachability status and calls the callbacks for them.
 */
 
-static void sssp_bfs(meshlink_handle_t *mesh) {
-	list_t *todo_list = list_alloc(NULL);
+/* The weight of an edge as used for distances. Weights come from the network, so keep them positive and small enough not to overflow. */
+static int edge_cost(const edge_t *e) {
+	if(e->weight < 1) {
+		return 1;
+	} else if(e->weight > 0xffff) {
+		return 0xffff;
+	} else {
+		return e->weight;
+	}
+}
 
-	/* Clear visited status on nodes */
+/* The cost of an edge on a path. Older nodes route on hop counts, with the edge weight only breaking ties.
+   As long as any of them is reachable, do the same, otherwise we could pick paths they disagree with and route in circles. */
+static int path_cost(const meshlink_handle_t *mesh, const edge_t *e) {
+	return mesh->hop_routing ? 1 : edge_cost(e);
+}
 
-	for splay_each(node_t, n, mesh->nodes) {
-		n->status.visited = false;
-		n->distance = -1;
+static int distance_compare(const node_t *a, const node_t *b) {
+	if(a->distance != b->distance) {
+		return a->distance < b->distance ? -1 : 1;
+	}
+
+	return a < b ? -1 : a > b;
+}
+
+static splay_tree_t *alloc_queue(void) {
+	return splay_alloc_tree((splay_compare_t) distance_compare, NULL);
+}
+
+static void mark_dirty(meshlink_handle_t *mesh, node_t *n) {
+	if(!n->status.graph_dirty) {
+		n->status.graph_dirty = true;
+		n->graph_next = mesh->graph_dirty;
+		mesh->graph_dirty = n;
+	}
+}
+
+static void set_path(meshlink_handle_t *mesh, node_t *n, edge_t *e) {
+	node_t *from = e->from;
+
+	n->prevedge = e;
+	n->distance = from->distance + path_cost(mesh, e);
+	n->nexthop = (from == mesh->self) ? n : from->nexthop;
+	n->options = e->options;
+
+	if(!n->status.reachable || (n->address.sa.sa_family == AF_UNSPEC && e->address.sa.sa_family != AF_UNKNOWN)) {
+		update_node_udp(mesh, n, &e->address);
+	}
+
+	mark_dirty(mesh, n);
+}
+
+/* Check if edge e gives e->to a better path, or if e->to's path through e has changed. */
+static void relax(meshlink_handle_t *mesh, splay_tree_t *todo, edge_t *e) {
+	node_t *from = e->from;
+	node_t *to = e->to;
+
+	if(!e->reverse || from->distance < 0 || to == mesh->self) {
+		return;
 	}
 
-	/* Begin with mesh->self */
+	int distance = from->distance + path_cost(mesh, e);
+
+	if(to->prevedge == e) {
+		if(to->distance == distance && to->nexthop == ((from == mesh->self) ? to : from->nexthop) && to->options == e->options) {
+			return;
+		}
+	} else if(to->distance >= 0 && (to->distance < distance || (to->distance == distance && e->weight >= to->prevedge->weight))) {
+		return;
+	}
 
-	mesh->self->status.visited = mesh->threadstarted;
-	mesh->self->nexthop = mesh->self;
-	mesh->self->prevedge = NULL;
-	mesh->self->distance = 0;
-	list_insert_head(todo_list, mesh->self);
+	/* The queue is sorted on distance, so take it out before changing that */
 
-	/* Loop while todo_list is filled */
+	if(to->distance >= 0 && splay_search(todo, to)) {
+		splay_delete(todo, to);
+	}
+
+	set_path(mesh, to, e);
+	splay_insert(todo, to);
+}
+
+static void propagate(meshlink_handle_t *mesh, splay_tree_t *todo) {
+	while(todo->head) {
+		node_t *n = todo->head->data;
+		splay_delete(todo, n);
 
-	for list_each(node_t, n, todo_list) {                   /* "n" is the node from which we start */
 		logger(mesh, MESHLINK_DEBUG, " Examining edges from %s", n->name);
 
-		if(n->distance < 0) {
-			abort();
+		for splay_each(edge_t, e, n->edge_tree) {
+			relax(mesh, todo, e);
 		}
+	}
+}
 
-		for splay_each(edge_t, e, n->edge_tree) {       /* "e" is the edge connected to "from" */
-			if(!e->reverse) {
-				continue;
+static void topology_changed(meshlink_handle_t *mesh) {
+	mesh->mst_dirty = true;
+	mesh->last_topology_change = mesh->loop.now.tv_sec;
+}
+
+void graph_add_edge(meshlink_handle_t *mesh, edge_t *e) {
+	topology_changed(mesh);
+
+	/* Other nodes can only know about a new connection of ours after it is in the MST, so flood over it until then */
+	if(e->from == mesh->self && e->connection) {
+		e->connection->status.mst = true;
+	}
+
+	/* The session ID of a node is taken from its edges */
+	mark_dirty(mesh, e->from);
+
+	if(!e->reverse) {
+		return;
+	}
+
+	splay_tree_t *todo = alloc_queue();
+	relax(mesh, todo, e);
+	relax(mesh, todo, e->reverse);
+	propagate(mesh, todo);
+	splay_delete_tree(todo);
+}
+
+/* Detach the subtree behind root, the nodes in it are added to orphans. */
+static void detach_subtree(meshlink_handle_t *mesh, list_t *orphans, node_t *root) {
+	list_node_t *first = orphans->tail;
+
+	root->distance = -1;
+	root->prevedge = NULL;
+	list_insert_tail(orphans, root);
+
+	for(list_node_t *node = first ? first->next : orphans->head; node; node = node->next) {
+		node_t *n = node->data;
+		mark_dirty(mesh, n);
+
+		for splay_each(edge_t, e, n->edge_tree) {
+			if(e->to->prevedge == e) {
+				e->to->distance = -1;
+				e->to->prevedge = NULL;
+				list_insert_tail(orphans, e->to);
 			}
+		}
+	}
+}
 
-			/* Situation:
+list_t *graph_detach_edge(meshlink_handle_t *mesh, edge_t *e) {
+	list_t *orphans = NULL;
 
-			           /
-			          /
-			   ----->(n)---e-->(e->to)
-			          \
-			           \
+	topology_changed(mesh);
+	mst_del_edge(mesh, e);
 
-			   Where e is an edge, (n) and (e->to) are nodes.
-			   n->address is set to the e->address of the edge left of n to n.
-			   We are currently examining the edge e right of n from n:
+	if(e->to->prevedge == e || (e->reverse && e->from->prevedge == e->reverse)) {
+		orphans = list_alloc(NULL);
+		detach_subtree(mesh, orphans, e->to->prevedge == e ? e->to : e->from);
+	}
 
-			   - If edge e provides for better reachability of e->to, update
-			     e->to and (re)add it to the todo_list to (re)examine the reachability
-			     of nodes behind it.
-			 */
+	return orphans;
+}
+
+void graph_reattach(meshlink_handle_t *mesh, list_t *orphans) {
+	if(!orphans) {
+		return;
+	}
 
-			if(e->to->status.visited
-			                && (e->to->distance != n->distance + 1 || e->weight >= e->to->prevedge->weight)) {
+	splay_tree_t *todo = alloc_queue();
+
+	/* Give every orphan the best path through the rest of the tree, propagate() then finds the paths through other orphans */
+
+	for list_each(node_t, n, orphans) {
+		edge_t *best = NULL;
+		int best_distance = 0;
+
+		for splay_each(edge_t, e, n->edge_tree) {
+			edge_t *in = e->reverse;
+
+			if(!in || in->from->distance < 0) {
 				continue;
 			}
 
-			e->to->status.visited = true;
-			e->to->nexthop = (n->nexthop == mesh->self) ? e->to : n->nexthop;
-			e->to->prevedge = e;
-			e->to->distance = n->distance + 1;
+			int distance = in->from->distance + path_cost(mesh, in);
 
-			if(!e->to->status.reachable || (e->to->address.sa.sa_family == AF_UNSPEC && e->address.sa.sa_family != AF_UNKNOWN)) {
-				update_node_udp(mesh, e->to, &e->address);
+			if(!best || distance < best_distance || (distance == best_distance && in->weight < best->weight)) {
+				best = in;
+				best_distance = distance;
 			}
+		}
 
-			list_insert_tail(todo_list, e->to);
+		if(best) {
+			set_path(mesh, n, best);
+			splay_insert(todo, n);
 		}
+	}
+
+	propagate(mesh, todo);
+	splay_delete_tree(todo);
+	list_delete_list(orphans);
+}
 
-		list_next = list_node->next; /* Because the list_insert_tail() above could have added something extra for us! */
-		list_delete_node(todo_list, list_node);
+/* Update the paths and the MST after the weight of an edge changed in place. */
+void graph_reweight_edge(meshlink_handle_t *mesh, edge_t *e, int old_weight) {
+	if(!e->reverse) {
+		return;
 	}
 
-	list_free(todo_list);
+	/* Kruskal's algorithm takes the cheapest edges first, so an edge in the MST can only be replaced if it became more expensive,
+	   and an edge outside of it can only replace another one if it became cheaper. */
+
+	if(e->mst ? e->weight > old_weight : e->weight < old_weight) {
+		topology_changed(mesh);
+	}
+
+	if(e->to->prevedge == e && e->weight > old_weight) {
+		/* The nodes behind this edge might have better paths via other edges now */
+		list_t *orphans = list_alloc(NULL);
+		detach_subtree(mesh, orphans, e->to);
+		graph_reattach(mesh, orphans);
+	} else {
+		splay_tree_t *todo = alloc_queue();
+		relax(mesh, todo, e);
+		propagate(mesh, todo);
+		splay_delete_tree(todo);
+	}
 }
 
-static void check_reachability(meshlink_handle_t *mesh) {
-	/* Check reachability status. */
+/* Recompute all paths from scratch, needed when the cost of every edge changes at once. */
+static void graph_recompute(meshlink_handle_t *mesh) {
+	list_t *orphans = list_alloc(NULL);
 
-	int reachable = -1; /* Don't count ourself */
+	for splay_each(edge_t, e, mesh->self->edge_tree) {
+		if(e->to->prevedge == e) {
+			detach_subtree(mesh, orphans, e->to);
+		}
+	}
 
-	for splay_each(node_t, n, mesh->nodes) {
-		if(n->status.visited) {
-			reachable++;
+	graph_reattach(mesh, orphans);
+}
+
+void graph_forget_node(meshlink_handle_t *mesh, node_t *n) {
+	if(n->status.graph_dirty) {
+		for(node_t **p = &mesh->graph_dirty; *p; p = &(*p)->graph_next) {
+			if(*p == n) {
+				*p = n->graph_next;
+				break;
+			}
 		}
 
-		/* Check for nodes that have changed session_id */
-		if(n->status.visited && n->prevedge && n->prevedge->reverse->session_id != n->session_id) {
-			logger(mesh, MESHLINK_DEBUG, "Node %s has a new session ID", n->name);
+		n->status.graph_dirty = false;
+		n->graph_next = NULL;
+	}
+
+	if(n->status.reachable) {
+		mesh->nreachable--;
+	}
 
-			n->session_id = n->prevedge->reverse->session_id;
+	if(n->status.hop_routing) {
+		mesh->hop_routing_nodes--;
+	}
+}
 
-			if(n->utcp) {
-				utcp_reset_all_connections(n->utcp);
-			}
+static void check_reachability(meshlink_handle_t *mesh, node_t *n) {
+	/* Our own node is only reachable while our thread is running */
+
+	n->status.visited = (n == mesh->self) ? mesh->threadstarted : n->distance >= 0;
 
-			n->status.validkey = false;
-			sptps_stop(&n->sptps);
-			n->status.waitingforkey = false;
-			n->last_req_key = -3600;
+	/* Keep track of reachable nodes that do not route on edge weights yet */
+	bool hop_routing = n->status.visited && n != mesh->self && OPTION_VERSION(n->options) < PROT_MINOR_RTT;
 
-			n->status.udp_confirmed = false;
-			n->maxmtu = MTU;
-			n->minmtu = 0;
-			n->mtuprobes = 0;
+	if(hop_routing != n->status.hop_routing) {
+		n->status.hop_routing = hop_routing;
+		mesh->hop_routing_nodes += hop_routing ? 1 : -1;
+	}
+
+	/* Check for nodes that have changed session_id */
+	if(n->status.visited && n->prevedge && n->prevedge->reverse->session_id != n->session_id) {
+		logger(mesh, MESHLINK_DEBUG, "Node %s has a new session ID", n->name);
+
+		n->session_id = n->prevedge->reverse->session_id;
 
-			timeout_del(&mesh->loop, &n->mtutimeout);
+		if(n->utcp) {
+			utcp_reset_all_connections(n->utcp);
 		}
 
-		if(n->status.visited != n->status.reachable) {
-			n->status.reachable = !n->status.reachable;
-			n->status.dirty = true;
+		n->status.validkey = false;
+		sptps_stop(&n->sptps);
+		n->status.waitingforkey = false;
+		n->last_req_key = -3600;
 
-			if(!n->status.blacklisted) {
-				if(n->status.reachable) {
-					logger(mesh, MESHLINK_DEBUG, "Node %s became reachable", n->name);
-					bool first_time_reachable = !n->last_reachable;
-					n->last_reachable = time(NULL);
+		n->status.udp_confirmed = false;
+		n->maxmtu = MTU;
+		n->minmtu = 0;
+		n->mtuprobes = 0;
+
+		timeout_del(&mesh->loop, &n->mtutimeout);
+		update_node_snapshot(n);
+	}
 
-					if(first_time_reachable) {
-						if(!node_write_config(mesh, n, false)) {
-							logger(mesh, MESHLINK_WARNING, "Could not write host config file for node %s!\n", n->name);
+	if(n->status.visited != n->status.reachable) {
+		n->status.reachable = !n->status.reachable;
+		n->status.dirty = true;
+		mesh->nreachable += n->status.reachable ? 1 : -1;
+		update_node_autoconnect(mesh, n);
+
+		if(!n->status.blacklisted) {
+			if(n->status.reachable) {
+				logger(mesh, MESHLINK_DEBUG, "Node %s became reachable", n->name);
+				bool first_time_reachable = !n->last_reachable;
+				n->last_reachable = time(NULL);
+
+				if(first_time_reachable) {
+					if(!node_write_config(mesh, n, false)) {
+						logger(mesh, MESHLINK_WARNING, "Could not write host config file for node %s!\n", n->name);
 
-						}
 					}
-				} else {
-					logger(mesh, MESHLINK_DEBUG, "Node %s became unreachable", n->name);
-					n->last_unreachable = time(NULL);
 				}
+			} else {
+				logger(mesh, MESHLINK_DEBUG, "Node %s became unreachable", n->name);
+				n->last_unreachable = time(NULL);
 			}
+		}
 
-			n->status.udp_confirmed = false;
-			n->maxmtu = MTU;
-			n->minmtu = 0;
-			n->mtuprobes = 0;
+		n->status.udp_confirmed = false;
+		n->maxmtu = MTU;
+		n->minmtu = 0;
+		n->mtuprobes = 0;
 
-			timeout_del(&mesh->loop, &n->mtutimeout);
+		timeout_del(&mesh->loop, &n->mtutimeout);
+		update_node_snapshot(n);
 
-			if(!n->status.blacklisted) {
-				update_node_status(mesh, n);
-			}
+		if(!n->status.blacklisted) {
+			update_node_status(mesh, n);
+		}
 
-			if(!n->status.reachable) {
-				update_node_udp(mesh, n, NULL);
-				n->status.broadcast = false;
-			}
+		if(!n->status.reachable) {
+			update_node_udp(mesh, n, NULL);
+			n->status.broadcast = false;
 
-			if(n->utcp) {
-				utcp_offline(n->utcp, !n->status.reachable);
+			/* A REQ_KEY we sent might have been lost along with the connection, so it should not win a tie-break */
+			if(!n->status.validkey) {
+				n->last_req_key = -3600;
 			}
 		}
+
+		if(n->utcp) {
+			utcp_offline(n->utcp, !n->status.reachable);
+		}
 	}
+}
+
+void graph(meshlink_handle_t *mesh) {
+	mark_dirty(mesh, mesh->self);
+
+	/* Callbacks might change the graph again, so always take the next node from the head of the list */
+
+	while(mesh->graph_dirty) {
+		node_t *n = mesh->graph_dirty;
+		mesh->graph_dirty = n->graph_next;
+		n->graph_next = NULL;
+		n->status.graph_dirty = false;
+		check_reachability(mesh, n);
+
+		/* Switch between routing on hop counts and on edge weights once every node we can reach agrees on it */
+
+		if(!mesh->graph_dirty && mesh->hop_routing != (mesh->meta_text_only || mesh->hop_routing_nodes > 0)) {
+			mesh->hop_routing = !mesh->hop_routing;
+			logger(mesh, MESHLINK_DEBUG, "Routing on %s", mesh->hop_routing ? "hop counts" : "edge weights");
+			graph_recompute(mesh);
+		}
+	}
+
+	int reachable = mesh->nreachable - 1; /* Don't count ourself */
 
 	if(mesh->reachable != reachable) {
 		if(!reachable) {
@@ -225,7 +459,154 @@ static void check_reachability(meshlink_handle_t *mesh) {
 	}
 }
 
-void graph(meshlink_handle_t *mesh) {
-	sssp_bfs(mesh);
-	check_reachability(mesh);
+static void graph_handler(event_loop_t *loop, void *data) {
+	(void)loop;
+	graph(data);
+}
+
+void graph_schedule(meshlink_handle_t *mesh) {
+	/* Without a running event loop there is nothing to coalesce with */
+
+	if(!mesh->graphtimer.cb) {
+		graph(mesh);
+		return;
+	}
+
+	/* Run at most once per event loop iteration, no matter how many edges changed in this one */
+
+	if(!mesh->graphtimer.node.data) {
+		timeout_set(&mesh->loop, &mesh->graphtimer, &(struct timespec) {
+			0, 0
+		});
+	}
+}
+
+void init_graph(meshlink_handle_t *mesh) {
+	timeout_add(&mesh->loop, &mesh->graphtimer, graph_handler, mesh, &(struct timespec) {
+		0, 0
+	});
+}
+
+void exit_graph(meshlink_handle_t *mesh) {
+	timeout_del(&mesh->loop, &mesh->graphtimer);
+}
+
+/* Implementation of Kruskal's minimum spanning tree algorithm. */
+
+static node_t *mst_find(node_t *n) {
+	while(n->mst_parent != n) {
+		n->mst_parent = n->mst_parent->mst_parent;
+		n = n->mst_parent;
+	}
+
+	return n;
+}
+
+static int mst_edge_compare(const void *va, const void *vb) {
+	const edge_t *a = *(const edge_t **)va;
+	const edge_t *b = *(const edge_t **)vb;
+
+	int wa = edge_cost(a) + edge_cost(a->reverse);
+	int wb = edge_cost(b) + edge_cost(b->reverse);
+
+	if(wa != wb) {
+		return wa < wb ? -1 : 1;
+	}
+
+	int result = strcmp(a->from->name, b->from->name);
+
+	if(result) {
+		return result;
+	}
+
+	return strcmp(a->to->name, b->to->name);
+}
+
+static void mst_kruskal(meshlink_handle_t *mesh) {
+	for splay_each(node_t, n, mesh->nodes) {
+		n->mst_parent = n;
+	}
+
+	for list_each(connection_t, c, mesh->connections) {
+		c->status.mst = false;
+	}
+
+	/* Only consider every bidirectional edge once */
+
+	edge_t **edges = xmalloc((mesh->edges->count + 1) * sizeof(*edges));
+	unsigned int count = 0;
+
+	for splay_each(edge_t, e, mesh->edges) {
+		e->mst = false;
+
+		if(e->reverse && strcmp(e->from->name, e->to->name) < 0) {
+			edges[count++] = e;
+		}
+	}
+
+	qsort(edges, count, sizeof(*edges), mst_edge_compare);
+
+	for(unsigned int i = 0; i < count; i++) {
+		edge_t *e = edges[i];
+		node_t *from = mst_find(e->from);
+		node_t *to = mst_find(e->to);
+
+		if(from == to) {
+			continue;
+		}
+
+		from->mst_parent = to;
+		e->mst = true;
+		e->reverse->mst = true;
+
+		if(e->from == mesh->self && e->connection) {
+			e->connection->status.mst = true;
+		} else if(e->to == mesh->self && e->reverse->connection) {
+			e->reverse->connection->status.mst = true;
+		}
+	}
+
+	free(edges);
+
+	logger(mesh, MESHLINK_DEBUG, "Computed minimum spanning tree");
+	mesh->mst_dirty = false;
+	mesh->mst_valid = true;
+	mesh->last_mst_update = mesh->loop.now.tv_sec;
+}
+
+/* Recompute the MST if the topology has settled since it last changed. */
+void mst_update(meshlink_handle_t *mesh) {
+	if(mesh->mst_dirty && mesh->loop.now.tv_sec - mesh->last_topology_change >= MST_SETTLE_TIME) {
+		mst_kruskal(mesh);
+	}
+}
+
+/* Once an edge of the MST is gone, the tree no longer reaches every node. */
+void mst_del_edge(meshlink_handle_t *mesh, const edge_t *e) {
+	if(e->mst) {
+		mesh->mst_valid = false;
+	}
+}
+
+/* Check whether a request that is flooded, and which came in via from, only has to be sent over connections that are part of the MST. */
+bool mst_broadcast(meshlink_handle_t *mesh, const connection_t *from) {
+	/* Nodes in submeshes only see part of the topology, so they cannot agree on a spanning tree */
+
+	if(mesh->submeshes && mesh->submeshes->count) {
+		return false;
+	}
+
+	mst_update(mesh);
+
+	/* Other nodes compute their tree on their own, so they can still be using a different one.
+	   Only rely on the tree once the topology has stayed the same for a while after computing it,
+	   and flood to everyone while it is out of date. */
+
+	if(!mesh->mst_valid || mesh->mst_dirty || mesh->loop.now.tv_sec - mesh->last_mst_update < MST_SETTLE_TIME) {
+		return false;
+	}
+
+	/* If it came in over a connection outside our tree, the sender has a different view of the topology */
+
+	return !from || from->status.mst;
 }
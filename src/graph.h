@@ -20,6 +20,26 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+/* Flooding is only restricted to the minimum spanning tree once the topology has not changed for this many seconds */
+
+#define MST_SETTLE_TIME 5
+
+struct connection_t;
+struct edge_t;
+struct list_t;
+struct node_t;
+
 void graph(struct meshlink_handle *mesh);
+void graph_schedule(struct meshlink_handle *mesh);
+void init_graph(struct meshlink_handle *mesh);
+void exit_graph(struct meshlink_handle *mesh);
+void graph_add_edge(struct meshlink_handle *mesh, struct edge_t *e);
+struct list_t *graph_detach_edge(struct meshlink_handle *mesh, struct edge_t *e) __attribute__((__warn_unused_result__));
+void graph_reattach(struct meshlink_handle *mesh, struct list_t *orphans);
+void graph_reweight_edge(struct meshlink_handle *mesh, struct edge_t *e, int old_weight);
+void graph_forget_node(struct meshlink_handle *mesh, struct node_t *n);
+void mst_update(struct meshlink_handle *mesh);
+void mst_del_edge(struct meshlink_handle *mesh, const struct edge_t *e);
+bool mst_broadcast(struct meshlink_handle *mesh, const struct connection_t *from) __attribute__((__warn_unused_result__));
 
 #endif
@@ -35,6 +35,9 @@ typedef meshlink_log_level_t log_level_t;
 /// Code of most recent error encountered.
 typedef meshlink_errno_t errno_t;
 
+/// Transport statistics of a channel.
+typedef meshlink_channel_stats_t channel_stats_t;
+
 /// A callback for receiving data from the mesh.
 /** @param mesh      A handle which represents an instance of MeshLink.
  *  @param source    A pointer to a meshlink::node describing the source of the data.
@@ -930,6 +933,19 @@ public:
 		meshlink_set_channel_flags(handle, channel, flags);
 	}
 
+	/// Enable or disable send staging for a channel.
+	/** With send staging enabled, channel_send() copies data into a ring buffer without taking MeshLink's internal lock.
+	 *  See meshlink_set_channel_send_staging() for the restrictions.
+	 *
+	 *  @param channel   A handle for the channel.
+	 *  @param size      The size of the ring buffer, or 0 to disable send staging.
+	 *
+	 *  @return          True if send staging was enabled or disabled, false otherwise.
+	 */
+	bool set_channel_send_staging(channel *channel, size_t size) {
+		return meshlink_set_channel_send_staging(handle, channel, size);
+	}
+
 	/// Set the send buffer storage of a channel.
 	/** This function provides MeshLink with a send buffer allocated by the application.
 	*
@@ -1070,6 +1086,50 @@ public:
 		return meshlink_channel_send(handle, channel, data, len);
 	}
 
+	/// Transmit data from multiple buffers on a channel
+	/** This queues the contents of an array of buffers to send to the remote node,
+	 *  as if they were concatenated and passed to a single call to channel_send().
+	 *
+	 *  @param channel      A handle for the channel.
+	 *  @param iov          A pointer to an array of iovcnt struct iovec elements describing the buffers to send.
+	 *  @param iovcnt       The number of elements in the iov array.
+	 *
+	 *  @return             The amount of data that was queued, which can be less than the total length of all buffers,
+	 *                      or a negative value in case of an error.
+	 *                      If MESHLINK_CHANNEL_NO_PARTIAL is set, then the result will either be the total length,
+	 *                      0 if the buffer is currently too full, or -1 if the total length is too big even for an empty buffer.
+	 */
+	ssize_t channel_sendv(channel *channel, const struct iovec *iov, int iovcnt) {
+		return meshlink_channel_sendv(handle, channel, iov, iovcnt);
+	}
+
+	/// Get direct access to received data on a channel.
+	/** If MESHLINK_CHANNEL_PEEK is set on a reliable channel, received data is kept in the channel's receive buffer
+	 *  until the application consumes it. This function fills in up to two iovecs that point directly into the receive buffer.
+	 *  The data remains valid until the next call to channel_consume().
+	 *
+	 *  @param channel      A handle for the channel.
+	 *  @param iov          A pointer to an array of iovcnt struct iovec elements that will be filled in.
+	 *  @param iovcnt       The number of elements in the iov array.
+	 *
+	 *  @return             The amount of data described by the iovecs, or -1 in case of an error.
+	 */
+	ssize_t channel_peek(channel *channel, struct iovec *iov, int iovcnt) {
+		return meshlink_channel_peek(handle, channel, iov, iovcnt);
+	}
+
+	/// Consume received data on a channel.
+	/** This removes data from the start of the channel's receive buffer.
+	 *
+	 *  @param channel      A handle for the channel.
+	 *  @param len          The amount of data to consume.
+	 *
+	 *  @return             This function will return true if the data was consumed, false otherwise.
+	 */
+	bool channel_consume(channel *channel, size_t len) {
+		return meshlink_channel_consume(handle, channel, len);
+	}
+
 	/// Transmit data on a channel asynchronously
 	/** This registers a buffer that will be used to send data to the remote node.
 	 *  Multiple buffers can be registered, in which case data will be sent in the order the buffers were registered.
@@ -1177,6 +1237,18 @@ public:
 		return meshlink_channel_get_mss(handle, channel);
 	};
 
+	/// Get transport statistics of a channel.
+	/** This fills in a snapshot of the state of the congestion control and retransmission logic of a channel.
+	 *
+	 *  @param channel      A handle for the channel.
+	 *  @param stats        A reference to a struct that will be filled in.
+	 *
+	 *  @return             This function will return true if the statistics were filled in, false otherwise.
+	 */
+	bool channel_get_stats(channel *channel, channel_stats_t &stats) {
+		return meshlink_channel_get_stats(handle, channel, &stats, sizeof(stats));
+	}
+
 	/// Enable or disable zeroconf discovery of local peers
 	/** This controls whether zeroconf discovery using the Catta library will be
 	 *  enabled to search for peers on the local network. By default, it is enabled.
@@ -1240,6 +1312,31 @@ public:
 		meshlink_set_inviter_commits_first(handle, inviter_commits_first);
 	}
 
+	/// Set the number of crypto worker threads
+	/** This sets the number of threads used to encrypt and decrypt packets that are sent to and received from other nodes via UDP.
+	 *  By default, this is 0, and all encryption and decryption is done by MeshLink's own thread.
+	 *
+	 *  @param threads       The number of worker threads, at most 64, or 0 to disable the worker threads.
+	 *
+	 *  @return              This function returns true if the number of threads was set, false otherwise.
+	 */
+	bool set_crypto_threads(int threads) {
+		return meshlink_set_crypto_threads(handle, threads);
+	}
+
+	/// Use a shared event loop.
+	/** This causes the instance to run its event loop on the thread of a shared event loop instead of starting its own thread.
+	 *  This can only be changed while the instance is not running.
+	 *
+	 *  @param shared   A pointer to a shared event loop created with meshlink_shared_loop_new(),
+	 *                  or NULL to let the instance start its own thread again.
+	 *
+	 *  @return         This function returns true if the shared event loop was set, false otherwise.
+	 */
+	bool set_shared_loop(meshlink_shared_loop_t *shared) {
+		return meshlink_set_shared_loop(handle, shared);
+	}
+
 	/// Set the URL used to discover the host's external address
 	/** For generating invitation URLs, MeshLink can look up the externally visible address of the local node.
 	 *  It does so by querying an external service. By default, this is http://meshlink.io/host.cgi.
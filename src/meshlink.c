@@ -22,6 +22,7 @@
 
 #include "adns.h"
 #include "crypto.h"
+#include "crypto_pool.h"
 #include "ecdsagen.h"
 #include "logger.h"
 #include "meshlink_internal.h"
@@ -33,6 +34,8 @@
 #include "prf.h"
 #include "protocol.h"
 #include "route.h"
+#include "shard.h"
+#include "shared_loop.h"
 #include "sockaddr.h"
 #include "utils.h"
 #include "xalloc.h"
@@ -50,6 +53,97 @@ meshlink_log_level_t global_log_level;
 
 typedef bool (*search_node_by_condition_t)(const node_t *, const void *);
 
+#ifdef MESHLINK_LOCK_STATS
+static uint32_t usec_between(const struct timespec *start, const struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+static struct lock_stats *lookup_lock_stats(meshlink_handle_t *mesh, const char *site) {
+	size_t hash = ((uintptr_t)site >> 4) % LOCK_STATS_SITES;
+
+	for(size_t i = 0; i < LOCK_STATS_SITES; i++) {
+		struct lock_stats *ls = &mesh->lock_stats[(hash + i) % LOCK_STATS_SITES];
+
+		if(!ls->site) {
+			ls->site = site;
+		}
+
+		if(ls->site == site) {
+			return ls;
+		}
+	}
+
+	return NULL;
+}
+
+static void record_lock_hold(meshlink_handle_t *mesh) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct lock_stats *ls = lookup_lock_stats(mesh, mesh->lock_site);
+
+	if(ls) {
+		uint32_t hold = usec_between(&mesh->lock_start, &now);
+		ls->hold_usec += hold;
+
+		if(hold > ls->max_hold_usec) {
+			ls->max_hold_usec = hold;
+		}
+	}
+}
+
+void meshlink_lock_site(meshlink_handle_t *mesh, const char *site) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+
+	// Only account for the outermost lock, nested locks never wait
+	if(mesh->lock_depth++) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &mesh->lock_start);
+	mesh->lock_site = site;
+	struct lock_stats *ls = lookup_lock_stats(mesh, site);
+
+	if(ls) {
+		uint32_t wait = usec_between(&start, &mesh->lock_start);
+		ls->count++;
+		ls->wait_usec += wait;
+
+		if(wait > ls->max_wait_usec) {
+			ls->max_wait_usec = wait;
+		}
+	}
+}
+
+void meshlink_unlock(meshlink_handle_t *mesh) {
+	assert(mesh->lock_depth > 0);
+
+	if(!--mesh->lock_depth) {
+		record_lock_hold(mesh);
+	}
+
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
+void meshlink_cond_wait(meshlink_handle_t *mesh, pthread_cond_t *cond) {
+	// Waiting releases the mutex, so don't count this as holding it
+	int depth = mesh->lock_depth;
+	const char *site = mesh->lock_site;
+	record_lock_hold(mesh);
+	mesh->lock_depth = 0;
+
+	pthread_cond_wait(cond, &mesh->mutex);
+
+	mesh->lock_depth = depth;
+	mesh->lock_site = site;
+	clock_gettime(CLOCK_MONOTONIC, &mesh->lock_start);
+}
+#endif
+
 static int rstrip(char *value) {
 	int len = strlen(value);
 
@@ -756,6 +850,7 @@ static bool finalize_join(join_state_t *state, const void *buf, uint16_t len) {
 	mesh->self->submesh = strcmp(submesh_name, CORE_MESH) ? lookup_or_create_submesh(mesh, submesh_name) : NULL;
 	free(submesh_name);
 	mesh->self->devclass = devclass == DEV_CLASS_UNKNOWN ? mesh->devclass : devclass;
+	update_node_snapshot(mesh->self);
 
 	// Initialize configuration directory
 	if(!config_init(mesh, "current")) {
@@ -1044,6 +1139,8 @@ static struct timespec idle(event_loop_t *loop, void *data) {
 		if(timespec_lt(&t, &tmin)) {
 			tmin = t;
 		}
+
+		channel_flush_coalesced(mesh, n);
 	}
 
 	return tmin;
@@ -1300,6 +1397,19 @@ bool meshlink_open_params_set_lock_filename(meshlink_open_params_t *params, cons
 	return true;
 }
 
+bool meshlink_open_params_set_udp_shards(meshlink_open_params_t *params, int shards) {
+	logger(NULL, MESHLINK_DEBUG, "meshlink_open_params_set_udp_shards(%d)", shards);
+
+	if(!params || shards < 0 || shards > MAX_UDP_SHARDS) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	params->udp_shards = shards;
+
+	return true;
+}
+
 bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key, size_t new_keylen) {
 	logger(NULL, MESHLINK_DEBUG, "meshlink_encrypted_key_rotate(%p, %zu)", new_key, new_keylen);
 
@@ -1309,9 +1419,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	// Create hash for the new key
 	void *new_config_key;
@@ -1320,7 +1428,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	if(!prf(new_key, new_keylen, "MeshLink configuration key", 26, new_config_key, CHACHA_POLY1305_KEYLEN)) {
 		logger(mesh, MESHLINK_ERROR, "Error creating new configuration key!\n");
 		meshlink_errno = MESHLINK_EINTERNAL;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
@@ -1329,7 +1437,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	if(!config_copy(mesh, "current", mesh->config_key, "new", new_config_key)) {
 		logger(mesh, MESHLINK_ERROR, "Could not set up configuration in %s/old: %s\n", mesh->confbase, strerror(errno));
 		meshlink_errno = MESHLINK_ESTORAGE;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
@@ -1340,7 +1448,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	if(!config_rename(mesh, "current", "old")) {
 		logger(mesh, MESHLINK_ERROR, "Cannot rename %s/current to %s/old\n", mesh->confbase, mesh->confbase);
 		meshlink_errno = MESHLINK_ESTORAGE;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
@@ -1351,7 +1459,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	if(!config_rename(mesh, "new", "current")) {
 		logger(mesh, MESHLINK_ERROR, "Cannot rename %s/new to %s/current\n", mesh->confbase, mesh->confbase);
 		meshlink_errno = MESHLINK_ESTORAGE;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
@@ -1360,7 +1468,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	// Cleanup the "old" confbase sub-directory
 
 	if(!config_destroy(mesh->confbase, "old")) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
@@ -1369,7 +1477,7 @@ bool meshlink_encrypted_key_rotate(meshlink_handle_t *mesh, const void *new_key,
 	free(mesh->config_key);
 	mesh->config_key = new_config_key;
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return true;
 }
@@ -1541,6 +1649,7 @@ meshlink_handle_t *meshlink_open_ex(const meshlink_open_params_t *params) {
 	mesh->discovery.enabled = true;
 	mesh->invitation_timeout = 604800; // 1 week
 	mesh->netns = params->netns;
+	mesh->udp_shards = params->udp_shards;
 	mesh->submeshes = NULL;
 	mesh->log_cb = global_log_cb;
 	mesh->log_level = global_log_level;
@@ -1586,6 +1695,8 @@ meshlink_handle_t *meshlink_open_ex(const meshlink_open_params_t *params) {
 	mesh->loop.data = mesh;
 
 	meshlink_queue_init(&mesh->outpacketqueue);
+	meshlink_queue_init(&mesh->transport_queue);
+	meshlink_queue_init(&mesh->shard_queue);
 
 	// Atomically lock the configuration directory.
 	if(!main_config_lock(mesh, params->lock_filename)) {
@@ -1700,13 +1811,11 @@ meshlink_submesh_t *meshlink_submesh_open(meshlink_handle_t *mesh, const char *s
 	}
 
 	//lock mesh->nodes
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	s = (meshlink_submesh_t *)create_submesh(mesh, submesh);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return s;
 }
@@ -1732,9 +1841,7 @@ static void *meshlink_main_loop(void *arg) {
 		discovery_start(mesh);
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(mesh->thread_status_cb) {
 		mesh->thread_status_cb(mesh, true);
@@ -1745,11 +1852,15 @@ static void *meshlink_main_loop(void *arg) {
 	main_loop(mesh);
 	logger(mesh, MESHLINK_DEBUG, "main_loop returned.\n");
 
+	for splay_each(node_t, n, mesh->nodes) {
+		channel_flush_coalesced(mesh, n);
+	}
+
 	if(mesh->thread_status_cb) {
 		mesh->thread_status_cb(mesh, false);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	// Stop discovery
 	if(mesh->discovery.enabled) {
@@ -1759,6 +1870,67 @@ static void *meshlink_main_loop(void *arg) {
 	return NULL;
 }
 
+meshlink_shared_loop_t *meshlink_shared_loop_new(void) {
+	meshlink_shared_loop_t *shared = shared_loop_new();
+
+	if(!shared) {
+		logger(NULL, MESHLINK_ERROR, "Could not start shared event loop: %s\n", strerror(errno));
+		meshlink_errno = MESHLINK_EINTERNAL;
+	}
+
+	return shared;
+}
+
+bool meshlink_shared_loop_free(meshlink_shared_loop_t *shared) {
+	if(!shared) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	if(!shared_loop_free(shared)) {
+		logger(NULL, MESHLINK_ERROR, "Shared event loop is still in use\n");
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	return true;
+}
+
+bool meshlink_set_shared_loop(meshlink_handle_t *mesh, meshlink_shared_loop_t *shared) {
+	if(!mesh) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	meshlink_lock(mesh);
+
+	if(mesh->threadstarted) {
+		logger(mesh, MESHLINK_ERROR, "Cannot change the event loop while MeshLink is running\n");
+		meshlink_errno = MESHLINK_EINVAL;
+		meshlink_unlock(mesh);
+		return false;
+	}
+
+	if(shared && mesh->netns != -1) {
+		logger(mesh, MESHLINK_ERROR, "Shared event loops cannot be used with network namespaces\n");
+		meshlink_errno = MESHLINK_EINVAL;
+		meshlink_unlock(mesh);
+		return false;
+	}
+
+	if(shared) {
+		shared_loop_ref(shared);
+	}
+
+	if(mesh->shared_loop) {
+		shared_loop_unref(mesh->shared_loop);
+	}
+
+	mesh->shared_loop = shared;
+	meshlink_unlock(mesh);
+	return true;
+}
+
 bool meshlink_start(meshlink_handle_t *mesh) {
 	if(!mesh) {
 		meshlink_errno = MESHLINK_EINVAL;
@@ -1767,9 +1939,7 @@ bool meshlink_start(meshlink_handle_t *mesh) {
 
 	logger(mesh, MESHLINK_DEBUG, "meshlink_start called\n");
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	assert(mesh->self);
 	assert(mesh->private_key);
@@ -1778,7 +1948,7 @@ bool meshlink_start(meshlink_handle_t *mesh) {
 
 	if(mesh->threadstarted) {
 		logger(mesh, MESHLINK_DEBUG, "thread was already running\n");
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return true;
 	}
 
@@ -1791,6 +1961,7 @@ bool meshlink_start(meshlink_handle_t *mesh) {
 	// Reset node connection timers
 	for splay_each(node_t, n, mesh->nodes) {
 		n->last_connect_try = 0;
+		update_node_autoconnect(mesh, n);
 	}
 
 	// TODO: open listening sockets first
@@ -1799,38 +1970,52 @@ bool meshlink_start(meshlink_handle_t *mesh) {
 	if(!mesh->name) {
 		logger(mesh, MESHLINK_ERROR, "No name given!\n");
 		meshlink_errno = MESHLINK_EINVAL;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
 	init_outgoings(mesh);
 	init_adns(mesh);
+	init_crypto_pool(mesh);
 
 	// Start the main thread
 
 	event_loop_start(&mesh->loop);
 
-	// Ensure we have a decent amount of stack space. Musl's default of 80 kB is too small.
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-	pthread_attr_setstacksize(&attr, 1024 * 1024);
+	if(mesh->shared_loop) {
+		if(!shared_loop_attach(mesh)) {
+			logger(mesh, MESHLINK_ERROR, "Could not attach to the shared event loop\n");
+			meshlink_errno = MESHLINK_EINTERNAL;
+			event_loop_stop(&mesh->loop);
+			meshlink_unlock(mesh);
+			return false;
+		}
+	} else {
+		// Ensure we have a decent amount of stack space. Musl's default of 80 kB is too small.
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, 1024 * 1024);
+
+		if(pthread_create(&mesh->thread, &attr, meshlink_main_loop, mesh) != 0) {
+			logger(mesh, MESHLINK_ERROR, "Could not start thread: %s\n", strerror(errno));
+			memset(&mesh->thread, 0, sizeof(mesh)->thread);
+			meshlink_errno = MESHLINK_EINTERNAL;
+			event_loop_stop(&mesh->loop);
+			meshlink_unlock(mesh);
+			return false;
+		}
 
-	if(pthread_create(&mesh->thread, &attr, meshlink_main_loop, mesh) != 0) {
-		logger(mesh, MESHLINK_ERROR, "Could not start thread: %s\n", strerror(errno));
-		memset(&mesh->thread, 0, sizeof(mesh)->thread);
-		meshlink_errno = MESHLINK_EINTERNAL;
-		event_loop_stop(&mesh->loop);
-		pthread_mutex_unlock(&mesh->mutex);
-		return false;
+		meshlink_cond_wait(mesh, &mesh->cond);
 	}
 
-	pthread_cond_wait(&mesh->cond, &mesh->mutex);
 	mesh->threadstarted = true;
 
+	init_shards(mesh);
+
 	// Ensure we are considered reachable
 	graph(mesh);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	return true;
 }
 
@@ -1842,9 +2027,7 @@ void meshlink_stop(meshlink_handle_t *mesh) {
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	// Shut down the main thread
 	event_loop_stop(&mesh->loop);
@@ -1864,21 +2047,24 @@ void meshlink_stop(meshlink_handle_t *mesh) {
 		}
 	}
 
-	if(mesh->threadstarted) {
+	if(mesh->threadstarted && mesh->shared_loop) {
+		shared_loop_detach(mesh);
+		mesh->threadstarted = false;
+	} else if(mesh->threadstarted) {
 		// Wait for the main thread to finish
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 
 		if(pthread_join(mesh->thread, NULL) != 0) {
 			abort();
 		}
 
-		if(pthread_mutex_lock(&mesh->mutex) != 0) {
-			abort();
-		}
+		meshlink_lock(mesh);
 
 		mesh->threadstarted = false;
 	}
 
+	exit_shards(mesh);
+
 	// Close all metaconnections
 	if(mesh->connections) {
 		for(list_node_t *node = mesh->connections->head, *next; node; node = next) {
@@ -1889,6 +2075,7 @@ void meshlink_stop(meshlink_handle_t *mesh) {
 		}
 	}
 
+	exit_crypto_pool(mesh);
 	exit_adns(mesh);
 	exit_outgoings(mesh);
 
@@ -1908,7 +2095,7 @@ void meshlink_stop(meshlink_handle_t *mesh) {
 		}
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_close(meshlink_handle_t *mesh) {
@@ -1922,11 +2109,13 @@ void meshlink_close(meshlink_handle_t *mesh) {
 	// stop can be called even if mesh has not been started
 	meshlink_stop(mesh);
 
-	// lock is not released after this
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
+	if(mesh->shared_loop) {
+		shared_loop_unref(mesh->shared_loop);
 	}
 
+	// lock is not released after this
+	meshlink_lock(mesh);
+
 	// Close and free all resources used.
 
 	close_network_connections(mesh);
@@ -1955,6 +2144,17 @@ void meshlink_close(meshlink_handle_t *mesh) {
 
 	meshlink_queue_exit(&mesh->outpacketqueue);
 
+	for(transport_item_t *item; (item = meshlink_queue_pop(&mesh->transport_queue));) {
+		if(item->fd != -1) {
+			closesocket(item->fd);
+		}
+
+		free(item);
+	}
+
+	meshlink_queue_exit(&mesh->transport_queue);
+	meshlink_queue_exit(&mesh->shard_queue);
+
 	free(mesh->name);
 	free(mesh->appname);
 	free(mesh->confbase);
@@ -1967,9 +2167,13 @@ void meshlink_close(meshlink_handle_t *mesh) {
 		list_delete_list(mesh->invitation_addresses);
 	}
 
+	if(mesh->staged_channels) {
+		list_delete_list(mesh->staged_channels);
+	}
+
 	main_config_unlock(mesh);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	pthread_mutex_destroy(&mesh->mutex);
 
 	memset(mesh, 0, sizeof(*mesh));
@@ -2066,12 +2270,10 @@ void meshlink_set_receive_cb(meshlink_handle_t *mesh, meshlink_receive_cb_t cb)
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->receive_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_connection_try_cb(meshlink_handle_t *mesh, meshlink_connection_try_cb_t cb) {
@@ -2082,12 +2284,10 @@ void meshlink_set_connection_try_cb(meshlink_handle_t *mesh, meshlink_connection
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->connection_try_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_node_status_cb(meshlink_handle_t *mesh, meshlink_node_status_cb_t cb) {
@@ -2098,12 +2298,10 @@ void meshlink_set_node_status_cb(meshlink_handle_t *mesh, meshlink_node_status_c
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->node_status_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_node_pmtu_cb(meshlink_handle_t *mesh, meshlink_node_pmtu_cb_t cb) {
@@ -2114,12 +2312,10 @@ void meshlink_set_node_pmtu_cb(meshlink_handle_t *mesh, meshlink_node_pmtu_cb_t
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->node_pmtu_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_node_duplicate_cb(meshlink_handle_t *mesh, meshlink_node_duplicate_cb_t cb) {
@@ -2130,25 +2326,21 @@ void meshlink_set_node_duplicate_cb(meshlink_handle_t *mesh, meshlink_node_dupli
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->node_duplicate_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_log_cb(meshlink_handle_t *mesh, meshlink_log_level_t level, meshlink_log_cb_t cb) {
 	logger(mesh, MESHLINK_DEBUG, "meshlink_set_log_cb(%p)", (void *)(intptr_t)cb);
 
 	if(mesh) {
-		if(pthread_mutex_lock(&mesh->mutex) != 0) {
-			abort();
-		}
+		meshlink_lock(mesh);
 
 		mesh->log_cb = cb;
 		mesh->log_level = cb ? level : 0;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 	} else {
 		global_log_cb = cb;
 		global_log_level = cb ? level : 0;
@@ -2163,12 +2355,10 @@ void meshlink_set_error_cb(struct meshlink_handle *mesh, meshlink_error_cb_t cb)
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->error_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_blacklisted_cb(struct meshlink_handle *mesh, meshlink_blacklisted_cb_t cb) {
@@ -2179,12 +2369,10 @@ void meshlink_set_blacklisted_cb(struct meshlink_handle *mesh, meshlink_blacklis
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->blacklisted_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_thread_status_cb(struct meshlink_handle *mesh, meshlink_thread_status_cb_t cb) {
@@ -2195,16 +2383,19 @@ void meshlink_set_thread_status_cb(struct meshlink_handle *mesh, meshlink_thread
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->thread_status_cb = cb;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
-static bool prepare_packet(meshlink_handle_t *mesh, meshlink_node_t *destination, const void *data, size_t len, vpn_packet_t *packet) {
+static bool prepare_packetv(meshlink_handle_t *mesh, meshlink_node_t *destination, const struct iovec *iov, int iovcnt, vpn_packet_t *packet) {
 	meshlink_packethdr_t *hdr;
+	size_t len = 0;
+
+	for(int i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
 
 	if(len > MAXSIZE - sizeof(*hdr)) {
 		meshlink_errno = MESHLINK_EINVAL;
@@ -2222,6 +2413,7 @@ static bool prepare_packet(meshlink_handle_t *mesh, meshlink_node_t *destination
 	// Prepare the packet
 	packet->probe = false;
 	packet->tcp = false;
+	packet->coalesced = false;
 	packet->len = len + sizeof(*hdr);
 
 	hdr = (meshlink_packethdr_t *)packet->data;
@@ -2231,19 +2423,29 @@ static bool prepare_packet(meshlink_handle_t *mesh, meshlink_node_t *destination
 	strncpy((char *)hdr->destination, destination->name, sizeof(hdr->destination) - 1);
 	strncpy((char *)hdr->source, mesh->self->name, sizeof(hdr->source) - 1);
 
-	memcpy(packet->data + sizeof(*hdr), data, len);
+	uint8_t *p = packet->data + sizeof(*hdr);
+
+	for(int i = 0; i < iovcnt; i++) {
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
 
 	return true;
 }
 
-static bool meshlink_send_immediate(meshlink_handle_t *mesh, meshlink_node_t *destination, const void *data, size_t len) {
+static bool prepare_packet(meshlink_handle_t *mesh, meshlink_node_t *destination, const void *data, size_t len, vpn_packet_t *packet) {
+	struct iovec iov = {(void *)data, len};
+	return prepare_packetv(mesh, destination, &iov, 1, packet);
+}
+
+static bool meshlink_send_immediatev(meshlink_handle_t *mesh, meshlink_node_t *destination, const struct iovec *iov, int iovcnt) {
 	assert(mesh);
 	assert(destination);
-	assert(data);
-	assert(len);
+	assert(iov);
+	assert(iovcnt);
 
 	// Prepare the packet
-	if(!prepare_packet(mesh, destination, data, len, mesh->packet)) {
+	if(!prepare_packetv(mesh, destination, iov, iovcnt, mesh->packet)) {
 		return false;
 	}
 
@@ -2318,23 +2520,10 @@ ssize_t meshlink_get_pmtu(meshlink_handle_t *mesh, meshlink_node_t *destination)
 		return -1;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
-
-	node_t *n = (node_t *)destination;
-
-	if(!n->status.reachable) {
-		pthread_mutex_unlock(&mesh->mutex);
-		return 0;
+	node_snapshot_t snapshot;
+	read_node_snapshot(mesh, (node_t *)destination, &snapshot);
 
-	} else if(n->mtuprobes > 30 && n->minmtu) {
-		pthread_mutex_unlock(&mesh->mutex);
-		return n->minmtu;
-	} else {
-		pthread_mutex_unlock(&mesh->mutex);
-		return MTU;
-	}
+	return snapshot.pmtu;
 }
 
 char *meshlink_get_fingerprint(meshlink_handle_t *mesh, meshlink_node_t *node) {
@@ -2343,15 +2532,13 @@ char *meshlink_get_fingerprint(meshlink_handle_t *mesh, meshlink_node_t *node) {
 		return NULL;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	node_t *n = (node_t *)node;
 
 	if(!node_read_public_key(mesh, n) || !n->ecdsa) {
 		meshlink_errno = MESHLINK_EINTERNAL;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
@@ -2361,7 +2548,7 @@ char *meshlink_get_fingerprint(meshlink_handle_t *mesh, meshlink_node_t *node) {
 		meshlink_errno = MESHLINK_EINTERNAL;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	return fingerprint;
 }
 
@@ -2382,12 +2569,10 @@ meshlink_node_t *meshlink_get_node(meshlink_handle_t *mesh, const char *name) {
 
 	node_t *n = NULL;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	n = lookup_node(mesh, (char *)name); // TODO: make lookup_node() use const
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	if(!n) {
 		meshlink_errno = MESHLINK_ENOENT;
@@ -2404,12 +2589,10 @@ meshlink_submesh_t *meshlink_get_submesh(meshlink_handle_t *mesh, const char *na
 
 	meshlink_submesh_t *submesh = NULL;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	submesh = (meshlink_submesh_t *)lookup_submesh(mesh, name);
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	if(!submesh) {
 		meshlink_errno = MESHLINK_ENOENT;
@@ -2427,9 +2610,7 @@ meshlink_node_t **meshlink_get_all_nodes(meshlink_handle_t *mesh, meshlink_node_
 	meshlink_node_t **result;
 
 	//lock mesh->nodes
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	*nmemb = mesh->nodes->count;
 	result = realloc(nodes, *nmemb * sizeof(*nodes));
@@ -2446,7 +2627,7 @@ meshlink_node_t **meshlink_get_all_nodes(meshlink_handle_t *mesh, meshlink_node_
 		meshlink_errno = MESHLINK_ENOMEM;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return result;
 }
@@ -2454,9 +2635,7 @@ meshlink_node_t **meshlink_get_all_nodes(meshlink_handle_t *mesh, meshlink_node_
 static meshlink_node_t **meshlink_get_all_nodes_by_condition(meshlink_handle_t *mesh, const void *condition, meshlink_node_t **nodes, size_t *nmemb, search_node_by_condition_t search_node) {
 	meshlink_node_t **result;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	*nmemb = 0;
 
@@ -2468,7 +2647,7 @@ static meshlink_node_t **meshlink_get_all_nodes_by_condition(meshlink_handle_t *
 
 	if(*nmemb == 0) {
 		free(nodes);
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return NULL;
 	}
 
@@ -2488,7 +2667,7 @@ static meshlink_node_t **meshlink_get_all_nodes_by_condition(meshlink_handle_t *
 		meshlink_errno = MESHLINK_ENOMEM;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return result;
 }
@@ -2584,17 +2763,10 @@ dev_class_t meshlink_get_node_dev_class(meshlink_handle_t *mesh, meshlink_node_t
 		return -1;
 	}
 
-	dev_class_t devclass;
-
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
-
-	devclass = ((node_t *)node)->devclass;
-
-	pthread_mutex_unlock(&mesh->mutex);
+	node_snapshot_t snapshot;
+	read_node_snapshot(mesh, (node_t *)node, &snapshot);
 
-	return devclass;
+	return snapshot.devclass;
 }
 
 bool meshlink_get_node_tiny(meshlink_handle_t *mesh, meshlink_node_t *node) {
@@ -2603,17 +2775,10 @@ bool meshlink_get_node_tiny(meshlink_handle_t *mesh, meshlink_node_t *node) {
 		return -1;
 	}
 
-	bool tiny;
-
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
-
-	tiny = ((node_t *)node)->status.tiny;
-
-	pthread_mutex_unlock(&mesh->mutex);
+	node_snapshot_t snapshot;
+	read_node_snapshot(mesh, (node_t *)node, &snapshot);
 
-	return tiny;
+	return snapshot.tiny;
 }
 
 bool meshlink_get_node_blacklisted(meshlink_handle_t *mesh, meshlink_node_t *node) {
@@ -2625,17 +2790,10 @@ bool meshlink_get_node_blacklisted(meshlink_handle_t *mesh, meshlink_node_t *nod
 		return mesh->default_blacklist;
 	}
 
-	bool blacklisted;
-
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
-
-	blacklisted = ((node_t *)node)->status.blacklisted;
-
-	pthread_mutex_unlock(&mesh->mutex);
+	node_snapshot_t snapshot;
+	read_node_snapshot(mesh, (node_t *)node, &snapshot);
 
-	return blacklisted;
+	return snapshot.blacklisted;
 }
 
 meshlink_submesh_t *meshlink_get_node_submesh(meshlink_handle_t *mesh, meshlink_node_t *node) {
@@ -2659,26 +2817,18 @@ bool meshlink_get_node_reachability(struct meshlink_handle *mesh, struct meshlin
 		return NULL;
 	}
 
-	node_t *n = (node_t *)node;
-	bool reachable;
-
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
-
-	reachable = n->status.reachable && !n->status.blacklisted;
+	node_snapshot_t snapshot;
+	read_node_snapshot(mesh, (node_t *)node, &snapshot);
 
 	if(last_reachable) {
-		*last_reachable = n->last_reachable;
+		*last_reachable = snapshot.last_reachable;
 	}
 
 	if(last_unreachable) {
-		*last_unreachable = n->last_unreachable;
+		*last_unreachable = snapshot.last_unreachable;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
-
-	return reachable;
+	return snapshot.reachable && !snapshot.blacklisted;
 }
 
 bool meshlink_sign(meshlink_handle_t *mesh, const void *data, size_t len, void *signature, size_t *siglen) {
@@ -2694,18 +2844,16 @@ bool meshlink_sign(meshlink_handle_t *mesh, const void *data, size_t len, void *
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(!ecdsa_sign(mesh->private_key, data, len, signature)) {
 		meshlink_errno = MESHLINK_EINTERNAL;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
 	*siglen = MESHLINK_SIGLEN;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	return true;
 }
 
@@ -2722,9 +2870,7 @@ bool meshlink_verify(meshlink_handle_t *mesh, meshlink_node_t *source, const voi
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	bool rval = false;
 
@@ -2737,14 +2883,12 @@ bool meshlink_verify(meshlink_handle_t *mesh, meshlink_node_t *source, const voi
 		rval = ecdsa_verify(((struct node_t *)source)->ecdsa, data, len, signature);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	return rval;
 }
 
 static bool refresh_invitation_key(meshlink_handle_t *mesh) {
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	size_t count = invitation_purge_old(mesh, time(NULL) - mesh->invitation_timeout);
 
@@ -2752,7 +2896,7 @@ static bool refresh_invitation_key(meshlink_handle_t *mesh) {
 		// TODO: Update invitation key if necessary?
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return mesh->invitation_key;
 }
@@ -2788,20 +2932,18 @@ bool meshlink_set_canonical_address(meshlink_handle_t *mesh, meshlink_node_t *no
 
 	xasprintf(&canonical_address, "%s %s", address, port ? port : mesh->myport);
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	node_t *n = (node_t *)node;
 	free(n->canonical_address);
 	n->canonical_address = canonical_address;
 
 	if(!node_write_config(mesh, n, false)) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return config_sync(mesh, "current");
 }
@@ -2814,20 +2956,18 @@ bool meshlink_clear_canonical_address(meshlink_handle_t *mesh, meshlink_node_t *
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	node_t *n = (node_t *)node;
 	free(n->canonical_address);
 	n->canonical_address = NULL;
 
 	if(!node_write_config(mesh, n, false)) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return config_sync(mesh, "current");
 }
@@ -2860,16 +3000,14 @@ bool meshlink_add_invitation_address(struct meshlink_handle *mesh, const char *a
 		combo = xstrdup(address);
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(!mesh->invitation_addresses) {
 		mesh->invitation_addresses = list_alloc((list_action_t)free);
 	}
 
 	list_insert_tail(mesh->invitation_addresses, combo);
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return true;
 }
@@ -2882,16 +3020,14 @@ void meshlink_clear_invitation_addresses(struct meshlink_handle *mesh) {
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(mesh->invitation_addresses) {
 		list_delete_list(mesh->invitation_addresses);
 		mesh->invitation_addresses = NULL;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 bool meshlink_add_address(meshlink_handle_t *mesh, const char *address) {
@@ -2933,12 +3069,10 @@ int meshlink_get_port(meshlink_handle_t *mesh) {
 
 	int port;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	port = atoi(mesh->myport);
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return port;
 }
@@ -2964,9 +3098,7 @@ bool meshlink_set_port(meshlink_handle_t *mesh, int port) {
 
 	bool rval = false;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(mesh->threadstarted) {
 		meshlink_errno = MESHLINK_EINVAL;
@@ -3007,7 +3139,7 @@ bool meshlink_set_port(meshlink_handle_t *mesh, int port) {
 	rval = config_sync(mesh, "current");
 
 done:
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return rval && meshlink_get_port(mesh) == port;
 }
@@ -3040,15 +3172,13 @@ char *meshlink_invite_ex(meshlink_handle_t *mesh, meshlink_submesh_t *submesh, c
 		s = (meshlink_submesh_t *)mesh->self->submesh;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	// Check validity of the new node's name
 	if(!check_id(name)) {
 		logger(mesh, MESHLINK_ERROR, "Invalid name for node.\n");
 		meshlink_errno = MESHLINK_EINVAL;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return NULL;
 	}
 
@@ -3056,7 +3186,7 @@ char *meshlink_invite_ex(meshlink_handle_t *mesh, meshlink_submesh_t *submesh, c
 	if(config_exists(mesh, "current", name)) {
 		logger(mesh, MESHLINK_ERROR, "A host config file for %s already exists!\n", name);
 		meshlink_errno = MESHLINK_EEXIST;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return NULL;
 	}
 
@@ -3064,7 +3194,7 @@ char *meshlink_invite_ex(meshlink_handle_t *mesh, meshlink_submesh_t *submesh, c
 	if(lookup_node(mesh, name)) {
 		logger(mesh, MESHLINK_ERROR, "A node with name %s is already known!\n", name);
 		meshlink_errno = MESHLINK_EEXIST;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return NULL;
 	}
 
@@ -3074,13 +3204,13 @@ char *meshlink_invite_ex(meshlink_handle_t *mesh, meshlink_submesh_t *submesh, c
 	if(!address) {
 		logger(mesh, MESHLINK_ERROR, "No Address known for ourselves!\n");
 		meshlink_errno = MESHLINK_ERESOLV;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return NULL;
 	}
 
 	if(!refresh_invitation_key(mesh)) {
 		meshlink_errno = MESHLINK_EINTERNAL;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return NULL;
 	}
 
@@ -3088,7 +3218,7 @@ char *meshlink_invite_ex(meshlink_handle_t *mesh, meshlink_submesh_t *submesh, c
 	if(mesh->self->status.dirty) {
 		if(!node_write_config(mesh, mesh->self, false)) {
 			logger(mesh, MESHLINK_ERROR, "Could not write our own host config file!\n");
-			pthread_mutex_unlock(&mesh->mutex);
+			meshlink_unlock(mesh);
 			return NULL;
 		}
 	}
@@ -3150,7 +3280,7 @@ char *meshlink_invite_ex(meshlink_handle_t *mesh, meshlink_submesh_t *submesh, c
 	if(!invitation_write(mesh, "current", cookiehash, &config, mesh->config_key)) {
 		logger(mesh, MESHLINK_DEBUG, "Could not create invitation file %s: %s\n", cookiehash, strerror(errno));
 		meshlink_errno = MESHLINK_ESTORAGE;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return NULL;
 	}
 
@@ -3159,7 +3289,7 @@ char *meshlink_invite_ex(meshlink_handle_t *mesh, meshlink_submesh_t *submesh, c
 	xasprintf(&url, "%s/%s%s", address, hash, cookie);
 	free(address);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	return url;
 }
 
@@ -3193,9 +3323,7 @@ bool meshlink_join(meshlink_handle_t *mesh, const char *invitation) {
 	//TODO: think of a better name for this variable, or of a different way to tokenize the invitation URL.
 	char copy[strlen(invitation) + 1];
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	//Before doing meshlink_join make sure we are not connected to another mesh
 	if(mesh->threadstarted) {
@@ -3418,7 +3546,7 @@ bool meshlink_join(meshlink_handle_t *mesh, const char *invitation) {
 	ecdsa_free(key);
 	closesocket(state.sock);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	return true;
 
 invalid:
@@ -3433,7 +3561,7 @@ exit:
 		closesocket(state.sock);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	return false;
 }
 
@@ -3451,9 +3579,7 @@ char *meshlink_export(meshlink_handle_t *mesh) {
 	packmsg_add_str(&out, mesh->name);
 	packmsg_add_str(&out, CORE_MESH);
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	packmsg_add_int32(&out, mesh->self->devclass);
 	packmsg_add_bool(&out, mesh->self->status.blacklisted);
@@ -3487,7 +3613,7 @@ char *meshlink_export(meshlink_handle_t *mesh) {
 	packmsg_add_int64(&out, 0);
 	packmsg_add_int64(&out, 0);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	if(!packmsg_output_ok(&out)) {
 		logger(mesh, MESHLINK_ERROR, "Error creating export data\n");
@@ -3545,9 +3671,7 @@ bool meshlink_import(meshlink_handle_t *mesh, const char *data) {
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	while(count--) {
 		const void *data2;
@@ -3604,7 +3728,7 @@ bool meshlink_import(meshlink_handle_t *mesh, const char *data) {
 		node_add(mesh, n);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	free(buf);
 
@@ -3634,6 +3758,7 @@ static bool blacklist(meshlink_handle_t *mesh, node_t *n) {
 	}
 
 	n->status.blacklisted = true;
+	update_node_autoconnect(mesh, n);
 
 	/* Immediately shut down any connections we have with the blacklisted node.
 	 * We can't call terminate_connection(), because we might be called from a callback function.
@@ -3660,6 +3785,8 @@ static bool blacklist(meshlink_handle_t *mesh, node_t *n) {
 		n->last_unreachable = time(NULL);
 	}
 
+	update_node_snapshot(n);
+
 	/* Graph updates will suppress status updates for blacklisted nodes, so we need to
 	 * manually call the status callback if necessary.
 	 */
@@ -3681,16 +3808,14 @@ bool meshlink_blacklist(meshlink_handle_t *mesh, meshlink_node_t *node) {
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(!blacklist(mesh, (node_t *)node)) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	logger(mesh, MESHLINK_DEBUG, "Blacklisted %s.\n", node->name);
 	return true;
@@ -3704,9 +3829,7 @@ bool meshlink_blacklist_by_name(meshlink_handle_t *mesh, const char *name) {
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	node_t *n = lookup_node(mesh, (char *)name);
 
@@ -3717,11 +3840,11 @@ bool meshlink_blacklist_by_name(meshlink_handle_t *mesh, const char *name) {
 	}
 
 	if(!blacklist(mesh, (node_t *)n)) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	logger(mesh, MESHLINK_DEBUG, "Blacklisted %s.\n", name);
 	return true;
@@ -3740,9 +3863,15 @@ static bool whitelist(meshlink_handle_t *mesh, node_t *n) {
 	}
 
 	n->status.blacklisted = false;
+	update_node_autoconnect(mesh, n);
 
 	if(n->status.reachable) {
 		n->last_reachable = time(NULL);
+	}
+
+	update_node_snapshot(n);
+
+	if(n->status.reachable) {
 		update_node_status(mesh, n);
 	}
 
@@ -3757,16 +3886,14 @@ bool meshlink_whitelist(meshlink_handle_t *mesh, meshlink_node_t *node) {
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(!whitelist(mesh, (node_t *)node)) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	logger(mesh, MESHLINK_DEBUG, "Whitelisted %s.\n", node->name);
 	return true;
@@ -3780,9 +3907,7 @@ bool meshlink_whitelist_by_name(meshlink_handle_t *mesh, const char *name) {
 		return false;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	node_t *n = lookup_node(mesh, (char *)name);
 
@@ -3793,11 +3918,11 @@ bool meshlink_whitelist_by_name(meshlink_handle_t *mesh, const char *name) {
 	}
 
 	if(!whitelist(mesh, (node_t *)n)) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	logger(mesh, MESHLINK_DEBUG, "Whitelisted %s.\n", name);
 	return true;
@@ -3817,20 +3942,18 @@ bool meshlink_forget_node(meshlink_handle_t *mesh, meshlink_node_t *node) {
 
 	node_t *n = (node_t *)node;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	/* Check that the node is not reachable */
 	if(n->status.reachable || n->connection) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		logger(mesh, MESHLINK_WARNING, "Could not forget %s: still reachable", n->name);
 		return false;
 	}
 
 	/* Check that we don't have any active UTCP connections */
 	if(n->utcp && utcp_is_active(n->utcp)) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		logger(mesh, MESHLINK_WARNING, "Could not forget %s: active UTCP connections", n->name);
 		return false;
 	}
@@ -3838,7 +3961,7 @@ bool meshlink_forget_node(meshlink_handle_t *mesh, meshlink_node_t *node) {
 	/* Check that we have no active connections to this node */
 	for list_each(connection_t, c, mesh->connections) {
 		if(c->node == n) {
-			pthread_mutex_unlock(&mesh->mutex);
+			meshlink_unlock(mesh);
 			logger(mesh, MESHLINK_WARNING, "Could not forget %s: active connection", n->name);
 			return false;
 		}
@@ -3855,7 +3978,7 @@ bool meshlink_forget_node(meshlink_handle_t *mesh, meshlink_node_t *node) {
 
 	/* Delete the config file for this node */
 	if(!config_delete(mesh, "current", n->name)) {
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return false;
 	}
 
@@ -3865,7 +3988,7 @@ bool meshlink_forget_node(meshlink_handle_t *mesh, meshlink_node_t *node) {
 	/* Delete the node struct and any remaining edges referencing this node */
 	node_del(mesh, n);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return config_sync(mesh, "current");
 }
@@ -3881,9 +4004,7 @@ void meshlink_hint_address(meshlink_handle_t *mesh, meshlink_node_t *node, const
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	node_t *n = (node_t *)node;
 
@@ -3893,7 +4014,7 @@ void meshlink_hint_address(meshlink_handle_t *mesh, meshlink_node_t *node, const
 		}
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 	// @TODO do we want to fire off a connection attempt right away?
 }
 
@@ -3951,6 +4072,63 @@ static bool aio_abort(meshlink_handle_t *mesh, meshlink_channel_t *channel, mesh
 	return true;
 }
 
+/* With MESHLINK_CHANNEL_PEEK, received data is held in the UTCP receive buffer.
+ * Move as much of it as possible into AIO buffers, and tell the application about the rest.
+ */
+static void channel_recv_held(meshlink_handle_t *mesh, meshlink_channel_t *channel, size_t len) {
+	struct iovec iov[2];
+
+	while(channel->aio_receive && len) {
+		if(utcp_peek(channel->c, iov, 1) <= 0) {
+			return;
+		}
+
+		meshlink_aio_buffer_t *aio = channel->aio_receive;
+		size_t todo = aio->len - aio->done;
+
+		if(todo > iov[0].iov_len) {
+			todo = iov[0].iov_len;
+		}
+
+		if(aio->data) {
+			memcpy((char *)aio->data + aio->done, iov[0].iov_base, todo);
+		} else {
+			ssize_t result = write(aio->fd, iov[0].iov_base, todo);
+
+			if(result <= 0) {
+				if(result < 0 && errno == EINTR) {
+					continue;
+				}
+
+				/* Writing to fd failed, cancel just this AIO buffer. */
+				logger(mesh, MESHLINK_ERROR, "Writing to AIO fd %d failed: %s", aio->fd, strerror(errno));
+
+				if(!aio_finish_one(mesh, channel, &channel->aio_receive)) {
+					return;
+				}
+
+				continue;
+			}
+
+			todo = result;
+		}
+
+		aio->done += todo;
+		len -= todo;
+		utcp_consume(channel->c, todo);
+
+		if(aio->done == aio->len) {
+			if(!aio_finish_one(mesh, channel, &channel->aio_receive)) {
+				return;
+			}
+		}
+	}
+
+	if(len && channel->receive_cb) {
+		channel->receive_cb(mesh, channel, NULL, len);
+	}
+}
+
 static ssize_t channel_recv(struct utcp_connection *connection, const void *data, size_t len) {
 	meshlink_channel_t *channel = connection->priv;
 
@@ -3966,6 +4144,11 @@ static ssize_t channel_recv(struct utcp_connection *connection, const void *data
 		return len;
 	}
 
+	if(!data && len) {
+		channel_recv_held(mesh, channel, len);
+		return len;
+	}
+
 	const char *p = data;
 	size_t left = len;
 
@@ -4066,7 +4249,77 @@ static void channel_retransmit(struct utcp_connection *utcp_connection) {
 	}
 }
 
-static ssize_t channel_send(struct utcp *utcp, const void *data, size_t len) {
+/* UTCP segments generated on the library thread for a node that supports it
+ * are staged in n->coalesce_packet, and sent as a single packet at the end of
+ * the event loop iteration or when the next segment would exceed the PMTU.
+ * Each segment is prefixed by its length as a 16-bit big-endian integer.
+ */
+static bool can_coalesce(meshlink_handle_t *mesh, node_t *n) {
+	return mesh->threadstarted
+	       && pthread_equal(mesh->thread, pthread_self())
+	       && OPTION_VERSION(n->options) >= PROT_MINOR_COALESCED
+	       && !n->status.tiny
+	       && n->minmtu;
+}
+
+void channel_flush_coalesced(meshlink_handle_t *mesh, node_t *n) {
+	vpn_packet_t *packet = n->coalesce_packet;
+
+	if(!n->coalesced_segments) {
+		return;
+	}
+
+	if(n->coalesced_segments == 1) {
+		/* Send a lone segment as a normal packet */
+		uint8_t *payload = packet->data + sizeof(meshlink_packethdr_t);
+		packet->len -= 2;
+		memmove(payload, payload + 2, packet->len - sizeof(meshlink_packethdr_t));
+	} else {
+		packet->coalesced = true;
+	}
+
+	n->coalesced_segments = 0;
+	route(mesh, mesh->self, packet);
+}
+
+static bool channel_coalesce(meshlink_handle_t *mesh, node_t *n, const struct iovec *iov, int iovcnt, size_t len) {
+	size_t limit = n->minmtu < MAXSIZE ? n->minmtu : MAXSIZE;
+
+	if(n->coalesced_segments && n->coalesce_packet->len + 2 + len > limit) {
+		channel_flush_coalesced(mesh, n);
+	}
+
+	if(sizeof(meshlink_packethdr_t) + 2 + len > limit) {
+		return meshlink_send_immediatev(mesh, (meshlink_node_t *)n, iov, iovcnt);
+	}
+
+	if(!n->coalesce_packet) {
+		n->coalesce_packet = xmalloc(sizeof(*n->coalesce_packet));
+	}
+
+	vpn_packet_t *packet = n->coalesce_packet;
+	uint8_t prefix[2] = {len >> 8, len};
+
+	if(!n->coalesced_segments) {
+		if(!prepare_packet(mesh, (meshlink_node_t *)n, prefix, sizeof(prefix), packet)) {
+			return false;
+		}
+	} else {
+		memcpy(packet->data + packet->len, prefix, sizeof(prefix));
+		packet->len += sizeof(prefix);
+	}
+
+	for(int i = 0; i < iovcnt; i++) {
+		memcpy(packet->data + packet->len, iov[i].iov_base, iov[i].iov_len);
+		packet->len += iov[i].iov_len;
+	}
+
+	n->coalesced_segments++;
+
+	return true;
+}
+
+static ssize_t channel_sendv(struct utcp *utcp, const struct iovec *iov, int iovcnt) {
 	node_t *n = utcp->priv;
 
 	if(n->status.destroyed) {
@@ -4074,7 +4327,25 @@ static ssize_t channel_send(struct utcp *utcp, const void *data, size_t len) {
 	}
 
 	meshlink_handle_t *mesh = n->mesh;
-	return meshlink_send_immediate(mesh, (meshlink_node_t *)n, data, len) ? (ssize_t)len : -1;
+	size_t len = 0;
+
+	for(int i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	if(can_coalesce(mesh, n)) {
+		return channel_coalesce(mesh, n, iov, iovcnt, len) ? (ssize_t)len : -1;
+	}
+
+	/* Keep segments in order if we can no longer coalesce */
+	channel_flush_coalesced(mesh, n);
+
+	return meshlink_send_immediatev(mesh, (meshlink_node_t *)n, iov, iovcnt) ? (ssize_t)len : -1;
+}
+
+static ssize_t channel_send(struct utcp *utcp, const void *data, size_t len) {
+	struct iovec iov = {(void *)data, len};
+	return channel_sendv(utcp, &iov, 1);
 }
 
 void meshlink_set_channel_receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, meshlink_channel_receive_cb_t cb) {
@@ -4099,6 +4370,223 @@ void channel_receive(meshlink_handle_t *mesh, meshlink_node_t *source, const voi
 	utcp_recv(n->utcp, data, len);
 }
 
+void channel_receive_coalesced(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	node_t *n = (node_t *)source;
+	const uint8_t *p = data;
+
+	while(len >= 2) {
+		size_t seglen = p[0] << 8 | p[1];
+		p += 2;
+		len -= 2;
+
+		if(!seglen || seglen > len) {
+			logger(mesh, MESHLINK_WARNING, "Got invalid coalesced packet from %s", n->name);
+			return;
+		}
+
+		channel_receive(mesh, source, p, seglen);
+		p += seglen;
+		len -= seglen;
+	}
+}
+
+#ifdef HAVE_STDATOMIC_H
+/* A ring buffer that stages data passed to meshlink_channel_send().
+ * It has a single producer, the application thread sending on the channel,
+ * and a single consumer, the library thread, so neither needs to take the mesh lock.
+ */
+struct meshlink_send_ring {
+	char *data;
+	size_t size;                            /* Always a power of two */
+	atomic_size_t head;                     /* Only written by the application */
+	atomic_size_t tail;                     /* Only written by the library thread */
+	atomic_flag kicked;                     /* Set while the library thread has been asked to drain the ring */
+	atomic_bool failed;                     /* Set by the library thread when UTCP refused the staged data */
+};
+
+static size_t staged_used(struct meshlink_send_ring *ring) {
+	return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+static ssize_t stage_send(meshlink_handle_t *mesh, meshlink_channel_t *channel, const struct iovec *iov, int iovcnt, size_t len) {
+	struct meshlink_send_ring *ring = channel->staging;
+
+	if(atomic_load_explicit(&ring->failed, memory_order_acquire)) {
+		meshlink_errno = MESHLINK_ENETWORK;
+		return -1;
+	}
+
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t todo = ring->size - (head - tail);
+
+	if(todo > len) {
+		todo = len;
+	}
+
+	size_t done = 0;
+
+	for(int i = 0; i < iovcnt && done < todo; i++) {
+		size_t chunk = iov[i].iov_len < todo - done ? iov[i].iov_len : todo - done;
+		size_t offset = (head + done) & (ring->size - 1);
+		size_t first = chunk < ring->size - offset ? chunk : ring->size - offset;
+
+		memcpy(ring->data + offset, iov[i].iov_base, first);
+		memcpy(ring->data, (const char *)iov[i].iov_base + first, chunk - first);
+		done += chunk;
+	}
+
+	if(!todo) {
+		return 0;
+	}
+
+	atomic_store_explicit(&ring->head, head + todo, memory_order_release);
+
+	/* Only wake up the library thread if it is not already going to drain the ring. */
+	if(!atomic_flag_test_and_set(&ring->kicked)) {
+		signal_trigger(&mesh->loop, &mesh->staged_signal);
+	}
+
+	return todo;
+}
+
+/* Move as much staged data as possible to the UTCP send buffer.
+ * Returns the amount left in the ring, or -1 if UTCP refused the data.
+ */
+static ssize_t drain_staged(meshlink_handle_t *mesh, meshlink_channel_t *channel) {
+	struct meshlink_send_ring *ring = channel->staging;
+
+	if(atomic_load_explicit(&ring->failed, memory_order_relaxed)) {
+		return -1;
+	}
+
+	atomic_flag_clear(&ring->kicked);
+
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t used = atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+
+	if(!used) {
+		return 0;
+	}
+
+	size_t offset = tail & (ring->size - 1);
+	struct iovec iov[2] = {
+		{ring->data + offset, ring->size - offset},
+		{ring->data, 0},
+	};
+
+	if(iov[0].iov_len >= used) {
+		iov[0].iov_len = used;
+	} else {
+		iov[1].iov_len = used - iov[0].iov_len;
+	}
+
+	ssize_t sent = utcp_sendv(channel->c, iov, iov[1].iov_len ? 2 : 1);
+
+	if(sent < 0) {
+		/* The connection can no longer send, keep the data staged so it still shows up in the send queue,
+		 * and leave the ring kicked so the application stops waking us up for it. */
+		logger(mesh, MESHLINK_WARNING, "Could not send %zu bytes of staged data for channel %p: %s", used, (void *)channel, strerror(errno));
+		atomic_flag_test_and_set(&ring->kicked);
+		atomic_store_explicit(&ring->failed, true, memory_order_release);
+		return -1;
+	}
+
+	atomic_store_explicit(&ring->tail, tail + sent, memory_order_release);
+	used -= sent;
+
+	/* If the UTCP send buffer is full, the poll callback will drain the rest,
+	 * so there is no need for the application to kick us until then. */
+	if(used) {
+		atomic_flag_test_and_set(&ring->kicked);
+	}
+
+	return used;
+}
+
+static bool staging_failed(struct meshlink_send_ring *ring) {
+	return atomic_load_explicit(&ring->failed, memory_order_acquire);
+}
+
+static void free_staging(meshlink_handle_t *mesh, meshlink_channel_t *channel) {
+	if(staging_failed(channel->staging)) {
+		logger(mesh, MESHLINK_WARNING, "Discarding %zu bytes of unsendable staged data for channel %p", staged_used(channel->staging), (void *)channel);
+	}
+
+	list_delete(mesh->staged_channels, channel);
+	free(channel->staging->data);
+	free(channel->staging);
+	channel->staging = NULL;
+}
+#else
+struct meshlink_send_ring;
+
+static size_t staged_used(struct meshlink_send_ring *ring) {
+	(void)ring;
+	return 0;
+}
+
+static ssize_t stage_send(meshlink_handle_t *mesh, meshlink_channel_t *channel, const struct iovec *iov, int iovcnt, size_t len) {
+	(void)mesh;
+	(void)channel;
+	(void)iov;
+	(void)iovcnt;
+	(void)len;
+	abort();
+}
+
+static ssize_t drain_staged(meshlink_handle_t *mesh, meshlink_channel_t *channel) {
+	(void)mesh;
+	(void)channel;
+	return 0;
+}
+
+static bool staging_failed(struct meshlink_send_ring *ring) {
+	(void)ring;
+	return false;
+}
+
+static void free_staging(meshlink_handle_t *mesh, meshlink_channel_t *channel) {
+	(void)mesh;
+	(void)channel;
+}
+#endif
+
+void meshlink_send_from_staging(event_loop_t *loop, void *data) {
+	(void)loop;
+	meshlink_handle_t *mesh = data;
+
+	if(!mesh->staged_channels) {
+		return;
+	}
+
+	for list_each(meshlink_channel_t, channel, mesh->staged_channels) {
+		/* The application was already told its data was accepted, so report a failure via the poll callback, once. */
+		if(!staging_failed(channel->staging) && drain_staged(mesh, channel) < 0 && channel->poll_cb) {
+			channel->poll_cb(mesh, channel, 0);
+		}
+	}
+}
+
+static void channel_poll(struct utcp_connection *connection, size_t len);
+
+/* Move all staged data to the UTCP send buffer, growing it if necessary, and disable staging. */
+static void flush_staging(meshlink_handle_t *mesh, meshlink_channel_t *channel) {
+	if(!channel->staging) {
+		return;
+	}
+
+	ssize_t left = drain_staged(mesh, channel);
+
+	if(left > 0) {
+		utcp_set_sndbuf(channel->c, NULL, utcp_get_sndbuf(channel->c) + left);
+		drain_staged(mesh, channel);
+	}
+
+	free_staging(mesh, channel);
+	utcp_set_poll_cb(channel->c, (channel->poll_cb || channel->aio_send) ? channel_poll : NULL);
+}
+
 static void channel_poll(struct utcp_connection *connection, size_t len) {
 	meshlink_channel_t *channel = connection->priv;
 
@@ -4109,6 +4597,19 @@ static void channel_poll(struct utcp_connection *connection, size_t len) {
 	node_t *n = channel->node;
 	meshlink_handle_t *mesh = n->mesh;
 
+	if(channel->staging && len) {
+		/* Refill the UTCP send buffer, and tell the application how much room is left for staging. */
+		if(drain_staged(mesh, channel) < 0) {
+			len = 0;
+		} else {
+			len = channel->staging->size - staged_used(channel->staging);
+
+			if(!len) {
+				return;
+			}
+		}
+	}
+
 	while(channel->aio_send) {
 		if(!len) {
 			/* This poll callback signalled an error, abort all outstanding AIO buffers. */
@@ -4190,7 +4691,7 @@ static void channel_poll(struct utcp_connection *connection, size_t len) {
 
 	if(channel->poll_cb) {
 		channel->poll_cb(mesh, channel, len);
-	} else {
+	} else if(!channel->staging) {
 		utcp_set_poll_cb(connection, NULL);
 	}
 }
@@ -4203,13 +4704,11 @@ void meshlink_set_channel_poll_cb(meshlink_handle_t *mesh, meshlink_channel_t *c
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	channel->poll_cb = cb;
-	utcp_set_poll_cb(channel->c, (cb || channel->aio_send) ? channel_poll : NULL);
-	pthread_mutex_unlock(&mesh->mutex);
+	utcp_set_poll_cb(channel->c, (cb || channel->aio_send || channel->staging) ? channel_poll : NULL);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_channel_listen_cb(meshlink_handle_t *mesh, meshlink_channel_listen_cb_t cb) {
@@ -4220,13 +4719,11 @@ void meshlink_set_channel_listen_cb(meshlink_handle_t *mesh, meshlink_channel_li
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->channel_listen_cb = cb;
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_channel_accept_cb(meshlink_handle_t *mesh, meshlink_channel_accept_cb_t cb) {
@@ -4237,9 +4734,7 @@ void meshlink_set_channel_accept_cb(meshlink_handle_t *mesh, meshlink_channel_ac
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->channel_accept_cb = cb;
 
@@ -4248,10 +4743,11 @@ void meshlink_set_channel_accept_cb(meshlink_handle_t *mesh, meshlink_channel_ac
 			n->utcp = utcp_init(channel_accept, channel_pre_accept, channel_send, n);
 			utcp_set_mtu(n->utcp, n->mtu - sizeof(meshlink_packethdr_t));
 			utcp_set_retransmit_cb(n->utcp, channel_retransmit);
+			utcp_set_sendv_cb(n->utcp, channel_sendv);
 		}
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_channel_sndbuf(meshlink_handle_t *mesh, meshlink_channel_t *channel, size_t size) {
@@ -4274,12 +4770,10 @@ void meshlink_set_channel_sndbuf_storage(meshlink_handle_t *mesh, meshlink_chann
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	utcp_set_sndbuf(channel->c, buf, size);
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_channel_rcvbuf_storage(meshlink_handle_t *mesh, meshlink_channel_t *channel, void *buf, size_t size) {
@@ -4290,12 +4784,10 @@ void meshlink_set_channel_rcvbuf_storage(meshlink_handle_t *mesh, meshlink_chann
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	utcp_set_rcvbuf(channel->c, buf, size);
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_channel_flags(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint32_t flags) {
@@ -4306,12 +4798,74 @@ void meshlink_set_channel_flags(meshlink_handle_t *mesh, meshlink_channel_t *cha
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
+	meshlink_lock(mesh);
+
+	/* Staged data is sent in arbitrary chunks, which doesn't mix with all-or-nothing sends. */
+	if(flags & MESHLINK_CHANNEL_NO_PARTIAL) {
+		flush_staging(mesh, channel);
 	}
 
 	utcp_set_flags(channel->c, flags);
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
+}
+
+bool meshlink_set_channel_send_staging(meshlink_handle_t *mesh, meshlink_channel_t *channel, size_t size) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_channel_send_staging(%p, %zu)", (void *)channel, size);
+
+	if(!mesh || !channel) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+#ifdef HAVE_STDATOMIC_H
+	meshlink_lock(mesh);
+
+	if(!channel->c || channel->aio_send) {
+		meshlink_unlock(mesh);
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	uint32_t flags = channel->c->flags;
+
+	if(size && (!(flags & MESHLINK_CHANNEL_RELIABLE) || (flags & (MESHLINK_CHANNEL_FRAMED | MESHLINK_CHANNEL_NO_PARTIAL)))) {
+		meshlink_unlock(mesh);
+		meshlink_errno = MESHLINK_ENOTSUP;
+		return false;
+	}
+
+	flush_staging(mesh, channel);
+
+	if(size) {
+		struct meshlink_send_ring *ring = xzalloc(sizeof(*ring));
+		ring->size = 1;
+
+		while(ring->size < size) {
+			ring->size <<= 1;
+		}
+
+		ring->data = xmalloc(ring->size);
+		atomic_init(&ring->head, 0);
+		atomic_init(&ring->tail, 0);
+		atomic_flag_clear(&ring->kicked);
+		atomic_init(&ring->failed, false);
+		channel->staging = ring;
+
+		if(!mesh->staged_channels) {
+			mesh->staged_channels = list_alloc(NULL);
+		}
+
+		list_insert_tail(mesh->staged_channels, channel);
+		utcp_set_poll_cb(channel->c, channel_poll);
+	}
+
+	meshlink_unlock(mesh);
+	return true;
+#else
+	(void)size;
+	meshlink_errno = MESHLINK_ENOTSUP;
+	return false;
+#endif
 }
 
 meshlink_channel_t *meshlink_channel_open_ex(meshlink_handle_t *mesh, meshlink_node_t *node, uint16_t port, meshlink_channel_receive_cb_t cb, const void *data, size_t len, uint32_t flags) {
@@ -4326,9 +4880,7 @@ meshlink_channel_t *meshlink_channel_open_ex(meshlink_handle_t *mesh, meshlink_n
 		return NULL;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	node_t *n = (node_t *)node;
 
@@ -4336,10 +4888,11 @@ meshlink_channel_t *meshlink_channel_open_ex(meshlink_handle_t *mesh, meshlink_n
 		n->utcp = utcp_init(channel_accept, channel_pre_accept, channel_send, n);
 		utcp_set_mtu(n->utcp, n->mtu - sizeof(meshlink_packethdr_t));
 		utcp_set_retransmit_cb(n->utcp, channel_retransmit);
+		utcp_set_sendv_cb(n->utcp, channel_sendv);
 
 		if(!n->utcp) {
 			meshlink_errno = errno == ENOMEM ? MESHLINK_ENOMEM : MESHLINK_EINTERNAL;
-			pthread_mutex_unlock(&mesh->mutex);
+			meshlink_unlock(mesh);
 			return NULL;
 		}
 	}
@@ -4347,7 +4900,7 @@ meshlink_channel_t *meshlink_channel_open_ex(meshlink_handle_t *mesh, meshlink_n
 	if(n->status.blacklisted) {
 		logger(mesh, MESHLINK_ERROR, "Cannot open a channel with blacklisted node\n");
 		meshlink_errno = MESHLINK_EBLACKLISTED;
-		pthread_mutex_unlock(&mesh->mutex);
+		meshlink_unlock(mesh);
 		return NULL;
 	}
 
@@ -4361,7 +4914,7 @@ meshlink_channel_t *meshlink_channel_open_ex(meshlink_handle_t *mesh, meshlink_n
 
 	channel->c = utcp_connect_ex(n->utcp, port, channel_recv, channel, flags);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	if(!channel->c) {
 		meshlink_errno = errno == ENOMEM ? MESHLINK_ENOMEM : MESHLINK_EINTERNAL;
@@ -4386,12 +4939,14 @@ void meshlink_channel_shutdown(meshlink_handle_t *mesh, meshlink_channel_t *chan
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
+	meshlink_lock(mesh);
+
+	if(direction != UTCP_SHUT_RD) {
+		flush_staging(mesh, channel);
 	}
 
 	utcp_shutdown(channel->c, direction);
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_channel_close(meshlink_handle_t *mesh, meshlink_channel_t *channel) {
@@ -4402,11 +4957,10 @@ void meshlink_channel_close(meshlink_handle_t *mesh, meshlink_channel_t *channel
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(channel->c) {
+		flush_staging(mesh, channel);
 		utcp_close(channel->c);
 		channel->c = NULL;
 
@@ -4419,7 +4973,7 @@ void meshlink_channel_close(meshlink_handle_t *mesh, meshlink_channel_t *channel
 		free(channel);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_channel_abort(meshlink_handle_t *mesh, meshlink_channel_t *channel) {
@@ -4430,11 +4984,13 @@ void meshlink_channel_abort(meshlink_handle_t *mesh, meshlink_channel_t *channel
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(channel->c) {
+		if(channel->staging) {
+			free_staging(mesh, channel);
+		}
+
 		utcp_abort(channel->c);
 		channel->c = NULL;
 
@@ -4447,7 +5003,7 @@ void meshlink_channel_abort(meshlink_handle_t *mesh, meshlink_channel_t *channel
 		free(channel);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 ssize_t meshlink_channel_send(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
@@ -4467,17 +5023,16 @@ ssize_t meshlink_channel_send(meshlink_handle_t *mesh, meshlink_channel_t *chann
 		return -1;
 	}
 
-	// TODO: more finegrained locking.
-	// Ideally we want to put the data into the UTCP connection's send buffer.
-	// Then, preferably only if there is room in the receiver window,
-	// kick the meshlink thread to go send packets.
-
 	ssize_t retval;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
+	/* Staged channels don't need the mesh lock, the library thread will pick up the data. */
+	if(channel->staging) {
+		struct iovec iov = {(void *)data, len};
+		return stage_send(mesh, channel, &iov, 1, len);
 	}
 
+	meshlink_lock(mesh);
+
 	/* Disallow direct calls to utcp_send() while we still have AIO active. */
 	if(channel->aio_send) {
 		retval = 0;
@@ -4485,7 +5040,7 @@ ssize_t meshlink_channel_send(meshlink_handle_t *mesh, meshlink_channel_t *chann
 		retval = utcp_send(channel->c, data, len);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	if(retval < 0) {
 		meshlink_errno = MESHLINK_ENETWORK;
@@ -4494,6 +5049,96 @@ ssize_t meshlink_channel_send(meshlink_handle_t *mesh, meshlink_channel_t *chann
 	return retval;
 }
 
+ssize_t meshlink_channel_sendv(meshlink_handle_t *mesh, meshlink_channel_t *channel, const struct iovec *iov, int iovcnt) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_channel_sendv(%p, %p, %d)", (void *)channel, (void *)iov, iovcnt);
+
+	if(!mesh || !channel || iovcnt < 0 || (iovcnt && !iov)) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return -1;
+	}
+
+	size_t len = 0;
+
+	for(int i = 0; i < iovcnt; i++) {
+		if(iov[i].iov_len && !iov[i].iov_base) {
+			meshlink_errno = MESHLINK_EINVAL;
+			return -1;
+		}
+
+		len += iov[i].iov_len;
+	}
+
+	if(!len) {
+		return 0;
+	}
+
+	if(channel->staging) {
+		return stage_send(mesh, channel, iov, iovcnt, len);
+	}
+
+	ssize_t retval;
+
+	meshlink_lock(mesh);
+
+	/* Disallow direct calls to utcp_sendv() while we still have AIO active. */
+	if(channel->aio_send) {
+		retval = 0;
+	} else {
+		retval = utcp_sendv(channel->c, iov, iovcnt);
+	}
+
+	meshlink_unlock(mesh);
+
+	if(retval < 0) {
+		meshlink_errno = MESHLINK_ENETWORK;
+	}
+
+	return retval;
+}
+
+ssize_t meshlink_channel_peek(meshlink_handle_t *mesh, meshlink_channel_t *channel, struct iovec *iov, int iovcnt) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_channel_peek(%p, %p, %d)", (void *)channel, (void *)iov, iovcnt);
+
+	if(!mesh || !channel || iovcnt < 0 || (iovcnt && !iov)) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return -1;
+	}
+
+	meshlink_lock(mesh);
+
+	ssize_t retval = utcp_peek(channel->c, iov, iovcnt);
+
+	meshlink_unlock(mesh);
+
+	if(retval < 0) {
+		meshlink_errno = MESHLINK_EINVAL;
+	}
+
+	return retval;
+}
+
+bool meshlink_channel_consume(meshlink_handle_t *mesh, meshlink_channel_t *channel, size_t len) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_channel_consume(%p, %zu)", (void *)channel, len);
+
+	if(!mesh || !channel) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	meshlink_lock(mesh);
+
+	ssize_t retval = utcp_consume(channel->c, len);
+
+	meshlink_unlock(mesh);
+
+	if(retval < 0) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	return true;
+}
+
 bool meshlink_channel_aio_send(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len, meshlink_aio_cb_t cb, void *priv) {
 	logger(mesh, MESHLINK_DEBUG, "meshlink_channel_aio_send(%p, %p, %zu, %p, %p)", (void *)channel, data, len, (void *)(intptr_t)cb, priv);
 
@@ -4502,7 +5147,7 @@ bool meshlink_channel_aio_send(meshlink_handle_t *mesh, meshlink_channel_t *chan
 		return false;
 	}
 
-	if(!len || !data) {
+	if(!len || !data || channel->staging) {
 		meshlink_errno = MESHLINK_EINVAL;
 		return false;
 	}
@@ -4513,9 +5158,7 @@ bool meshlink_channel_aio_send(meshlink_handle_t *mesh, meshlink_channel_t *chan
 	aio->cb.buffer = cb;
 	aio->priv = priv;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	/* Append the AIO buffer descriptor to the end of the chain */
 	meshlink_aio_buffer_t **p = &channel->aio_send;
@@ -4534,7 +5177,7 @@ bool meshlink_channel_aio_send(meshlink_handle_t *mesh, meshlink_channel_t *chan
 		channel_poll(channel->c, todo);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return true;
 }
@@ -4547,7 +5190,7 @@ bool meshlink_channel_aio_fd_send(meshlink_handle_t *mesh, meshlink_channel_t *c
 		return false;
 	}
 
-	if(!len || fd == -1) {
+	if(!len || fd == -1 || channel->staging) {
 		meshlink_errno = MESHLINK_EINVAL;
 		return false;
 	}
@@ -4558,9 +5201,7 @@ bool meshlink_channel_aio_fd_send(meshlink_handle_t *mesh, meshlink_channel_t *c
 	aio->cb.fd = cb;
 	aio->priv = priv;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	/* Append the AIO buffer descriptor to the end of the chain */
 	meshlink_aio_buffer_t **p = &channel->aio_send;
@@ -4579,7 +5220,7 @@ bool meshlink_channel_aio_fd_send(meshlink_handle_t *mesh, meshlink_channel_t *c
 		channel_poll(channel->c, left);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 
 	return true;
 }
@@ -4603,9 +5244,7 @@ bool meshlink_channel_aio_receive(meshlink_handle_t *mesh, meshlink_channel_t *c
 	aio->cb.buffer = cb;
 	aio->priv = priv;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	/* Append the AIO buffer descriptor to the end of the chain */
 	meshlink_aio_buffer_t **p = &channel->aio_receive;
@@ -4616,7 +5255,15 @@ bool meshlink_channel_aio_receive(meshlink_handle_t *mesh, meshlink_channel_t *c
 
 	*p = aio;
 
-	pthread_mutex_unlock(&mesh->mutex);
+	/* Move any data already held in the receive buffer into the AIO buffers */
+	struct iovec iov[2];
+	ssize_t held = utcp_peek(channel->c, iov, 2);
+
+	if(held > 0) {
+		channel_recv_held(mesh, channel, held);
+	}
+
+	meshlink_unlock(mesh);
 
 	return true;
 }
@@ -4640,9 +5287,7 @@ bool meshlink_channel_aio_fd_receive(meshlink_handle_t *mesh, meshlink_channel_t
 	aio->cb.fd = cb;
 	aio->priv = priv;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	/* Append the AIO buffer descriptor to the end of the chain */
 	meshlink_aio_buffer_t **p = &channel->aio_receive;
@@ -4653,7 +5298,15 @@ bool meshlink_channel_aio_fd_receive(meshlink_handle_t *mesh, meshlink_channel_t
 
 	*p = aio;
 
-	pthread_mutex_unlock(&mesh->mutex);
+	/* Move any data already held in the receive buffer into the AIO buffers */
+	struct iovec iov[2];
+	ssize_t held = utcp_peek(channel->c, iov, 2);
+
+	if(held > 0) {
+		channel_recv_held(mesh, channel, held);
+	}
+
+	meshlink_unlock(mesh);
 
 	return true;
 }
@@ -4673,7 +5326,13 @@ size_t meshlink_channel_get_sendq(meshlink_handle_t *mesh, meshlink_channel_t *c
 		return -1;
 	}
 
-	return utcp_get_sendq(channel->c);
+	size_t sendq = utcp_get_sendq(channel->c);
+
+	if(channel->staging) {
+		sendq += staged_used(channel->staging);
+	}
+
+	return sendq;
 }
 
 size_t meshlink_channel_get_recvq(meshlink_handle_t *mesh, meshlink_channel_t *channel) {
@@ -4694,6 +5353,44 @@ size_t meshlink_channel_get_mss(meshlink_handle_t *mesh, meshlink_channel_t *cha
 	return utcp_get_mss(channel->node->utcp);
 }
 
+bool meshlink_channel_get_stats(meshlink_handle_t *mesh, meshlink_channel_t *channel, meshlink_channel_stats_t *stats, size_t size) {
+	if(!mesh || !channel || !stats || size < sizeof(stats->version)) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	struct utcp_stats us;
+
+	meshlink_lock(mesh);
+
+	utcp_get_stats(channel->c, &us);
+
+	meshlink_unlock(mesh);
+
+	meshlink_channel_stats_t result = {
+		.version = MESHLINK_CHANNEL_STATS_VERSION,
+		.cwnd = us.cwnd,
+		.ssthresh = us.ssthresh,
+		.snd_wnd = us.snd_wnd,
+		.flight = us.flight,
+		.srtt = us.srtt,
+		.rttvar = us.rttvar,
+		.rto = us.rto,
+		.dupack = us.dupack,
+		.sack_holes = us.sack_holes,
+		.segments_sent = us.segments_sent,
+		.bytes_sent = us.bytes_sent,
+		.bytes_acked = us.bytes_acked,
+		.dupacks = us.dupacks,
+		.retransmits = us.retransmits,
+		.fast_retransmits = us.fast_retransmits,
+		.bytes_retransmitted = us.bytes_retransmitted,
+	};
+
+	memcpy(stats, &result, size < sizeof(result) ? size : sizeof(result));
+	return true;
+}
+
 void meshlink_set_node_channel_timeout(meshlink_handle_t *mesh, meshlink_node_t *node, int timeout) {
 	logger(mesh, MESHLINK_DEBUG, "meshlink_set_node_channel_timeout(%s, %d)", node ? node->name : "(null)", timeout);
 
@@ -4704,26 +5401,28 @@ void meshlink_set_node_channel_timeout(meshlink_handle_t *mesh, meshlink_node_t
 
 	node_t *n = (node_t *)node;
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(!n->utcp) {
 		n->utcp = utcp_init(channel_accept, channel_pre_accept, channel_send, n);
 		utcp_set_mtu(n->utcp, n->mtu - sizeof(meshlink_packethdr_t));
 		utcp_set_retransmit_cb(n->utcp, channel_retransmit);
+		utcp_set_sendv_cb(n->utcp, channel_sendv);
 	}
 
 	utcp_set_user_timeout(n->utcp, timeout);
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void update_node_status(meshlink_handle_t *mesh, node_t *n) {
+	update_node_snapshot(n);
+
 	if(n->status.reachable && mesh->channel_accept_cb && !n->utcp) {
 		n->utcp = utcp_init(channel_accept, channel_pre_accept, channel_send, n);
 		utcp_set_mtu(n->utcp, n->mtu - sizeof(meshlink_packethdr_t));
 		utcp_set_retransmit_cb(n->utcp, channel_retransmit);
+		utcp_set_sendv_cb(n->utcp, channel_sendv);
 	}
 
 	if(mesh->node_status_cb) {
@@ -4736,6 +5435,7 @@ void update_node_status(meshlink_handle_t *mesh, node_t *n) {
 }
 
 void update_node_pmtu(meshlink_handle_t *mesh, node_t *n) {
+	update_node_snapshot(n);
 	utcp_set_mtu(n->utcp, (n->minmtu > MINMTU ? n->minmtu : MINMTU) - sizeof(meshlink_packethdr_t));
 
 	if(mesh->node_pmtu_cb && !n->status.blacklisted) {
@@ -4760,9 +5460,7 @@ void meshlink_enable_discovery(meshlink_handle_t *mesh, bool enable) {
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(mesh->discovery.enabled == enable) {
 		goto end;
@@ -4779,7 +5477,7 @@ void meshlink_enable_discovery(meshlink_handle_t *mesh, bool enable) {
 	mesh->discovery.enabled = enable;
 
 end:
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_hint_network_change(struct meshlink_handle *mesh) {
@@ -4790,9 +5488,7 @@ void meshlink_hint_network_change(struct meshlink_handle *mesh) {
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	if(mesh->discovery.enabled) {
 		scan_ifaddrs(mesh);
@@ -4803,7 +5499,7 @@ void meshlink_hint_network_change(struct meshlink_handle *mesh) {
 		handle_network_change(mesh, 1);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_dev_class_timeouts(meshlink_handle_t *mesh, dev_class_t devclass, int pinginterval, int pingtimeout) {
@@ -4819,13 +5515,11 @@ void meshlink_set_dev_class_timeouts(meshlink_handle_t *mesh, dev_class_t devcla
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->dev_class_traits[devclass].pinginterval = pinginterval;
 	mesh->dev_class_traits[devclass].pingtimeout = pingtimeout;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_dev_class_fast_retry_period(meshlink_handle_t *mesh, dev_class_t devclass, int fast_retry_period) {
@@ -4841,12 +5535,10 @@ void meshlink_set_dev_class_fast_retry_period(meshlink_handle_t *mesh, dev_class
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->dev_class_traits[devclass].fast_retry_period = fast_retry_period;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_dev_class_maxtimeout(struct meshlink_handle *mesh, dev_class_t devclass, int maxtimeout) {
@@ -4862,12 +5554,10 @@ void meshlink_set_dev_class_maxtimeout(struct meshlink_handle *mesh, dev_class_t
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->dev_class_traits[devclass].maxtimeout = maxtimeout;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_reset_timers(struct meshlink_handle *mesh) {
@@ -4877,9 +5567,7 @@ void meshlink_reset_timers(struct meshlink_handle *mesh) {
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	handle_network_change(mesh, true);
 
@@ -4887,7 +5575,7 @@ void meshlink_reset_timers(struct meshlink_handle *mesh) {
 		discovery_refresh(mesh);
 	}
 
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_inviter_commits_first(struct meshlink_handle *mesh, bool inviter_commits_first) {
@@ -4898,12 +5586,31 @@ void meshlink_set_inviter_commits_first(struct meshlink_handle *mesh, bool invit
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->inviter_commits_first = inviter_commits_first;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
+}
+
+bool meshlink_set_crypto_threads(meshlink_handle_t *mesh, int threads) {
+	logger(mesh, MESHLINK_DEBUG, "meshlink_set_crypto_threads(%d)", threads);
+
+	if(!mesh || threads < 0 || threads > CRYPTO_POOL_MAX_THREADS) {
+		meshlink_errno = MESHLINK_EINVAL;
+		return false;
+	}
+
+	meshlink_lock(mesh);
+
+	mesh->crypto_threads = threads;
+
+	if(mesh->threadstarted) {
+		exit_crypto_pool(mesh);
+		init_crypto_pool(mesh);
+	}
+
+	meshlink_unlock(mesh);
+	return true;
 }
 
 void meshlink_set_external_address_discovery_url(struct meshlink_handle *mesh, const char *url) {
@@ -4919,13 +5626,11 @@ void meshlink_set_external_address_discovery_url(struct meshlink_handle *mesh, c
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	free(mesh->external_address_url);
 	mesh->external_address_url = url ? xstrdup(url) : NULL;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void meshlink_set_scheduling_granularity(struct meshlink_handle *mesh, long granularity) {
@@ -4947,12 +5652,10 @@ void meshlink_set_storage_policy(struct meshlink_handle *mesh, meshlink_storage_
 		return;
 	}
 
-	if(pthread_mutex_lock(&mesh->mutex) != 0) {
-		abort();
-	}
+	meshlink_lock(mesh);
 
 	mesh->storage_policy = policy;
-	pthread_mutex_unlock(&mesh->mutex);
+	meshlink_unlock(mesh);
 }
 
 void handle_network_change(meshlink_handle_t *mesh, bool online) {
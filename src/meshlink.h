@@ -30,6 +30,7 @@
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef __cplusplus
@@ -57,6 +58,9 @@ typedef struct meshlink_open_params meshlink_open_params_t;
 /// A handle for a MeshLink sub-mesh.
 typedef struct meshlink_submesh meshlink_submesh_t;
 
+/// A handle for an event loop thread that can be shared by several instances of MeshLink.
+typedef struct meshlink_shared_loop meshlink_shared_loop_t;
+
 /// Code of most recent error encountered.
 typedef enum {
 	MESHLINK_OK,           ///< Everything is fine
@@ -103,6 +107,7 @@ static const uint32_t MESHLINK_CHANNEL_ORDERED = 2;    // Data is delivered in-o
 static const uint32_t MESHLINK_CHANNEL_FRAMED = 4;     // Data is delivered in chunks of the same length as data was originally sent.
 static const uint32_t MESHLINK_CHANNEL_DROP_LATE = 8;  // When packets are reordered, late packets are ignored.
 static const uint32_t MESHLINK_CHANNEL_NO_PARTIAL = 16; // Calls to meshlink_channel_send() will either send all data or nothing.
+static const uint32_t MESHLINK_CHANNEL_PEEK = 32;      // Received data is kept until consumed with meshlink_channel_consume().
 static const uint32_t MESHLINK_CHANNEL_TCP = 3;        // Select TCP semantics.
 static const uint32_t MESHLINK_CHANNEL_UDP = 0;        // Select UDP semantics.
 
@@ -217,6 +222,23 @@ bool meshlink_open_params_set_storage_policy(meshlink_open_params_t *params, mes
  */
 bool meshlink_open_params_set_lock_filename(meshlink_open_params_t *params, const char *filename) __attribute__((__warn_unused_result__));
 
+/// Set the number of UDP shards.
+/** This function changes the open parameters to start the given number of additional threads per listening address
+ *  when meshlink_start() is called. Each of these threads has its own UDP socket bound to the same address using SO_REUSEPORT,
+ *  and decrypts packets it receives in parallel with the other threads.
+ *  The kernel distributes packets over the sockets based on their source address,
+ *  so packets from a given node are normally all handled by the same thread.
+ *  These threads only decrypt packets, everything else, including the handling of the decrypted packets
+ *  and all callbacks, is still done by MeshLink's own thread.
+ *  On platforms without SO_REUSEPORT, this setting has no effect.
+ *
+ *  @param params   A pointer to a meshlink_open_params_t which must have been created earlier with meshlink_open_params_init().
+ *  @param shards   The number of additional threads per listening address, at most 64. The default is 0.
+ *
+ *  @return         This function will return true if the open parameters have been successfully updated, false otherwise.
+ */
+bool meshlink_open_params_set_udp_shards(meshlink_open_params_t *params, int shards) __attribute__((__warn_unused_result__));
+
 /// Open or create a MeshLink instance.
 /** This function opens or creates a MeshLink instance.
  *  All parameters needed by MeshLink are passed via a meshlink_open_params_t struct,
@@ -1353,6 +1375,9 @@ typedef bool (*meshlink_channel_accept_cb_t)(struct meshlink_handle *mesh, struc
  *  In both cases, @a data will be NULL and @a len will be 0, and meshlink_errno will be set.
  *  In any case, the @a channel handle will still be valid until the application calls meshlink_close().
  *
+ *  If MESHLINK_CHANNEL_PEEK is set on a reliable channel, @a data will be NULL and @a len will be
+ *  the amount of received data that can be accessed using meshlink_channel_peek().
+ *
  *  @param mesh         A handle which represents an instance of MeshLink.
  *  @param channel      A handle for the channel.
  *  @param data         A pointer to a buffer containing data sent by the source, or NULL in case of an error.
@@ -1484,7 +1509,7 @@ void meshlink_set_channel_rcvbuf_storage(struct meshlink_handle *mesh, struct me
 
 /// Set the flags of a channel.
 /** This function allows changing some of the channel flags.
- *  Currently only MESHLINK_CHANNEL_NO_PARTIAL and MESHLINK_CHANNEL_DROP_LATE are supported, other flags are ignored.
+ *  Currently only MESHLINK_CHANNEL_NO_PARTIAL, MESHLINK_CHANNEL_DROP_LATE and MESHLINK_CHANNEL_PEEK are supported, other flags are ignored.
  *  These flags only affect the local side of the channel with the peer.
  *  The changes take effect immediately.
  *
@@ -1495,6 +1520,31 @@ void meshlink_set_channel_rcvbuf_storage(struct meshlink_handle *mesh, struct me
  */
 void meshlink_set_channel_flags(struct meshlink_handle *mesh, struct meshlink_channel *channel, uint32_t flags);
 
+/// Enable or disable send staging for a channel.
+/** With send staging enabled, meshlink_channel_send() and meshlink_channel_sendv() no longer take MeshLink's internal lock.
+ *  Instead, data is copied into a ring buffer belonging to the channel, and MeshLink's own thread moves it to the send buffer.
+ *  This allows multiple application threads to send on different channels in parallel.
+ *  Only one thread may send on a given channel at the same time.
+ *
+ *  When staging is enabled, the return value of meshlink_channel_send() is the amount of data that fitted in the ring buffer,
+ *  errors are only reported via the poll callback, and the poll callback reports the free space in the ring buffer.
+ *  If the channel can no longer send the staged data, the poll callback is called with a length of 0,
+ *  the data stays in the ring buffer and is still counted by meshlink_channel_get_sendq(),
+ *  and further calls to meshlink_channel_send() will return -1.
+ *  Staged data is flushed to the send buffer when the channel is shut down for writing or closed, and dropped when it is aborted.
+ *  Send staging is only supported for reliable channels without MESHLINK_CHANNEL_FRAMED and MESHLINK_CHANNEL_NO_PARTIAL,
+ *  and cannot be combined with AIO sends. Setting MESHLINK_CHANNEL_NO_PARTIAL with meshlink_set_channel_flags() disables it.
+ *  This function must not be called while another thread is sending on the same channel.
+ *
+ *  \memberof meshlink_channel
+ *  @param mesh      A handle which represents an instance of MeshLink.
+ *  @param channel   A handle for the channel.
+ *  @param size      The size of the ring buffer, which will be rounded up to a power of two, or 0 to disable send staging.
+ *
+ *  @return          True if send staging was enabled or disabled, false otherwise.
+ */
+bool meshlink_set_channel_send_staging(struct meshlink_handle *mesh, struct meshlink_channel *channel, size_t size) __attribute__((__warn_unused_result__));
+
 /// Open a reliable stream channel to another node.
 /** This function is called whenever a remote node wants to open a channel to the local node.
  *  The application then has to decide whether to accept or reject this channel.
@@ -1606,6 +1656,25 @@ void meshlink_channel_abort(struct meshlink_handle *mesh, struct meshlink_channe
  */
 ssize_t meshlink_channel_send(struct meshlink_handle *mesh, struct meshlink_channel *channel, const void *data, size_t len) __attribute__((__warn_unused_result__));
 
+/// Transmit data from multiple buffers on a channel
+/** This queues the contents of an array of buffers to send to the remote node,
+ *  as if they were concatenated and passed to a single call to meshlink_channel_send().
+ *
+ *  \memberof meshlink_channel
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param channel      A handle for the channel.
+ *  @param iov          A pointer to an array of iovcnt struct iovec elements describing the buffers to send.
+ *                      After meshlink_channel_sendv() returns, the application is free to overwrite or free these buffers.
+ *  @param iovcnt       The number of elements in the iov array.
+ *
+ *  @return             The amount of data that was queued, which can be less than the total length of all buffers,
+ *                      or a negative value in case of an error.
+ *                      If MESHLINK_CHANNEL_NO_PARTIAL is set, then the result will either be the total length,
+ *                      0 if the buffer is currently too full, or -1 if the total length is too big even for an empty buffer.
+ *                      For UDP channels, all buffers together form a single packet.
+ */
+ssize_t meshlink_channel_sendv(struct meshlink_handle *mesh, struct meshlink_channel *channel, const struct iovec *iov, int iovcnt) __attribute__((__warn_unused_result__));
+
 /// A callback for cleaning up buffers submitted for asynchronous I/O.
 /** This callbacks signals that MeshLink has finished using this buffer.
  *  The ownership of the buffer is now back into the application's hands.
@@ -1629,6 +1698,41 @@ typedef void (*meshlink_aio_cb_t)(struct meshlink_handle *mesh, struct meshlink_
  */
 typedef void (*meshlink_aio_fd_cb_t)(struct meshlink_handle *mesh, struct meshlink_channel *channel, int fd, size_t len, void *priv);
 
+/// Get direct access to received data on a channel.
+/** If MESHLINK_CHANNEL_PEEK is set on a reliable channel, received data is kept in the channel's receive buffer
+ *  until the application consumes it, instead of being passed to the receive callback.
+ *  This function fills in up to two iovecs that point directly into the receive buffer, without copying the data.
+ *  Two iovecs are needed to describe all the data if it wraps around the end of the receive buffer.
+ *
+ *  The data is read-only and remains valid until the next call to meshlink_channel_consume(),
+ *  meshlink_set_channel_rcvbuf(), meshlink_set_channel_rcvbuf_storage() or until the channel is closed.
+ *  Held data reduces the receive window, so the application should consume it in a timely manner.
+ *
+ *  \memberof meshlink_channel
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param channel      A handle for the channel.
+ *  @param iov          A pointer to an array of iovcnt struct iovec elements that will be filled in.
+ *                      Unused elements will have their base set to NULL and their length to 0.
+ *  @param iovcnt       The number of elements in the iov array.
+ *
+ *  @return             The amount of data described by the iovecs, or -1 in case of an error.
+ */
+ssize_t meshlink_channel_peek(struct meshlink_handle *mesh, struct meshlink_channel *channel, struct iovec *iov, int iovcnt) __attribute__((__warn_unused_result__));
+
+/// Consume received data on a channel.
+/** This removes data from the start of the channel's receive buffer, after the application has processed it
+ *  using the iovecs returned by meshlink_channel_peek(). This opens up the receive window again.
+ *
+ *  \memberof meshlink_channel
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param channel      A handle for the channel.
+ *  @param len          The amount of data to consume.
+ *                      If this is larger than the amount of data in the receive buffer, all data is consumed.
+ *
+ *  @return             This function will return true if the data was consumed, false otherwise.
+ */
+bool meshlink_channel_consume(struct meshlink_handle *mesh, struct meshlink_channel *channel, size_t len);
+
 /// Transmit data on a channel asynchronously
 /** This registers a buffer that will be used to send data to the remote node.
  *  Multiple buffers can be registered, in which case data will be sent in the order the buffers were registered.
@@ -1747,6 +1851,51 @@ size_t meshlink_channel_get_recvq(struct meshlink_handle *mesh, struct meshlink_
  */
 size_t meshlink_channel_get_mss(struct meshlink_handle *mesh, struct meshlink_channel *channel) __attribute__((__warn_unused_result__));
 
+/// The current version of struct meshlink_channel_stats.
+#define MESHLINK_CHANNEL_STATS_VERSION 1
+
+/// Transport statistics of a channel.
+/** New fields will only be added at the end of this struct, and will increment MESHLINK_CHANNEL_STATS_VERSION.
+ *  Counters start at zero when the channel is opened, and only ever increase.
+ */
+typedef struct meshlink_channel_stats {
+	uint32_t version;             ///< The version of the statistics that were filled in.
+
+	uint32_t cwnd;                ///< The congestion window, in bytes.
+	uint32_t ssthresh;            ///< The slow start threshold, in bytes.
+	uint32_t snd_wnd;             ///< The receive window advertised by the peer, in bytes.
+	uint32_t flight;              ///< The amount of bytes sent but not yet acknowledged.
+	uint32_t srtt;                ///< The smoothed round-trip time, in microseconds.
+	uint32_t rttvar;              ///< The round-trip time variation, in microseconds.
+	uint32_t rto;                 ///< The retransmission timeout, in microseconds.
+	uint32_t dupack;              ///< The number of duplicate ACKs received since the last new ACK.
+	uint32_t sack_holes;          ///< The number of gaps in the receive buffer in front of out-of-order data.
+
+	uint64_t segments_sent;       ///< The number of new segments sent.
+	uint64_t bytes_sent;          ///< The number of new bytes sent.
+	uint64_t bytes_acked;         ///< The number of bytes acknowledged by the peer.
+	uint64_t dupacks;             ///< The total number of duplicate ACKs received.
+	uint64_t retransmits;         ///< The number of retransmission timeouts.
+	uint64_t fast_retransmits;    ///< The number of fast retransmits.
+	uint64_t bytes_retransmitted; ///< The number of bytes sent again because of timeouts or fast retransmits.
+} meshlink_channel_stats_t;
+
+/// Get transport statistics of a channel.
+/** This fills in a snapshot of the state of the congestion control and retransmission logic of a channel,
+ *  which can help to diagnose throughput problems.
+ *  Only the first @a size bytes of @a stats are written to, so that an application compiled against
+ *  an older version of the struct can be used with a newer version of MeshLink.
+ *
+ *  \memberof meshlink_channel
+ *  @param mesh         A handle which represents an instance of MeshLink.
+ *  @param channel      A handle for the channel.
+ *  @param stats        A pointer to a struct meshlink_channel_stats that will be filled in.
+ *  @param size         The size of the struct pointed to by @a stats, normally sizeof(*stats).
+ *
+ *  @return             This function will return true if the statistics were filled in, false otherwise.
+ */
+bool meshlink_channel_get_stats(struct meshlink_handle *mesh, struct meshlink_channel *channel, meshlink_channel_stats_t *stats, size_t size) __attribute__((__warn_unused_result__));
+
 /// Set the connection timeout used for channels to the given node.
 /** This sets the timeout after which unresponsive channels will be reported as closed.
  *  The timeout is set for all current and future channels to the given node.
@@ -1858,6 +2007,56 @@ void meshlink_reset_timers(struct meshlink_handle *mesh);
  */
 void meshlink_set_inviter_commits_first(struct meshlink_handle *mesh, bool inviter_commits_first);
 
+/// Set the number of crypto worker threads
+/** This sets the number of threads used to encrypt and decrypt packets that are sent to and received from other nodes via UDP.
+ *  By default, this is 0, and all encryption and decryption is done by MeshLink's own thread.
+ *  When worker threads are used, MeshLink's thread only does the network I/O and hands records to and from the workers.
+ *  Packets to and from a given node are still handled in the same order as without worker threads,
+ *  and replay protection is unaffected.
+ *  Changing the number of threads while MeshLink is running may cause packets that are being processed at that moment to be lost.
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh          A handle which represents an instance of MeshLink.
+ *  @param threads       The number of worker threads, at most 64, or 0 to disable the worker threads.
+ *
+ *  @return              This function returns true if the number of threads was set, false otherwise.
+ */
+bool meshlink_set_crypto_threads(struct meshlink_handle *mesh, int threads);
+
+/// Create a shared event loop.
+/** This starts a single thread that can run the event loops of several instances of MeshLink.
+ *  Applications that open many instances in the same process can use this to avoid having one thread per instance.
+ *  Callbacks of all instances attached to the same shared loop are called from this thread,
+ *  so a slow callback of one instance delays all the others.
+ *
+ *  @return         A pointer to a shared event loop, or NULL in case of an error.
+ *                  The pointer is valid until meshlink_shared_loop_free() is called.
+ */
+struct meshlink_shared_loop *meshlink_shared_loop_new(void) __attribute__((__warn_unused_result__));
+
+/// Free a shared event loop.
+/** This stops the thread of the shared event loop and frees all its resources.
+ *  This will fail if there are still instances of MeshLink that use this shared loop.
+ *
+ *  @param shared   A pointer to a shared event loop.
+ *
+ *  @return         This function returns true if the shared event loop was freed, false otherwise.
+ */
+bool meshlink_shared_loop_free(struct meshlink_shared_loop *shared);
+
+/// Use a shared event loop.
+/** This causes the instance to run its event loop on the thread of a shared event loop instead of starting its own thread.
+ *  This can only be changed while the instance is not running.
+ *  Shared event loops cannot be used together with meshlink_open_params_set_netns().
+ *
+ *  \memberof meshlink_handle
+ *  @param mesh     A handle which represents an instance of MeshLink.
+ *  @param shared   A pointer to a shared event loop, or NULL to let the instance start its own thread again.
+ *
+ *  @return         This function returns true if the shared event loop was set, false otherwise.
+ */
+bool meshlink_set_shared_loop(struct meshlink_handle *mesh, struct meshlink_shared_loop *shared);
+
 /// Set the URL used to discover the host's external address
 /** For generating invitation URLs, MeshLink can look up the externally visible address of the local node.
  *  It does so by querying an external service. By default, this is http://meshlink.io/host.cgi.
@@ -37,6 +37,7 @@
 #include <pthread.h>
 
 #define MAXSOCKETS 4    /* Probably overkill... */
+#define TOPOLOGY_BUCKETS 64 /* Number of buckets the topology digest is split into */
 
 static const char meshlink_invitation_label[] = "MeshLink invitation";
 static const char meshlink_tcp_label[] = "MeshLink TCP";
@@ -64,6 +65,8 @@ struct meshlink_open_params {
 	const void *key;
 	size_t keylen;
 	meshlink_storage_policy_t storage_policy;
+
+	int udp_shards;
 };
 
 /// Device class traits
@@ -77,6 +80,20 @@ typedef struct {
 	int edge_weight;
 } dev_class_traits_t;
 
+#ifdef MESHLINK_LOCK_STATS
+#define LOCK_STATS_SITES 64
+
+/// Contention statistics for the mesh lock, per function that takes it.
+struct lock_stats {
+	const char *site;
+	uint64_t count;
+	uint64_t wait_usec;
+	uint64_t hold_usec;
+	uint32_t max_wait_usec;
+	uint32_t max_hold_usec;
+};
+#endif
+
 /// A handle for an instance of MeshLink.
 struct meshlink_handle {
 	// public members
@@ -93,6 +110,14 @@ struct meshlink_handle {
 
 	// The most important network-related members come first
 	int reachable;
+	int nreachable;                 // number of nodes that are reachable, including ourself
+	struct node_t *graph_dirty;     // nodes whose reachability graph() has to check
+	int hop_routing_nodes;          // number of reachable nodes that only route on hop counts
+	bool hop_routing;               // paths are chosen on hop counts instead of edge weights
+	bool mst_valid;                 // flooded requests may be restricted to the minimum spanning tree
+	bool mst_dirty;                 // the topology changed since the minimum spanning tree was computed
+	time_t last_topology_change;
+	time_t last_mst_update;         // when the minimum spanning tree was last computed
 	int listen_sockets;
 	listen_socket_t listen_socket[MAXSOCKETS];
 
@@ -104,24 +129,34 @@ struct meshlink_handle {
 
 	struct splay_tree_t *nodes;
 	struct splay_tree_t *edges;
+	uint64_t topology_digest[TOPOLOGY_BUCKETS]; // XOR of the edge digests of all nodes in each bucket
+	uint64_t topology_edges_sent;  // ADD_EDGEs sent to newly activated meta-connections
 
 	struct list_t *connections;
+	struct list_t *core_connections; // active connections with nodes that are not in a submesh
 	struct list_t *outgoings;
 	struct list_t *submeshes;
 
+	// Autoconnect-related members
+	struct splay_tree_t *autoconnect_candidates[DEV_CLASS_COUNT][2]; // unconnected nodes by device class and reachability
+	struct splay_tree_t *autoconnect_backoff; // unconnected nodes we recently tried to connect to
+	int autoconnect_retry_timeout;
+	unsigned int autoconnect_connects[DEV_CLASS_COUNT]; // active connections by device class of the peer
+
 	// Meta-connection-related members
-	struct splay_tree_t *past_request_tree;
-	timeout_t past_request_timeout;
+	struct past_request_set_t *past_requests;
 
 	int connection_burst;
 	int contradicting_add_edge;
 	int contradicting_del_edge;
+	bool meta_text_only;            // only used by devtool_set_meta_text_only()
 	int sleeptime;
 	time_t connection_burst_time;
 	time_t last_hard_try;
 	time_t last_unreachable;
 	timeout_t pingtimer;
 	timeout_t periodictimer;
+	timeout_t graphtimer;           // runs graph() once at the end of a burst of edge changes
 
 	struct connection_t *everyone;
 	uint64_t prng_state[4];
@@ -173,6 +208,8 @@ struct meshlink_handle {
 	pthread_t thread;
 	pthread_cond_t cond;
 	bool threadstarted;
+	struct meshlink_shared_loop *shared_loop;
+	bool shared_attached;
 
 	// mDNS discovery
 	struct {
@@ -192,10 +229,41 @@ struct meshlink_handle {
 
 	// ADNS
 	pthread_t adns_thread;
+	bool adns_thread_started;
 	pthread_cond_t adns_cond;
 	meshlink_queue_t adns_queue;
 	meshlink_queue_t adns_done_queue;
 	signal_t adns_signal;
+
+	// Virtual transport
+	const struct devtool_transport *transport;
+	meshlink_queue_t transport_queue;
+	signal_t transport_signal;
+
+	// Channels with send staging enabled
+	struct list_t *staged_channels;
+	signal_t staged_signal;
+
+	// Crypto worker pool
+	int crypto_threads;
+	struct crypto_pool *crypto_pool;
+	signal_t crypto_signal;
+
+	// UDP shards
+	int udp_shards;
+	int nshards;
+	struct shard *shards;
+	meshlink_queue_t shard_queue;
+	signal_t shard_signal;
+	int shard_queued;                       /* Packets in shard_queue, protected by the mesh lock */
+
+#ifdef MESHLINK_LOCK_STATS
+	// Lock statistics, only accessed while holding the mutex
+	int lock_depth;
+	const char *lock_site;
+	struct timespec lock_start;
+	struct lock_stats lock_stats[LOCK_STATS_SITES];
+#endif
 };
 
 /// A handle for a MeshLink node.
@@ -235,6 +303,7 @@ struct meshlink_channel {
 	meshlink_aio_buffer_t *aio_receive;
 	meshlink_channel_receive_cb_t receive_cb;
 	meshlink_channel_poll_cb_t poll_cb;
+	struct meshlink_send_ring *staging;
 };
 
 /// Header for data packets routed between nodes
@@ -244,6 +313,7 @@ typedef struct meshlink_packethdr {
 } __attribute__((__packed__)) meshlink_packethdr_t;
 
 void meshlink_send_from_queue(event_loop_t *loop, void *mesh);
+void meshlink_send_from_staging(event_loop_t *loop, void *mesh);
 void update_node_status(meshlink_handle_t *mesh, struct node_t *n);
 void update_node_pmtu(meshlink_handle_t *mesh, struct node_t *n);
 extern meshlink_log_level_t global_log_level;
@@ -252,6 +322,30 @@ void handle_duplicate_node(meshlink_handle_t *mesh, struct node_t *n);
 void handle_network_change(meshlink_handle_t *mesh, bool online);
 void call_error_cb(meshlink_handle_t *mesh, meshlink_errno_t meshlink_errno);
 void channel_receive(meshlink_handle_t *mesh, meshlink_node_t *node, const void *data, size_t len);
+void channel_receive_coalesced(meshlink_handle_t *mesh, meshlink_node_t *node, const void *data, size_t len);
+void channel_flush_coalesced(meshlink_handle_t *mesh, struct node_t *n);
+
+/// Locking the mesh
+#ifdef MESHLINK_LOCK_STATS
+#define meshlink_lock(mesh) meshlink_lock_site(mesh, __func__)
+void meshlink_lock_site(meshlink_handle_t *mesh, const char *site);
+void meshlink_unlock(meshlink_handle_t *mesh);
+void meshlink_cond_wait(meshlink_handle_t *mesh, pthread_cond_t *cond);
+#else
+static inline void meshlink_lock(meshlink_handle_t *mesh) {
+	if(pthread_mutex_lock(&mesh->mutex) != 0) {
+		abort();
+	}
+}
+
+static inline void meshlink_unlock(meshlink_handle_t *mesh) {
+	pthread_mutex_unlock(&mesh->mutex);
+}
+
+static inline void meshlink_cond_wait(meshlink_handle_t *mesh, pthread_cond_t *cond) {
+	pthread_cond_wait(cond, &mesh->mutex);
+}
+#endif
 
 /// Per-instance PRNG
 static inline int prng(meshlink_handle_t *mesh, uint64_t max) {
@@ -20,6 +20,7 @@
 #include "system.h"
 
 #include "connection.h"
+#include "graph.h"
 #include "logger.h"
 #include "meshlink_internal.h"
 #include "meta.h"
@@ -64,8 +65,10 @@ void broadcast_meta(meshlink_handle_t *mesh, connection_t *from, const char *buf
 	assert(buffer);
 	assert(length);
 
+	bool mst = mst_broadcast(mesh, from);
+
 	for list_each(connection_t, c, mesh->connections)
-		if(c != from && c->status.active && !(c->flags & PROTOCOL_TINY)) {
+		if(c != from && c->status.active && !(c->flags & PROTOCOL_TINY) && (!mst || c->status.mst)) {
 			send_meta(mesh, c, buffer, length);
 		}
 }
@@ -74,12 +77,17 @@ void broadcast_submesh_meta(meshlink_handle_t *mesh, connection_t *from, const s
 	assert(buffer);
 	assert(length);
 
-	for list_each(connection_t, c, mesh->connections)
-		if(c != from && c->status.active && !(c->flags & PROTOCOL_TINY)) {
-			if(c->node && submesh_allows_node(s, c->node)) {
+	/* Only nodes in the core mesh and in the submesh itself are allowed to see this */
+
+	list_t *indexes[] = {s ? mesh->core_connections : mesh->connections, s ? s->connections : NULL};
+
+	for(int i = 0; i < 2 && indexes[i]; i++) {
+		for list_each(connection_t, c, indexes[i]) {
+			if(c != from && c->status.active && !(c->flags & PROTOCOL_TINY)) {
 				send_meta(mesh, c, buffer, length);
 			}
 		}
+	}
 }
 
 bool receive_meta_sptps(void *handle, uint8_t type, const void *data, uint16_t length) {
@@ -119,6 +127,10 @@ bool receive_meta_sptps(void *handle, uint8_t type, const void *data, uint16_t l
 		return true;
 	}
 
+	if(type == META_BINARY) {
+		return receive_binary_request(mesh, c, data, length);
+	}
+
 	/* Change newline to null byte, just like non-SPTPS requests */
 
 	if(request[length - 1] == '\n') {
@@ -62,9 +62,10 @@ void terminate_connection(meshlink_handle_t *mesh, connection_t *c, bool report)
 		}
 
 		c->node->connection = NULL;
+		update_node_autoconnect(mesh, c->node);
 	}
 
-	c->status.active = false;
+	connection_deactivate(mesh, c);
 
 	if(c->edge) {
 		if(report) {
@@ -76,11 +77,12 @@ void terminate_connection(meshlink_handle_t *mesh, connection_t *c, bool report)
 
 		/* Run MST and SSSP algorithms */
 
-		graph(mesh);
+		graph_schedule(mesh);
 
-		/* If the node is not reachable anymore but we remember it had an edge to us, clean it up */
+		/* If the node is not reachable anymore but we remember it had an edge to us, clean it up.
+		   The shortest path tree is already up to date, even if graph() has not run yet. */
 
-		if(report && c->node && !c->node->status.reachable) {
+		if(report && c->node && c->node->distance < 0) {
 			edge_t *e;
 			e = lookup_edge(c->node, mesh->self);
 
@@ -164,97 +166,31 @@ static void timeout_handler(event_loop_t *loop, void *data) {
 		}
 	}
 
+	/* Pick up a settled topology even if nothing is being flooded */
+	mst_update(mesh);
+
 	timeout_set(&mesh->loop, data, &(struct timespec) {
 		1, prng(mesh, TIMER_FUDGE)
 	});
 }
 
-// devclass asc, last_successfull_connection desc
-static int node_compare_devclass_asc_lsc_desc(const void *a, const void *b) {
-	const node_t *na = a, *nb = b;
-
-	if(na->devclass < nb->devclass) {
-		return -1;
-	}
-
-	if(na->devclass > nb->devclass) {
-		return 1;
-	}
-
-	if(na->last_successfull_connection == nb->last_successfull_connection) {
-		return 0;
-	}
-
-	if(na->last_successfull_connection == 0 || na->last_successfull_connection > nb->last_successfull_connection) {
-		return -1;
-	}
-
-	if(nb->last_successfull_connection == 0 || na->last_successfull_connection < nb->last_successfull_connection) {
-		return 1;
-	}
-
-	if(na < nb) {
-		return -1;
-	}
-
-	if(na > nb) {
-		return 1;
-	}
-
-	return 0;
-}
-
-// last_successfull_connection desc
-static int node_compare_lsc_desc(const void *a, const void *b) {
-	const node_t *na = a, *nb = b;
-
-	if(na->last_successfull_connection == nb->last_successfull_connection) {
-		return 0;
-	}
-
-	if(na->last_successfull_connection == 0 || na->last_successfull_connection > nb->last_successfull_connection) {
-		return -1;
-	}
-
-	if(nb->last_successfull_connection == 0 || na->last_successfull_connection < nb->last_successfull_connection) {
-		return 1;
-	}
-
-	if(na < nb) {
-		return -1;
-	}
-
-	if(na > nb) {
-		return 1;
-	}
-
-	return 0;
-}
-
-// devclass desc
-static int node_compare_devclass_desc(const void *a, const void *b) {
-	const node_t *na = a, *nb = b;
+/* Return the best node of the given device class to autoconnect to, preferring the one we most recently had a successful connection with.
+   If unreachable_only is set, only consider nodes that are not reachable. */
+static node_t *autoconnect_candidate(meshlink_handle_t *mesh, dev_class_t devclass, bool unreachable_only) {
+	splay_tree_t *unreachable = mesh->autoconnect_candidates[devclass][false];
+	splay_tree_t *reachable = mesh->autoconnect_candidates[devclass][true];
 
-	if(na->devclass < nb->devclass) {
-		return -1;
+	if(unreachable_only || !reachable->head) {
+		return unreachable->head ? unreachable->head->data : NULL;
 	}
 
-	if(na->devclass > nb->devclass) {
-		return 1;
+	if(!unreachable->head) {
+		return reachable->head->data;
 	}
 
-	if(na < nb) {
-		return -1;
-	}
-
-	if(na > nb) {
-		return 1;
-	}
-
-	return 0;
+	return reachable->compare(unreachable->head->data, reachable->head->data) < 0 ? unreachable->head->data : reachable->head->data;
 }
 
-
 /*
 
 autoconnect()
@@ -391,6 +327,20 @@ static void periodic_handler(event_loop_t *loop, void *data) {
 		logger(mesh, MESHLINK_DEBUG, "* nodes = %d", mesh->nodes->count);
 		logger(mesh, MESHLINK_DEBUG, "* retry_timeout = %d", retry_timeout);
 
+		// make nodes we tried to connect to long enough ago eligible again
+
+		mesh->autoconnect_retry_timeout = retry_timeout;
+
+		while(mesh->autoconnect_backoff->head) {
+			node_t *n = mesh->autoconnect_backoff->head->data;
+
+			if(mesh->loop.now.tv_sec - n->last_connect_try <= retry_timeout) {
+				break;
+			}
+
+			update_node_autoconnect(mesh, n);
+		}
+
 
 		// connect disconnect nodes
 
@@ -402,10 +352,8 @@ static void periodic_handler(event_loop_t *loop, void *data) {
 
 		unsigned int cur_connects = 0;
 
-		for list_each(connection_t, c, mesh->connections) {
-			if(c->status.active) {
-				cur_connects += 1;
-			}
+		for(dev_class_t devclass = 0; devclass < DEV_CLASS_COUNT; ++devclass) {
+			cur_connects += mesh->autoconnect_connects[devclass];
 		}
 
 		logger(mesh, MESHLINK_DEBUG, "* cur_connects = %d", cur_connects);
@@ -422,26 +370,16 @@ static void periodic_handler(event_loop_t *loop, void *data) {
 		// find the best one for initial connect
 
 		if(cur_connects < min_connects) {
-			splay_tree_t *nodes = splay_alloc_tree(node_compare_devclass_asc_lsc_desc, NULL);
-
-			for splay_each(node_t, n, mesh->nodes) {
-				logger(mesh, MESHLINK_DEBUG, "* %s->devclass = %d", n->name, n->devclass);
-
-				if(n != mesh->self && n->devclass <= mesh->devclass && !n->connection && !n->status.blacklisted && (n->last_connect_try == 0 || (mesh->loop.now.tv_sec - n->last_connect_try) > retry_timeout)) {
-					splay_insert(nodes, n);
-				}
+			for(dev_class_t devclass = 0; devclass <= mesh->devclass && !connect_to; ++devclass) {
+				connect_to = autoconnect_candidate(mesh, devclass, false);
 			}
 
-			if(nodes->head) {
+			if(connect_to) {
 				//timeout = 0;
-				connect_to = (node_t *)nodes->head->data;
-
 				logger(mesh, MESHLINK_DEBUG, "* found best one for initial connect: %s", connect_to->name);
 			} else {
 				logger(mesh, MESHLINK_DEBUG, "* could not find node for initial connect");
 			}
-
-			splay_delete_tree(nodes);
 		}
 
 
@@ -451,30 +389,15 @@ static void periodic_handler(event_loop_t *loop, void *data) {
 			unsigned int connects = 0;
 
 			for(dev_class_t devclass = 0; devclass <= mesh->devclass; ++devclass) {
-				for list_each(connection_t, c, mesh->connections) {
-					if(c->status.active && c->node && c->node->devclass == devclass) {
-						connects += 1;
-					}
-				}
+				connects += mesh->autoconnect_connects[devclass];
 
 				if(connects < min_connects) {
-					splay_tree_t *nodes = splay_alloc_tree(node_compare_lsc_desc, NULL);
+					connect_to = autoconnect_candidate(mesh, devclass, false);
 
-					for splay_each(node_t, n, mesh->nodes) {
-						if(n != mesh->self && n->devclass == devclass && !n->connection && !n->status.blacklisted && (n->last_connect_try == 0 || (mesh->loop.now.tv_sec - n->last_connect_try) > retry_timeout)) {
-							splay_insert(nodes, n);
-						}
-					}
-
-					if(nodes->head) {
+					if(connect_to) {
 						logger(mesh, MESHLINK_DEBUG, "* found better node");
-						connect_to = (node_t *)nodes->head->data;
-
-						splay_delete_tree(nodes);
 						break;
 					}
-
-					splay_delete_tree(nodes);
 				} else {
 					break;
 				}
@@ -489,22 +412,15 @@ static void periodic_handler(event_loop_t *loop, void *data) {
 		// heal partitions
 
 		if(!connect_to && min_connects <= cur_connects && cur_connects < max_connects) {
-			splay_tree_t *nodes = splay_alloc_tree(node_compare_devclass_asc_lsc_desc, NULL);
-
-			for splay_each(node_t, n, mesh->nodes) {
-				if(n != mesh->self && n->devclass <= mesh->devclass && !n->status.reachable && !n->status.blacklisted && (n->last_connect_try == 0 || (mesh->loop.now.tv_sec - n->last_connect_try) > retry_timeout)) {
-					splay_insert(nodes, n);
-				}
+			for(dev_class_t devclass = 0; devclass <= mesh->devclass && !connect_to; ++devclass) {
+				connect_to = autoconnect_candidate(mesh, devclass, true);
 			}
 
-			if(nodes->head) {
+			if(connect_to) {
 				logger(mesh, MESHLINK_DEBUG, "* try to heal partition");
-				connect_to = (node_t *)nodes->head->data;
 			} else {
 				logger(mesh, MESHLINK_DEBUG, "* could not find nodes for partition healing");
 			}
-
-			splay_delete_tree(nodes);
 		}
 
 
@@ -512,6 +428,7 @@ static void periodic_handler(event_loop_t *loop, void *data) {
 
 		if(connect_to && !connect_to->connection) {
 			connect_to->last_connect_try = mesh->loop.now.tv_sec;
+			update_node_autoconnect(mesh, connect_to);
 			logger(mesh, MESHLINK_DEBUG, "Autoconnect trying to connect to %s", connect_to->name);
 
 			/* check if there is already a connection attempt to this node */
@@ -546,27 +463,19 @@ static void periodic_handler(event_loop_t *loop, void *data) {
 			unsigned int connects = 0;
 
 			for(dev_class_t devclass = 0; devclass <= mesh->devclass; ++devclass) {
-				for list_each(connection_t, c, mesh->connections) {
-					if(c->status.active && c->node && c->node->devclass == devclass) {
-						connects += 1;
-					}
-				}
+				connects += mesh->autoconnect_connects[devclass];
 
 				if(min_connects < connects) {
-					splay_tree_t *nodes = splay_alloc_tree(node_compare_devclass_desc, NULL);
-
 					for list_each(connection_t, c, mesh->connections) {
-						if(c->outgoing && c->node && c->node->devclass >= devclass) {
-							splay_insert(nodes, c->node);
+						if(c->outgoing && c->node && c->node->devclass >= devclass && (!disconnect_from || c->node->devclass < disconnect_from->devclass)) {
+							disconnect_from = c->node;
 						}
 					}
 
-					if(nodes->head) {
+					if(disconnect_from) {
 						logger(mesh, MESHLINK_DEBUG, "* disconnect suboptimal outgoing connection");
-						disconnect_from = (node_t *)nodes->head->data;
 					}
 
-					splay_delete_tree(nodes);
 					break;
 				}
 			}
@@ -580,24 +489,19 @@ static void periodic_handler(event_loop_t *loop, void *data) {
 		// disconnect connections (too many connections)
 
 		if(!disconnect_from && max_connects < cur_connects) {
-			splay_tree_t *nodes = splay_alloc_tree(node_compare_devclass_desc, NULL);
-
 			for list_each(connection_t, c, mesh->connections) {
-				if(c->status.active && c->node) {
-					splay_insert(nodes, c->node);
+				if(c->status.active && c->node && (!disconnect_from || c->node->devclass < disconnect_from->devclass)) {
+					disconnect_from = c->node;
 				}
 			}
 
-			if(nodes->head) {
+			if(disconnect_from) {
 				logger(mesh, MESHLINK_DEBUG, "* disconnect connection (too many connections)");
 
 				//timeout = 0;
-				disconnect_from = (node_t *)nodes->head->data;
 			} else {
 				logger(mesh, MESHLINK_DEBUG, "* no node we want to disconnect, even though we have too many connections");
 			}
-
-			splay_delete_tree(nodes);
 		}
 
 
@@ -720,27 +624,44 @@ void retry(meshlink_handle_t *mesh) {
 	}
 }
 
-/*
-  this is where it all happens...
-*/
-void main_loop(meshlink_handle_t *mesh) {
+void main_loop_init(meshlink_handle_t *mesh) {
 	timeout_add(&mesh->loop, &mesh->pingtimer, timeout_handler, &mesh->pingtimer, &(struct timespec) {
 		1, prng(mesh, TIMER_FUDGE)
 	});
 	timeout_add(&mesh->loop, &mesh->periodictimer, periodic_handler, &mesh->periodictimer, &(struct timespec) {
 		0, 0
 	});
+	init_graph(mesh);
 
 	//Add signal handler
 	mesh->datafromapp.signum = 0;
 	signal_add(&mesh->loop, &mesh->datafromapp, meshlink_send_from_queue, mesh, mesh->datafromapp.signum);
+	signal_add(&mesh->loop, &mesh->transport_signal, handle_transport_queue, mesh, 2);
+	signal_add(&mesh->loop, &mesh->staged_signal, meshlink_send_from_staging, mesh, 3);
+
+	// Pick up anything that was staged while we were not running
+	meshlink_send_from_staging(&mesh->loop, mesh);
+}
+
+void main_loop_exit(meshlink_handle_t *mesh) {
+	signal_del(&mesh->loop, &mesh->staged_signal);
+	signal_del(&mesh->loop, &mesh->transport_signal);
+	signal_del(&mesh->loop, &mesh->datafromapp);
+	exit_graph(mesh);
+	timeout_del(&mesh->loop, &mesh->periodictimer);
+	timeout_del(&mesh->loop, &mesh->pingtimer);
+}
+
+/*
+  this is where it all happens...
+*/
+void main_loop(meshlink_handle_t *mesh) {
+	main_loop_init(mesh);
 
 	if(!event_loop_run(&mesh->loop, mesh)) {
 		logger(mesh, MESHLINK_ERROR, "Error while waiting for input: %s", strerror(errno));
 		call_error_cb(mesh, MESHLINK_ENETWORK);
 	}
 
-	signal_del(&mesh->loop, &mesh->datafromapp);
-	timeout_del(&mesh->loop, &mesh->periodictimer);
-	timeout_del(&mesh->loop, &mesh->pingtimer);
+	main_loop_exit(mesh);
 }
@@ -38,9 +38,13 @@
 /* MAXBUFSIZE is the maximum size of a request: enough for a base64 encoded MAXSIZEd packet plus request header */
 #define MAXBUFSIZE ((MAXSIZE * 8) / 6 + 128)
 
+/* UDP_SOCKET_BUFFER_SIZE is the size of the kernel buffers we ask for on UDP sockets */
+#define UDP_SOCKET_BUFFER_SIZE (1024 * 1024)
+
 typedef struct vpn_packet_t {
 	uint16_t probe: 1;
 	int16_t tcp: 1;
+	uint16_t coalesced: 1;  /* 1 if the payload consists of multiple length-prefixed segments */
 	uint16_t len;           /* the actual number of bytes in the `data' field */
 	uint8_t data[MAXSIZE];
 } vpn_packet_t;
@@ -49,6 +53,7 @@ typedef struct vpn_packet_t {
 
 #define PKT_COMPRESSED 1
 #define PKT_PROBE 4
+#define PKT_COALESCED 8
 
 typedef enum packet_type_t {
 	PACKET_NORMAL,
@@ -83,14 +88,28 @@ typedef struct outgoing_t {
 void init_outgoings(struct meshlink_handle *mesh);
 void exit_outgoings(struct meshlink_handle *mesh);
 
+/* A packet or connection injected by a virtual transport, see devtool_set_transport() */
+typedef struct transport_item_t {
+	int fd;                                 /* the socket of an accepted connection, or -1 for a packet */
+	sockaddr_t from;
+	size_t len;
+	uint8_t data[];
+} transport_item_t;
+
 void retry_outgoing(struct meshlink_handle *mesh, outgoing_t *);
 void handle_incoming_vpn_data(struct event_loop_t *loop, void *, int);
+void handle_incoming_vpn_packet(struct meshlink_handle *mesh, struct listen_socket_t *ls, struct vpn_packet_t *pkt, sockaddr_t *from);
+void handle_sharded_vpn_packet(struct meshlink_handle *mesh, struct shard *shard, struct vpn_packet_t *pkt, sockaddr_t *from);
+void handle_shard_queue(struct event_loop_t *loop, void *);
+void handle_transport_queue(struct event_loop_t *loop, void *);
 void finish_connecting(struct meshlink_handle *mesh, struct connection_t *);
 void do_outgoing_connection(struct meshlink_handle *mesh, struct outgoing_t *);
 void handle_new_meta_connection(struct event_loop_t *loop, void *, int);
+void handle_meta_io(struct event_loop_t *loop, void *, int);
 int setup_tcp_listen_socket(struct meshlink_handle *mesh, const struct addrinfo *aip) __attribute__((__warn_unused_result__));
 int setup_udp_listen_socket(struct meshlink_handle *mesh, const struct addrinfo *aip) __attribute__((__warn_unused_result__));
 bool send_sptps_data(void *handle, uint8_t type, const void *data, size_t len);
+bool send_sptps_data_now(struct node_t *to, uint8_t type, const void *data, size_t len);
 bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t len) __attribute__((__warn_unused_result__));
 void send_packet(struct meshlink_handle *mesh, struct node_t *, struct vpn_packet_t *);
 char *get_name(struct meshlink_handle *mesh) __attribute__((__warn_unused_result__));
@@ -101,6 +120,8 @@ void reset_outgoing(struct outgoing_t *);
 void setup_outgoing_connection(struct meshlink_handle *mesh, struct outgoing_t *);
 void close_network_connections(struct meshlink_handle *mesh);
 void main_loop(struct meshlink_handle *mesh);
+void main_loop_init(struct meshlink_handle *mesh);
+void main_loop_exit(struct meshlink_handle *mesh);
 void terminate_connection(struct meshlink_handle *mesh, struct connection_t *, bool);
 bool node_read_public_key(struct meshlink_handle *mesh, struct node_t *) __attribute__((__warn_unused_result__));
 bool node_read_from_config(struct meshlink_handle *mesh, struct node_t *, const config_t *config) __attribute__((__warn_unused_result__));
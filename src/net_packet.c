@@ -22,6 +22,8 @@
 #include "conf.h"
 #include "connection.h"
 #include "crypto.h"
+#include "crypto_pool.h"
+#include "devtools.h"
 #include "graph.h"
 #include "logger.h"
 #include "meshlink_internal.h"
@@ -29,6 +31,7 @@
 #include "netutl.h"
 #include "protocol.h"
 #include "route.h"
+#include "shard.h"
 #include "sptps.h"
 #include "utils.h"
 #include "xalloc.h"
@@ -39,6 +42,7 @@ static void send_udppacket(meshlink_handle_t *mesh, node_t *, vpn_packet_t *);
 
 #define MAX_SEQNO 1073741824
 #define PROBE_OVERHEAD (SPTPS_DATAGRAM_OVERHEAD + 40)
+#define VPN_READ_BATCH 64
 
 /* mtuprobes == 1..30: initial discovery, send bursts with 1 second interval
    mtuprobes ==    31: sleep pinginterval seconds
@@ -66,6 +70,7 @@ static void send_mtu_probe_handler(event_loop_t *loop, void *data) {
 	if(!n->status.reachable || !n->status.validkey) {
 		logger(mesh, MESHLINK_INFO, "Trying to send MTU probe to unreachable or rekeying node %s", n->name);
 		n->mtuprobes = 0;
+		update_node_snapshot(n);
 		return;
 	}
 
@@ -137,6 +142,7 @@ static void send_mtu_probe_handler(event_loop_t *loop, void *data) {
 
 		vpn_packet_t packet;
 		packet.probe = true;
+		packet.coalesced = false;
 		memset(packet.data, 0, 14);
 		randomize(packet.data + 14, len - 14);
 		packet.len = len;
@@ -151,6 +157,8 @@ static void send_mtu_probe_handler(event_loop_t *loop, void *data) {
 	n->status.broadcast = false;
 
 end:
+	update_node_snapshot(n);
+
 	timeout_set(&mesh->loop, &n->mtutimeout, &(struct timespec) {
 		timeout, prng(mesh, TIMER_FUDGE)
 	});
@@ -187,6 +195,15 @@ static void mtu_probe_h(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *packet
 		n->out_meta += packet->len + PROBE_OVERHEAD;
 		send_udppacket(mesh, n, packet);
 		n->status.udp_confirmed = udp_confirmed;
+
+		/* If our first burst of probes got no reply, it probably arrived before the other side
+		   finished the key exchange. Now that it can send us probes, send the next burst right away. */
+
+		if(n->mtuprobes == 1 && !n->minmtu && n->status.validkey) {
+			timeout_set(&mesh->loop, &n->mtutimeout, &(struct timespec) {
+				0, 0
+			});
+		}
 	} else {
 		/* It's a valid reply: now we know bidirectional communication
 		   is possible using the address and socket that the reply
@@ -214,6 +231,7 @@ static void mtu_probe_h(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *packet
 				logger(mesh, MESHLINK_INFO, "Increase in PMTU to %s detected, restarting PMTU discovery", n->name);
 				n->maxmtu = MTU;
 				n->mtuprobes = 10;
+				update_node_snapshot(n);
 				return;
 			}
 
@@ -233,6 +251,8 @@ static void mtu_probe_h(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *packet
 		if(n->minmtu < len) {
 			n->minmtu = len;
 			update_node_pmtu(mesh, n);
+		} else {
+			update_node_snapshot(n);
 		}
 	}
 }
@@ -271,6 +291,13 @@ static void receive_udppacket(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *
 		return;
 	}
 
+	n->in_packets++;
+	n->in_udp += inpkt->len;
+
+	if(crypto_pool_open(mesh, n, inpkt->data, inpkt->len)) {
+		return;
+	}
+
 	if(!sptps_receive_data(&n->sptps, inpkt->data, inpkt->len)) {
 		logger(mesh, MESHLINK_ERROR, "Could not process SPTPS data from %s: %s", n->name, strerror(errno));
 	}
@@ -302,7 +329,7 @@ static void send_sptps_packet(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *
 		return;
 	}
 
-	uint8_t type = 0;
+	uint8_t type = origpkt->coalesced ? PKT_COALESCED : 0;
 
 	// If it's a probe, send it immediately without trying to compress it.
 	if(origpkt->probe) {
@@ -310,6 +337,11 @@ static void send_sptps_packet(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *
 		return;
 	}
 
+	// Records that will be sent via UDP can be encrypted by the crypto worker pool.
+	if(origpkt->len <= n->minmtu && crypto_pool_seal(mesh, n, type, origpkt->data, origpkt->len)) {
+		return;
+	}
+
 	sptps_send_record(&n->sptps, type, origpkt->data, origpkt->len);
 	return;
 }
@@ -447,12 +479,24 @@ static void send_udppacket(meshlink_handle_t *mesh, node_t *n, vpn_packet_t *ori
 	send_sptps_packet(mesh, n, origpkt);
 }
 
+/* The send callback of a node's SPTPS session. Datagrams for the node that are still in the crypto pool have to go out first. */
 bool send_sptps_data(void *handle, uint8_t type, const void *data, size_t len) {
 	assert(handle);
+
+	node_t *to = handle;
+
+	if(crypto_pool_send(to->mesh, to, type, data, len)) {
+		return true;
+	}
+
+	return send_sptps_data_now(to, type, data, len);
+}
+
+bool send_sptps_data_now(node_t *to, uint8_t type, const void *data, size_t len) {
+	assert(to);
 	assert(data);
 	assert(len);
 
-	node_t *to = handle;
 	meshlink_handle_t *mesh = to->mesh;
 
 	if(!to->status.reachable) {
@@ -463,20 +507,21 @@ bool send_sptps_data(void *handle, uint8_t type, const void *data, size_t len) {
 	/* Send it via TCP if it is a handshake packet, TCPOnly is in use, or this packet is larger than the MTU. */
 
 	if(type >= SPTPS_HANDSHAKE || (type != PKT_PROBE && (len - 21) > to->minmtu)) {
-		char buf[len * 4 / 3 + 5];
-		b64encode(data, buf, len);
-
 		if(!to->nexthop || !to->nexthop->connection) {
 			logger(mesh, MESHLINK_WARNING, "Unable to forward SPTPS packet to %s via %s", to->name, to->nexthop ? to->nexthop->name : to->name);
 			return false;
 		}
 
+		to->out_relayed += len;
+
 		/* If no valid key is known yet, send the packets using ANS_KEY requests,
 		   to ensure we get to learn the reflexive UDP address. */
 		if(!to->status.validkey) {
+			char buf[len * 4 / 3 + 5];
+			b64encode(data, buf, len);
 			return send_request(mesh, to->nexthop->connection, NULL, "%d %s %s %s -1 -1 -1 %d", ANS_KEY, mesh->self->name, to->name, buf, 0);
 		} else {
-			return send_request(mesh, to->nexthop->connection, NULL, "%d %s %s %d %s", REQ_KEY, mesh->self->name, to->name, REQ_SPTPS, buf);
+			return send_relay_sptps(mesh, to->nexthop->connection, mesh->self, to, data, len);
 		}
 	}
 
@@ -492,6 +537,18 @@ bool send_sptps_data(void *handle, uint8_t type, const void *data, size_t len) {
 		choose_udp_address(mesh, to, &sa, &sock, &sa_buf);
 	}
 
+	to->out_packets++;
+	to->out_udp += len;
+
+	if(mesh->transport) {
+		if(!mesh->transport->send(mesh, &sa->sa, data, len)) {
+			logger(mesh, MESHLINK_WARNING, "Error sending UDP SPTPS packet to %s via virtual transport", to->name);
+			return false;
+		}
+
+		return true;
+	}
+
 	if(sendto(mesh->listen_socket[sock].udp.fd, data, len, 0, &sa->sa, SALEN(sa->sa)) < 0 && !sockwouldblock(sockerrno)) {
 		if(sockmsgsize(sockerrno)) {
 			if(to->maxmtu >= len) {
@@ -548,7 +605,7 @@ bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t
 		inpkt.probe = false;
 	}
 
-	if(type & ~(PKT_COMPRESSED)) {
+	if(type & ~(PKT_COMPRESSED | PKT_COALESCED)) {
 		logger(mesh, MESHLINK_ERROR, "Unexpected SPTPS record type %d len %d from %s", type, len, from->name);
 		return false;
 	}
@@ -560,6 +617,7 @@ bool receive_sptps_record(void *handle, uint8_t type, const void *data, uint16_t
 
 	memcpy(inpkt.data, data, len); // TODO: get rid of memcpy
 	inpkt.len = len;
+	inpkt.coalesced = !!(type & PKT_COALESCED);
 
 	receive_packet(mesh, from, &inpkt);
 	return true;
@@ -619,42 +677,18 @@ static node_t *try_harder(meshlink_handle_t *mesh, const sockaddr_t *from, const
 	return n;
 }
 
-void handle_incoming_vpn_data(event_loop_t *loop, void *data, int flags) {
-	(void)flags;
-	meshlink_handle_t *mesh = loop->data;
-	listen_socket_t *ls = data;
-	vpn_packet_t pkt;
+void handle_incoming_vpn_packet(meshlink_handle_t *mesh, listen_socket_t *ls, vpn_packet_t *pkt, sockaddr_t *from) {
 	char *hostname;
-	sockaddr_t from;
-	socklen_t fromlen = sizeof(from);
-	node_t *n;
-	int len;
-
-	memset(&from, 0, sizeof(from));
-
-	len = recvfrom(ls->udp.fd, pkt.data, MAXSIZE, 0, &from.sa, &fromlen);
-
-	if(len <= 0 || len > MAXSIZE) {
-		if(!sockwouldblock(sockerrno)) {
-			logger(mesh, MESHLINK_ERROR, "Receiving packet failed: %s", sockstrerror(sockerrno));
-		}
-
-		return;
-	}
-
-	pkt.len = len;
-
-	sockaddrunmap(&from); /* Some braindead IPv6 implementations do stupid things. */
-
-	n = lookup_node_udp(mesh, &from);
+	node_t *n = lookup_node_udp(mesh, from);
 
 	if(!n) {
-		n = try_harder(mesh, &from, &pkt);
+		n = try_harder(mesh, from, pkt);
 
 		if(n) {
-			update_node_udp(mesh, n, &from);
+			n->try_harder_hits++;
+			update_node_udp(mesh, n, from);
 		} else if(mesh->log_level <= MESHLINK_WARNING) {
-			hostname = sockaddr2hostname(&from);
+			hostname = sockaddr2hostname(from);
 			logger(mesh, MESHLINK_WARNING, "Received UDP packet from unknown source %s", hostname);
 			free(hostname);
 			return;
@@ -670,5 +704,123 @@ void handle_incoming_vpn_data(event_loop_t *loop, void *data, int flags) {
 
 	n->sock = ls - mesh->listen_socket;
 
-	receive_udppacket(mesh, n, &pkt);
+	receive_udppacket(mesh, n, pkt);
+}
+
+/* Handle a packet received by a UDP shard thread, which does not hold the lock.
+   The lock is only held while looking up the node, the packet is then decrypted without it,
+   so multiple shards can decrypt packets in parallel. Everything else, like the replay window,
+   routing, UTCP and the application's callbacks, is handed over to MeshLink's own thread.
+   Since the kernel distributes packets over the shards based on the source address, packets from a given node
+   are normally handled by the same shard, and they are handed over in the order they arrived. */
+void handle_sharded_vpn_packet(meshlink_handle_t *mesh, shard_t *shard, vpn_packet_t *pkt, sockaddr_t *from) {
+	shard_item_t *item = xzalloc(sizeof(*item) + pkt->len);
+	item->shard = shard;
+	item->from = *from;
+	item->len = pkt->len;
+	memcpy(item->data, pkt->data, pkt->len);
+
+	meshlink_lock(mesh);
+
+	shard->in_packets++;
+
+	if(mesh->shard_queued >= SHARD_QUEUE_MAX) {
+		// MeshLink's own thread cannot keep up, treat this like a full socket buffer
+		meshlink_unlock(mesh);
+		free(item);
+		return;
+	}
+
+	mesh->shard_queued++;
+
+	node_t *n = lookup_node_udp(mesh, from);
+
+	// Let the regular code deal with anything unusual
+	if(n && !n->status.blacklisted && n->status.reachable && sptps_prepare_open(&n->sptps, item->len, shard->cipher)) {
+		item->node = n;
+		item->generation = n->sptps.generation;
+		item->inkey = n->sptps.inkey;
+	}
+
+	meshlink_unlock(mesh);
+
+	if(item->node) {
+		item->verified = sptps_open_datagram(shard->cipher, item->data, item->len);
+	}
+
+	if(!meshlink_queue_push(&mesh->shard_queue, item)) {
+		abort();
+	}
+
+	signal_trigger(&mesh->loop, &mesh->shard_signal);
+}
+
+/* Handle the packets handed over by the UDP shards. */
+void handle_shard_queue(event_loop_t *loop, void *data) {
+	(void)loop;
+	meshlink_handle_t *mesh = data;
+
+	for(shard_item_t *item; (item = meshlink_queue_pop(&mesh->shard_queue));) {
+		mesh->shard_queued--;
+
+		listen_socket_t *ls = item->shard->ls;
+		node_t *n = item->node;
+
+		if(!n) {
+			vpn_packet_t pkt;
+			pkt.len = item->len;
+			memcpy(pkt.data, item->data, item->len);
+			handle_incoming_vpn_packet(mesh, ls, &pkt, &item->from);
+		} else if(lookup_node_udp(mesh, &item->from) != n || n->sptps.generation != item->generation) {
+			// The node might have been forgotten or restarted its session in the mean time
+			logger(mesh, MESHLINK_DEBUG, "Dropping SPTPS datagram from a previous session");
+		} else {
+			n->sock = ls - mesh->listen_socket;
+			n->in_packets++;
+			n->in_udp += item->len;
+
+			if(!sptps_receive_opened_datagram(&n->sptps, item->inkey, item->verified, item->data, item->len)) {
+				logger(mesh, MESHLINK_ERROR, "Could not process SPTPS data from %s: %s", n->name, strerror(errno));
+			} else {
+				item->shard->handled_packets++;
+			}
+		}
+
+		free(item);
+	}
+}
+
+void handle_incoming_vpn_data(event_loop_t *loop, void *data, int flags) {
+	(void)flags;
+	meshlink_handle_t *mesh = loop->data;
+	listen_socket_t *ls = data;
+	vpn_packet_t pkt;
+	sockaddr_t from;
+	socklen_t fromlen;
+	int len;
+
+	/* With the crypto worker pool enabled, read a batch of packets at once,
+	   so the workers can decrypt them in parallel. */
+	int batch = mesh->crypto_pool ? VPN_READ_BATCH : 1;
+
+	for(int i = 0; i < batch; i++) {
+		memset(&from, 0, sizeof(from));
+		fromlen = sizeof(from);
+
+		len = recvfrom(ls->udp.fd, pkt.data, MAXSIZE, 0, &from.sa, &fromlen);
+
+		if(len <= 0 || len > MAXSIZE) {
+			if(!sockwouldblock(sockerrno)) {
+				logger(mesh, MESHLINK_ERROR, "Receiving packet failed: %s", sockstrerror(sockerrno));
+			}
+
+			return;
+		}
+
+		pkt.len = len;
+
+		sockaddrunmap(&from); /* Some braindead IPv6 implementations do stupid things. */
+
+		handle_incoming_vpn_packet(mesh, ls, &pkt, &from);
+	}
 }
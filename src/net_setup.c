@@ -132,6 +132,8 @@ bool node_read_public_key(meshlink_handle_t *mesh, node_t *n) {
 		n->last_unreachable = last_unreachable;
 	}
 
+	update_node_snapshot(n);
+
 	config_free(&config);
 	return true;
 }
@@ -429,6 +431,20 @@ int setup_udp_listen_socket(meshlink_handle_t *mesh, const struct addrinfo *aip)
 	setsockopt(nfd, SOL_SOCKET, SO_REUSEADDR, (void *)&option, sizeof(option));
 	setsockopt(nfd, SOL_SOCKET, SO_BROADCAST, (void *)&option, sizeof(option));
 
+	/* Make room for bursts from several channels at once, the default is easily overrun */
+	int bufsize = UDP_SOCKET_BUFFER_SIZE;
+	setsockopt(nfd, SOL_SOCKET, SO_RCVBUF, (void *)&bufsize, sizeof(bufsize));
+	setsockopt(nfd, SOL_SOCKET, SO_SNDBUF, (void *)&bufsize, sizeof(bufsize));
+
+#ifdef SO_REUSEPORT
+
+	// UDP shards bind additional sockets to the same address
+	if(mesh->udp_shards) {
+		setsockopt(nfd, SOL_SOCKET, SO_REUSEPORT, (void *)&option, sizeof(option));
+	}
+
+#endif
+
 #if defined(IPV6_V6ONLY)
 
 	if(aip->ai_family == AF_INET6) {
@@ -578,6 +594,8 @@ static bool add_listen_sockets(meshlink_handle_t *mesh) {
 */
 static bool setup_myself(meshlink_handle_t *mesh) {
 	mesh->self->nexthop = mesh->self;
+	mesh->self->prevedge = NULL;
+	mesh->self->distance = 0;
 
 	node_add(mesh, mesh->self);
 
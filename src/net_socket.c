@@ -22,6 +22,7 @@
 #include "adns.h"
 #include "conf.h"
 #include "connection.h"
+#include "devtools.h"
 #include "list.h"
 #include "logger.h"
 #include "meshlink_internal.h"
@@ -151,7 +152,7 @@ void flush_meta(meshlink_handle_t *mesh, connection_t *c) {
 	handle_meta_write(mesh, c);
 }
 
-static void handle_meta_io(event_loop_t *loop, void *data, int flags) {
+void handle_meta_io(event_loop_t *loop, void *data, int flags) {
 	meshlink_handle_t *mesh = loop->data;
 	connection_t *c = data;
 
@@ -402,7 +403,11 @@ begin:
 		free(hostname);
 	}
 
-	c->socket = socket(c->address.sa.sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if(mesh->transport) {
+		c->socket = mesh->transport->connect(mesh, &c->address.sa);
+	} else {
+		c->socket = socket(c->address.sa.sa_family, SOCK_STREAM, IPPROTO_TCP);
+	}
 
 	if(c->socket == -1) {
 		if(mesh->log_level <= MESHLINK_ERROR) {
@@ -432,7 +437,7 @@ begin:
 
 	/* Connect */
 
-	int result = connect(c->socket, &c->address.sa, SALEN(c->address.sa));
+	int result = mesh->transport ? 0 : connect(c->socket, &c->address.sa, SALEN(c->address.sa));
 
 	if(result == -1 && !sockinprogress(sockerrno)) {
 		if(mesh->log_level <= MESHLINK_ERROR) {
@@ -515,35 +520,7 @@ static void tarpit(meshlink_handle_t *mesh, int fd) {
   accept a new tcp connect and create a
   new connection
 */
-void handle_new_meta_connection(event_loop_t *loop, void *data, int flags) {
-	(void)flags;
-	meshlink_handle_t *mesh = loop->data;
-	listen_socket_t *l = data;
-	connection_t *c;
-	sockaddr_t sa;
-	int fd;
-	socklen_t len = sizeof(sa);
-
-	memset(&sa, 0, sizeof(sa));
-
-	fd = accept(l->tcp.fd, &sa.sa, &len);
-
-	if(fd < 0) {
-		if(sockwouldblock(errno)) {
-			return;
-		}
-
-		if(errno == EINVAL) { // TODO: check if Windows agrees
-			event_loop_stop(loop);
-			return;
-		}
-
-		logger(mesh, MESHLINK_ERROR, "Accepting a new connection failed: %s", sockstrerror(sockerrno));
-		return;
-	}
-
-	sockaddrunmap(&sa);
-
+static void accept_meta_connection(meshlink_handle_t *mesh, int fd, const sockaddr_t *sa) {
 	/* Rate limit incoming connections to max_connection_burst/second. */
 
 	if(mesh->loop.now.tv_sec != mesh->connection_burst_time) {
@@ -560,14 +537,14 @@ void handle_new_meta_connection(event_loop_t *loop, void *data, int flags) {
 
 	// Accept the new connection
 
-	c = new_connection();
+	connection_t *c = new_connection();
 	c->name = xstrdup("<unknown>");
 
-	c->address = sa;
+	c->address = *sa;
 	c->socket = fd;
 	c->last_ping_time = mesh->loop.now.tv_sec;
 
-	char *hostname = sockaddr2hostname(&sa);
+	char *hostname = sockaddr2hostname(sa);
 	logger(mesh, MESHLINK_INFO, "Connection from %s", hostname);
 	free(hostname);
 
@@ -581,6 +558,56 @@ void handle_new_meta_connection(event_loop_t *loop, void *data, int flags) {
 	send_id(mesh, c);
 }
 
+void handle_new_meta_connection(event_loop_t *loop, void *data, int flags) {
+	(void)flags;
+	meshlink_handle_t *mesh = loop->data;
+	listen_socket_t *l = data;
+	sockaddr_t sa;
+	int fd;
+	socklen_t len = sizeof(sa);
+
+	memset(&sa, 0, sizeof(sa));
+
+	fd = accept(l->tcp.fd, &sa.sa, &len);
+
+	if(fd < 0) {
+		if(sockwouldblock(errno)) {
+			return;
+		}
+
+		if(errno == EINVAL) { // TODO: check if Windows agrees
+			event_loop_stop(loop);
+			return;
+		}
+
+		logger(mesh, MESHLINK_ERROR, "Accepting a new connection failed: %s", sockstrerror(sockerrno));
+		return;
+	}
+
+	sockaddrunmap(&sa);
+
+	accept_meta_connection(mesh, fd, &sa);
+}
+
+/* Handle packets and connections injected by a virtual transport. */
+void handle_transport_queue(event_loop_t *loop, void *data) {
+	(void)loop;
+	meshlink_handle_t *mesh = data;
+
+	for(transport_item_t *item; (item = meshlink_queue_pop(&mesh->transport_queue));) {
+		if(item->fd != -1) {
+			accept_meta_connection(mesh, item->fd, &item->from);
+		} else {
+			vpn_packet_t pkt;
+			pkt.len = item->len;
+			memcpy(pkt.data, item->data, item->len);
+			handle_incoming_vpn_packet(mesh, &mesh->listen_socket[0], &pkt, &item->from);
+		}
+
+		free(item);
+	}
+}
+
 static void free_outgoing(outgoing_t *outgoing) {
 	meshlink_handle_t *mesh = outgoing->node->mesh;
 
@@ -19,6 +19,8 @@
 
 #include "system.h"
 
+#include "crypto_pool.h"
+#include "graph.h"
 #include "hash.h"
 #include "logger.h"
 #include "meshlink_internal.h"
@@ -33,12 +35,62 @@ static int node_compare(const node_t *a, const node_t *b) {
 	return strcmp(a->name, b->name);
 }
 
+// last_successfull_connection desc, nodes we never connected to first
+static int node_compare_lsc_desc(const node_t *a, const node_t *b) {
+	if(a->last_successfull_connection != b->last_successfull_connection) {
+		if(!a->last_successfull_connection) {
+			return -1;
+		}
+
+		if(!b->last_successfull_connection) {
+			return 1;
+		}
+
+		return a->last_successfull_connection > b->last_successfull_connection ? -1 : 1;
+	}
+
+	return node_compare(a, b);
+}
+
+// last_connect_try asc
+static int node_compare_last_connect_try(const node_t *a, const node_t *b) {
+	if(a->last_connect_try != b->last_connect_try) {
+		return a->last_connect_try < b->last_connect_try ? -1 : 1;
+	}
+
+	return node_compare(a, b);
+}
+
 void init_nodes(meshlink_handle_t *mesh) {
 	mesh->nodes = splay_alloc_tree((splay_compare_t) node_compare, (splay_action_t) free_node);
 	mesh->node_udp_cache = hash_alloc(0x100, sizeof(sockaddr_t));
+
+	for(int i = 0; i < DEV_CLASS_COUNT; i++) {
+		for(int j = 0; j < 2; j++) {
+			mesh->autoconnect_candidates[i][j] = splay_alloc_tree((splay_compare_t) node_compare_lsc_desc, NULL);
+		}
+	}
+
+	mesh->autoconnect_backoff = splay_alloc_tree((splay_compare_t) node_compare_last_connect_try, NULL);
 }
 
 void exit_nodes(meshlink_handle_t *mesh) {
+	for(int i = 0; i < DEV_CLASS_COUNT; i++) {
+		for(int j = 0; j < 2; j++) {
+			if(mesh->autoconnect_candidates[i][j]) {
+				splay_delete_tree(mesh->autoconnect_candidates[i][j]);
+			}
+
+			mesh->autoconnect_candidates[i][j] = NULL;
+		}
+	}
+
+	if(mesh->autoconnect_backoff) {
+		splay_delete_tree(mesh->autoconnect_backoff);
+	}
+
+	mesh->autoconnect_backoff = NULL;
+
 	if(mesh->node_udp_cache) {
 		hash_free(mesh->node_udp_cache);
 	}
@@ -49,6 +101,8 @@ void exit_nodes(meshlink_handle_t *mesh) {
 
 	mesh->node_udp_cache = NULL;
 	mesh->nodes = NULL;
+	mesh->graph_dirty = NULL;
+	mesh->nreachable = 0;
 }
 
 node_t *new_node(void) {
@@ -58,6 +112,8 @@ node_t *new_node(void) {
 	n->mtu = MTU;
 	n->maxmtu = MTU;
 	n->devclass = DEV_CLASS_UNKNOWN;
+	n->distance = -1;
+	update_node_snapshot(n);
 
 	return n;
 }
@@ -65,7 +121,12 @@ node_t *new_node(void) {
 void free_node(node_t *n) {
 	n->status.destroyed = true;
 
+	if(n->mesh) {
+		crypto_pool_forget_node(n->mesh, n);
+	}
+
 	utcp_exit(n->utcp);
+	free(n->coalesce_packet);
 
 	if(n->edge_tree) {
 		free_edge_tree(n->edge_tree);
@@ -89,16 +150,25 @@ void free_node(node_t *n) {
 
 void node_add(meshlink_handle_t *mesh, node_t *n) {
 	n->mesh = mesh;
+	update_node_snapshot(n);
 	splay_insert(mesh->nodes, n);
+	update_node_autoconnect(mesh, n);
 }
 
 void node_del(meshlink_handle_t *mesh, node_t *n) {
 	timeout_del(&mesh->loop, &n->mtutimeout);
 
+	if(n->autoconnect_node) {
+		splay_delete_node(n->autoconnect_tree, n->autoconnect_node);
+		n->autoconnect_tree = NULL;
+		n->autoconnect_node = NULL;
+	}
+
 	for splay_each(edge_t, e, n->edge_tree) {
 		edge_del(mesh, e);
 	}
 
+	graph_forget_node(mesh, n);
 	splay_delete(mesh->nodes, n);
 }
 
@@ -174,3 +244,78 @@ bool node_add_recent_address(meshlink_handle_t *mesh, node_t *n, const sockaddr_
 	n->status.dirty = true;
 	return !found;
 }
+
+/* Must be called with the mesh lock held whenever one of the fields in node_snapshot_t might have changed. */
+void update_node_snapshot(node_t *n) {
+	node_snapshot_t snapshot;
+	memset(&snapshot, 0, sizeof(snapshot));
+
+	snapshot.reachable = n->status.reachable;
+	snapshot.blacklisted = n->status.blacklisted;
+	snapshot.tiny = n->status.tiny;
+	snapshot.devclass = n->devclass;
+	snapshot.last_reachable = n->last_reachable;
+	snapshot.last_unreachable = n->last_unreachable;
+
+	if(!n->status.reachable) {
+		snapshot.pmtu = 0;
+	} else if(n->mtuprobes > 30 && n->minmtu) {
+		snapshot.pmtu = n->minmtu;
+	} else {
+		snapshot.pmtu = MTU;
+	}
+
+	if(!memcmp(&snapshot, &n->snapshot, sizeof(snapshot))) {
+		return;
+	}
+
+#ifdef HAVE_STDATOMIC_H
+	unsigned int seq = atomic_load_explicit(&n->snapshot_seq, memory_order_relaxed);
+	atomic_store_explicit(&n->snapshot_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&n->snapshot, &snapshot, sizeof(snapshot));
+	atomic_store_explicit(&n->snapshot_seq, seq + 2, memory_order_release);
+#else
+	memcpy(&n->snapshot, &snapshot, sizeof(snapshot));
+#endif
+}
+
+void read_node_snapshot(meshlink_handle_t *mesh, node_t *n, node_snapshot_t *snapshot) {
+#ifdef HAVE_STDATOMIC_H
+	(void)mesh;
+	unsigned int seq;
+
+	do {
+		seq = atomic_load_explicit(&n->snapshot_seq, memory_order_acquire);
+		memcpy(snapshot, &n->snapshot, sizeof(*snapshot));
+		atomic_thread_fence(memory_order_acquire);
+	} while((seq & 1) || seq != atomic_load_explicit(&n->snapshot_seq, memory_order_relaxed));
+
+#else
+	meshlink_lock(mesh);
+	memcpy(snapshot, &n->snapshot, sizeof(*snapshot));
+	meshlink_unlock(mesh);
+#endif
+}
+
+/* Move a node to the autoconnect index matching its current state.
+   This has to be called whenever anything the autoconnect algorithm selects nodes on changes. */
+void update_node_autoconnect(meshlink_handle_t *mesh, node_t *n) {
+	if(n->autoconnect_node) {
+		splay_delete_node(n->autoconnect_tree, n->autoconnect_node);
+		n->autoconnect_tree = NULL;
+		n->autoconnect_node = NULL;
+	}
+
+	if(n == mesh->self || n->connection || n->status.blacklisted || n->devclass >= DEV_CLASS_COUNT) {
+		return;
+	}
+
+	if(n->last_connect_try && mesh->loop.now.tv_sec - n->last_connect_try <= mesh->autoconnect_retry_timeout) {
+		n->autoconnect_tree = mesh->autoconnect_backoff;
+	} else {
+		n->autoconnect_tree = mesh->autoconnect_candidates[n->devclass][n->status.reachable];
+	}
+
+	n->autoconnect_node = splay_insert(n->autoconnect_tree, n);
+}
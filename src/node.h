@@ -39,10 +39,24 @@ typedef struct node_status_t {
 	uint16_t dirty: 1;                  /* 1 if the configuration of the node is dirty and needs to be written out */
 	uint16_t want_udp: 1;               /* 1 if we want working UDP because we have data to send */
 	uint16_t tiny: 1;                   /* 1 if this is a tiny node */
+	uint16_t graph_dirty: 1;            /* 1 if this node is in the list of nodes graph() has to check */
+	uint16_t hop_routing: 1;            /* 1 if this node is reachable and only routes on hop counts */
 } node_status_t;
 
 #define MAX_RECENT 5
 
+/* The part of the node state that is returned by the read-only API functions.
+ * It is published with a seqlock, so it can be read without taking the mesh lock. */
+typedef struct node_snapshot_t {
+	bool reachable;
+	bool blacklisted;
+	bool tiny;
+	dev_class_t devclass;
+	uint16_t pmtu;
+	time_t last_reachable;
+	time_t last_unreachable;
+} node_snapshot_t;
+
 typedef struct node_t {
 	// Public member variables
 	char *name;                             /* name of this node */
@@ -52,14 +66,18 @@ typedef struct node_t {
 	node_status_t status;
 	uint16_t minmtu;                        /* Probed minimum MTU */
 	dev_class_t devclass;
+	uint32_t options;                       /* Options of this node, learned from the edge we reach it through */
 
 	// Used for packet I/O
 	int sock;                               /* Socket to use for outgoing UDP packets */
 	uint32_t session_id;                    /* Unique ID for this node's currently running process */
 	sptps_t sptps;
 	sockaddr_t address;                     /* his real (internet) ip to send UDP packets to */
+	unsigned int pending_seals;             /* Records for this node the crypto pool has not sent yet */
 
 	struct utcp *utcp;
+	struct vpn_packet_t *coalesce_packet;   /* UTCP segments waiting to be sent as a single packet */
+	int coalesced_segments;                 /* Number of segments in coalesce_packet */
 
 	// Traffic counters
 	uint64_t in_data;                       /* Bytes received from channels */
@@ -68,6 +86,13 @@ typedef struct node_t {
 	uint64_t out_forward;                   /* Bytes forwarded from channel from other nodes */
 	uint64_t in_meta;                       /* Bytes received from meta-connections, heartbeat packets etc. */
 	uint64_t out_meta;                      /* Bytes sent on meta-connections, heartbeat packets etc. */
+	uint64_t in_packets;                    /* SPTPS packets received via UDP */
+	uint64_t out_packets;                   /* SPTPS packets sent via UDP */
+	uint64_t in_udp;                        /* Bytes of SPTPS packets received via UDP */
+	uint64_t out_udp;                       /* Bytes of SPTPS packets sent via UDP */
+	uint64_t in_relayed;                    /* Bytes of SPTPS packets received via meta-connections */
+	uint64_t out_relayed;                   /* Bytes of SPTPS packets sent via meta-connections */
+	uint64_t try_harder_hits;               /* UDP packets from an unknown address that were matched to this node */
 
 	// MTU probes
 	timeout_t mtutimeout;                   /* Probe event */
@@ -86,6 +111,8 @@ typedef struct node_t {
 	struct connection_t *connection;        /* Connection associated with this node (if a direct connection exists) */
 	time_t last_connect_try;
 	time_t last_successfull_connection;
+	struct splay_tree_t *autoconnect_tree;  /* The autoconnect index this node is in, if any */
+	struct splay_node_t *autoconnect_node;  /* Position of this node in autoconnect_tree */
 
 	char *canonical_address;                /* The canonical address of this node, if known */
 	char *external_ip_address;              /* The external IP address of this node, if known */
@@ -99,8 +126,17 @@ typedef struct node_t {
 	int distance;
 	struct node_t *nexthop;                 /* nearest node from us to him */
 	struct edge_t *prevedge;                /* nearest node from him to us */
+	struct node_t *graph_next;              /* next node in the list of nodes graph() has to check */
+	struct node_t *mst_parent;              /* union-find parent used while computing the minimum spanning tree */
 
 	struct splay_tree_t *edge_tree;         /* Edges with this node as one of the endpoints */
+	uint64_t edge_digest;                   /* XOR of the digests of all edges in edge_tree */
+
+	// State published for the read-only API functions
+#ifdef HAVE_STDATOMIC_H
+	atomic_uint snapshot_seq;               /* Odd while the snapshot is being updated */
+#endif
+	node_snapshot_t snapshot;
 } node_t;
 
 void init_nodes(struct meshlink_handle *mesh);
@@ -113,5 +149,8 @@ node_t *lookup_node(struct meshlink_handle *mesh, const char *name) __attribute_
 node_t *lookup_node_udp(struct meshlink_handle *mesh, const sockaddr_t *sa) __attribute__((__warn_unused_result__));
 void update_node_udp(struct meshlink_handle *mesh, node_t *n, const sockaddr_t *sa);
 bool node_add_recent_address(struct meshlink_handle *mesh, node_t *n, const sockaddr_t *addr);
+void update_node_snapshot(node_t *n);
+void update_node_autoconnect(struct meshlink_handle *mesh, node_t *n);
+void read_node_snapshot(struct meshlink_handle *mesh, node_t *n, node_snapshot_t *snapshot);
 
 #endif
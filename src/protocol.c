@@ -20,10 +20,13 @@
 #include "system.h"
 
 #include "conf.h"
+#include "ed25519/sha512.h"
 #include "connection.h"
+#include "graph.h"
 #include "logger.h"
 #include "meshlink_internal.h"
 #include "meta.h"
+#include "packmsg.h"
 #include "protocol.h"
 #include "utils.h"
 #include "xalloc.h"
@@ -45,6 +48,16 @@ static bool (*request_handlers[NUM_REQUESTS])(meshlink_handle_t *, connection_t
 	[REQ_KEY] = req_key_h,
 	[ANS_KEY] = ans_key_h,
 	[PACKET] = raw_packet_h,
+	[TOPOLOGY_DIGEST] = topology_digest_h,
+	[NODE_DIGEST] = node_digest_h,
+};
+
+/* Jumptable for the handlers of requests that can also be sent in binary form */
+
+static bool (*binary_request_handlers[NUM_REQUESTS])(meshlink_handle_t *, connection_t *, const void *, uint32_t) = {
+	[ADD_EDGE] = add_edge_b,
+	[DEL_EDGE] = del_edge_b,
+	[RELAY_SPTPS] = relay_sptps_b,
 };
 
 /* Request names */
@@ -63,6 +76,9 @@ static const char *request_name[NUM_REQUESTS] = {
 	[REQ_KEY] = "REQ_KEY",
 	[ANS_KEY] = "ANS_KEY",
 	[PACKET] = "PACKET",
+	[TOPOLOGY_DIGEST] = "TOPOLOGY_DIGEST",
+	[NODE_DIGEST] = "NODE_DIGEST",
+	[RELAY_SPTPS] = "RELAY_SPTPS",
 };
 
 bool check_id(const char *id) {
@@ -164,6 +180,12 @@ bool receive_request(meshlink_handle_t *mesh, connection_t *c, const char *reque
 			return false;
 		}
 
+		/* Only edge updates may be coalesced, everything else should see a settled graph */
+
+		if(mesh->graph_dirty && reqno != ADD_EDGE && reqno != DEL_EDGE) {
+			graph(mesh);
+		}
+
 		if(!request_handlers[reqno](mesh, c, request)) {
 			/* Something went wrong. Probably scriptkiddies. Terminate. */
 
@@ -178,84 +200,240 @@ bool receive_request(meshlink_handle_t *mesh, connection_t *c, const char *reque
 	return true;
 }
 
-static int past_request_compare(const past_request_t *a, const past_request_t *b) {
-	return strcmp(a->request, b->request);
+/* Send one request that has both a binary and a text form to c. The text form is only generated the first time it is needed,
+   request and len keep it around for the next connection. */
+static bool send_dual_one(meshlink_handle_t *mesh, connection_t *c, const connection_t *from, request_t reqno, const void *binary, uint32_t binlen, const char *text, request_format_t format, const void *arg, char *request, int *len) {
+	if(binlen && c->status.binary) {
+		logger(mesh, MESHLINK_DEBUG, "%s %s to %s (binary)", from ? "Forwarding" : "Sending", request_name[reqno], c->name);
+		return sptps_send_record(&c->sptps, META_BINARY, binary, binlen);
+	}
+
+	if(!*len) {
+		*len = text ? snprintf(request, MAXBUFSIZE, "%s", text) : format(arg, request, MAXBUFSIZE);
+
+		if(*len <= 0 || *len > MAXBUFSIZE - 1) {
+			logger(mesh, MESHLINK_ERROR, "Output buffer overflow while sending request to %s", c->name);
+			*len = 0;
+			return false;
+		}
+
+		request[(*len)++] = '\n';
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "%s %s to %s: %.*s", from ? "Forwarding" : "Sending", request_name[reqno], c->name, *len - 1, request);
+	return send_meta(mesh, c, request, *len);
+}
+
+/* Send a request that has both a binary and a text form. Connections with peers that understand binary requests get the binary form,
+   the text form is only generated if it is needed for any of the other peers. If the binary form is not available, everyone gets the text form.
+   If to is NULL or mesh->everyone, the request is broadcast to all active connections except from, like forward_request() does. */
+bool send_dual_request(meshlink_handle_t *mesh, connection_t *to, connection_t *from, const submesh_t *s, request_t reqno, const void *binary, uint32_t binlen, const char *text, request_format_t format, const void *arg) {
+	assert(text || format);
+
+	char request[MAXBUFSIZE];
+	int len = 0;
+
+	if(to && to != mesh->everyone) {
+		return send_dual_one(mesh, to, from, reqno, binary, binlen, text, format, arg, request, &len);
+	}
+
+	bool result = true;
+	bool mst = !s && mst_broadcast(mesh, from);
+
+	/* Requests for a submesh only go to the active connections with nodes in the core mesh and in that submesh */
+
+	list_t *indexes[] = {mesh->connections, NULL};
+
+	if(s) {
+		indexes[0] = mesh->core_connections;
+		indexes[1] = s->connections;
+	}
+
+	for(int i = 0; i < 2 && indexes[i]; i++) {
+		for list_each(connection_t, c, indexes[i]) {
+			if(c == from || !c->status.active || (c->flags & PROTOCOL_TINY) || (mst && !c->status.mst)) {
+				continue;
+			}
+
+			result &= send_dual_one(mesh, c, from, reqno, binary, binlen, text, format, arg, request, &len);
+		}
+	}
+
+	return result;
 }
 
-static void free_past_request(past_request_t *r) {
-	if(r->request) {
-		free((void *)r->request);
+bool receive_binary_request(meshlink_handle_t *mesh, connection_t *c, const void *data, uint32_t len) {
+	assert(data);
+
+	packmsg_input_t in = {data, len};
+	uint8_t reqno = packmsg_get_uint8(&in);
+
+	if(!packmsg_input_ok(&in) || reqno >= NUM_REQUESTS || !binary_request_handlers[reqno]) {
+		logger(mesh, MESHLINK_DEBUG, "Unknown binary request from %s", c->name);
+		return false;
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "Got %s from %s (binary)", request_name[reqno], c->name);
+
+	if(c->allow_request != ALL) {
+		logger(mesh, MESHLINK_ERROR, "Unauthorized request from %s", c->name);
+		return false;
 	}
 
-	free(r);
+	if(!binary_request_handlers[reqno](mesh, c, data, len)) {
+		logger(mesh, MESHLINK_ERROR, "Error while processing %s from %s", request_name[reqno], c->name);
+		return false;
+	}
+
+	return true;
 }
 
+/* Requests have to be remembered for at least request_timeout seconds,
+   so the oldest slice is only dropped after PAST_REQUEST_SLICES - 1 newer slices have started. */
+
 static const int request_timeout = 60;
 
-static void age_past_requests(event_loop_t *loop, void *data) {
-	(void)data;
-	meshlink_handle_t *mesh = loop->data;
-	int left = 0, deleted = 0;
+#define PAST_REQUEST_MIN_SIZE 256
 
-	for splay_each(past_request_t, p, mesh->past_request_tree) {
-		if(p->firstseen + request_timeout <= mesh->loop.now.tv_sec) {
-			splay_delete_node(mesh->past_request_tree, splay_node), deleted++;
-		} else {
-			left++;
+static void past_request_digest(const void *request, size_t len, uint64_t digest[2]) {
+	uint8_t hash[64];
+	sha512(request, len, hash);
+	memcpy(digest, hash, 2 * sizeof(*digest));
+
+	/* All zeroes marks an empty slot */
+	if(!digest[0] && !digest[1]) {
+		digest[0] = 1;
+	}
+}
+
+static uint32_t past_request_find(const past_request_set_t *set, const uint64_t digest[2]) {
+	uint32_t mask = set->size - 1;
+	uint32_t i = digest[0] & mask;
+
+	while(set->digests[i][0] || set->digests[i][1]) {
+		if(set->digests[i][0] == digest[0] && set->digests[i][1] == digest[1]) {
+			break;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	return i;
+}
+
+static void past_request_resize(past_request_set_t *set, uint32_t size) {
+	uint64_t (*old)[2] = set->digests;
+	uint32_t oldsize = set->size;
+
+	set->digests = xzalloc(size * sizeof(*set->digests));
+	set->size = size;
+
+	for(uint32_t i = 0; i < oldsize; i++) {
+		if(old[i][0] || old[i][1]) {
+			uint32_t j = past_request_find(set, old[i]);
+			set->digests[j][0] = old[i][0];
+			set->digests[j][1] = old[i][1];
 		}
 	}
 
-	if(left || deleted) {
-		logger(mesh, MESHLINK_DEBUG, "Aging past requests: deleted %d, left %d", deleted, left);
+	free(old);
+}
+
+static void clear_past_requests(meshlink_handle_t *mesh, past_request_set_t *set) {
+	if(set->count) {
+		logger(mesh, MESHLINK_DEBUG, "Aging past requests: deleted %u", set->count);
 	}
 
-	if(left) {
-		timeout_set(&mesh->loop, &mesh->past_request_timeout, &(struct timespec) {
-			10, prng(mesh, TIMER_FUDGE)
-		});
+	/* A set that grew during a burst of requests shrinks back to its minimum size */
+
+	if(set->size > PAST_REQUEST_MIN_SIZE) {
+		free(set->digests);
+		set->digests = xzalloc(PAST_REQUEST_MIN_SIZE * sizeof(*set->digests));
+		set->size = PAST_REQUEST_MIN_SIZE;
+	} else if(set->count) {
+		memset(set->digests, 0, set->size * sizeof(*set->digests));
 	}
+
+	set->count = 0;
 }
 
-bool seen_request(meshlink_handle_t *mesh, const char *request) {
+/* Start a new slice of time, and clear the sets that have become too old. */
+static void age_past_requests(meshlink_handle_t *mesh, time_t slice) {
+	for(int i = 0; i < PAST_REQUEST_SLICES; i++) {
+		past_request_set_t *set = &mesh->past_requests[i];
+
+		if(set->count && set->slice <= slice - PAST_REQUEST_SLICES) {
+			clear_past_requests(mesh, set);
+		}
+	}
+
+	past_request_set_t *current = &mesh->past_requests[slice % PAST_REQUEST_SLICES];
+	clear_past_requests(mesh, current);
+	current->slice = slice;
+}
+
+bool seen_request(meshlink_handle_t *mesh, const void *request, size_t len) {
 	assert(request);
-	assert(*request);
+	assert(len);
 
-	past_request_t *new, p = {.request = request};
+	uint64_t digest[2];
+	past_request_digest(request, len, digest);
 
-	if(splay_search(mesh->past_request_tree, &p)) {
-		logger(mesh, MESHLINK_DEBUG, "Already seen request");
-		return true;
-	} else {
-		new = xmalloc(sizeof(*new));
-		new->request = xstrdup(request);
-		new->firstseen = mesh->loop.now.tv_sec;
-
-		if(!mesh->past_request_tree->head && mesh->past_request_timeout.cb) {
-			timeout_set(&mesh->loop, &mesh->past_request_timeout, &(struct timespec) {
-				10, prng(mesh, TIMER_FUDGE)
-			});
+	time_t slice = mesh->loop.now.tv_sec / (request_timeout / (PAST_REQUEST_SLICES - 1));
+	past_request_set_t *current = &mesh->past_requests[slice % PAST_REQUEST_SLICES];
+
+	if(current->slice != slice) {
+		age_past_requests(mesh, slice);
+	}
+
+	for(int i = 0; i < PAST_REQUEST_SLICES; i++) {
+		past_request_set_t *set = &mesh->past_requests[i];
+
+		if(!set->count) {
+			continue;
 		}
 
-		splay_insert(mesh->past_request_tree, new);
-		return false;
+		uint32_t j = past_request_find(set, digest);
+
+		if(set->digests[j][0] || set->digests[j][1]) {
+			logger(mesh, MESHLINK_DEBUG, "Already seen request");
+			return true;
+		}
 	}
+
+	/* Keep the load factor below 50% */
+
+	if(2 * (current->count + 1) > current->size) {
+		past_request_resize(current, 2 * current->size);
+	}
+
+	uint32_t j = past_request_find(current, digest);
+	current->digests[j][0] = digest[0];
+	current->digests[j][1] = digest[1];
+	current->count++;
+
+	return false;
 }
 
 void init_requests(meshlink_handle_t *mesh) {
-	assert(!mesh->past_request_tree);
+	assert(!mesh->past_requests);
 
-	mesh->past_request_tree = splay_alloc_tree((splay_compare_t) past_request_compare, (splay_action_t) free_past_request);
-	timeout_add(&mesh->loop, &mesh->past_request_timeout, age_past_requests, NULL, &(struct timespec) {
-		0, 0
-	});
+	mesh->past_requests = xzalloc(PAST_REQUEST_SLICES * sizeof(*mesh->past_requests));
+
+	for(int i = 0; i < PAST_REQUEST_SLICES; i++) {
+		mesh->past_requests[i].digests = xzalloc(PAST_REQUEST_MIN_SIZE * sizeof(*mesh->past_requests[i].digests));
+		mesh->past_requests[i].size = PAST_REQUEST_MIN_SIZE;
+	}
 }
 
 void exit_requests(meshlink_handle_t *mesh) {
-	if(mesh->past_request_tree) {
-		splay_delete_tree(mesh->past_request_tree);
-	}
+	if(mesh->past_requests) {
+		for(int i = 0; i < PAST_REQUEST_SLICES; i++) {
+			free(mesh->past_requests[i].digests);
+		}
 
-	mesh->past_request_tree = NULL;
+		free(mesh->past_requests);
+	}
 
-	timeout_del(&mesh->loop, &mesh->past_request_timeout);
+	mesh->past_requests = NULL;
 }
@@ -25,7 +25,36 @@
 /* Protocol version. Different major versions are incompatible. */
 
 #define PROT_MAJOR 17
-#define PROT_MINOR 3 /* Should not exceed 255! */
+#define PROT_MINOR 8 /* Should not exceed 255! */
+
+/* Minimum protocol minor version of a node that understands coalesced packets */
+
+#define PROT_MINOR_COALESCED 4
+
+/* Minimum protocol minor version of a node that understands binary requests */
+
+#define PROT_MINOR_BINARY 5
+
+/* Minimum protocol minor version of a node that understands topology digests */
+
+#define PROT_MINOR_SYNC 6
+
+/* Minimum protocol minor version of a node that understands binary relayed SPTPS data */
+
+#define PROT_MINOR_RELAY 7
+
+/* Minimum protocol minor version of a node that routes on edge weights including the RTT, older nodes route on hop counts */
+
+#define PROT_MINOR_RTT 8
+
+/* SPTPS record type used for binary requests on meta-connections, text requests use type 0 */
+
+#define META_BINARY 1
+
+/* A change in the RTT of a meta-connection is only advertised in its edge weight if it is at least this large */
+
+#define RTT_HYSTERESIS_MIN 2 /* milliseconds */
+#define RTT_HYSTERESIS_PERCENT 25
 
 /* Silly Windows */
 
@@ -50,6 +79,8 @@ typedef enum request_t {
 	REQ_SPTPS,
 	REQ_CANONICAL,
 	REQ_EXTERNAL,
+	TOPOLOGY_DIGEST, NODE_DIGEST,
+	RELAY_SPTPS,
 	NUM_REQUESTS
 } request_t;
 
@@ -58,10 +89,21 @@ typedef enum request_error_t {
 	BLACKLISTED = 1,
 } request_error_t;
 
-typedef struct past_request_t {
-	const char *request;
-	time_t firstseen;
-} past_request_t;
+/* Flooded requests we have already seen are remembered by a 128 bit digest.
+ * Each set holds the digests first seen during one slice of time, when a set becomes too old it is simply cleared. */
+
+#define PAST_REQUEST_SLICES 4
+
+typedef struct past_request_set_t {
+	uint64_t (*digests)[2];                 /* open addressing hash table, all zeroes means an empty slot */
+	uint32_t size;                          /* always a power of two */
+	uint32_t count;
+	time_t slice;                           /* the slice of time this set belongs to */
+} past_request_set_t;
+
+/* Generates the text form of a request that also has a binary form, returns the length like snprintf() */
+
+typedef int (*request_format_t)(const void *arg, char *buf, size_t size);
 
 /* Protocol support flags */
 
@@ -84,11 +126,13 @@ static const uint32_t PROTOCOL_TINY = 1; // Peer is using meshlink-tiny
 bool send_request(struct meshlink_handle *mesh, struct connection_t *, const struct submesh_t *s, const char *, ...) __attribute__((__format__(printf, 4, 5)));
 void forward_request(struct meshlink_handle *mesh, struct connection_t *, const struct submesh_t *, const char *);
 bool receive_request(struct meshlink_handle *mesh, struct connection_t *, const char *);
+bool send_dual_request(struct meshlink_handle *mesh, struct connection_t *to, struct connection_t *from, const struct submesh_t *s, request_t reqno, const void *binary, uint32_t binlen, const char *text, request_format_t format, const void *arg);
+bool receive_binary_request(struct meshlink_handle *mesh, struct connection_t *, const void *, uint32_t);
 bool check_id(const char *);
 
 void init_requests(struct meshlink_handle *mesh);
 void exit_requests(struct meshlink_handle *mesh);
-bool seen_request(struct meshlink_handle *mesh, const char *);
+bool seen_request(struct meshlink_handle *mesh, const void *, size_t);
 
 /* Requests */
 
@@ -98,11 +142,14 @@ bool send_error(struct meshlink_handle *mesh, struct connection_t *, request_err
 bool send_ping(struct meshlink_handle *mesh, struct connection_t *);
 bool send_pong(struct meshlink_handle *mesh, struct connection_t *);
 bool send_add_edge(struct meshlink_handle *mesh, struct connection_t *, const struct edge_t *, int contradictions);
+bool broadcast_add_edge(struct meshlink_handle *mesh, struct connection_t *except, const struct edge_t *);
 bool send_del_edge(struct meshlink_handle *mesh, struct connection_t *, const struct edge_t *, int contradictions);
+bool send_topology_digest(struct meshlink_handle *mesh, struct connection_t *);
 bool send_req_key(struct meshlink_handle *mesh, struct node_t *);
 bool send_canonical_address(struct meshlink_handle *mesh, struct node_t *);
 bool send_external_ip_address(struct meshlink_handle *mesh, struct node_t *);
 bool send_raw_packet(struct meshlink_handle *mesh, struct connection_t *, const vpn_packet_t *);
+bool send_relay_sptps(struct meshlink_handle *mesh, struct connection_t *, const struct node_t *from, const struct node_t *to, const void *data, size_t len);
 
 /* Request handlers  */
 
@@ -115,10 +162,18 @@ bool ping_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool pong_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool add_edge_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool del_edge_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
+bool topology_digest_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
+bool node_digest_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool key_changed_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool req_key_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool ans_key_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool tcppacket_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 bool raw_packet_h(struct meshlink_handle *mesh, struct connection_t *, const char *);
 
+/* Binary request handlers */
+
+bool add_edge_b(struct meshlink_handle *mesh, struct connection_t *, const void *, uint32_t);
+bool del_edge_b(struct meshlink_handle *mesh, struct connection_t *, const void *, uint32_t);
+bool relay_sptps_b(struct meshlink_handle *mesh, struct connection_t *, const void *, uint32_t);
+
 #endif
@@ -315,15 +315,22 @@ bool send_ack(meshlink_handle_t *mesh, connection_t *c) {
 	}
 
 	c->last_ping_time = mesh->loop.now.tv_sec;
-	return send_request(mesh, c, NULL, "%d %s %d %x", ACK, mesh->myport, mesh->devclass, OPTION_PMTU_DISCOVERY | (PROT_MINOR << 24));
+	int minor = mesh->meta_text_only ? PROT_MINOR_BINARY - 1 : PROT_MINOR;
+	return send_request(mesh, c, NULL, "%d %s %d %x", ACK, mesh->myport, mesh->devclass, OPTION_PMTU_DISCOVERY | (minor << 24));
 }
 
 static void send_everything(meshlink_handle_t *mesh, connection_t *c) {
-	/* Send all known subnets and edges */
+	/* Send all known subnets and edges. Skip nodes of other submeshes as a whole,
+	   send_add_edge() would reject all their edges anyway. */
 
 	for splay_each(node_t, n, mesh->nodes) {
+		if(c->node->submesh && !submesh_allows_node(n->submesh, c->node)) {
+			continue;
+		}
+
 		for inner_splay_each(edge_t, e, n->edge_tree) {
 			send_add_edge(mesh, c, e, 0);
+			mesh->topology_edges_sent++;
 		}
 	}
 }
@@ -378,21 +385,33 @@ bool ack_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		}
 	}
 
-	n->devclass = devclass;
+	if(n->devclass != (dev_class_t)devclass) {
+		n->devclass = devclass;
+		update_edge_digests(mesh, n);
+	}
+
 	n->status.dirty = true;
 	n->status.tiny = c->flags & PROTOCOL_TINY;
+	update_node_snapshot(n);
 
 	n->last_successfull_connection = mesh->loop.now.tv_sec;
 
 	n->connection = c;
-	n->nexthop = n;
 	c->node = n;
+	update_node_autoconnect(mesh, n);
+
+	if(n->distance < 0) {
+		n->nexthop = n;
+	}
+
+	c->status.binary = !mesh->meta_text_only && OPTION_VERSION(options) >= PROT_MINOR_BINARY;
+	c->status.binary_relay = c->status.binary && OPTION_VERSION(options) >= PROT_MINOR_RELAY;
 
 	/* Activate this connection */
 
 	c->allow_request = ALL;
 	c->last_key_renewal = mesh->loop.now.tv_sec;
-	c->status.active = true;
+	connection_activate(mesh, c);
 
 	logger(mesh, MESHLINK_INFO, "Connection with %s activated", c->name);
 
@@ -419,10 +438,20 @@ bool ack_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		}
 	}
 
-	/* Send him everything we know */
+	/* Measure the round trip time right away, so the weight of our edge reflects it.
+	   Do it before the topology is sent, so the PING does not have to wait behind all of it. */
+
+	send_ping(mesh, c);
+
+	/* Send him everything we know, or if he understands topology digests, only what he doesn't know yet.
+	   Submeshes only see part of the topology, so there the digests would never match. */
 
 	if(!(c->flags & PROTOCOL_TINY)) {
-		send_everything(mesh, c);
+		if(OPTION_VERSION(options) >= PROT_MINOR_SYNC && !mesh->meta_text_only && !mesh->self->submesh && !n->submesh) {
+			send_topology_digest(mesh, c);
+		} else {
+			send_everything(mesh, c);
+		}
 	}
 
 	/* Create an edge_t for this connection */
@@ -434,6 +463,8 @@ bool ack_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 	c->edge->to = n;
 	sockaddrcpy_setport(&c->edge->address, &c->address, atoi(hisport));
 	c->edge->weight = mesh->dev_class_traits[devclass].edge_weight;
+	c->edge->options = options;
+	c->edge->session_id = mesh->session_id;
 	c->edge->connection = c;
 
 	node_add_recent_address(mesh, n, &c->address);
@@ -29,15 +29,173 @@
 #include "net.h"
 #include "netutl.h"
 #include "node.h"
+#include "packmsg.h"
 #include "protocol.h"
 #include "utils.h"
 #include "xalloc.h"
 #include "submesh.h"
 
-bool send_add_edge(meshlink_handle_t *mesh, connection_t *c, const edge_t *e, int contradictions) {
-	bool x;
+/* ADD_EDGE and DEL_EDGE requests are first decoded into these structures, regardless of whether they were received in text or binary form.
+   Duplicates are detected on a form regenerated from the decoded fields, so both forms of the same request are seen as the same. */
+
+typedef struct add_edge_request_t {
+	uint32_t nonce;
+	char from_name[MAX_STRING_SIZE];
+	int from_devclass;
+	char from_submesh_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+	sockaddr_t address;
+	int to_devclass;
+	char to_submesh_name[MAX_STRING_SIZE];
+	uint32_t options;
+	int weight;
+	int contradictions;
+	uint32_t session_id;
+} add_edge_request_t;
+
+typedef struct del_edge_request_t {
+	uint32_t nonce;
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+	int contradictions;
+	uint32_t session_id;
+} del_edge_request_t;
+
+/* Only plain IPv4 and IPv6 addresses have a binary form, anything else is always sent as text */
+static bool binary_address(const sockaddr_t *sa) {
+	return sa->sa.sa_family == AF_INET || (sa->sa.sa_family == AF_INET6 && !sa->in6.sin6_scope_id);
+}
+
+/* Strings in binary requests must be valid words in the text form as well */
+static bool get_word(packmsg_input_t *in, char *buf) {
+	if(!packmsg_get_str_copy(in, buf, MAX_STRING_SIZE)) {
+		return false;
+	}
+
+	for(const char *p = buf; *p; p++) {
+		if(isspace((unsigned char)*p) || iscntrl((unsigned char)*p)) {
+			packmsg_input_invalidate(in);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static uint32_t encode_add_edge(const add_edge_request_t *r, uint8_t *buf, uint32_t size) {
+	if(!binary_address(&r->address)) {
+		return 0;
+	}
+
+	packmsg_output_t out = {buf, size};
+	packmsg_add_uint8(&out, ADD_EDGE);
+	packmsg_add_uint32(&out, r->nonce);
+	packmsg_add_str(&out, r->from_name);
+	packmsg_add_int32(&out, r->from_devclass);
+	packmsg_add_str(&out, r->from_submesh_name);
+	packmsg_add_str(&out, r->to_name);
+	packmsg_add_sockaddr(&out, &r->address);
+	packmsg_add_int32(&out, r->to_devclass);
+	packmsg_add_str(&out, r->to_submesh_name);
+	packmsg_add_uint32(&out, r->options);
+	packmsg_add_int32(&out, r->weight);
+	packmsg_add_int32(&out, r->contradictions);
+	packmsg_add_uint32(&out, r->session_id);
+
+	return packmsg_output_ok(&out) ? packmsg_output_size(&out, buf) : 0;
+}
+
+static bool decode_add_edge(add_edge_request_t *r, const void *data, uint32_t len) {
+	packmsg_input_t in = {data, len};
+	packmsg_get_uint8(&in);
+	r->nonce = packmsg_get_uint32(&in);
+	get_word(&in, r->from_name);
+	r->from_devclass = packmsg_get_int32(&in);
+	get_word(&in, r->from_submesh_name);
+	get_word(&in, r->to_name);
+	r->address = packmsg_get_sockaddr(&in);
+	r->to_devclass = packmsg_get_int32(&in);
+	get_word(&in, r->to_submesh_name);
+	r->options = packmsg_get_uint32(&in);
+	r->weight = packmsg_get_int32(&in);
+	r->contradictions = packmsg_get_int32(&in);
+	r->session_id = packmsg_get_uint32(&in);
+
+	return packmsg_done(&in);
+}
+
+static int format_add_edge(const void *arg, char *buf, size_t size) {
+	const add_edge_request_t *r = arg;
 	char *address, *port;
-	const char *from_submesh, *to_submesh;
+
+	sockaddr2str(&r->address, &address, &port);
+	int len = snprintf(buf, size, "%d %x %s %d %s %s %s %s %d %s %x %d %d %x", ADD_EDGE, r->nonce,
+	                   r->from_name, r->from_devclass, r->from_submesh_name, r->to_name, address, port,
+	                   r->to_devclass, r->to_submesh_name, r->options, r->weight, r->contradictions, r->session_id);
+	free(address);
+	free(port);
+
+	return len;
+}
+
+static uint32_t encode_del_edge(const del_edge_request_t *r, uint8_t *buf, uint32_t size) {
+	packmsg_output_t out = {buf, size};
+	packmsg_add_uint8(&out, DEL_EDGE);
+	packmsg_add_uint32(&out, r->nonce);
+	packmsg_add_str(&out, r->from_name);
+	packmsg_add_str(&out, r->to_name);
+	packmsg_add_int32(&out, r->contradictions);
+	packmsg_add_uint32(&out, r->session_id);
+
+	return packmsg_output_ok(&out) ? packmsg_output_size(&out, buf) : 0;
+}
+
+static bool decode_del_edge(del_edge_request_t *r, const void *data, uint32_t len) {
+	packmsg_input_t in = {data, len};
+	packmsg_get_uint8(&in);
+	r->nonce = packmsg_get_uint32(&in);
+	get_word(&in, r->from_name);
+	get_word(&in, r->to_name);
+	r->contradictions = packmsg_get_int32(&in);
+	r->session_id = packmsg_get_uint32(&in);
+
+	return packmsg_done(&in);
+}
+
+static int format_del_edge(const void *arg, char *buf, size_t size) {
+	const del_edge_request_t *r = arg;
+
+	return snprintf(buf, size, "%d %x %s %s %d %x", DEL_EDGE, r->nonce,
+	                r->from_name, r->to_name, r->contradictions, r->session_id);
+}
+
+/* Requests without a binary form are remembered by their text rendering instead */
+static bool seen_add_edge(meshlink_handle_t *mesh, const add_edge_request_t *r) {
+	uint8_t buf[MAXBUFSIZE];
+	uint32_t len = encode_add_edge(r, buf, sizeof(buf));
+
+	if(!len) {
+		int textlen = format_add_edge(r, (char *)buf, sizeof(buf));
+
+		if(textlen <= 0) {
+			return false;
+		}
+
+		len = (size_t)textlen < sizeof(buf) ? (uint32_t)textlen : sizeof(buf) - 1;
+	}
+
+	return seen_request(mesh, buf, len);
+}
+
+static bool seen_del_edge(meshlink_handle_t *mesh, const del_edge_request_t *r) {
+	uint8_t buf[MAXBUFSIZE];
+	uint32_t len = encode_del_edge(r, buf, sizeof(buf));
+
+	return len && seen_request(mesh, buf, len);
+}
+
+/* If c is mesh->everyone, the ADD_EDGE is broadcast to all connections except the given one */
+static bool send_add_edge_except(meshlink_handle_t *mesh, connection_t *c, connection_t *except, const edge_t *e, int contradictions) {
 	const submesh_t *s = NULL;
 
 	if(c->node && c->node->submesh) {
@@ -54,19 +212,19 @@ bool send_add_edge(meshlink_handle_t *mesh, connection_t *c, const edge_t *e, in
 		return true;
 	}
 
-	sockaddr2str(&e->address, &address, &port);
-
-	if(e->from->submesh) {
-		from_submesh = e->from->submesh->name;
-	} else {
-		from_submesh = CORE_MESH;
-	}
-
-	if(e->to->submesh) {
-		to_submesh = e->to->submesh->name;
-	} else {
-		to_submesh = CORE_MESH;
-	}
+	add_edge_request_t r;
+	r.nonce = prng(mesh, UINT_MAX);
+	snprintf(r.from_name, sizeof(r.from_name), "%s", e->from->name);
+	r.from_devclass = e->from->devclass;
+	snprintf(r.from_submesh_name, sizeof(r.from_submesh_name), "%s", e->from->submesh ? e->from->submesh->name : CORE_MESH);
+	snprintf(r.to_name, sizeof(r.to_name), "%s", e->to->name);
+	r.address = e->address;
+	r.to_devclass = e->to->devclass;
+	snprintf(r.to_submesh_name, sizeof(r.to_submesh_name), "%s", e->to->submesh ? e->to->submesh->name : CORE_MESH);
+	r.options = e->options;
+	r.weight = e->weight;
+	r.contradictions = contradictions;
+	r.session_id = e->from->session_id;
 
 	if(e->from->submesh) {
 		s = e->from->submesh;
@@ -74,84 +232,67 @@ bool send_add_edge(meshlink_handle_t *mesh, connection_t *c, const edge_t *e, in
 		s = e->to->submesh;
 	}
 
-	x = send_request(mesh, c, s, "%d %x %s %d %s %s %s %s %d %s %x %d %d %x", ADD_EDGE, prng(mesh, UINT_MAX),
-	                 e->from->name, e->from->devclass, from_submesh, e->to->name, address, port,
-	                 e->to->devclass, to_submesh, OPTION_PMTU_DISCOVERY, e->weight, contradictions, e->from->session_id);
-	free(address);
-	free(port);
+	uint8_t binary[MAXBUFSIZE];
+	uint32_t binlen = encode_add_edge(&r, binary, sizeof(binary));
 
-	return x;
+	return send_dual_request(mesh, c, except, s, ADD_EDGE, binary, binlen, NULL, format_add_edge, &r);
 }
 
-bool add_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
-	assert(request);
-	assert(*request);
+bool send_add_edge(meshlink_handle_t *mesh, connection_t *c, const edge_t *e, int contradictions) {
+	return send_add_edge_except(mesh, c, NULL, e, contradictions);
+}
+
+bool broadcast_add_edge(meshlink_handle_t *mesh, connection_t *except, const edge_t *e) {
+	return send_add_edge_except(mesh, mesh->everyone, except, e, 0);
+}
 
+static bool add_edge(meshlink_handle_t *mesh, connection_t *c, const add_edge_request_t *r, const uint8_t *binary, uint32_t binlen, const char *request) {
 	edge_t *e;
 	node_t *from, *to;
-	char from_name[MAX_STRING_SIZE];
-	int from_devclass;
-	char from_submesh_name[MAX_STRING_SIZE] = "";
-	char to_name[MAX_STRING_SIZE];
-	char to_address[MAX_STRING_SIZE];
-	char to_port[MAX_STRING_SIZE];
-	int to_devclass;
-	char to_submesh_name[MAX_STRING_SIZE] = "";
-	sockaddr_t address;
-	int weight;
-	int contradictions = 0;
-	uint32_t session_id = 0;
 	submesh_t *s = NULL;
 
-	if(sscanf(request, "%*d %*x "MAX_STRING" %d "MAX_STRING" "MAX_STRING" "MAX_STRING" "MAX_STRING" %d "MAX_STRING" %*x %d %d %x",
-	                from_name, &from_devclass, from_submesh_name, to_name, to_address, to_port, &to_devclass, to_submesh_name,
-	                &weight, &contradictions, &session_id) < 9) {
-		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "ADD_EDGE", c->name);
-		return false;
-	}
-
 	// Check if devclasses are valid
 
-	if(from_devclass < 0 || from_devclass >= DEV_CLASS_COUNT) {
+	if(r->from_devclass < 0 || r->from_devclass >= DEV_CLASS_COUNT) {
 		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s: %s", "ADD_EDGE", c->name, "from devclass invalid");
 		return false;
 	}
 
-	if(to_devclass < 0 || to_devclass >= DEV_CLASS_COUNT) {
+	if(r->to_devclass < 0 || r->to_devclass >= DEV_CLASS_COUNT) {
 		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s: %s", "ADD_EDGE", c->name, "to devclass invalid");
 		return false;
 	}
 
-	if(0 == strcmp(from_submesh_name, "")) {
+	if(0 == strcmp(r->from_submesh_name, "")) {
 		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s: %s", "ADD_EDGE", c->name, "invalid submesh id");
 		return false;
 	}
 
-	if(0 == strcmp(to_submesh_name, "")) {
+	if(0 == strcmp(r->to_submesh_name, "")) {
 		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s: %s", "ADD_EDGE", c->name, "invalid submesh id");
 		return false;
 	}
 
-	if(seen_request(mesh, request)) {
+	if(seen_add_edge(mesh, r)) {
 		return true;
 	}
 
 	/* Lookup nodes */
 
-	from = lookup_node(mesh, from_name);
-	to = lookup_node(mesh, to_name);
+	from = lookup_node(mesh, r->from_name);
+	to = lookup_node(mesh, r->to_name);
 
 	if(!from) {
 		from = new_node();
 		from->status.dirty = true;
 		from->status.blacklisted = mesh->default_blacklist;
-		from->name = xstrdup(from_name);
-		from->devclass = from_devclass;
+		from->name = xstrdup(r->from_name);
+		from->devclass = r->from_devclass;
 
 		from->submesh = NULL;
 
-		if(0 != strcmp(from_submesh_name, CORE_MESH)) {
-			if(!(from->submesh = lookup_or_create_submesh(mesh, from_submesh_name))) {
+		if(0 != strcmp(r->from_submesh_name, CORE_MESH)) {
+			if(!(from->submesh = lookup_or_create_submesh(mesh, r->from_submesh_name))) {
 				return false;
 			}
 		}
@@ -159,27 +300,33 @@ bool add_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		node_add(mesh, from);
 	}
 
-	if(contradictions > 50) {
+	if(r->contradictions > 50) {
 		handle_duplicate_node(mesh, from);
 	}
 
-	from->devclass = from_devclass;
+	if(from->devclass != (dev_class_t)r->from_devclass) {
+		from->devclass = r->from_devclass;
+		update_node_autoconnect(mesh, from);
+		update_edge_digests(mesh, from);
+	}
+
+	update_node_snapshot(from);
 
 	if(!from->session_id) {
-		from->session_id = session_id;
+		from->session_id = r->session_id;
 	}
 
 	if(!to) {
 		to = new_node();
 		to->status.dirty = true;
 		to->status.blacklisted = mesh->default_blacklist;
-		to->name = xstrdup(to_name);
-		to->devclass = to_devclass;
+		to->name = xstrdup(r->to_name);
+		to->devclass = r->to_devclass;
 
 		to->submesh = NULL;
 
-		if(0 != strcmp(to_submesh_name, CORE_MESH)) {
-			if(!(to->submesh = lookup_or_create_submesh(mesh, to_submesh_name))) {
+		if(0 != strcmp(r->to_submesh_name, CORE_MESH)) {
+			if(!(to->submesh = lookup_or_create_submesh(mesh, r->to_submesh_name))) {
 				return false;
 
 			}
@@ -188,31 +335,42 @@ bool add_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		node_add(mesh, to);
 	}
 
-	to->devclass = to_devclass;
-
-	/* Convert addresses */
+	if(to->devclass != (dev_class_t)r->to_devclass) {
+		to->devclass = r->to_devclass;
+		update_node_autoconnect(mesh, to);
+		update_edge_digests(mesh, to);
+	}
 
-	address = str2sockaddr(to_address, to_port);
+	update_node_snapshot(to);
 
-	/* Check if edge already exists */
+	/* Check if edge already exists. Senders older than PROT_MINOR_COALESCED
+	   do not know about the version in the options, only compare the flags. */
 
 	e = lookup_edge(from, to);
 
 	if(e) {
-		if(e->weight != weight || e->session_id != session_id || sockaddrcmp(&e->address, &address)) {
+		bool old_sender = !c->edge || OPTION_VERSION(c->edge->options) < PROT_MINOR_COALESCED;
+		bool options_differ = old_sender ? OPTION_FLAGS(e->options) != OPTION_FLAGS(r->options) : e->options != r->options;
+
+		if(e->weight != r->weight || options_differ || e->session_id != r->session_id || sockaddrcmp(&e->address, &r->address)) {
 			if(from == mesh->self) {
 				/* The sender has outdated information, we own this edge to send a correction back */
 				logger(mesh, MESHLINK_DEBUG, "Got %s from %s for ourself which does not match existing entry", "ADD_EDGE", c->name);
 				send_add_edge(mesh, c, e, 0);
 				return true;
-			} else if(to == mesh->self && from != c->node && from->status.reachable) {
+			} else if(to == mesh->self && from != c->node && from->distance >= 0) {
 				/* The sender has outdated information, someone else owns this node so they will correct */
 				logger(mesh, MESHLINK_DEBUG, "Got %s from %s which does not match existing entry, ignoring", "ADD_EDGE", c->name);
 				return true;
+			} else if(e->options == r->options && e->session_id == r->session_id && !sockaddrcmp(&e->address, &r->address)) {
+				/* Only the weight changed, which does not require taking the edge out of the graph */
+				logger(mesh, MESHLINK_DEBUG, "Got %s from %s with a new weight", "ADD_EDGE", c->name);
+				edge_set_weight(mesh, e, r->weight);
 			} else {
 				/* Might be outdated, but update our information, another node will send a correction if necessary */
 				logger(mesh, MESHLINK_DEBUG, "Got %s from %s which does not match existing entry", "ADD_EDGE", c->name);
 				edge_del(mesh, e);
+				e = NULL;
 			}
 		} else {
 			return true;
@@ -223,23 +381,26 @@ bool add_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		e = new_edge();
 		e->from = from;
 		e->to = to;
-		e->session_id = session_id;
+		e->session_id = r->session_id;
 		send_del_edge(mesh, c, e, mesh->contradicting_add_edge);
 		free_edge(e);
 		return true;
 	}
 
-	e = new_edge();
-	e->from = from;
-	e->to = to;
-	e->address = address;
-	e->weight = weight;
-	e->session_id = session_id;
-	edge_add(mesh, e);
+	if(!e) {
+		e = new_edge();
+		e->from = from;
+		e->to = to;
+		e->address = r->address;
+		e->weight = r->weight;
+		e->options = r->options;
+		e->session_id = r->session_id;
+		edge_add(mesh, e);
+	}
 
 	/* Run MST before or after we tell the rest? */
 
-	graph(mesh);
+	graph_schedule(mesh);
 
 	if(e->from->submesh && e->to->submesh && (e->from->submesh != e->to->submesh)) {
 		logger(mesh, MESHLINK_ERROR, "Dropping add edge ( %s to %s )", e->from->submesh->name, e->to->submesh->name);
@@ -254,11 +415,54 @@ bool add_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 
 	/* Tell the rest about the new edge */
 
-	forward_request(mesh, c, s, request);
+	send_dual_request(mesh, NULL, c, s, ADD_EDGE, binary, binlen, request, format_add_edge, r);
 
 	return true;
 }
 
+bool add_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
+	assert(request);
+	assert(*request);
+
+	add_edge_request_t r;
+	char to_address[MAX_STRING_SIZE];
+	char to_port[MAX_STRING_SIZE];
+
+	r.from_submesh_name[0] = 0;
+	r.to_submesh_name[0] = 0;
+	r.contradictions = 0;
+	r.session_id = 0;
+
+	if(sscanf(request, "%*d %x "MAX_STRING" %d "MAX_STRING" "MAX_STRING" "MAX_STRING" "MAX_STRING" %d "MAX_STRING" %x %d %d %x",
+	                &r.nonce, r.from_name, &r.from_devclass, r.from_submesh_name, r.to_name, to_address, to_port, &r.to_devclass, r.to_submesh_name,
+	                &r.options, &r.weight, &r.contradictions, &r.session_id) < 11) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "ADD_EDGE", c->name);
+		return false;
+	}
+
+	/* Convert addresses */
+
+	r.address = str2sockaddr(to_address, to_port);
+
+	/* Generate the binary form for peers that understand it */
+
+	uint8_t binary[MAXBUFSIZE];
+	uint32_t binlen = encode_add_edge(&r, binary, sizeof(binary));
+
+	return add_edge(mesh, c, &r, binary, binlen, request);
+}
+
+bool add_edge_b(meshlink_handle_t *mesh, connection_t *c, const void *data, uint32_t len) {
+	add_edge_request_t r;
+
+	if(!decode_add_edge(&r, data, len)) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "ADD_EDGE", c->name);
+		return false;
+	}
+
+	return add_edge(mesh, c, &r, data, len, NULL);
+}
+
 bool send_del_edge(meshlink_handle_t *mesh, connection_t *c, const edge_t *e, int contradictions) {
 	submesh_t *s = NULL;
 
@@ -283,35 +487,35 @@ bool send_del_edge(meshlink_handle_t *mesh, connection_t *c, const edge_t *e, in
 		s = e->to->submesh;
 	}
 
-	return send_request(mesh, c, s, "%d %x %s %s %d %x", DEL_EDGE, prng(mesh, UINT_MAX),
-	                    e->from->name, e->to->name, contradictions, e->session_id);
-}
+	del_edge_request_t r;
+	r.nonce = prng(mesh, UINT_MAX);
+	snprintf(r.from_name, sizeof(r.from_name), "%s", e->from->name);
+	snprintf(r.to_name, sizeof(r.to_name), "%s", e->to->name);
+	r.contradictions = contradictions;
+	r.session_id = e->session_id;
 
-bool del_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
-	assert(request);
-	assert(*request);
+	/* Make sure the request is flooded everywhere if the edge is part of the spanning tree */
+	mst_del_edge(mesh, e);
+
+	uint8_t binary[MAXBUFSIZE];
+	uint32_t binlen = encode_del_edge(&r, binary, sizeof(binary));
 
+	return send_dual_request(mesh, c, NULL, s, DEL_EDGE, binary, binlen, NULL, format_del_edge, &r);
+}
+
+static bool del_edge(meshlink_handle_t *mesh, connection_t *c, const del_edge_request_t *r, const uint8_t *binary, uint32_t binlen, const char *request) {
 	edge_t *e;
-	char from_name[MAX_STRING_SIZE];
-	char to_name[MAX_STRING_SIZE];
 	node_t *from, *to;
-	int contradictions = 0;
-	uint32_t session_id = 0;
 	submesh_t *s = NULL;
 
-	if(sscanf(request, "%*d %*x "MAX_STRING" "MAX_STRING" %d %x", from_name, to_name, &contradictions, &session_id) < 2) {
-		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "DEL_EDGE", c->name);
-		return false;
-	}
-
-	if(seen_request(mesh, request)) {
+	if(seen_del_edge(mesh, r)) {
 		return true;
 	}
 
 	/* Lookup nodes */
 
-	from = lookup_node(mesh, from_name);
-	to = lookup_node(mesh, to_name);
+	from = lookup_node(mesh, r->from_name);
+	to = lookup_node(mesh, r->to_name);
 
 	if(!from) {
 		logger(mesh, MESHLINK_WARNING, "Got %s from %s which does not appear in the edge tree", "DEL_EDGE", c->name);
@@ -323,7 +527,7 @@ bool del_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		return true;
 	}
 
-	if(contradictions > 50) {
+	if(r->contradictions > 50) {
 		handle_duplicate_node(mesh, from);
 	}
 
@@ -343,8 +547,9 @@ bool del_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		return true;
 	}
 
-	/* Tell the rest about the deleted edge */
+	/* Tell the rest about the deleted edge, the spanning tree might not reach everyone without it */
 
+	mst_del_edge(mesh, e);
 
 	if(!e->from->submesh || !e->to->submesh || (e->from->submesh == e->to->submesh)) {
 		if(e->from->submesh) {
@@ -354,7 +559,7 @@ bool del_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 		}
 
 		/* Tell the rest about the deleted edge */
-		forward_request(mesh, c, s, request);
+		send_dual_request(mesh, NULL, c, s, DEL_EDGE, binary, binlen, request, format_del_edge, r);
 
 	} else {
 		logger(mesh, MESHLINK_ERROR, "Dropping del edge ( %s to %s )", e->from->submesh->name, e->to->submesh->name);
@@ -367,11 +572,12 @@ bool del_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 
 	/* Run MST before or after we tell the rest? */
 
-	graph(mesh);
+	graph_schedule(mesh);
 
-	/* If the node is not reachable anymore but we remember it had an edge to us, clean it up */
+	/* If the node is not reachable anymore but we remember it had an edge to us, clean it up.
+	   The shortest path tree is already up to date, even if graph() has not run yet. */
 
-	if(!to->status.reachable) {
+	if(to->distance < 0) {
 		e = lookup_edge(to, mesh->self);
 
 		if(e) {
@@ -382,3 +588,165 @@ bool del_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 
 	return true;
 }
+
+bool del_edge_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
+	assert(request);
+	assert(*request);
+
+	del_edge_request_t r;
+	r.contradictions = 0;
+	r.session_id = 0;
+
+	if(sscanf(request, "%*d %x "MAX_STRING" "MAX_STRING" %d %x", &r.nonce, r.from_name, r.to_name, &r.contradictions, &r.session_id) < 3) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "DEL_EDGE", c->name);
+		return false;
+	}
+
+	uint8_t binary[MAXBUFSIZE];
+	uint32_t binlen = encode_del_edge(&r, binary, sizeof(binary));
+
+	return del_edge(mesh, c, &r, binary, binlen, request);
+}
+
+bool del_edge_b(meshlink_handle_t *mesh, connection_t *c, const void *data, uint32_t len) {
+	del_edge_request_t r;
+
+	if(!decode_del_edge(&r, data, len)) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "DEL_EDGE", c->name);
+		return false;
+	}
+
+	return del_edge(mesh, c, &r, data, len, NULL);
+}
+
+/* Topology synchronisation.
+   Instead of sending all edges to a newly activated connection, both sides send a digest of their view of the topology, split into buckets.
+   For every bucket that differs, the digests of the nodes in that bucket are sent as queries, and the other side sends its edges of every node that differs.
+   If the other side did not query that node itself, it also replies with its own digest, so the edges it has are sent back as well.
+   The result is the same as sending everything, but the amount of data is proportional to how much both views differ. */
+
+static bool sync_allows_node(connection_t *c, const node_t *n) {
+	return !c->node || !c->node->submesh || submesh_allows_node(n->submesh, c->node);
+}
+
+static bool send_node_digest(meshlink_handle_t *mesh, connection_t *c, const char *name, uint64_t digest, bool reply) {
+	return send_request(mesh, c, NULL, "%d %s %" PRIx64 " %d", NODE_DIGEST, name, digest, reply);
+}
+
+bool send_topology_digest(meshlink_handle_t *mesh, connection_t *c) {
+	char digests[TOPOLOGY_BUCKETS * 17 + 1];
+	char *p = digests;
+
+	for(int i = 0; i < TOPOLOGY_BUCKETS; i++) {
+		p += snprintf(p, digests + sizeof(digests) - p, " %" PRIx64, mesh->topology_digest[i]);
+	}
+
+	return send_request(mesh, c, NULL, "%d %d%s", TOPOLOGY_DIGEST, TOPOLOGY_BUCKETS, digests);
+}
+
+bool topology_digest_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
+	assert(request);
+	assert(*request);
+
+	int count;
+	int offset;
+
+	if(sscanf(request, "%*d %d%n", &count, &offset) != 1 || count <= 0) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "TOPOLOGY_DIGEST", c->name);
+		return false;
+	}
+
+	if(c->sync_queried) {
+		logger(mesh, MESHLINK_ERROR, "Got duplicate %s from %s", "TOPOLOGY_DIGEST", c->name);
+		return false;
+	}
+
+	c->sync_queried = splay_alloc_tree((splay_compare_t) strcmp, (splay_action_t) free);
+
+	/* If the other side uses a different number of buckets, treat all buckets as different */
+
+	bool differs[TOPOLOGY_BUCKETS];
+	bool any = false;
+	const char *p = request + offset;
+
+	for(int i = 0; i < TOPOLOGY_BUCKETS; i++) {
+		differs[i] = true;
+
+		if(count != TOPOLOGY_BUCKETS) {
+			continue;
+		}
+
+		char *end;
+		uint64_t digest = strtoull(p, &end, 16);
+
+		if(end == p) {
+			logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "TOPOLOGY_DIGEST", c->name);
+			return false;
+		}
+
+		p = end;
+		differs[i] = digest != mesh->topology_digest[i];
+		any |= differs[i];
+	}
+
+	if(count == TOPOLOGY_BUCKETS && !any) {
+		logger(mesh, MESHLINK_DEBUG, "Topology of %s is identical to ours", c->name);
+		return true;
+	}
+
+	for splay_each(node_t, n, mesh->nodes) {
+		if(n->edge_digest && differs[topology_bucket(n)] && sync_allows_node(c, n)) {
+			splay_insert(c->sync_queried, xstrdup(n->name));
+
+			if(!send_node_digest(mesh, c, n->name, n->edge_digest, false)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool node_digest_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
+	assert(request);
+	assert(*request);
+
+	char name[MAX_STRING_SIZE];
+	uint64_t digest;
+	int reply;
+
+	if(sscanf(request, "%*d " MAX_STRING " %" SCNx64 " %d", name, &digest, &reply) != 3 || !check_id(name)) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "NODE_DIGEST", c->name);
+		return false;
+	}
+
+	node_t *n = lookup_node(mesh, name);
+
+	if(n && !sync_allows_node(c, n)) {
+		n = NULL;
+	}
+
+	uint64_t ours = n ? n->edge_digest : 0;
+
+	if(digest == ours) {
+		return true;
+	}
+
+	if(n) {
+		for splay_each(edge_t, e, n->edge_tree) {
+			if(!send_add_edge(mesh, c, e, 0)) {
+				return false;
+			}
+
+			mesh->topology_edges_sent++;
+		}
+	}
+
+	/* If we did not query this node ourself, the other side doesn't know which edges it has to send us */
+
+	if(!reply && (!c->sync_queried || !splay_search(c->sync_queried, name))) {
+		return send_node_digest(mesh, c, name, ours, true);
+	}
+
+	return true;
+}
@@ -25,6 +25,7 @@
 #include "net.h"
 #include "netutl.h"
 #include "node.h"
+#include "packmsg.h"
 #include "prf.h"
 #include "protocol.h"
 #include "sptps.h"
@@ -45,7 +46,7 @@ bool key_changed_h(meshlink_handle_t *mesh, connection_t *c, const char *request
 		return false;
 	}
 
-	if(seen_request(mesh, request)) {
+	if(seen_request(mesh, request, strlen(request))) {
 		return true;
 	}
 
@@ -218,7 +219,9 @@ static bool req_key_ext_h(meshlink_handle_t *mesh, connection_t *c, const char *
 		if(from->sptps.label) {
 			logger(mesh, MESHLINK_DEBUG, "Got REQ_KEY from %s while we already started a SPTPS session!", from->name);
 
-			if(mesh->loop.now.tv_sec < from->last_req_key + req_key_timeout && strcmp(mesh->self->name, from->name) < 0) {
+			/* Only break the tie if our own key exchange is still in progress.
+			   If it already finished, the other side has restarted and needs a new one. */
+			if(!from->status.validkey && mesh->loop.now.tv_sec < from->last_req_key + req_key_timeout && strcmp(mesh->self->name, from->name) < 0) {
 				logger(mesh, MESHLINK_DEBUG, "Ignoring REQ_KEY from %s.", from->name);
 				return true;
 			}
@@ -232,6 +235,8 @@ static bool req_key_ext_h(meshlink_handle_t *mesh, connection_t *c, const char *
 			return true;
 		}
 
+		from->in_relayed += len;
+
 		char label[sizeof(meshlink_udp_label) + strlen(from->name) + strlen(mesh->self->name) + 2];
 		snprintf(label, sizeof(label), "%s %s %s", meshlink_udp_label, from->name, mesh->self->name);
 		sptps_stop(&from->sptps);
@@ -272,6 +277,8 @@ static bool req_key_ext_h(meshlink_handle_t *mesh, connection_t *c, const char *
 			return true;
 		}
 
+		from->in_relayed += len;
+
 		if(!sptps_receive_data(&from->sptps, buf, len)) {
 			logger(mesh, MESHLINK_ERROR, "Could not process SPTPS data from %s: %s", from->name, strerror(errno));
 			return true;
@@ -519,6 +526,7 @@ bool ans_key_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 
 		char buf[strlen(key)];
 		int len = b64decode(key, buf, strlen(key));
+		from->in_relayed += len;
 
 		if(!len || !sptps_receive_data(&from->sptps, buf, len)) {
 			logger(mesh, MESHLINK_ERROR, "Error processing SPTPS data from %s", from->name);
@@ -537,3 +545,104 @@ bool ans_key_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 
 	return true;
 }
+
+/* Relay SPTPS data between two nodes over a meta-connection. Peers that understand it get the data as a binary record,
+   so it does not have to be base64 encoded and parsed again at every hop, and it can be as large as a meta-connection record.
+   Other peers get it in the text form of a REQ_KEY request. */
+bool send_relay_sptps(meshlink_handle_t *mesh, connection_t *c, const node_t *from, const node_t *to, const void *data, size_t len) {
+	assert(data);
+	assert(len);
+
+	if(!c->status.binary_relay) {
+		char buf[len * 4 / 3 + 5];
+		b64encode(data, buf, len);
+		return send_request(mesh, c, NULL, "%d %s %s %d %s", REQ_KEY, from->name, to->name, REQ_SPTPS, buf);
+	}
+
+	uint8_t buf[len + strlen(from->name) + strlen(to->name) + 16];
+	packmsg_output_t out = {buf, sizeof(buf)};
+	packmsg_add_uint8(&out, RELAY_SPTPS);
+	packmsg_add_str(&out, from->name);
+	packmsg_add_str(&out, to->name);
+	packmsg_add_bin(&out, data, len);
+
+	if(!packmsg_output_ok(&out) || packmsg_output_size(&out, buf) > UINT16_MAX) {
+		logger(mesh, MESHLINK_ERROR, "SPTPS data from %s to %s is too large to relay via %s", from->name, to->name, c->name);
+		return false;
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "Sending %s to %s (binary)", "RELAY_SPTPS", c->name);
+	return sptps_send_record(&c->sptps, META_BINARY, buf, packmsg_output_size(&out, buf));
+}
+
+bool relay_sptps_b(meshlink_handle_t *mesh, connection_t *c, const void *data, uint32_t len) {
+	char from_name[MAX_STRING_SIZE];
+	char to_name[MAX_STRING_SIZE];
+	const void *sptps_data;
+
+	packmsg_input_t in = {data, len};
+	packmsg_get_uint8(&in);
+	packmsg_get_str_copy(&in, from_name, sizeof(from_name));
+	packmsg_get_str_copy(&in, to_name, sizeof(to_name));
+	uint32_t sptps_len = packmsg_get_bin_raw(&in, &sptps_data);
+
+	if(!packmsg_done(&in) || !sptps_len) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s", "RELAY_SPTPS", c->name);
+		return false;
+	}
+
+	if(!check_id(from_name) || !check_id(to_name)) {
+		logger(mesh, MESHLINK_ERROR, "Got bad %s from %s: %s", "RELAY_SPTPS", c->name, "invalid name");
+		return false;
+	}
+
+	node_t *from = lookup_node(mesh, from_name);
+
+	if(!from) {
+		logger(mesh, MESHLINK_ERROR, "Got %s from %s origin %s which does not exist in our connection list",
+		       "RELAY_SPTPS", c->name, from_name);
+		return true;
+	}
+
+	node_t *to = lookup_node(mesh, to_name);
+
+	if(!to) {
+		logger(mesh, MESHLINK_ERROR, "Got %s from %s destination %s which does not exist in our connection list",
+		       "RELAY_SPTPS", c->name, to_name);
+		return true;
+	}
+
+	/* Forward it if necessary, without decoding it again if the next hop understands the binary form as well */
+
+	if(to != mesh->self) {
+		if(!to->status.reachable || !to->nexthop || !to->nexthop->connection) {
+			logger(mesh, MESHLINK_WARNING, "Got %s from %s destination %s which is not reachable",
+			       "RELAY_SPTPS", c->name, to_name);
+			return true;
+		}
+
+		connection_t *next = to->nexthop->connection;
+		from->in_forward += len + SPTPS_OVERHEAD;
+		to->out_forward += len + SPTPS_OVERHEAD;
+
+		if(next->status.binary_relay) {
+			logger(mesh, MESHLINK_DEBUG, "Forwarding %s to %s (binary)", "RELAY_SPTPS", next->name);
+			return sptps_send_record(&next->sptps, META_BINARY, data, len);
+		}
+
+		return send_relay_sptps(mesh, next, from, to, sptps_data, sptps_len);
+	}
+
+	if(!from->status.validkey) {
+		logger(mesh, MESHLINK_ERROR, "Got %s from %s but we don't have a valid key yet", "RELAY_SPTPS", from->name);
+		return true;
+	}
+
+	from->in_relayed += sptps_len;
+
+	if(!sptps_receive_data(&from->sptps, sptps_data, sptps_len)) {
+		logger(mesh, MESHLINK_ERROR, "Could not process SPTPS data from %s: %s", from->name, strerror(errno));
+	}
+
+	return true;
+}
@@ -21,6 +21,8 @@
 
 #include "conf.h"
 #include "connection.h"
+#include "edge.h"
+#include "graph.h"
 #include "logger.h"
 #include "meshlink_internal.h"
 #include "meta.h"
@@ -94,6 +96,7 @@ bool termreq_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 bool send_ping(meshlink_handle_t *mesh, connection_t *c) {
 	c->status.pinged = true;
 	c->last_ping_time = mesh->loop.now.tv_sec;
+	clock_gettime(EVENT_CLOCK, &c->ping_sent);
 
 	return send_request(mesh, c, NULL, "%d", PING);
 }
@@ -111,8 +114,39 @@ bool send_pong(meshlink_handle_t *mesh, connection_t *c) {
 	return send_request(mesh, c, NULL, "%d", PONG);
 }
 
+/* Advertise the smoothed RTT of a connection as part of the weight of its edge.
+   Only significant changes are advertised, so jitter does not cause a flood of ADD_EDGEs and flapping routes.
+   Peers that do not route on edge weights keep the weight of the device class, like they would advertise themselves. */
+static void update_edge_weight(meshlink_handle_t *mesh, connection_t *c) {
+	if(!c->edge || !c->node || mesh->meta_text_only || OPTION_VERSION(c->edge->options) < PROT_MINOR_RTT) {
+		return;
+	}
+
+	int base = mesh->dev_class_traits[c->node->devclass].edge_weight;
+	int advertised = c->edge->weight - base;
+	int diff = abs(c->rtt - advertised);
+
+	if(advertised > 0 && (diff < RTT_HYSTERESIS_MIN || diff * 100 < advertised * RTT_HYSTERESIS_PERCENT)) {
+		return;
+	}
+
+	if(c->edge->weight == base + c->rtt) {
+		return;
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "RTT to %s is now %d ms, updating edge weight", c->name, c->rtt);
+
+	edge_set_weight(mesh, c->edge, base + c->rtt);
+
+	/* The other end ignores updates of its edges that are relayed by others, and the broadcast might reach it
+	   via another node first, in which case a direct copy of the same request would be dropped as a duplicate.
+	   So send it a request of its own, and leave it out of the broadcast. */
+	send_add_edge(mesh, c, c->edge, 0);
+	broadcast_add_edge(mesh, c, c->edge);
+	graph_schedule(mesh);
+}
+
 bool pong_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
-	(void)mesh;
 	(void)request;
 
 	assert(request);
@@ -120,6 +154,35 @@ bool pong_h(meshlink_handle_t *mesh, connection_t *c, const char *request) {
 
 	c->status.pinged = false;
 
+	/* Update the smoothed RTT, with the same gain as TCP uses */
+
+	if(c->ping_sent.tv_sec) {
+		struct timespec now;
+		clock_gettime(EVENT_CLOCK, &now);
+		int sample = (now.tv_sec - c->ping_sent.tv_sec) * 1000 + (now.tv_nsec - c->ping_sent.tv_nsec) / 1000000;
+
+		if(sample < 1) {
+			sample = 1;
+		}
+
+		c->ping_sent.tv_sec = 0;
+		c->ping_sent.tv_nsec = 0;
+
+		if(!c->rtt) {
+			/* The first exchange overlaps with the initial topology sync, so it is likely inflated.
+			   Ping again right away and seed the RTT with the lower of the two samples. */
+			c->rtt = sample;
+			send_ping(mesh, c);
+		} else if(!c->status.rtt_seeded) {
+			c->rtt = sample < c->rtt ? sample : c->rtt;
+			c->status.rtt_seeded = true;
+			update_edge_weight(mesh, c);
+		} else {
+			c->rtt = (7 * c->rtt + sample + 4) / 8;
+			update_edge_weight(mesh, c);
+		}
+	}
+
 	/* Successful connection, reset timeout if this is an outgoing connection. */
 
 	if(c->outgoing) {
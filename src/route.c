@@ -76,7 +76,13 @@ void route(meshlink_handle_t *mesh, node_t *source, vpn_packet_t *packet) {
 
 		logger(mesh, MESHLINK_DEBUG, "I received a packet for me with payload: %s\n", hex);
 
-		if(source->utcp) {
+		if(packet->coalesced) {
+			if(source->utcp) {
+				channel_receive_coalesced(mesh, (meshlink_node_t *)source, payload, len);
+			} else {
+				logger(mesh, MESHLINK_WARNING, "Got coalesced packet from %s without channels", source->name);
+			}
+		} else if(source->utcp) {
 			channel_receive(mesh, (meshlink_node_t *)source, payload, len);
 		} else if(mesh->receive_cb) {
 			mesh->receive_cb(mesh, (meshlink_node_t *)source, payload, len);
@@ -0,0 +1,199 @@
+/*
+    shard.c -- additional threads receiving UDP packets
+    Copyright (C) 2026 Guus Sliepen <guus@meshlink.io>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include <poll.h>
+
+#include "logger.h"
+#include "net.h"
+#include "netutl.h"
+#include "shard.h"
+#include "utils.h"
+#include "xalloc.h"
+
+/* Each shard owns a UDP socket bound to the same address as one of the listen sockets, using SO_REUSEPORT.
+   The kernel spreads incoming packets over all sockets in the group based on the source address,
+   so all packets from a given peer end up in the same shard. Shards only decrypt the packets,
+   they are then handed over to MeshLink's own thread, which also still receives its share of UDP packets,
+   and which runs everything else. */
+
+#define SHARD_READ_BATCH 64
+
+static void *shard_loop(void *arg) {
+	shard_t *shard = arg;
+	meshlink_handle_t *mesh = shard->mesh;
+	vpn_packet_t pkt;
+	sockaddr_t from;
+	socklen_t fromlen;
+
+	struct pollfd fds[2] = {
+		{.fd = shard->fd, .events = POLLIN},
+		{.fd = shard->pipefd[0], .events = POLLIN},
+	};
+
+	while(true) {
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			logger(mesh, MESHLINK_ERROR, "Error while waiting for input: %s", strerror(errno));
+			break;
+		}
+
+		if(fds[1].revents) {
+			break;
+		}
+
+		for(int i = 0; i < SHARD_READ_BATCH; i++) {
+			memset(&from, 0, sizeof(from));
+			fromlen = sizeof(from);
+
+			int len = recvfrom(shard->fd, pkt.data, MAXSIZE, MSG_DONTWAIT, &from.sa, &fromlen);
+
+			if(len <= 0 || len > MAXSIZE) {
+				if(!sockwouldblock(sockerrno)) {
+					logger(mesh, MESHLINK_ERROR, "Receiving packet failed: %s", sockstrerror(sockerrno));
+				}
+
+				break;
+			}
+
+			pkt.len = len;
+			sockaddrunmap(&from);
+			handle_sharded_vpn_packet(mesh, shard, &pkt, &from);
+		}
+	}
+
+	return NULL;
+}
+
+static bool start_shard(meshlink_handle_t *mesh, shard_t *shard, listen_socket_t *ls) {
+	sockaddr_t sa;
+	socklen_t salen = sizeof(sa);
+
+	if(getsockname(ls->udp.fd, &sa.sa, &salen)) {
+		logger(mesh, MESHLINK_ERROR, "System call `%s' failed: %s", "getsockname", sockstrerror(sockerrno));
+		return false;
+	}
+
+	struct addrinfo ai = {
+		.ai_family = sa.sa.sa_family,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_protocol = IPPROTO_UDP,
+		.ai_addr = &sa.sa,
+		.ai_addrlen = salen,
+	};
+
+	shard->fd = setup_udp_listen_socket(mesh, &ai);
+
+	if(shard->fd == -1) {
+		logger(mesh, MESHLINK_ERROR, "Could not create UDP shard socket: %s", sockstrerror(sockerrno));
+		return false;
+	}
+
+	if(pipe(shard->pipefd)) {
+		logger(mesh, MESHLINK_ERROR, "System call `%s' failed: %s", "pipe", strerror(errno));
+		closesocket(shard->fd);
+		return false;
+	}
+
+	shard->mesh = mesh;
+	shard->ls = ls;
+	shard->cipher = chacha_poly1305_init();
+
+	if(pthread_create(&shard->thread, NULL, shard_loop, shard) != 0) {
+		logger(mesh, MESHLINK_ERROR, "Could not start UDP shard thread: %s", strerror(errno));
+		chacha_poly1305_exit(shard->cipher);
+		close(shard->pipefd[0]);
+		close(shard->pipefd[1]);
+		closesocket(shard->fd);
+		return false;
+	}
+
+	return true;
+}
+
+void init_shards(meshlink_handle_t *mesh) {
+	if(mesh->shards || mesh->udp_shards <= 0 || mesh->transport || !mesh->listen_sockets) {
+		return;
+	}
+
+	mesh->shards = xzalloc(mesh->listen_sockets * mesh->udp_shards * sizeof(*mesh->shards));
+
+	for(int i = 0; i < mesh->listen_sockets; i++) {
+		for(int j = 0; j < mesh->udp_shards; j++) {
+			if(start_shard(mesh, &mesh->shards[mesh->nshards], &mesh->listen_socket[i])) {
+				mesh->nshards++;
+			}
+		}
+	}
+
+	if(mesh->nshards) {
+		signal_add(&mesh->loop, &mesh->shard_signal, handle_shard_queue, mesh, 5);
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "Started %d UDP shard threads", mesh->nshards);
+}
+
+/* Stop all shards. This must be called while holding the lock,
+   it is temporarily released since the shards might be waiting for it. */
+void exit_shards(meshlink_handle_t *mesh) {
+	if(!mesh->shards) {
+		return;
+	}
+
+	for(int i = 0; i < mesh->nshards; i++) {
+		if(write(mesh->shards[i].pipefd[1], "", 1) != 1) {
+			abort();
+		}
+	}
+
+	meshlink_unlock(mesh);
+
+	for(int i = 0; i < mesh->nshards; i++) {
+		pthread_join(mesh->shards[i].thread, NULL);
+	}
+
+	meshlink_lock(mesh);
+
+	// Packets that have not been handed over yet are dropped
+	for(shard_item_t *item; (item = meshlink_queue_pop(&mesh->shard_queue));) {
+		free(item);
+	}
+
+	mesh->shard_queued = 0;
+
+	if(mesh->shard_signal.cb) {
+		signal_del(&mesh->loop, &mesh->shard_signal);
+	}
+
+	for(int i = 0; i < mesh->nshards; i++) {
+		shard_t *shard = &mesh->shards[i];
+		chacha_poly1305_exit(shard->cipher);
+		close(shard->pipefd[0]);
+		close(shard->pipefd[1]);
+		closesocket(shard->fd);
+	}
+
+	free(mesh->shards);
+	mesh->shards = NULL;
+	mesh->nshards = 0;
+}
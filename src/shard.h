@@ -0,0 +1,59 @@
+#ifndef MESHLINK_SHARD_H
+#define MESHLINK_SHARD_H
+
+/*
+    shard.h -- header file for shard.c
+    Copyright (C) 2026 Guus Sliepen <guus@meshlink.io>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <pthread.h>
+
+#include "meshlink_internal.h"
+#include "chacha-poly1305/chacha-poly1305.h"
+
+#define MAX_UDP_SHARDS 64
+#define SHARD_QUEUE_MAX 4096 // packets waiting to be handled by MeshLink's own thread
+
+typedef struct shard {
+	meshlink_handle_t *mesh;
+	listen_socket_t *ls;
+	int fd;
+	int pipefd[2];
+	pthread_t thread;
+	chacha_poly1305_ctx_t *cipher;
+
+	/* Protected by the mesh lock */
+	uint64_t in_packets;                    /* UDP packets received by this shard */
+	uint64_t handled_packets;               /* Packets this shard decrypted itself */
+} shard_t;
+
+/* A packet received by a shard, handed over to MeshLink's own thread */
+typedef struct shard_item {
+	shard_t *shard;
+	struct node_t *node;                    /* The node the packet was opened for, or NULL if the shard could not open it */
+	uint32_t generation;                    /* The node's SPTPS session when the packet was opened */
+	uint32_t inkey;                         /* The incoming key the packet was opened with */
+	bool verified;
+	sockaddr_t from;
+	uint16_t len;
+	uint8_t data[];
+} shard_item_t;
+
+void init_shards(meshlink_handle_t *mesh);
+void exit_shards(meshlink_handle_t *mesh);
+
+#endif
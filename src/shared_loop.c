@@ -0,0 +1,336 @@
+/*
+    shared_loop.c -- one event loop thread for several MeshLink instances
+    Copyright (C) 2026 Guus Sliepen <guus@meshlink.io>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "system.h"
+
+#include <pthread.h>
+
+#include "list.h"
+#include "logger.h"
+#include "meshlink_internal.h"
+#include "discovery.h"
+#include "net.h"
+#include "node.h"
+#include "shared_loop.h"
+#include "utils.h"
+#include "xalloc.h"
+
+/* The shared thread waits for the file descriptors of all attached instances in a single poll() call.
+   Each instance is only ever touched while holding its own mutex, exactly like its own main thread would,
+   so callbacks and the rest of the API behave the same as with a dedicated thread.
+   The shared mutex only protects the reference count and the stop flag, and is never held together with a mesh mutex. */
+
+struct meshlink_shared_loop {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	int pipefd[2];                  // used to wake up the shared thread
+	meshlink_queue_t attach_queue;  // instances waiting to be picked up by the shared thread
+	list_t *meshes;                 // attached instances, only touched by the shared thread
+	int users;                      // number of instances that have this loop set
+	bool stop;
+};
+
+static void shared_loop_kick(meshlink_shared_loop_t *shared) {
+	if(write(shared->pipefd[1], "", 1) != 1 && errno != EAGAIN) {
+		logger(NULL, MESHLINK_ERROR, "Could not wake up the shared event loop: %s", strerror(errno));
+	}
+}
+
+static void attach_mesh(meshlink_handle_t *mesh) {
+	if(mesh->discovery.enabled) {
+		discovery_start(mesh);
+	}
+
+	meshlink_lock(mesh);
+
+	// Nothing of the last poll() belongs to this instance yet
+	mesh->loop.poll_count = 0;
+
+	if(mesh->thread_status_cb) {
+		mesh->thread_status_cb(mesh, true);
+	}
+
+	logger(mesh, MESHLINK_DEBUG, "Attached to the shared event loop\n");
+	main_loop_init(mesh);
+
+	mesh->shared_attached = true;
+	pthread_cond_broadcast(&mesh->cond);
+	meshlink_unlock(mesh);
+}
+
+static void detach_mesh(meshlink_handle_t *mesh) {
+	meshlink_lock(mesh);
+	main_loop_exit(mesh);
+	logger(mesh, MESHLINK_DEBUG, "Detached from the shared event loop\n");
+
+	for splay_each(node_t, n, mesh->nodes) {
+		channel_flush_coalesced(mesh, n);
+	}
+
+	if(mesh->thread_status_cb) {
+		mesh->thread_status_cb(mesh, false);
+	}
+
+	meshlink_unlock(mesh);
+
+	if(mesh->discovery.enabled) {
+		discovery_stop(mesh);
+	}
+
+	// The application may free the mesh as soon as we release the lock, so this has to be the last access
+	meshlink_lock(mesh);
+	mesh->shared_attached = false;
+	pthread_cond_broadcast(&mesh->cond);
+	meshlink_unlock(mesh);
+}
+
+static void *shared_loop_thread(void *arg) {
+	meshlink_shared_loop_t *shared = arg;
+	list_t *meshes = shared->meshes;
+
+	// The results of the last poll() are dispatched while the descriptors for the next one are collected.
+	// The first entry is always the pipe.
+	size_t size = 1;
+	size_t next_size = 1;
+	struct pollfd *pfds = xzalloc(size * sizeof(*pfds));
+	struct pollfd *next_pfds = xzalloc(next_size * sizeof(*next_pfds));
+	int n = 0;
+	int poll_errno = 0;
+
+	while(true) {
+		pthread_mutex_lock(&shared->mutex);
+		bool stop = shared->stop;
+		pthread_mutex_unlock(&shared->mutex);
+
+		if(stop) {
+			break;
+		}
+
+		for(meshlink_handle_t *mesh; (mesh = meshlink_queue_pop(&shared->attach_queue));) {
+			attach_mesh(mesh);
+			list_insert_tail(meshes, mesh);
+		}
+
+		next_pfds[0].fd = shared->pipefd[0];
+		next_pfds[0].events = POLLIN;
+		next_pfds[0].revents = 0;
+
+		size_t nfds = 1;
+		struct timespec ts = {3600, 0};
+
+		for list_each(meshlink_handle_t, mesh, meshes) {
+			if(!mesh) {
+				// Detached from within a callback, see shared_loop_detach()
+				list_delete_node(meshes, list_node);
+				continue;
+			}
+
+			event_loop_t *loop = &mesh->loop;
+
+			meshlink_lock(mesh);
+
+			if(!loop->running) {
+				meshlink_unlock(mesh);
+				detach_mesh(mesh);
+				list_delete_node(meshes, list_node);
+				continue;
+			}
+
+			clock_gettime(EVENT_CLOCK, &loop->now);
+			struct timespec woken = loop->now;
+
+			if(n > 0) {
+				event_loop_dispatch(loop, pfds + loop->poll_first, loop->poll_count);
+			} else if(n < 0 && !sockwouldblock(poll_errno)) {
+				event_loop_check_fds(loop);
+			}
+
+			struct timespec mesh_ts = event_loop_prepare(loop);
+
+			if(!loop->running) {
+				// Detach it right away
+				mesh_ts.tv_sec = 0;
+				mesh_ts.tv_nsec = 0;
+			}
+
+			if(mesh_ts.tv_sec < ts.tv_sec || (mesh_ts.tv_sec == ts.tv_sec && mesh_ts.tv_nsec < ts.tv_nsec)) {
+				ts = mesh_ts;
+			}
+
+			nfds = event_loop_get_pollfds(loop, &next_pfds, &next_size, nfds);
+
+			struct timespec sleeping;
+			clock_gettime(EVENT_CLOCK, &sleeping);
+			event_loop_account(loop, &woken, &sleeping);
+
+			meshlink_unlock(mesh);
+		}
+
+		n = event_poll(next_pfds, nfds, &ts);
+		poll_errno = errno;
+
+		if(n < 0 && !sockwouldblock(poll_errno)) {
+			logger(NULL, MESHLINK_WARNING, "Error from poll() in the shared event loop, checking for bad fds: %s", strerror(poll_errno));
+		}
+
+		struct pollfd *tmp = pfds;
+		pfds = next_pfds;
+		next_pfds = tmp;
+
+		size_t tmp_size = size;
+		size = next_size;
+		next_size = tmp_size;
+
+		if(n > 0 && pfds[0].revents) {
+			char buf[64];
+
+			while(read(shared->pipefd[0], buf, sizeof(buf)) > 0);
+		}
+	}
+
+	free(pfds);
+	free(next_pfds);
+	return NULL;
+}
+
+meshlink_shared_loop_t *shared_loop_new(void) {
+	meshlink_shared_loop_t *shared = xzalloc(sizeof(*shared));
+
+	if(pipe(shared->pipefd) != 0) {
+		free(shared);
+		return NULL;
+	}
+
+#ifdef O_NONBLOCK
+	fcntl(shared->pipefd[0], F_SETFL, O_NONBLOCK);
+	fcntl(shared->pipefd[1], F_SETFL, O_NONBLOCK);
+#endif
+
+	pthread_mutex_init(&shared->mutex, NULL);
+	meshlink_queue_init(&shared->attach_queue);
+	shared->meshes = list_alloc(NULL);
+
+	// Ensure we have a decent amount of stack space. Musl's default of 80 kB is too small.
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 1024 * 1024);
+
+	if(pthread_create(&shared->thread, &attr, shared_loop_thread, shared) != 0) {
+		list_free(shared->meshes);
+		meshlink_queue_exit(&shared->attach_queue);
+		pthread_mutex_destroy(&shared->mutex);
+		close(shared->pipefd[0]);
+		close(shared->pipefd[1]);
+		free(shared);
+		return NULL;
+	}
+
+	return shared;
+}
+
+bool shared_loop_free(meshlink_shared_loop_t *shared) {
+	pthread_mutex_lock(&shared->mutex);
+
+	if(shared->users) {
+		pthread_mutex_unlock(&shared->mutex);
+		return false;
+	}
+
+	shared->stop = true;
+	pthread_mutex_unlock(&shared->mutex);
+
+	shared_loop_kick(shared);
+
+	if(pthread_join(shared->thread, NULL) != 0) {
+		abort();
+	}
+
+	list_free(shared->meshes);
+	meshlink_queue_exit(&shared->attach_queue);
+	pthread_mutex_destroy(&shared->mutex);
+	close(shared->pipefd[0]);
+	close(shared->pipefd[1]);
+	free(shared);
+	return true;
+}
+
+void shared_loop_ref(meshlink_shared_loop_t *shared) {
+	pthread_mutex_lock(&shared->mutex);
+	shared->users++;
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+void shared_loop_unref(meshlink_shared_loop_t *shared) {
+	pthread_mutex_lock(&shared->mutex);
+	shared->users--;
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+bool shared_loop_attach(meshlink_handle_t *mesh) {
+	meshlink_shared_loop_t *shared = mesh->shared_loop;
+
+	if(pthread_equal(pthread_self(), shared->thread)) {
+		// Called from a callback of another instance, the shared thread cannot wait for itself
+		mesh->thread = shared->thread;
+		meshlink_unlock(mesh);
+		attach_mesh(mesh);
+		meshlink_lock(mesh);
+		list_insert_tail(shared->meshes, mesh);
+		return true;
+	}
+
+	if(!meshlink_queue_push(&shared->attach_queue, mesh)) {
+		return false;
+	}
+
+	shared_loop_kick(shared);
+	mesh->thread = shared->thread;
+
+	while(!mesh->shared_attached) {
+		meshlink_cond_wait(mesh, &mesh->cond);
+	}
+
+	return true;
+}
+
+void shared_loop_detach(meshlink_handle_t *mesh) {
+	meshlink_shared_loop_t *shared = mesh->shared_loop;
+
+	if(pthread_equal(pthread_self(), shared->thread)) {
+		// Called from a callback of another instance. The shared thread might be iterating over the list right now,
+		// so just clear the entry, the thread removes it itself once it gets back to it.
+		for list_each(meshlink_handle_t, attached, shared->meshes) {
+			if(attached == mesh) {
+				list_node->data = NULL;
+				meshlink_unlock(mesh);
+				detach_mesh(mesh);
+				meshlink_lock(mesh);
+				break;
+			}
+		}
+
+		return;
+	}
+
+	shared_loop_kick(shared);
+
+	while(mesh->shared_attached) {
+		meshlink_cond_wait(mesh, &mesh->cond);
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef MESHLINK_SHARED_LOOP_H
+#define MESHLINK_SHARED_LOOP_H
+
+/*
+    shared_loop.h -- header file for shared_loop.c
+    Copyright (C) 2026 Guus Sliepen <guus@meshlink.io>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "meshlink_internal.h"
+
+struct meshlink_shared_loop *shared_loop_new(void);
+bool shared_loop_free(struct meshlink_shared_loop *shared);
+void shared_loop_ref(struct meshlink_shared_loop *shared);
+void shared_loop_unref(struct meshlink_shared_loop *shared);
+
+// Both must be called with the mesh locked, they return once the shared thread has picked up the change.
+// When called from the shared thread itself, the change is made right away.
+bool shared_loop_attach(meshlink_handle_t *mesh);
+void shared_loop_detach(meshlink_handle_t *mesh);
+
+#endif
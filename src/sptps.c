@@ -157,6 +157,44 @@ bool sptps_send_record(sptps_t *s, uint8_t type, const void *data, uint16_t len)
 	return send_record_priv(s, type, data, len);
 }
 
+// Build an application datagram record without encrypting it, so it can be sealed on another thread.
+// The sequence number is reserved immediately, and a copy of the outgoing cipher is stored in cipher.
+// The buffer must have room for len + SPTPS_DATAGRAM_OVERHEAD bytes.
+bool sptps_prepare_datagram(sptps_t *s, uint8_t type, const void *data, uint16_t len, void *vbuffer, chacha_poly1305_ctx_t *cipher) {
+	assert(!len || data);
+	assert(vbuffer);
+	assert(cipher);
+
+	if(!s->datagram || !s->outstate) {
+		return error(s, EINVAL, "Handshake phase not finished yet");
+	}
+
+	if(type >= SPTPS_HANDSHAKE) {
+		return error(s, EINVAL, "Invalid application record type");
+	}
+
+	char *buffer = vbuffer;
+	uint32_t seqno = s->outseqno++;
+	uint32_t netseqno = htonl(seqno);
+
+	memcpy(buffer, &netseqno, 4);
+	buffer[4] = type;
+	memcpy(buffer + 5, data, len);
+
+	chacha_poly1305_copy(cipher, s->outcipher);
+	return true;
+}
+
+// Encrypt and HMAC a record built by sptps_prepare_datagram(), len is the size of the sealed record.
+void sptps_seal_datagram(chacha_poly1305_ctx_t *cipher, void *vbuffer, size_t len) {
+	char *buffer = vbuffer;
+	uint32_t seqno;
+	memcpy(&seqno, buffer, 4);
+	seqno = ntohl(seqno);
+
+	chacha_poly1305_encrypt(cipher, seqno, buffer + 4, len - SPTPS_DATAGRAM_OVERHEAD + 1, buffer + 4, NULL);
+}
+
 // Send a Key EXchange record, containing a random nonce and an ECDHE public key.
 static bool send_kex(sptps_t *s) {
 	size_t keylen = ECDH_SIZE;
@@ -281,6 +319,7 @@ static bool receive_ack(sptps_t *s, const char *data, uint16_t len) {
 	free(s->key);
 	s->key = NULL;
 	s->instate = true;
+	s->inkey++;
 
 	return true;
 }
@@ -466,53 +505,9 @@ bool sptps_verify_datagram(sptps_t *s, const void *data, size_t len) {
 	return chacha_poly1305_verify(s->incipher, seqno, (const char *)data + 4, len - 4);
 }
 
-// Receive incoming data, datagram version.
-static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t len) {
-	const char *data = vdata;
-
-	if(len < (s->instate ? SPTPS_DATAGRAM_OVERHEAD : 5)) {
-		return error(s, EIO, "Received short packet in sptps_receive_data_datagram");
-	}
-
-	uint32_t seqno;
-	memcpy(&seqno, data, 4);
-	seqno = ntohl(seqno);
-
-	if(!s->instate) {
-		if(seqno != s->inseqno) {
-			return error(s, EIO, "Invalid packet seqno: %d != %d", seqno, s->inseqno);
-		}
-
-		s->inseqno = seqno + 1;
-
-		uint8_t type = data[4];
-
-		if(type != SPTPS_HANDSHAKE) {
-			return error(s, EIO, "Application record received before handshake finished");
-		}
-
-		return receive_handshake(s, data + 5, len - 5);
-	}
-
-	// Decrypt
-
-	if(len > s->decrypted_buffer_len) {
-		s->decrypted_buffer_len *= 2;
-		char *new_buffer = realloc(s->decrypted_buffer, s->decrypted_buffer_len);
-
-		if(!new_buffer) {
-			return error(s, errno, strerror(errno));
-		}
-
-		s->decrypted_buffer = new_buffer;
-	}
-
-	size_t outlen;
-
-	if(!chacha_poly1305_decrypt(s->incipher, seqno, data + 4, len - 4, s->decrypted_buffer, &outlen)) {
-		return error(s, EIO, "Failed to decrypt and verify packet");
-	}
-
+// Apply replay protection to a decrypted datagram record and handle it.
+// The record buffer must have room for a terminating NULL byte.
+static bool receive_decrypted_datagram(sptps_t *s, uint32_t seqno, char *record, size_t len) {
 	// Replay protection using a sliding window of configurable size.
 	// s->inseqno is expected sequence number
 	// seqno is received sequence number
@@ -528,6 +523,7 @@ static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t le
 			} else if(seqno < s->inseqno) {
 				// If the sequence number is farther in the past than the bitmap goes, or if the packet was already received, drop it.
 				if((s->inseqno >= s->replaywin * 8 && seqno < s->inseqno - s->replaywin * 8) || !(s->late[(seqno / 8) % s->replaywin] & (1 << seqno % 8))) {
+					s->replay_drops++;
 					return error(s, EIO, "Received late or replayed packet, seqno %d, last received %d\n", seqno, s->inseqno);
 				}
 			} else {
@@ -553,20 +549,20 @@ static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t le
 	}
 
 	// Append a NULL byte for safety.
-	s->decrypted_buffer[len - 20] = 0;
+	record[len - 20] = 0;
 
-	uint8_t type = s->decrypted_buffer[0];
+	uint8_t type = record[0];
 
 	if(type < SPTPS_HANDSHAKE) {
 		if(!s->instate) {
 			return error(s, EIO, "Application record received before handshake finished");
 		}
 
-		if(!s->receive_record(s->handle, type, s->decrypted_buffer + 1, len - SPTPS_DATAGRAM_OVERHEAD)) {
+		if(!s->receive_record(s->handle, type, record + 1, len - SPTPS_DATAGRAM_OVERHEAD)) {
 			abort();
 		}
 	} else if(type == SPTPS_HANDSHAKE) {
-		if(!receive_handshake(s, s->decrypted_buffer + 1, len - SPTPS_DATAGRAM_OVERHEAD)) {
+		if(!receive_handshake(s, record + 1, len - SPTPS_DATAGRAM_OVERHEAD)) {
 			abort();
 		}
 	} else {
@@ -576,6 +572,108 @@ static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t le
 	return true;
 }
 
+// Receive incoming data, datagram version.
+static bool sptps_receive_data_datagram(sptps_t *s, const void *vdata, size_t len) {
+	const char *data = vdata;
+
+	if(len < (s->instate ? SPTPS_DATAGRAM_OVERHEAD : 5)) {
+		return error(s, EIO, "Received short packet in sptps_receive_data_datagram");
+	}
+
+	uint32_t seqno;
+	memcpy(&seqno, data, 4);
+	seqno = ntohl(seqno);
+
+	if(!s->instate) {
+		if(seqno != s->inseqno) {
+			return error(s, EIO, "Invalid packet seqno: %d != %d", seqno, s->inseqno);
+		}
+
+		s->inseqno = seqno + 1;
+
+		uint8_t type = data[4];
+
+		if(type != SPTPS_HANDSHAKE) {
+			return error(s, EIO, "Application record received before handshake finished");
+		}
+
+		return receive_handshake(s, data + 5, len - 5);
+	}
+
+	// Decrypt
+
+	if(len > s->decrypted_buffer_len) {
+		s->decrypted_buffer_len *= 2;
+		char *new_buffer = realloc(s->decrypted_buffer, s->decrypted_buffer_len);
+
+		if(!new_buffer) {
+			return error(s, errno, strerror(errno));
+		}
+
+		s->decrypted_buffer = new_buffer;
+	}
+
+	size_t outlen;
+
+	if(!chacha_poly1305_decrypt(s->incipher, seqno, data + 4, len - 4, s->decrypted_buffer, &outlen)) {
+		s->decrypt_failures++;
+		return error(s, EIO, "Failed to decrypt and verify packet");
+	}
+
+	return receive_decrypted_datagram(s, seqno, s->decrypted_buffer, len);
+}
+
+// Check whether a datagram can be decrypted outside of sptps_receive_data(), if so store a copy of the incoming cipher.
+// The caller should remember s->inkey, and pass it to sptps_receive_opened_datagram().
+// This does not report an error, the caller should fall back to sptps_receive_data().
+bool sptps_prepare_open(sptps_t *s, size_t len, chacha_poly1305_ctx_t *cipher) {
+	assert(cipher);
+
+	if(!s->state || !s->datagram || !s->instate || len < SPTPS_DATAGRAM_OVERHEAD) {
+		return false;
+	}
+
+	chacha_poly1305_copy(cipher, s->incipher);
+	return true;
+}
+
+// Decrypt and verify a datagram in place, the decrypted record starts 4 bytes into the buffer.
+bool sptps_open_datagram(chacha_poly1305_ctx_t *cipher, void *vbuffer, size_t len) {
+	char *buffer = vbuffer;
+	uint32_t seqno;
+	memcpy(&seqno, buffer, 4);
+	seqno = ntohl(seqno);
+
+	return chacha_poly1305_decrypt(cipher, seqno, buffer + 4, len - 4, buffer + 4, NULL);
+}
+
+// Handle a datagram decrypted by sptps_open_datagram(), verified is the result of that call.
+// Replay protection is applied here, so datagrams must be passed in the order they were received.
+// If the incoming key changed since sptps_prepare_open(), a datagram that could not be verified
+// might already use the new key. Since a failed verification leaves the buffer untouched, try again with the current key.
+bool sptps_receive_opened_datagram(sptps_t *s, uint32_t inkey, bool verified, void *vbuffer, size_t len) {
+	char *buffer = vbuffer;
+
+	if(!s->state || !s->datagram || !s->instate || len < SPTPS_DATAGRAM_OVERHEAD) {
+		return error(s, EIO, "SPTPS state not ready to receive this datagram");
+	}
+
+	if(!verified && inkey != s->inkey) {
+		return sptps_receive_data_datagram(s, buffer, len);
+	}
+
+	if(!verified) {
+		s->decrypt_failures++;
+		return error(s, EIO, "Failed to decrypt and verify packet");
+	}
+
+	uint32_t seqno;
+	memcpy(&seqno, buffer, 4);
+	seqno = ntohl(seqno);
+
+	return receive_decrypted_datagram(s, seqno, buffer + 4, len);
+}
+
 // Receive incoming data. Check if it contains a complete record, if so, handle it.
 bool sptps_receive_data(sptps_t *s, const void *data, size_t len) {
 	if(!s->state) {
@@ -688,7 +786,13 @@ bool sptps_start(sptps_t *s, void *handle, bool initiator, bool datagram, ecdsa_
 	}
 
 	// Initialise struct sptps
+	uint64_t decrypt_failures = s->decrypt_failures;
+	uint64_t replay_drops = s->replay_drops;
+	uint32_t generation = s->generation;
 	memset(s, 0, sizeof(*s));
+	s->decrypt_failures = decrypt_failures;
+	s->replay_drops = replay_drops;
+	s->generation = generation + 1;
 
 	s->handle = handle;
 	s->initiator = initiator;
@@ -754,6 +858,12 @@ bool sptps_stop(sptps_t *s) {
 	free(s->late);
 	memset(s->decrypted_buffer, 0, s->decrypted_buffer_len);
 	free(s->decrypted_buffer);
+	uint64_t decrypt_failures = s->decrypt_failures;
+	uint64_t replay_drops = s->replay_drops;
+	uint32_t generation = s->generation;
 	memset(s, 0, sizeof(*s));
+	s->decrypt_failures = decrypt_failures;
+	s->replay_drops = replay_drops;
+	s->generation = generation;
 	return true;
 }
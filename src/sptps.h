@@ -60,6 +60,7 @@ typedef struct sptps {
 	size_t buflen;
 
 	chacha_poly1305_ctx_t *incipher;
+	uint32_t inkey;       // Incremented whenever incipher gets a new key
 	uint32_t replaywin;
 	uint32_t inseqno;
 	uint32_t received;
@@ -89,6 +90,10 @@ typedef struct sptps {
 	char *label;
 	size_t labellen;
 
+	// Statistics, these survive sptps_stop() and sptps_start()
+	uint64_t decrypt_failures;
+	uint64_t replay_drops;
+	uint32_t generation;  // Incremented by every sptps_start()
 } sptps_t;
 
 void sptps_log_quiet(sptps_t *s, int s_errno, const char *format, va_list ap);
@@ -101,4 +106,11 @@ bool sptps_receive_data(sptps_t *s, const void *data, size_t len) __attribute__(
 bool sptps_force_kex(sptps_t *s) __attribute__((__warn_unused_result__));
 bool sptps_verify_datagram(sptps_t *s, const void *data, size_t len) __attribute__((__warn_unused_result__));
 
+// Datagram records split into a part that must run in order, and the cipher work which can run on any thread.
+bool sptps_prepare_datagram(sptps_t *s, uint8_t type, const void *data, uint16_t len, void *buffer, chacha_poly1305_ctx_t *cipher) __attribute__((__warn_unused_result__));
+void sptps_seal_datagram(chacha_poly1305_ctx_t *cipher, void *buffer, size_t len);
+bool sptps_prepare_open(sptps_t *s, size_t len, chacha_poly1305_ctx_t *cipher) __attribute__((__warn_unused_result__));
+bool sptps_open_datagram(chacha_poly1305_ctx_t *cipher, void *buffer, size_t len) __attribute__((__warn_unused_result__));
+bool sptps_receive_opened_datagram(sptps_t *s, uint32_t inkey, bool verified, void *buffer, size_t len);
+
 #endif
@@ -31,10 +31,13 @@
 #include "protocol.h"
 
 static submesh_t *new_submesh(void) {
-	return xzalloc(sizeof(submesh_t));
+	submesh_t *s = xzalloc(sizeof(submesh_t));
+	s->connections = list_alloc(NULL);
+	return s;
 }
 
 static void free_submesh(submesh_t *s) {
+	list_delete_list(s->connections);
 	free(s->name);
 	free(s);
 }
@@ -29,6 +29,7 @@ typedef struct submesh_t {
 	void *priv;
 
 	struct meshlink_handle *mesh;                   /* the mesh this submesh belongs to */
+	struct list_t *connections;             /* active meta-connections with nodes in this submesh */
 } submesh_t;
 
 void init_submeshes(struct meshlink_handle *mesh);
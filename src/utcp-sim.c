@@ -0,0 +1,635 @@
+/*
+    utcp-sim.c -- Deterministic simulation of a UTCP connection
+    Copyright (C) 2026 Guus Sliepen <guus@tinc-vpn.org>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* This program connects two UTCP instances through an in-memory link model,
+ * and transfers data from one to the other. Time is simulated; UTCP is compiled
+ * with UTCP_GETTIME pointing to utcp_sim_gettime(), so the results only depend
+ * on the parameters and the random seed, not on the speed of the machine.
+ *
+ * Parameters are passed via environment variables:
+ *
+ * SIZE       Amount of data to transfer in bytes (default 10000000)
+ * RATE       Link rate in bits per second, with optional k, m or g suffix (default 100m, 0 is unlimited)
+ * DELAY      One-way delay in milliseconds (default 10)
+ * JITTER     Maximum random extra delay in milliseconds (default 1)
+ * LOSS       Packet loss probability (default 0.001)
+ * REORDER    Probability that a packet is delayed by an extra DELAY (default 0)
+ * QUEUE      Maximum number of bytes queued for transmission on a link (default 262144, 0 is unlimited)
+ * MTU        Maximum size of a packet, including IP and UDP headers (default 1500)
+ * BUFSIZE    Send and receive buffer size (default 0, use UTCP's default)
+ * FLAGS      Connection flags (default UTCP_TCP)
+ * SEED       Seed for the random number generator (default 1)
+ * TIMELIMIT  Maximum duration of the simulation in seconds of simulated time (default 3600)
+ */
+
+#include "system.h"
+#include <inttypes.h>
+#include <time.h>
+
+#include "utcp_priv.h"
+
+#define NSEC_PER_MSEC 1000000L
+
+struct packet {
+	int64_t when;
+	uint64_t id;
+	size_t len;
+	char data[];
+};
+
+struct link {
+	struct endpoint *dst;
+
+	// Parameters
+	double rate; // bytes per nanosecond
+	int64_t delay;
+	int64_t jitter;
+	double loss;
+	double reorder;
+	size_t queue;
+
+	// State
+	int64_t busy_until;
+	int64_t last_arrival;
+	struct packet **heap;
+	size_t nheap;
+	size_t nallocated;
+
+	// Statistics
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t lost;
+	uint64_t overflowed;
+	uint64_t reordered;
+};
+
+struct sample {
+	uint32_t end;
+	int64_t sent;
+	bool valid;
+};
+
+struct endpoint {
+	struct utcp *utcp;
+	struct utcp_connection *c;
+	struct link out;
+
+	// Sender side tracking
+	bool snd_max_valid;
+	uint32_t snd_max;
+	uint64_t data_packets;
+	uint64_t data_bytes;
+	uint64_t retransmits;
+	uint64_t retransmitted_bytes;
+
+	struct sample *samples;
+	size_t nsamples;
+	size_t first_sample;
+	size_t nallocated;
+};
+
+static int64_t now;
+static uint64_t next_id;
+static uint64_t rng_state;
+
+static struct endpoint left;
+static struct endpoint right;
+
+static size_t total_size = 10000000;
+static size_t sent;
+static size_t received;
+static bool finished;
+static bool failed;
+
+static int64_t *rtts;
+static size_t nrtts;
+static size_t rtts_allocated;
+
+static int32_t seqdiff(uint32_t a, uint32_t b) {
+	return a - b;
+}
+
+int utcp_sim_gettime(struct timespec *ts);
+
+int utcp_sim_gettime(struct timespec *ts) {
+	ts->tv_sec = now / NSEC_PER_SEC;
+	ts->tv_nsec = now % NSEC_PER_SEC;
+	return 0;
+}
+
+// xorshift64*
+static double rng(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 0x2545F4914F6CDD1DULL >> 11) * 0x1.0p-53;
+}
+
+static void *xrealloc_array(void *ptr, size_t *nallocated, size_t size) {
+	size_t n = *nallocated ? *nallocated * 2 : 64;
+	ptr = realloc(ptr, n * size);
+
+	if(!ptr) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	*nallocated = n;
+	return ptr;
+}
+
+// Packets in flight are kept in a min-heap, ordered by arrival time.
+static bool packet_before(const struct packet *a, const struct packet *b) {
+	return a->when < b->when || (a->when == b->when && a->id < b->id);
+}
+
+static void heap_push(struct link *link, struct packet *pkt) {
+	if(link->nheap == link->nallocated) {
+		link->heap = xrealloc_array(link->heap, &link->nallocated, sizeof(*link->heap));
+	}
+
+	size_t i = link->nheap++;
+
+	while(i) {
+		size_t parent = (i - 1) / 2;
+
+		if(!packet_before(pkt, link->heap[parent])) {
+			break;
+		}
+
+		link->heap[i] = link->heap[parent];
+		i = parent;
+	}
+
+	link->heap[i] = pkt;
+}
+
+static struct packet *heap_pop(struct link *link) {
+	struct packet *top = link->heap[0];
+	struct packet *last = link->heap[--link->nheap];
+	size_t i = 0;
+
+	while(true) {
+		size_t child = 2 * i + 1;
+
+		if(child >= link->nheap) {
+			break;
+		}
+
+		if(child + 1 < link->nheap && packet_before(link->heap[child + 1], link->heap[child])) {
+			child++;
+		}
+
+		if(!packet_before(link->heap[child], last)) {
+			break;
+		}
+
+		link->heap[i] = link->heap[child];
+		i = child;
+	}
+
+	if(link->nheap) {
+		link->heap[i] = last;
+	}
+
+	return top;
+}
+
+static void record_rtt(int64_t rtt) {
+	if(nrtts == rtts_allocated) {
+		rtts = xrealloc_array(rtts, &rtts_allocated, sizeof(*rtts));
+	}
+
+	rtts[nrtts++] = rtt;
+}
+
+// Keep track of retransmissions and round trip times of data sent by an endpoint.
+static void track_outgoing(struct endpoint *ep, const struct hdr *hdr, size_t len) {
+	if(!len || hdr->ctl & SYN) {
+		return;
+	}
+
+	uint32_t end = hdr->seq + len;
+
+	ep->data_packets++;
+	ep->data_bytes += len;
+
+	if(ep->snd_max_valid && seqdiff(hdr->seq, ep->snd_max) < 0) {
+		ep->retransmits++;
+		ep->retransmitted_bytes += len;
+
+		// Karn's algorithm: don't measure the RTT of retransmitted data
+		for(size_t i = ep->first_sample; i < ep->nsamples; i++) {
+			if(seqdiff(ep->samples[i].end, hdr->seq) > 0) {
+				ep->samples[i].valid = false;
+			}
+		}
+	}
+
+	if(!ep->snd_max_valid || seqdiff(end, ep->snd_max) > 0) {
+		ep->snd_max = end;
+		ep->snd_max_valid = true;
+
+		if(ep->nsamples == ep->nallocated) {
+			ep->samples = xrealloc_array(ep->samples, &ep->nallocated, sizeof(*ep->samples));
+		}
+
+		ep->samples[ep->nsamples++] = (struct sample) {
+			end, now, true
+		};
+	}
+}
+
+static void track_incoming(struct endpoint *ep, const struct hdr *hdr) {
+	if(!(hdr->ctl & ACK)) {
+		return;
+	}
+
+	while(ep->first_sample < ep->nsamples && seqdiff(hdr->ack, ep->samples[ep->first_sample].end) >= 0) {
+		struct sample *sample = &ep->samples[ep->first_sample++];
+
+		if(sample->valid) {
+			record_rtt(now - sample->sent);
+		}
+	}
+}
+
+static ssize_t do_send(struct utcp *utcp, const void *data, size_t len) {
+	struct endpoint *ep = utcp->priv;
+	struct link *link = &ep->out;
+
+	if(len >= sizeof(struct hdr)) {
+		struct hdr hdr;
+		memcpy(&hdr, data, sizeof(hdr));
+		track_outgoing(ep, &hdr, len - sizeof(hdr));
+	}
+
+	link->packets++;
+	link->bytes += len;
+
+	// Drop packets if the transmit queue is full
+	int64_t departure = link->busy_until > now ? link->busy_until : now;
+
+	if(link->queue && link->rate && (departure - now) * link->rate + len > link->queue) {
+		link->overflowed++;
+		return len;
+	}
+
+	if(link->rate) {
+		departure += len / link->rate;
+	}
+
+	link->busy_until = departure;
+
+	if(rng() < link->loss) {
+		link->lost++;
+		return len;
+	}
+
+	struct packet *pkt = malloc(sizeof(*pkt) + len);
+
+	if(!pkt) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	pkt->when = departure + link->delay + (int64_t)(rng() * link->jitter);
+	pkt->id = next_id++;
+	pkt->len = len;
+	memcpy(pkt->data, data, len);
+
+	if(rng() < link->reorder) {
+		link->reordered++;
+		pkt->when += link->delay;
+	} else {
+		// Jitter does not reorder packets
+		if(pkt->when < link->last_arrival) {
+			pkt->when = link->last_arrival;
+		}
+
+		link->last_arrival = pkt->when;
+	}
+
+	heap_push(link, pkt);
+	return len;
+}
+
+static ssize_t do_recv(struct utcp_connection *c, const void *data, size_t len) {
+	(void)c;
+
+	if(!data || !len) {
+		if(errno) {
+			fprintf(stderr, "Connection error: %s\n", strerror(errno));
+			failed = true;
+		}
+
+		finished = true;
+		return 0;
+	}
+
+	const uint8_t *p = data;
+
+	for(size_t i = 0; i < len; i++) {
+		if(p[i] != (uint8_t)((received + i) % 251)) {
+			fprintf(stderr, "Received data differs from what was sent at offset %zu\n", received + i);
+			failed = true;
+			finished = true;
+			return len;
+		}
+	}
+
+	received += len;
+	return len;
+}
+
+static void do_poll(struct utcp_connection *c, size_t len) {
+	if(sent == total_size) {
+		return;
+	}
+
+	uint8_t buf[65536];
+
+	while(len && sent < total_size) {
+		size_t chunk = len;
+
+		if(chunk > sizeof(buf)) {
+			chunk = sizeof(buf);
+		}
+
+		if(chunk > total_size - sent) {
+			chunk = total_size - sent;
+		}
+
+		for(size_t i = 0; i < chunk; i++) {
+			buf[i] = (sent + i) % 251;
+		}
+
+		ssize_t result = utcp_send(c, buf, chunk);
+
+		if(result <= 0) {
+			return;
+		}
+
+		sent += result;
+		len -= result;
+	}
+
+	if(sent == total_size) {
+		utcp_shutdown(c, UTCP_SHUT_WR);
+	}
+}
+
+static size_t bufsize;
+
+static void do_accept(struct utcp_connection *c, uint16_t port) {
+	(void)port;
+	utcp_accept(c, do_recv, NULL);
+	right.c = c;
+
+	if(bufsize) {
+		utcp_set_sndbuf(c, NULL, bufsize);
+		utcp_set_rcvbuf(c, NULL, bufsize);
+	}
+}
+
+static double getenv_double(const char *name, double def) {
+	const char *value = getenv(name);
+	return value ? atof(value) : def;
+}
+
+static double parse_rate(const char *value) {
+	char *end;
+	double rate = strtod(value, &end);
+
+	switch(*end) {
+	case 'k':
+	case 'K':
+		rate *= 1e3;
+		break;
+
+	case 'm':
+	case 'M':
+		rate *= 1e6;
+		break;
+
+	case 'g':
+	case 'G':
+		rate *= 1e9;
+		break;
+
+	default:
+		break;
+	}
+
+	return rate;
+}
+
+static void init_link(struct link *link, struct endpoint *dst) {
+	const char *rate = getenv("RATE");
+
+	link->dst = dst;
+	link->rate = parse_rate(rate ? rate : "100m") / 8 / NSEC_PER_SEC;
+	link->delay = getenv_double("DELAY", 10) * NSEC_PER_MSEC;
+	link->jitter = getenv_double("JITTER", 1) * NSEC_PER_MSEC;
+	link->loss = getenv_double("LOSS", 0.001);
+	link->reorder = getenv_double("REORDER", 0);
+	link->queue = getenv_double("QUEUE", 262144);
+}
+
+static void free_link(struct link *link) {
+	while(link->nheap) {
+		free(heap_pop(link));
+	}
+
+	free(link->heap);
+}
+
+static int64_t next_arrival(const struct link *link) {
+	return link->nheap ? link->heap[0]->when : INT64_MAX;
+}
+
+static int64_t timespec_to_nsec(const struct timespec *ts) {
+	return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static int compare_int64(const void *va, const void *vb) {
+	int64_t a = *(const int64_t *)va;
+	int64_t b = *(const int64_t *)vb;
+	return (a > b) - (a < b);
+}
+
+static double percentile(double p) {
+	if(!nrtts) {
+		return 0;
+	}
+
+	size_t i = p * (nrtts - 1) + 0.5;
+	return rtts[i] / 1e6;
+}
+
+static void print_link(const char *dir, const struct link *link) {
+	printf("%-10s packets %" PRIu64 " bytes %" PRIu64 " lost %" PRIu64 " overflowed %" PRIu64 " reordered %" PRIu64 "\n",
+	       dir, link->packets, link->bytes, link->lost, link->overflowed, link->reordered);
+}
+
+int main(void) {
+	total_size = getenv_double("SIZE", 10000000);
+	rng_state = getenv_double("SEED", 1);
+	bufsize = getenv_double("BUFSIZE", 0);
+
+	if(!rng_state) {
+		rng_state = 1;
+	}
+
+	uint32_t flags = getenv_double("FLAGS", UTCP_TCP);
+	long mtu = getenv_double("MTU", 1500);
+	int64_t timelimit = getenv_double("TIMELIMIT", 3600) * NSEC_PER_SEC;
+
+	init_link(&left.out, &right);
+	init_link(&right.out, &left);
+
+	// Start at a non-zero time, UTCP treats a zero timestamp as unset.
+	now = NSEC_PER_SEC;
+	int64_t start = now;
+
+	utcp_set_clock_granularity(1);
+
+	left.utcp = utcp_init(NULL, NULL, do_send, &left);
+	right.utcp = utcp_init(do_accept, NULL, do_send, &right);
+
+	if(!left.utcp || !right.utcp) {
+		fprintf(stderr, "Could not initialize UTCP\n");
+		return 1;
+	}
+
+	utcp_set_mtu(left.utcp, mtu - 28);
+	utcp_set_mtu(right.utcp, mtu - 28);
+
+	left.c = utcp_connect_ex(left.utcp, 1, NULL, NULL, flags);
+
+	if(!left.c) {
+		fprintf(stderr, "Could not connect\n");
+		return 1;
+	}
+
+	if(bufsize) {
+		utcp_set_sndbuf(left.c, NULL, bufsize);
+		utcp_set_rcvbuf(left.c, NULL, bufsize);
+	}
+
+	utcp_set_poll_cb(left.c, do_poll);
+
+	struct timespec cpu_start, cpu_end;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+
+	while(!finished) {
+		// Run timers and find out when the next event happens.
+		struct timespec left_timeout = utcp_timeout(left.utcp);
+		struct timespec right_timeout = utcp_timeout(right.utcp);
+
+		if(finished) {
+			break;
+		}
+
+		// UTCP only fires timers that have strictly expired, so wake up just after the deadline.
+		int64_t next = now + timespec_to_nsec(&left_timeout) + 1;
+		int64_t t = now + timespec_to_nsec(&right_timeout) + 1;
+
+		if(t < next) {
+			next = t;
+		}
+
+		t = next_arrival(&left.out);
+
+		if(t < next) {
+			next = t;
+		}
+
+		t = next_arrival(&right.out);
+
+		if(t < next) {
+			next = t;
+		}
+
+		if(next > now) {
+			now = next;
+		}
+
+		if(now - start > timelimit) {
+			fprintf(stderr, "Time limit exceeded\n");
+			failed = true;
+			break;
+		}
+
+		// Deliver all packets that have arrived, in order of arrival.
+		while(!finished) {
+			struct link *link = next_arrival(&left.out) <= next_arrival(&right.out) ? &left.out : &right.out;
+
+			if(next_arrival(link) > now) {
+				break;
+			}
+
+			struct packet *pkt = heap_pop(link);
+
+			if(pkt->len >= sizeof(struct hdr)) {
+				struct hdr hdr;
+				memcpy(&hdr, pkt->data, sizeof(hdr));
+				track_incoming(link->dst, &hdr);
+			}
+
+			utcp_recv(link->dst->utcp, pkt->data, pkt->len);
+			free(pkt);
+		}
+	}
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+	double duration = (now - start) / 1e9;
+	double cpu = (timespec_to_nsec(&cpu_end) - timespec_to_nsec(&cpu_start)) / 1e9;
+
+	qsort(rtts, nrtts, sizeof(*rtts), compare_int64);
+
+	printf("transferred %zu of %zu bytes in %.3f s simulated time\n", received, total_size, duration);
+	printf("goodput    %.3f Mbit/s\n", duration > 0 ? received * 8 / duration / 1e6 : 0);
+	printf("segments   %" PRIu64 " (%" PRIu64 " bytes)\n", left.data_packets, left.data_bytes);
+	printf("rtrx       %" PRIu64 " (%" PRIu64 " bytes, %.2f%%)\n", left.retransmits, left.retransmitted_bytes,
+	       left.data_bytes ? 100.0 * left.retransmitted_bytes / left.data_bytes : 0);
+	printf("rtt        samples %zu min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f ms\n",
+	       nrtts, percentile(0), percentile(0.5), percentile(0.9), percentile(0.99), percentile(1));
+	print_link("forward", &left.out);
+	print_link("reverse", &right.out);
+	printf("cpu        %.3f s, %.1f ns/byte\n", cpu, received ? cpu * 1e9 / received : 0);
+
+	utcp_close(left.c);
+
+	if(right.c) {
+		utcp_close(right.c);
+	}
+
+	utcp_exit(left.utcp);
+	utcp_exit(right.utcp);
+
+	free_link(&left.out);
+	free_link(&right.out);
+	free(left.samples);
+	free(right.samples);
+	free(rtts);
+
+	return failed || received != total_size;
+}
@@ -22,6 +22,10 @@
 
 #include "utcp_priv.h"
 
+#ifdef UTCP_MIRRORED_BUFFERS
+#include <sys/mman.h>
+#endif
+
 #ifndef EBADMSG
 #define EBADMSG         104
 #endif
@@ -42,6 +46,14 @@
 #endif
 #endif
 
+#ifdef UTCP_GETTIME
+// Use an external clock, for example the virtual clock of utcp-sim.
+extern int UTCP_GETTIME(struct timespec *ts);
+#define get_time(ts) UTCP_GETTIME(ts)
+#else
+#define get_time(ts) clock_gettime(UTCP_CLOCK, ts)
+#endif
+
 static void timespec_sub(const struct timespec *a, const struct timespec *b, struct timespec *r) {
 	r->tv_sec = a->tv_sec - b->tv_sec;
 	r->tv_nsec = a->tv_nsec - b->tv_nsec;
@@ -106,6 +118,18 @@ static void debug(struct utcp_connection *c, const char *format, ...) {
 	}
 }
 
+static void print_header(struct utcp_connection *c, const char *dir, const struct hdr *hdr, size_t len, const char *data) {
+	debug(c, "%s: len %lu src %u dst %u seq %u ack %u wnd %u aux %x ctl %s%s%s%s%s data %s\n",
+	      dir, (unsigned long)len, hdr->src, hdr->dst, hdr->seq, hdr->ack, hdr->wnd, hdr->aux,
+	      hdr->ctl & SYN ? "SYN" : "",
+	      hdr->ctl & RST ? "RST" : "",
+	      hdr->ctl & FIN ? "FIN" : "",
+	      hdr->ctl & ACK ? "ACK" : "",
+	      hdr->ctl & MF ? "MF" : "",
+	      data
+	     );
+}
+
 static void print_packet(struct utcp_connection *c, const char *dir, const void *pkt, size_t len) {
 	struct hdr hdr;
 
@@ -136,15 +160,7 @@ static void print_packet(struct utcp_connection *c, const char *dir, const void
 
 	*p = 0;
 
-	debug(c, "%s: len %lu src %u dst %u seq %u ack %u wnd %u aux %x ctl %s%s%s%s%s data %s\n",
-	      dir, (unsigned long)len, hdr.src, hdr.dst, hdr.seq, hdr.ack, hdr.wnd, hdr.aux,
-	      hdr.ctl & SYN ? "SYN" : "",
-	      hdr.ctl & RST ? "RST" : "",
-	      hdr.ctl & FIN ? "FIN" : "",
-	      hdr.ctl & ACK ? "ACK" : "",
-	      hdr.ctl & MF ? "MF" : "",
-	      str
-	     );
+	print_header(c, dir, &hdr, len, str);
 }
 
 static void debug_cwnd(struct utcp_connection *c) {
@@ -152,7 +168,8 @@ static void debug_cwnd(struct utcp_connection *c) {
 }
 #else
 #define debug(...) do {} while(0)
-#define print_packet(...) do {} while(0)
+#define print_header(c, dir, ...) do { (void)(dir); } while(0)
+#define print_packet(c, dir, ...) do { (void)(dir); } while(0)
 #define debug_cwnd(...) do {} while(0)
 #endif
 
@@ -195,23 +212,140 @@ static bool buffer_wraps(struct buffer *buf) {
 	return buf->size - buf->offset < buf->used;
 }
 
+// Check whether the data in the buffer can always be accessed as a single contiguous region.
+static bool buffer_mirrored(const struct buffer *buf) {
+#ifdef UTCP_MIRRORED_BUFFERS
+	return !buf->external;
+#else
+	(void)buf;
+	return false;
+#endif
+}
+
+// Get a pointer to the data at the given offset.
+static char *buffer_at(const struct buffer *buf, size_t offset) {
+	uint32_t realoffset = buf->offset + offset;
+
+	if(buf->size - buf->offset <= offset) {
+		// The offset wrapped
+		realoffset -= buf->size;
+	}
+
+	return buf->data + realoffset;
+}
+
+#ifdef UTCP_MIRRORED_BUFFERS
+/* Map the pages of a memfd twice, back to back:
+ *
+ * [012345......][012345......]
+ *
+ * Any region of at most size bytes starting in the first half is then contiguous in memory,
+ * even if it wraps around the end of the ring buffer.
+ * Note that the mapping is shared, so it is not safe to use the buffer in both parent and child after a fork().
+ */
+static char *buffer_map(int fd, uint32_t size) {
+	char *area = mmap(NULL, 2 * (size_t)size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(area == MAP_FAILED) {
+		return NULL;
+	}
+
+	if(mmap(area, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	                mmap(area + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(area, 2 * (size_t)size);
+		return NULL;
+	}
+
+	return area;
+}
+
+static uint32_t page_size(void) {
+	static uint32_t size;
+
+	if(!size) {
+		long result = sysconf(_SC_PAGESIZE);
+		size = result > 0 ? result : 4096;
+	}
+
+	return size;
+}
+#endif
+
+// Release the internal storage of the buffer.
+static void buffer_release(struct buffer *buf) {
+	assert(!buf->external);
+
+#ifdef UTCP_MIRRORED_BUFFERS
+
+	if(buf->data) {
+		munmap(buf->data, 2 * (size_t)buf->size);
+		close(buf->fd);
+	}
+
+#else
+	free(buf->data);
+#endif
+	buf->data = NULL;
+	buf->size = 0;
+	buf->offset = 0;
+}
+
 static bool buffer_resize(struct buffer *buf, uint32_t newsize) {
 	assert(!buf->external);
 
 	if(!newsize) {
-		free(buf->data);
-		buf->data = NULL;
-		buf->size = 0;
-		buf->offset = 0;
+		buffer_release(buf);
+		return true;
+	}
+
+#ifdef UTCP_MIRRORED_BUFFERS
+	// Mappings have page granularity. Growing is done by extending the memfd and mapping it again,
+	// the contents of the file are preserved.
+	uint32_t pagesize = page_size();
+
+	if(newsize > UINT32_MAX / 2 - pagesize) {
+		return false;
+	}
+
+	newsize = (newsize + pagesize - 1) & ~(pagesize - 1);
+
+	if(newsize <= buf->size) {
 		return true;
 	}
 
+	int fd = buf->data ? buf->fd : memfd_create("utcp", MFD_CLOEXEC);
+
+	if(fd == -1) {
+		return false;
+	}
+
+	char *newdata = NULL;
+
+	if(ftruncate(fd, newsize) == 0) {
+		newdata = buffer_map(fd, newsize);
+	}
+
+	if(!newdata) {
+		if(!buf->data) {
+			close(fd);
+		}
+
+		return false;
+	}
+
+	if(buf->data) {
+		munmap(buf->data, 2 * (size_t)buf->size);
+	}
+
+	buf->fd = fd;
+#else
 	char *newdata = realloc(buf->data, newsize);
 
 	if(!newdata) {
 		return false;
 	}
 
+#endif
 	buf->data = newdata;
 
 	if(buffer_wraps(buf)) {
@@ -274,7 +408,7 @@ static ssize_t buffer_put_at(struct buffer *buf, size_t offset, const void *data
 		realoffset -= buf->size;
 	}
 
-	if(buf->size - realoffset < len) {
+	if(!buffer_mirrored(buf) && buf->size - realoffset < len) {
 		// The new chunk of data must be wrapped
 		memcpy(buf->data + realoffset, data, buf->size - realoffset);
 		memcpy(buf->data, (char *)data + buf->size - realoffset, len - (buf->size - realoffset));
@@ -293,6 +427,31 @@ static ssize_t buffer_put(struct buffer *buf, const void *data, size_t len) {
 	return buffer_put_at(buf, buf->used, data, len);
 }
 
+// Append the contents of an I/O vector, stopping at the first segment that does not fit completely.
+static ssize_t buffer_putv(struct buffer *buf, const struct iovec *iov, int iovcnt) {
+	ssize_t total = 0;
+
+	for(int i = 0; i < iovcnt; i++) {
+		if(!iov[i].iov_len) {
+			continue;
+		}
+
+		ssize_t put = buffer_put(buf, iov[i].iov_base, iov[i].iov_len);
+
+		if(put < 0) {
+			return total ? total : put;
+		}
+
+		total += put;
+
+		if((size_t)put != iov[i].iov_len) {
+			break;
+		}
+	}
+
+	return total;
+}
+
 // Copy data from the buffer without removing it.
 static ssize_t buffer_copy(struct buffer *buf, void *data, size_t offset, size_t len) {
 	// Ensure we don't copy more than is actually stored in the buffer
@@ -311,7 +470,7 @@ static ssize_t buffer_copy(struct buffer *buf, void *data, size_t offset, size_t
 		realoffset -= buf->size;
 	}
 
-	if(buf->size - realoffset < len) {
+	if(!buffer_mirrored(buf) && buf->size - realoffset < len) {
 		// The data is wrapped
 		memcpy(data, buf->data + realoffset, buf->size - realoffset);
 		memcpy((char *)data + buf->size - realoffset, buf->data, len - (buf->size - realoffset));
@@ -344,7 +503,7 @@ static ssize_t buffer_call(struct utcp_connection *c, struct buffer *buf, size_t
 		realoffset -= buf->size;
 	}
 
-	if(buf->size - realoffset < len) {
+	if(!buffer_mirrored(buf) && buf->size - realoffset < len) {
 		// The data is wrapped
 		ssize_t rx1 = c->recv(c, buf->data + realoffset, buf->size - realoffset);
 
@@ -390,6 +549,15 @@ static ssize_t buffer_discard(struct buffer *buf, size_t len) {
 	return len;
 }
 
+// Allocate the maximum size up front.
+static bool buffer_reserve(struct buffer *buf) {
+	if(buf->external || buf->size >= buf->maxsize) {
+		return true;
+	}
+
+	return buffer_resize(buf, buf->maxsize);
+}
+
 static void buffer_clear(struct buffer *buf) {
 	buf->used = 0;
 	buf->offset = 0;
@@ -445,8 +613,9 @@ static void set_buffer_storage(struct buffer *buf, char *data, size_t size) {
 		}
 
 		// Transition from internal to external buffer
+		struct buffer old = *buf;
 		buffer_transfer(buf, data, size);
-		free(buf->data);
+		buffer_release(&old);
 		buf->data = data;
 		buf->external = true;
 	} else if(buf->external) {
@@ -454,15 +623,17 @@ static void set_buffer_storage(struct buffer *buf, char *data, size_t size) {
 		size_t minsize = buf->used <= DEFAULT_SNDBUFSIZE ? DEFAULT_SNDBUFSIZE : buf->used;
 
 		if(minsize) {
-			data = malloc(minsize);
+			struct buffer storage = {.data = NULL};
 
-			if(!data) {
+			if(!buffer_resize(&storage, minsize)) {
 				// Cannot handle this
 				abort();
 			}
 
-			buffer_transfer(buf, data, minsize);
-			buf->data = data;
+			buffer_transfer(buf, storage.data, storage.size);
+			storage.used = buf->used;
+			storage.maxsize = buf->maxsize;
+			*buf = storage;
 		} else {
 			buf->data = NULL;
 			buf->size = 0;
@@ -475,6 +646,15 @@ static void set_buffer_storage(struct buffer *buf, char *data, size_t size) {
 			return;
 		}
 
+		// Mirrored buffers are never shrunk, only released when empty
+		if(buffer_mirrored(buf)) {
+			if(!buf->used) {
+				buffer_release(buf);
+			}
+
+			return;
+		}
+
 		// Realloc internal storage
 		size_t minsize = max(DEFAULT_SNDBUFSIZE, buf->offset + buf->used);
 
@@ -495,7 +675,7 @@ static void set_buffer_storage(struct buffer *buf, char *data, size_t size) {
 
 static void buffer_exit(struct buffer *buf) {
 	if(!buf->external) {
-		free(buf->data);
+		buffer_release(buf);
 	}
 
 	memset(buf, 0, sizeof(*buf));
@@ -663,6 +843,11 @@ static void update_rtt(struct utcp_connection *c, uint32_t rtt) {
 
 	c->rto = c->srtt + max(4 * c->rttvar, CLOCK_GRANULARITY);
 
+	// Don't let the peer's delayed ACK timer cause spurious retransmits
+	if(c->rto < MIN_RTO) {
+		c->rto = MIN_RTO;
+	}
+
 	if(c->rto > MAX_RTO) {
 		c->rto = MAX_RTO;
 	}
@@ -671,7 +856,7 @@ static void update_rtt(struct utcp_connection *c, uint32_t rtt) {
 }
 
 static void start_retransmit_timer(struct utcp_connection *c) {
-	clock_gettime(UTCP_CLOCK, &c->rtrx_timeout);
+	get_time(&c->rtrx_timeout);
 
 	uint32_t rto = c->rto;
 
@@ -695,6 +880,37 @@ static void stop_retransmit_timer(struct utcp_connection *c) {
 	debug(c, "rtrx_timeout cleared\n");
 }
 
+static void start_ack_timer(struct utcp_connection *c) {
+	get_time(&c->ack_timeout);
+	c->ack_timeout.tv_nsec += DELAYED_ACK_TIMEOUT * 1000;
+
+	if(c->ack_timeout.tv_nsec >= NSEC_PER_SEC) {
+		c->ack_timeout.tv_nsec -= NSEC_PER_SEC;
+		c->ack_timeout.tv_sec++;
+	}
+
+	debug(c, "ack_timeout %ld.%06lu\n", c->ack_timeout.tv_sec, c->ack_timeout.tv_nsec);
+}
+
+// Called whenever we send a packet that carries an up-to-date ACK.
+static void clear_delayed_ack(struct utcp_connection *c) {
+	c->ack_pending = 0;
+	timespec_clear(&c->ack_timeout);
+}
+
+/* Decide whether the ACK for a full-sized, in-order segment can be delayed.
+ * We ACK every second full segment immediately (RFC 1122 4.2.3.2 / RFC 5681 4.2),
+ * otherwise we start the delayed ACK timer.
+ */
+static bool delay_ack(struct utcp_connection *c) {
+	if(c->ack_pending++) {
+		return false;
+	}
+
+	start_ack_timer(c);
+	return true;
+}
+
 struct utcp_connection *utcp_connect_ex(struct utcp *utcp, uint16_t dst, utcp_recv_t recv, void *priv, uint32_t flags) {
 	struct utcp_connection *c = allocate_connection(utcp, 0, dst);
 
@@ -730,7 +946,7 @@ struct utcp_connection *utcp_connect_ex(struct utcp *utcp, uint16_t dst, utcp_re
 	print_packet(c, "send", &pkt, sizeof(pkt));
 	utcp->send(utcp, &pkt, sizeof(pkt));
 
-	clock_gettime(UTCP_CLOCK, &c->conn_timeout);
+	get_time(&c->conn_timeout);
 	c->conn_timeout.tv_sec += utcp->timeout;
 
 	start_retransmit_timer(c);
@@ -755,6 +971,33 @@ void utcp_accept(struct utcp_connection *c, utcp_recv_t recv, void *priv) {
 	set_state(c, ESTABLISHED);
 }
 
+// The receive window excludes data held for the application.
+static uint32_t rcv_wnd(const struct utcp_connection *c) {
+	return c->rcvbuf.maxsize > c->held ? c->rcvbuf.maxsize - c->held : 0;
+}
+
+// Send a packet consisting of a header followed by data from the send buffer.
+// If the send buffer is mirrored, the data is passed to the application directly, without copying it into the packet buffer first.
+static void send_data(struct utcp_connection *c, const char *dir, struct hdr *hdr, size_t offset, size_t len) {
+	struct utcp *utcp = c->utcp;
+
+	if(len && utcp->sendv && buffer_mirrored(&c->sndbuf)) {
+		struct iovec iov[2] = {
+			{hdr, sizeof(*hdr)},
+			{buffer_at(&c->sndbuf, offset), len},
+		};
+
+		// The payload is not copied behind the header, so only log the header
+		print_header(c, dir, hdr, sizeof(*hdr) + len, "");
+		utcp->sendv(utcp, iov, 2);
+		return;
+	}
+
+	buffer_copy(&c->sndbuf, hdr + 1, offset, len);
+	print_packet(c, dir, hdr, sizeof(*hdr) + len);
+	utcp->send(utcp, hdr, sizeof(*hdr) + len);
+}
+
 static void ack(struct utcp_connection *c, bool sendatleastone) {
 	int32_t left = seqdiff(c->snd.last, c->snd.nxt);
 	int32_t cwndleft = is_reliable(c) ? min(c->snd.cwnd, c->snd.wnd) - seqdiff(c->snd.nxt, c->snd.una) : MAX_UNRELIABLE_SIZE;
@@ -785,16 +1028,15 @@ static void ack(struct utcp_connection *c, bool sendatleastone) {
 	pkt->hdr.src = c->src;
 	pkt->hdr.dst = c->dst;
 	pkt->hdr.ack = c->rcv.nxt;
-	pkt->hdr.wnd = is_reliable(c) ? c->rcvbuf.maxsize : 0;
+	pkt->hdr.wnd = is_reliable(c) ? rcv_wnd(c) : 0;
 	pkt->hdr.ctl = ACK;
 	pkt->hdr.aux = 0;
 
 	do {
 		uint32_t seglen = left > c->utcp->mss ? c->utcp->mss : left;
+		uint32_t segoffset = seqdiff(c->snd.nxt, c->snd.una);
 		pkt->hdr.seq = c->snd.nxt;
 
-		buffer_copy(&c->sndbuf, pkt->data, seqdiff(c->snd.nxt, c->snd.una), seglen);
-
 		c->snd.nxt += seglen;
 		left -= seglen;
 
@@ -813,21 +1055,27 @@ static void ack(struct utcp_connection *c, bool sendatleastone) {
 
 		if(!c->rtt_start.tv_sec) {
 			// Start RTT measurement
-			clock_gettime(UTCP_CLOCK, &c->rtt_start);
+			get_time(&c->rtt_start);
 			c->rtt_seq = pkt->hdr.seq + seglen;
 			debug(c, "starting RTT measurement, expecting ack %u\n", c->rtt_seq);
 		}
 
-		print_packet(c, "send", pkt, sizeof(pkt->hdr) + seglen);
-		c->utcp->send(c->utcp, pkt, sizeof(pkt->hdr) + seglen);
+		send_data(c, "send", &pkt->hdr, segoffset, seglen);
+
+		if(seglen) {
+			c->counters.segments_sent++;
+			c->counters.bytes_sent += seglen;
+		}
 
 		if(left && !is_reliable(c)) {
 			pkt->hdr.wnd += seglen;
 		}
 	} while(left);
+
+	clear_delayed_ack(c);
 }
 
-ssize_t utcp_send(struct utcp_connection *c, const void *data, size_t len) {
+ssize_t utcp_sendv(struct utcp_connection *c, const struct iovec *iov, int iovcnt) {
 	if(c->reapable) {
 		debug(c, "send() called on closed connection\n");
 		errno = EBADF;
@@ -857,22 +1105,44 @@ ssize_t utcp_send(struct utcp_connection *c, const void *data, size_t len) {
 		return -1;
 	}
 
+	if(iovcnt < 0 || (iovcnt && !iov)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Determine the total amount of data to send.
+
+	ssize_t len = 0;
+
+	for(int i = 0; i < iovcnt; i++) {
+		if(!iov[i].iov_len) {
+			continue;
+		}
+
+		if(!iov[i].iov_base) {
+			errno = EFAULT;
+			return -1;
+		}
+
+		if(iov[i].iov_len > (size_t)(SSIZE_MAX - len)) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+
+		len += iov[i].iov_len;
+	}
+
 	// Exit early if we have nothing to send.
 
 	if(!len) {
 		return 0;
 	}
 
-	if(!data) {
-		errno = EFAULT;
-		return -1;
-	}
-
 	// Check if we need to be able to buffer all data
 
 	if(c->flags & UTCP_NO_PARTIAL) {
-		if(len > buffer_free(&c->sndbuf)) {
-			if(len > c->sndbuf.maxsize) {
+		if((size_t)len > buffer_free(&c->sndbuf)) {
+			if((size_t)len > c->sndbuf.maxsize) {
 				errno = EMSGSIZE;
 				return -1;
 			} else {
@@ -885,9 +1155,13 @@ ssize_t utcp_send(struct utcp_connection *c, const void *data, size_t len) {
 	// Add data to send buffer.
 
 	if(is_reliable(c)) {
-		len = buffer_put(&c->sndbuf, data, len);
+		len = buffer_putv(&c->sndbuf, iov, iovcnt);
 	} else if(c->state != SYN_SENT && c->state != SYN_RECEIVED) {
-		if(len > MAX_UNRELIABLE_SIZE || buffer_put(&c->sndbuf, data, len) != (ssize_t)len) {
+		// An unreliable packet must fit in its entirety, otherwise undo the partial write.
+		uint32_t used = c->sndbuf.used;
+
+		if(len > MAX_UNRELIABLE_SIZE || buffer_putv(&c->sndbuf, iov, iovcnt) != len) {
+			c->sndbuf.used = used;
 			errno = EMSGSIZE;
 			return -1;
 		}
@@ -924,13 +1198,18 @@ ssize_t utcp_send(struct utcp_connection *c, const void *data, size_t len) {
 	}
 
 	if(is_reliable(c) && !timespec_isset(&c->conn_timeout)) {
-		clock_gettime(UTCP_CLOCK, &c->conn_timeout);
+		get_time(&c->conn_timeout);
 		c->conn_timeout.tv_sec += c->utcp->timeout;
 	}
 
 	return len;
 }
 
+ssize_t utcp_send(struct utcp_connection *c, const void *data, size_t len) {
+	struct iovec iov = {(void *)data, len};
+	return utcp_sendv(c, &iov, 1);
+}
+
 static void swap_ports(struct hdr *hdr) {
 	uint16_t tmp = hdr->src;
 	hdr->src = hdr->dst;
@@ -952,7 +1231,7 @@ static void fast_retransmit(struct utcp_connection *c) {
 
 	pkt->hdr.src = c->src;
 	pkt->hdr.dst = c->dst;
-	pkt->hdr.wnd = c->rcvbuf.maxsize;
+	pkt->hdr.wnd = rcv_wnd(c);
 	pkt->hdr.aux = 0;
 
 	switch(c->state) {
@@ -972,9 +1251,10 @@ static void fast_retransmit(struct utcp_connection *c) {
 			pkt->hdr.ctl |= FIN;
 		}
 
-		buffer_copy(&c->sndbuf, pkt->data, 0, len);
-		print_packet(c, "rtrx", pkt, sizeof(pkt->hdr) + len);
-		utcp->send(utcp, pkt, sizeof(pkt->hdr) + len);
+		send_data(c, "rtrx", &pkt->hdr, 0, len);
+		clear_delayed_ack(c);
+		c->counters.fast_retransmits++;
+		c->counters.bytes_retransmitted += len;
 		break;
 
 	default:
@@ -990,6 +1270,7 @@ static void retransmit(struct utcp_connection *c) {
 	}
 
 	struct utcp *utcp = c->utcp;
+	c->counters.retransmits++;
 
 	if(utcp->retransmit) {
 		utcp->retransmit(c);
@@ -1002,7 +1283,7 @@ static void retransmit(struct utcp_connection *c) {
 
 	pkt->hdr.src = c->src;
 	pkt->hdr.dst = c->dst;
-	pkt->hdr.wnd = c->rcvbuf.maxsize;
+	pkt->hdr.wnd = rcv_wnd(c);
 	pkt->hdr.aux = 0;
 
 	switch(c->state) {
@@ -1021,8 +1302,8 @@ static void retransmit(struct utcp_connection *c) {
 		break;
 
 	case SYN_RECEIVED:
-		// Send SYNACK again
-		pkt->hdr.seq = c->snd.nxt;
+		// Send SYNACK again, it has to carry the same sequence number as the original
+		pkt->hdr.seq = c->snd.iss;
 		pkt->hdr.ack = c->rcv.nxt;
 		pkt->hdr.ctl = SYN | ACK;
 		print_packet(c, "rtrx", pkt, sizeof(pkt->hdr));
@@ -1051,9 +1332,9 @@ static void retransmit(struct utcp_connection *c) {
 		c->snd.cwnd = utcp->mss;
 		debug_cwnd(c);
 
-		buffer_copy(&c->sndbuf, pkt->data, 0, len);
-		print_packet(c, "rtrx", pkt, sizeof(pkt->hdr) + len);
-		utcp->send(utcp, pkt, sizeof(pkt->hdr) + len);
+		send_data(c, "rtrx", &pkt->hdr, 0, len);
+		clear_delayed_ack(c);
+		c->counters.bytes_retransmitted += len;
 
 		c->snd.nxt = c->snd.una + len;
 		break;
@@ -1084,7 +1365,7 @@ cleanup:
 	return;
 }
 
-/* Update receive buffer and SACK entries after consuming data.
+/* Update SACK entries after the receive window has moved forward.
  *
  * Situation:
  *
@@ -1102,17 +1383,7 @@ cleanup:
  *   change both its offset and size.
  * - the SACK entry is completely before ^, in that case delete it.
  */
-static void sack_consume(struct utcp_connection *c, size_t len) {
-	debug(c, "sack_consume %lu\n", (unsigned long)len);
-
-	if(len > c->rcvbuf.used) {
-		debug(c, "all SACK entries consumed\n");
-		c->sacks[0].len = 0;
-		return;
-	}
-
-	buffer_discard(&c->rcvbuf, len);
-
+static void sack_shift(struct utcp_connection *c, size_t len) {
 	for(int i = 0; i < NSACKS && c->sacks[i].len;) {
 		if(len < c->sacks[i].offset) {
 			c->sacks[i].offset -= len;
@@ -1137,10 +1408,24 @@ static void sack_consume(struct utcp_connection *c, size_t len) {
 	}
 }
 
+// Update receive buffer and SACK entries after consuming data.
+static void sack_consume(struct utcp_connection *c, size_t len) {
+	debug(c, "sack_consume %lu\n", (unsigned long)len);
+
+	if(len > c->rcvbuf.used) {
+		debug(c, "all SACK entries consumed\n");
+		c->sacks[0].len = 0;
+		return;
+	}
+
+	buffer_discard(&c->rcvbuf, len);
+	sack_shift(c, len);
+}
+
 static void handle_out_of_order(struct utcp_connection *c, uint32_t offset, const void *data, size_t len) {
 	debug(c, "out of order packet, offset %u\n", offset);
-	// Packet loss or reordering occured. Store the data in the buffer.
-	ssize_t rxd = buffer_put_at(&c->rcvbuf, offset, data, len);
+	// Packet loss or reordering occured. Store the data in the buffer, after any data held for the application.
+	ssize_t rxd = buffer_put_at(&c->rcvbuf, c->held + offset, data, len);
 
 	if(rxd <= 0) {
 		debug(c, "packet outside receive buffer, dropping\n");
@@ -1192,7 +1477,35 @@ static void handle_out_of_order(struct utcp_connection *c, uint32_t offset, cons
 	}
 }
 
+// Keep in-order data in the receive buffer until the application consumes it.
+static void handle_in_order_peek(struct utcp_connection *c, const void *data, size_t len) {
+	if(buffer_put_at(&c->rcvbuf, c->held, data, len) != (ssize_t)len) {
+		debug(c, "packet does not fit in receive buffer, dropping\n");
+		return;
+	}
+
+	// Check if this connects with out-of-order data, which is already in the right place.
+	if(c->sacks[0].len && len >= c->sacks[0].offset && len < c->sacks[0].offset + c->sacks[0].len) {
+		debug(c, "incoming packet len %lu connected with SACK at %u\n", (unsigned long)len, c->sacks[0].offset);
+		len = c->sacks[0].offset + c->sacks[0].len;
+	}
+
+	sack_shift(c, len);
+	c->held += len;
+	c->rcv.nxt += len;
+
+	// Tell the application how much data it can peek at.
+	if(c->recv) {
+		c->recv(c, NULL, c->held);
+	}
+}
+
 static void handle_in_order(struct utcp_connection *c, const void *data, size_t len) {
+	if(c->flags & UTCP_PEEK) {
+		handle_in_order_peek(c, data, len);
+		return;
+	}
+
 	if(c->recv) {
 		ssize_t rxd = c->recv(c, data, len);
 
@@ -1273,6 +1586,12 @@ static void handle_incoming_data(struct utcp_connection *c, const struct hdr *hd
 		return;
 	}
 
+	// Data held for the application must not move, so never resize the buffer once it is in use.
+	if(c->flags & UTCP_PEEK && !buffer_reserve(&c->rcvbuf)) {
+		debug(c, "could not allocate receive buffer, dropping\n");
+		return;
+	}
+
 	uint32_t offset = seqdiff(hdr->seq, c->rcv.nxt);
 
 	if(offset) {
@@ -1511,7 +1830,7 @@ synack:
 
 			// cut already accepted front overlapping
 			if(rcv_offset < 0) {
-				acceptable = len > (size_t) - rcv_offset;
+				acceptable = len > (size_t) - rcv_offset && len + rcv_offset <= rcv_wnd(c);
 
 				if(acceptable) {
 					ptr -= rcv_offset;
@@ -1519,12 +1838,12 @@ synack:
 					hdr.seq -= rcv_offset;
 				}
 			} else {
-				acceptable = seqdiff(hdr.seq, c->rcv.nxt) >= 0 && seqdiff(hdr.seq, c->rcv.nxt) + len <= c->rcvbuf.maxsize;
+				acceptable = seqdiff(hdr.seq, c->rcv.nxt) >= 0 && seqdiff(hdr.seq, c->rcv.nxt) + len <= rcv_wnd(c);
 			}
 		}
 
 		if(!acceptable) {
-			debug(c, "packet not acceptable, %u <= %u + %lu < %u\n", c->rcv.nxt, hdr.seq, (unsigned long)len, c->rcv.nxt + c->rcvbuf.maxsize);
+			debug(c, "packet not acceptable, %u <= %u + %lu < %u\n", c->rcv.nxt, hdr.seq, (unsigned long)len, c->rcv.nxt + rcv_wnd(c));
 
 			// Ignore unacceptable RST packets.
 			if(hdr.ctl & RST) {
@@ -1602,6 +1921,7 @@ synack:
 			errno = ECONNRESET;
 			buffer_clear(&c->sndbuf);
 			buffer_clear(&c->rcvbuf);
+			c->held = 0;
 
 			if(c->recv) {
 				c->recv(c, NULL, 0);
@@ -1660,7 +1980,7 @@ synack:
 		if(c->rtt_start.tv_sec) {
 			if(c->rtt_seq == hdr.ack) {
 				struct timespec now;
-				clock_gettime(UTCP_CLOCK, &now);
+				get_time(&now);
 				int32_t diff = timespec_diff_usec(&now, &c->rtt_start);
 				update_rtt(c, diff);
 				c->rtt_start.tv_sec = 0;
@@ -1692,6 +2012,7 @@ synack:
 
 		if(data_acked) {
 			buffer_discard(&c->sndbuf, data_acked);
+			c->counters.bytes_acked += data_acked;
 
 			if(is_reliable(c)) {
 				c->do_poll = true;
@@ -1714,9 +2035,10 @@ synack:
 			c->dupack = 0;
 		}
 
-		// Increase the congestion window according to RFC 5681
+		// Increase the congestion window according to RFC 5681.
+		// Allow up to two segments per ACK during slow start to compensate for delayed ACKs (RFC 3465).
 		if(c->snd.cwnd < c->snd.ssthresh) {
-			c->snd.cwnd += min(advanced, utcp->mss); // eq. 2
+			c->snd.cwnd += min(advanced, 2 * utcp->mss); // eq. 2
 		} else {
 			c->snd.cwnd += max(1, (utcp->mss * utcp->mss) / c->snd.cwnd); // eq. 3
 		}
@@ -1738,7 +2060,7 @@ synack:
 
 		case CLOSING:
 			if(c->snd.una == c->snd.last) {
-				clock_gettime(UTCP_CLOCK, &c->conn_timeout);
+				get_time(&c->conn_timeout);
 				c->conn_timeout.tv_sec += utcp->timeout;
 				set_state(c, TIME_WAIT);
 			}
@@ -1751,6 +2073,7 @@ synack:
 	} else {
 		if(!len && is_reliable(c) && c->snd.una != c->snd.last) {
 			c->dupack++;
+			c->counters.dupacks++;
 			debug(c, "duplicate ACK %d\n", c->dupack);
 
 			if(c->dupack == 3) {
@@ -1792,7 +2115,7 @@ synack:
 			timespec_clear(&c->conn_timeout);
 		} else if(is_reliable(c)) {
 			start_retransmit_timer(c);
-			clock_gettime(UTCP_CLOCK, &c->conn_timeout);
+			get_time(&c->conn_timeout);
 			c->conn_timeout.tv_sec += utcp->timeout;
 		}
 	}
@@ -1846,6 +2169,8 @@ skip_ack:
 
 	// 6. Process new data
 
+	bool delay = false;
+
 	if(c->state == SYN_RECEIVED) {
 		// This is the ACK after the SYNACK. It should always have ACKed the SYNACK.
 		if(!advanced) {
@@ -1900,6 +2225,15 @@ skip_ack:
 			return 0;
 		}
 
+		// Full-sized segments that arrive in order and don't fill a hole may have their ACK delayed.
+		// Anything else, such as a short segment at the end of a burst, is ACKed immediately.
+		delay = is_reliable(c)
+		        && c->state == ESTABLISHED
+		        && !(hdr.ctl & (SYN | FIN))
+		        && len >= utcp->mss
+		        && hdr.seq == c->rcv.nxt
+		        && !c->sacks[0].len;
+
 		handle_incoming_data(c, &hdr, ptr, len);
 	}
 
@@ -1924,7 +2258,7 @@ skip_ack:
 			break;
 
 		case FIN_WAIT_2:
-			clock_gettime(UTCP_CLOCK, &c->conn_timeout);
+			get_time(&c->conn_timeout);
 			c->conn_timeout.tv_sec += utcp->timeout;
 			set_state(c, TIME_WAIT);
 			break;
@@ -1955,13 +2289,13 @@ skip_ack:
 	}
 
 	// Now we send something back if:
-	// - we received data, so we have to send back an ACK
+	// - we received data, so we have to send back an ACK, unless we can delay it
 	//   -> sendatleastone = true
 	// - or we got an ack, so we should maybe send a bit more data
 	//   -> sendatleastone = false
 
 	if(is_reliable(c) || hdr.ctl & SYN || hdr.ctl & FIN) {
-		ack(c, has_data);
+		ack(c, has_data && !(delay && delay_ack(c)));
 	}
 
 	return 0;
@@ -2076,6 +2410,7 @@ static bool reset_connection(struct utcp_connection *c) {
 
 	buffer_clear(&c->sndbuf);
 	buffer_clear(&c->rcvbuf);
+	c->held = 0;
 
 	switch(c->state) {
 	case CLOSED:
@@ -2180,7 +2515,7 @@ int utcp_abort(struct utcp_connection *c) {
  */
 struct timespec utcp_timeout(struct utcp *utcp) {
 	struct timespec now;
-	clock_gettime(UTCP_CLOCK, &now);
+	get_time(&now);
 	struct timespec next = {now.tv_sec + 3600, now.tv_nsec};
 
 	for(int i = 0; i < utcp->nconnections; i++) {
@@ -2206,6 +2541,7 @@ struct timespec utcp_timeout(struct utcp *utcp) {
 			c->state = CLOSED;
 			buffer_clear(&c->sndbuf);
 			buffer_clear(&c->rcvbuf);
+			c->held = 0;
 
 			if(c->recv) {
 				c->recv(c, NULL, 0);
@@ -2223,6 +2559,11 @@ struct timespec utcp_timeout(struct utcp *utcp) {
 			retransmit(c);
 		}
 
+		if(timespec_isset(&c->ack_timeout) && timespec_lt(&c->ack_timeout, &now)) {
+			debug(c, "sending delayed ACK\n");
+			ack(c, true);
+		}
+
 		if(c->poll) {
 			if((c->state == ESTABLISHED || c->state == CLOSE_WAIT) && c->do_poll) {
 				c->do_poll = false;
@@ -2243,6 +2584,10 @@ struct timespec utcp_timeout(struct utcp *utcp) {
 		if(timespec_isset(&c->rtrx_timeout) && timespec_lt(&c->rtrx_timeout, &next)) {
 			next = c->rtrx_timeout;
 		}
+
+		if(timespec_isset(&c->ack_timeout) && timespec_lt(&c->ack_timeout, &next)) {
+			next = c->ack_timeout;
+		}
 	}
 
 	struct timespec diff;
@@ -2310,6 +2655,7 @@ void utcp_exit(struct utcp *utcp) {
 		if(!c->reapable) {
 			buffer_clear(&c->sndbuf);
 			buffer_clear(&c->rcvbuf);
+			c->held = 0;
 
 			if(c->recv) {
 				c->recv(c, NULL, 0);
@@ -2368,7 +2714,7 @@ void utcp_reset_timers(struct utcp *utcp) {
 
 	struct timespec now, then;
 
-	clock_gettime(UTCP_CLOCK, &now);
+	get_time(&now);
 
 	then = now;
 
@@ -2458,6 +2804,35 @@ void utcp_set_rcvbuf(struct utcp_connection *c, void *data, size_t size) {
 	set_buffer_storage(&c->rcvbuf, data, size);
 }
 
+void utcp_get_stats(struct utcp_connection *c, struct utcp_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+
+	if(!c) {
+		return;
+	}
+
+	stats->cwnd = c->snd.cwnd;
+	stats->ssthresh = c->snd.ssthresh;
+	stats->snd_wnd = c->snd.wnd;
+	stats->flight = seqdiff(c->snd.nxt, c->snd.una);
+	stats->srtt = c->srtt;
+	stats->rttvar = c->rttvar;
+	stats->rto = c->rto;
+	stats->dupack = c->dupack;
+
+	for(int i = 0; i < NSACKS && c->sacks[i].len; i++) {
+		stats->sack_holes++;
+	}
+
+	stats->segments_sent = c->counters.segments_sent;
+	stats->bytes_sent = c->counters.bytes_sent;
+	stats->bytes_acked = c->counters.bytes_acked;
+	stats->dupacks = c->counters.dupacks;
+	stats->retransmits = c->counters.retransmits;
+	stats->fast_retransmits = c->counters.fast_retransmits;
+	stats->bytes_retransmitted = c->counters.bytes_retransmitted;
+}
+
 size_t utcp_get_sendq(struct utcp_connection *c) {
 	return c->sndbuf.used;
 }
@@ -2522,7 +2897,7 @@ void utcp_expect_data(struct utcp_connection *c, bool expect) {
 	if(expect) {
 		// If we expect data, start the connection timer.
 		if(!timespec_isset(&c->conn_timeout)) {
-			clock_gettime(UTCP_CLOCK, &c->conn_timeout);
+			get_time(&c->conn_timeout);
 			c->conn_timeout.tv_sec += c->utcp->timeout;
 		}
 	} else {
@@ -2534,13 +2909,85 @@ void utcp_expect_data(struct utcp_connection *c, bool expect) {
 }
 
 void utcp_set_flags(struct utcp_connection *c, uint32_t flags) {
+	bool was_peeking = c->flags & UTCP_PEEK;
+
 	c->flags &= ~UTCP_CHANGEABLE_FLAGS;
 	c->flags |= flags & UTCP_CHANGEABLE_FLAGS;
+
+	// Hand any data still held for peeking to the receive callback.
+	if(was_peeking && !(c->flags & UTCP_PEEK) && c->held) {
+		uint32_t held = c->held;
+		buffer_call(c, &c->rcvbuf, 0, held);
+		buffer_discard(&c->rcvbuf, held);
+		c->held = 0;
+	}
+}
+
+ssize_t utcp_peek(struct utcp_connection *c, struct iovec *iov, int iovcnt) {
+	if(!c || iovcnt < 0 || (iovcnt && !iov)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	const struct buffer *buf = &c->rcvbuf;
+	uint32_t len = c->held;
+	uint32_t first = buffer_mirrored(buf) ? len : min(len, buf->size - buf->offset);
+	ssize_t total = 0;
+
+	for(int i = 0; i < iovcnt; i++) {
+		iov[i].iov_base = NULL;
+		iov[i].iov_len = 0;
+	}
+
+	if(iovcnt > 0 && first) {
+		iov[0].iov_base = buf->data + buf->offset;
+		iov[0].iov_len = first;
+		total += first;
+	}
+
+	// The held data wraps around the end of the ring buffer
+	if(iovcnt > 1 && len > first) {
+		iov[1].iov_base = buf->data;
+		iov[1].iov_len = len - first;
+		total += len - first;
+	}
+
+	return total;
+}
+
+ssize_t utcp_consume(struct utcp_connection *c, size_t len) {
+	if(!c) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if(len > c->held) {
+		len = c->held;
+	}
+
+	if(!len) {
+		return 0;
+	}
+
+	uint32_t oldwnd = rcv_wnd(c);
+
+	buffer_discard(&c->rcvbuf, len);
+	c->held -= len;
+
+	// Send a window update if the peer might have stopped sending because of a small window,
+	// but only once there is room for a full segment, to avoid the silly window syndrome.
+	uint32_t threshold = min(c->utcp->mss, c->rcvbuf.maxsize / 2);
+
+	if(is_reliable(c) && c->state != CLOSED && c->state != TIME_WAIT && oldwnd < threshold && rcv_wnd(c) >= threshold) {
+		ack(c, true);
+	}
+
+	return len;
 }
 
 void utcp_offline(struct utcp *utcp, bool offline) {
 	struct timespec now;
-	clock_gettime(UTCP_CLOCK, &now);
+	get_time(&now);
 
 	for(int i = 0; i < utcp->nconnections; i++) {
 		struct utcp_connection *c = utcp->connections[i];
@@ -2569,6 +3016,12 @@ void utcp_set_retransmit_cb(struct utcp *utcp, utcp_retransmit_t cb) {
 	utcp->retransmit = cb;
 }
 
+void utcp_set_sendv_cb(struct utcp *utcp, utcp_sendv_t sendv) {
+	if(utcp) {
+		utcp->sendv = sendv;
+	}
+}
+
 void utcp_set_clock_granularity(long granularity) {
 	CLOCK_GRANULARITY = granularity;
 }
@@ -25,6 +25,7 @@
 #include <stdbool.h>
 // TODO: Windows
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #ifndef UTCP_INTERNAL
 struct utcp {
@@ -50,16 +51,18 @@ struct utcp_connection;
 #define UTCP_FRAMED 4
 #define UTCP_DROP_LATE 8
 #define UTCP_NO_PARTIAL 16
+#define UTCP_PEEK 32
 
 #define UTCP_TCP 3
 #define UTCP_UDP 0
-#define UTCP_CHANGEABLE_FLAGS 0x18U
+#define UTCP_CHANGEABLE_FLAGS 0x38U
 
 typedef bool (*utcp_listen_t)(struct utcp *utcp, uint16_t port);
 typedef void (*utcp_accept_t)(struct utcp_connection *utcp_connection, uint16_t port);
 typedef void (*utcp_retransmit_t)(struct utcp_connection *connection);
 
 typedef ssize_t (*utcp_send_t)(struct utcp *utcp, const void *data, size_t len);
+typedef ssize_t (*utcp_sendv_t)(struct utcp *utcp, const struct iovec *iov, int iovcnt);
 typedef ssize_t (*utcp_recv_t)(struct utcp_connection *connection, const void *data, size_t len);
 
 typedef void (*utcp_poll_t)(struct utcp_connection *connection, size_t len);
@@ -71,6 +74,7 @@ struct utcp_connection *utcp_connect_ex(struct utcp *utcp, uint16_t port, utcp_r
 struct utcp_connection *utcp_connect(struct utcp *utcp, uint16_t port, utcp_recv_t recv, void *priv);
 void utcp_accept(struct utcp_connection *utcp, utcp_recv_t recv, void *priv);
 ssize_t utcp_send(struct utcp_connection *connection, const void *data, size_t len);
+ssize_t utcp_sendv(struct utcp_connection *connection, const struct iovec *iov, int iovcnt);
 ssize_t utcp_recv(struct utcp *utcp, const void *data, size_t len);
 int utcp_close(struct utcp_connection *connection);
 int utcp_abort(struct utcp_connection *connection);
@@ -95,6 +99,7 @@ void utcp_reset_timers(struct utcp *utcp);
 
 void utcp_offline(struct utcp *utcp, bool offline);
 void utcp_set_retransmit_cb(struct utcp *utcp, utcp_retransmit_t retransmit);
+void utcp_set_sendv_cb(struct utcp *utcp, utcp_sendv_t sendv);
 
 // Per-socket options
 
@@ -121,6 +126,35 @@ void utcp_expect_data(struct utcp_connection *connection, bool expect);
 
 void utcp_set_flags(struct utcp_connection *connection, uint32_t flags);
 
+ssize_t utcp_peek(struct utcp_connection *connection, struct iovec *iov, int iovcnt);
+ssize_t utcp_consume(struct utcp_connection *connection, size_t len);
+
+// Statistics
+
+struct utcp_stats {
+	// Current state
+	uint32_t cwnd;             // bytes
+	uint32_t ssthresh;         // bytes
+	uint32_t snd_wnd;          // bytes, as advertised by the peer
+	uint32_t flight;           // bytes sent but not yet acknowledged
+	uint32_t srtt;             // usec
+	uint32_t rttvar;           // usec
+	uint32_t rto;              // usec
+	uint32_t dupack;           // duplicate ACKs since snd.una last advanced
+	uint32_t sack_holes;       // gaps in the receive buffer in front of out-of-order data
+
+	// Counters since the connection was created
+	uint64_t segments_sent;
+	uint64_t bytes_sent;
+	uint64_t bytes_acked;
+	uint64_t dupacks;
+	uint64_t retransmits;      // retransmission timeouts
+	uint64_t fast_retransmits;
+	uint64_t bytes_retransmitted;
+};
+
+void utcp_get_stats(struct utcp_connection *connection, struct utcp_stats *stats);
+
 // Completely global options
 
 void utcp_set_clock_granularity(long granularity);
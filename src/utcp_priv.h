@@ -50,6 +50,8 @@
 #define DEFAULT_USER_TIMEOUT 60
 #define START_RTO (1 * USEC_PER_SEC)
 #define MAX_RTO (3 * USEC_PER_SEC)
+#define DELAYED_ACK_TIMEOUT 10000 // usec
+#define MIN_RTO (2 * DELAYED_ACK_TIMEOUT)
 
 struct hdr {
 	uint16_t src; // Source port
@@ -96,6 +98,9 @@ struct buffer {
 	uint32_t size;
 	uint32_t maxsize;
 	bool external;
+#ifdef UTCP_MIRRORED_BUFFERS
+	int fd; // memfd backing the double mapping of data
+#endif
 };
 
 struct sack {
@@ -103,6 +108,16 @@ struct sack {
 	uint32_t len;
 };
 
+struct counters {
+	uint64_t segments_sent;
+	uint64_t bytes_sent;
+	uint64_t bytes_acked;
+	uint64_t dupacks;
+	uint64_t retransmits;
+	uint64_t fast_retransmits;
+	uint64_t bytes_retransmitted;
+};
+
 struct utcp_connection {
 	void *priv;
 	struct utcp *utcp;
@@ -146,6 +161,8 @@ struct utcp_connection {
 	struct timespec rtrx_timeout;
 	struct timespec rtt_start;
 	uint32_t rtt_seq;
+	struct timespec ack_timeout;
+	int ack_pending; // number of full segments received but not yet ACKed
 
 	// RTT variables
 
@@ -158,6 +175,7 @@ struct utcp_connection {
 	uint32_t prev_free;
 	struct buffer sndbuf;
 	struct buffer rcvbuf;
+	uint32_t held; // in-order data at the start of rcvbuf, not yet consumed by the application
 	struct sack sacks[NSACKS];
 
 	// Per-socket options
@@ -170,6 +188,10 @@ struct utcp_connection {
 
 	struct timespec tlast;
 	uint64_t bandwidth;
+
+	// Statistics
+
+	struct counters counters;
 };
 
 struct utcp {
@@ -181,6 +203,7 @@ struct utcp {
 	utcp_listen_t listen;
 	utcp_retransmit_t retransmit;
 	utcp_send_t send;
+	utcp_sendv_t sendv;
 
 	// Packet buffer
 
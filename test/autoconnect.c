@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+#define NBACKBONES 5
+
+// Count the active connections of a mesh, and check whether one of them is with the given node.
+static size_t count_connections(meshlink_handle_t *mesh, const char *name, bool *found) {
+	size_t count = 0;
+	devtool_metrics_t *metrics = devtool_get_metrics(mesh);
+	assert(metrics);
+
+	if(found) {
+		*found = false;
+	}
+
+	for(size_t j = 0; j < metrics->nconnections; j++) {
+		if(!metrics->connections[j].active) {
+			continue;
+		}
+
+		count++;
+
+		if(found && name && !strcmp(metrics->connections[j].node->name, name)) {
+			*found = true;
+		}
+	}
+
+	free(metrics);
+	return count;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open a portable node that knows a number of backbone nodes. It should only connect to as many of them as it needs.
+
+	assert(meshlink_destroy("autoconnect_conf.p"));
+	meshlink_handle_t *portable = meshlink_open("autoconnect_conf.p", "p", "autoconnect", DEV_CLASS_PORTABLE);
+	assert(portable);
+	meshlink_enable_discovery(portable, false);
+
+	char *portable_data = meshlink_export(portable);
+	assert(portable_data);
+
+	meshlink_handle_t *backbone[NBACKBONES];
+
+	for(int j = 0; j < NBACKBONES; j++) {
+		char *path = NULL;
+		char *name = NULL;
+		assert(asprintf(&path, "autoconnect_conf.%d", j) != -1 && path);
+		assert(asprintf(&name, "b%d", j) != -1 && name);
+
+		assert(meshlink_destroy(path));
+		backbone[j] = meshlink_open(path, name, "autoconnect", DEV_CLASS_BACKBONE);
+		assert(backbone[j]);
+		free(path);
+		free(name);
+
+		meshlink_enable_discovery(backbone[j], false);
+		assert(meshlink_set_canonical_address(backbone[j], meshlink_get_self(backbone[j]), "localhost", NULL));
+		assert(meshlink_import(backbone[j], portable_data));
+
+		char *data = meshlink_export(backbone[j]);
+		assert(data);
+		assert(meshlink_import(portable, data));
+		free(data);
+
+		assert(meshlink_start(backbone[j]));
+	}
+
+	free(portable_data);
+
+	// Nodes that are blacklisted should never be autoconnected to.
+
+	assert(meshlink_blacklist(portable, meshlink_get_node(portable, "b4")));
+
+	assert(meshlink_start(portable));
+
+	// Portable nodes want exactly three connections, nodes we never connected to are tried first, in order of their names.
+
+	bool found;
+	assert_after(count_connections(portable, NULL, NULL) == 3, 20);
+	assert(count_connections(portable, "b0", &found) == 3 && found);
+	assert(count_connections(portable, "b4", &found) == 3 && !found);
+
+	// When we lose a connection, the node we have not connected to before should be picked to replace it.
+
+	meshlink_stop(backbone[0]);
+	assert_after(count_connections(portable, "b3", &found) == 3 && found, 20);
+	assert(count_connections(portable, "b4", &found) == 3 && !found);
+
+	// Clean up.
+
+	meshlink_close(portable);
+
+	for(int j = 0; j < NBACKBONES; j++) {
+		meshlink_close(backbone[j]);
+	}
+}
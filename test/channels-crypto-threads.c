@@ -0,0 +1,158 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+#define TOTAL_SIZE 2000000
+
+static struct sync_flag done_flag;
+static size_t received;
+static bool corrupt;
+static int renewals;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+	(void)channel;
+
+	const unsigned char *p = data;
+
+	for(size_t j = 0; j < len; j++) {
+		if(p[j] != (unsigned char)((received + j) * 7)) {
+			corrupt = true;
+		}
+	}
+
+	received += len;
+
+	if(received == TOTAL_SIZE) {
+		set_sync_flag(&done_flag, true);
+	}
+}
+
+static void renewal_probe(meshlink_node_t *node) {
+	(void)node;
+	__atomic_add_fetch(&renewals, 1, __ATOMIC_RELAXED);
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	return true;
+}
+
+static void send_range(meshlink_handle_t *mesh, meshlink_channel_t *channel, size_t from, size_t to) {
+	unsigned char buf[10000];
+
+	while(from < to) {
+		size_t len = to - from < sizeof(buf) ? to - from : sizeof(buf);
+
+		for(size_t j = 0; j < len; j++) {
+			buf[j] = (from + j) * 7;
+		}
+
+		ssize_t result = meshlink_channel_send(mesh, channel, buf, len);
+		assert(result >= 0);
+
+		if(!result) {
+			const struct timespec req = {0, 1000000};
+			nanosleep(&req, NULL);
+		}
+
+		from += result;
+	}
+}
+
+int main(void) {
+	init_sync_flag(&done_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open two new meshlink instances.
+
+	meshlink_handle_t *mesh_a, *mesh_b;
+	open_meshlink_pair(&mesh_a, &mesh_b, "channels_crypto_threads");
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+
+	// Check that invalid thread counts are rejected.
+
+	assert(!meshlink_set_crypto_threads(NULL, 1));
+	assert(!meshlink_set_crypto_threads(mesh_a, -1));
+	assert(!meshlink_set_crypto_threads(mesh_a, 65));
+
+	// Enable the worker pool on both sides before starting.
+
+	assert(meshlink_set_crypto_threads(mesh_a, 4));
+	assert(meshlink_set_crypto_threads(mesh_b, 4));
+	start_meshlink_pair(mesh_a, mesh_b);
+
+	// Wait for PMTU discovery, so data is sent via UDP.
+
+	meshlink_node_t *b = meshlink_get_node(mesh_a, "b");
+	assert(b);
+	assert_after(meshlink_get_pmtu(mesh_a, b) > 0, 15);
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh_a, b, 1, NULL, NULL, 0);
+	assert(channel);
+	meshlink_set_channel_sndbuf(mesh_a, channel, 100000);
+
+	// Stream data, and change the number of workers on both sides halfway.
+
+	send_range(mesh_a, channel, 0, TOTAL_SIZE / 2);
+	assert(meshlink_set_crypto_threads(mesh_a, 1));
+	assert(meshlink_set_crypto_threads(mesh_b, 2));
+	send_range(mesh_a, channel, TOTAL_SIZE / 2, TOTAL_SIZE);
+
+	assert(wait_sync_flag(&done_flag, 30));
+	assert(received == TOTAL_SIZE);
+	assert(!corrupt);
+
+	// Keep streaming while both sides renew their keys a few times.
+	// Datagrams that were opened with the old key while the new one was being activated must not be lost.
+
+	meshlink_node_t *a = meshlink_get_node(mesh_b, "a");
+	assert(a);
+	void (*old_probe)(meshlink_node_t *node) = devtool_sptps_renewal_probe;
+	devtool_sptps_renewal_probe = renewal_probe;
+	received = 0;
+	size_t sent = 0;
+
+	for(int j = 0; j < 400 && __atomic_load_n(&renewals, __ATOMIC_RELAXED) < 4; j++) {
+		devtool_force_sptps_renewal(mesh_a, b);
+		devtool_force_sptps_renewal(mesh_b, a);
+		send_range(mesh_a, channel, sent, sent + TOTAL_SIZE / 4);
+		sent += TOTAL_SIZE / 4;
+	}
+
+	assert(renewals >= 4);
+	assert_after(received == sent, 30);
+	assert(!corrupt);
+	devtool_sptps_renewal_probe = old_probe;
+
+	// Disabling the workers while running should not break the session.
+
+	reset_sync_flag(&done_flag);
+	received = 0;
+	assert(meshlink_set_crypto_threads(mesh_a, 0));
+	assert(meshlink_set_crypto_threads(mesh_b, 0));
+	send_range(mesh_a, channel, 0, TOTAL_SIZE);
+	assert(wait_sync_flag(&done_flag, 30));
+	assert(!corrupt);
+
+	// Clean up.
+
+	meshlink_channel_close(mesh_a, channel);
+	close_meshlink_pair(mesh_a, mesh_b);
+}
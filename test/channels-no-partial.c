@@ -66,6 +66,15 @@ int main(int argc, char *argv[]) {
 	assert(meshlink_channel_send(mesh_a, channel, buf, 29) == 0);
 	assert(meshlink_channel_send(mesh_a, channel, buf, 513) == -1);
 
+	// The same applies to a vectored send as a whole.
+
+	struct iovec iov[2] = {{buf, 20}, {buf, 9}};
+	assert(meshlink_channel_sendv(mesh_a, channel, iov, 2) == 0);
+	iov[1].iov_len = 8;
+	assert(meshlink_channel_sendv(mesh_a, channel, iov, 2) == 28);
+	iov[1].iov_len = 500;
+	assert(meshlink_channel_sendv(mesh_a, channel, iov, 2) == -1);
+
 	// Restart a to ensure it gets to flush the channel send queue.
 
 	assert(meshlink_start(mesh_a));
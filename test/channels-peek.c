@@ -0,0 +1,139 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "meshlink.h"
+#include "utils.h"
+
+#define RCVBUF_SIZE 8192
+#define TOTAL_SIZE 100000
+
+static struct sync_flag held_flag;
+static struct sync_flag done_flag;
+
+static bool consuming;
+static size_t received;
+static size_t peekable;
+static meshlink_channel_t *channel_b;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	// With MESHLINK_CHANNEL_PEEK set, we only get notified of the amount of data available.
+
+	assert(!data);
+	assert(len);
+	peekable = len;
+
+	if(!consuming) {
+		if(len >= RCVBUF_SIZE / 2) {
+			set_sync_flag(&held_flag, true);
+		}
+
+		return;
+	}
+
+	struct iovec iov[2];
+	ssize_t total = meshlink_channel_peek(mesh, channel, iov, 2);
+	assert(total >= 0 && (size_t)total == len);
+	assert(iov[0].iov_len + iov[1].iov_len == len);
+
+	for(int i = 0; i < 2; i++) {
+		const unsigned char *p = iov[i].iov_base;
+
+		for(size_t j = 0; j < iov[i].iov_len; j++) {
+			assert(p[j] == (unsigned char)(received++ % 251));
+		}
+	}
+
+	assert(meshlink_channel_consume(mesh, channel, len));
+
+	if(received == TOTAL_SIZE) {
+		set_sync_flag(&done_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_rcvbuf(mesh, channel, RCVBUF_SIZE);
+	meshlink_set_channel_flags(mesh, channel, MESHLINK_CHANNEL_TCP | MESHLINK_CHANNEL_PEEK);
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	channel_b = channel;
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	(void)argc;
+	(void)argv;
+
+	init_sync_flag(&held_flag);
+	init_sync_flag(&done_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Start two new meshlink instance.
+
+	meshlink_handle_t *mesh_a;
+	meshlink_handle_t *mesh_b;
+
+	open_meshlink_pair(&mesh_a, &mesh_b, "channels_peek");
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+	start_meshlink_pair(mesh_a, mesh_b);
+
+	// Open a channel and send more data than fits in b's receive buffer.
+
+	meshlink_node_t *b = meshlink_get_node(mesh_a, "b");
+	assert(b);
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh_a, b, 1, NULL, NULL, 0);
+	assert(channel);
+
+	unsigned char *buf = malloc(TOTAL_SIZE);
+	assert(buf);
+
+	for(size_t i = 0; i < TOTAL_SIZE; i++) {
+		buf[i] = i % 251;
+	}
+
+	meshlink_set_channel_sndbuf(mesh_a, channel, TOTAL_SIZE);
+	assert(meshlink_channel_send(mesh_a, channel, buf, TOTAL_SIZE) == TOTAL_SIZE);
+
+	// Since b does not consume anything, it should hold at most one receive buffer's worth of data,
+	// and the rest should remain queued at a.
+
+	assert(wait_sync_flag(&held_flag, 20));
+	sleep(1);
+	size_t held = peekable;
+	assert(held <= RCVBUF_SIZE);
+	assert(meshlink_channel_get_sendq(mesh_a, channel) >= TOTAL_SIZE - RCVBUF_SIZE);
+
+	// Peek at and consume the held data from outside the callback.
+	// The window update should let the rest of the data through.
+
+	struct iovec iov[2];
+	ssize_t total = meshlink_channel_peek(mesh_b, channel_b, iov, 2);
+	assert(total >= 0 && (size_t)total == held);
+	assert(iov[0].iov_len + iov[1].iov_len == held);
+	assert(!memcmp(iov[0].iov_base, buf, iov[0].iov_len));
+	assert(!memcmp(iov[1].iov_base, buf + iov[0].iov_len, iov[1].iov_len));
+
+	consuming = true;
+	received = held;
+	assert(meshlink_channel_consume(mesh_b, channel_b, held));
+
+	assert(wait_sync_flag(&done_flag, 20));
+	assert(received == TOTAL_SIZE);
+
+	// Clean up.
+
+	free(buf);
+	close_meshlink_pair(mesh_a, mesh_b);
+}
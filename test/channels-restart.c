@@ -0,0 +1,66 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "meshlink.h"
+#include "utils.h"
+
+/* Restart a pair of nodes many times, and check that a channel opened right away always works.
+   When both sides send a REQ_KEY at the same time, exactly one of them must back off. */
+
+#define ITERATIONS 50
+
+static struct sync_flag recv_flag;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+	(void)channel;
+	(void)data;
+
+	if(len) {
+		set_sync_flag(&recv_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	return true;
+}
+
+int main(void) {
+	init_sync_flag(&recv_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_WARNING, log_cb);
+
+	meshlink_handle_t *mesh_a, *mesh_b;
+	open_meshlink_pair(&mesh_a, &mesh_b, "channels_restart");
+	meshlink_set_channel_accept_cb(mesh_a, accept_cb);
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+
+	for(int j = 0; j < ITERATIONS; j++) {
+		start_meshlink_pair(mesh_a, mesh_b);
+
+		meshlink_node_t *a = meshlink_get_node(mesh_b, "a");
+		assert(a);
+
+		reset_sync_flag(&recv_flag);
+		meshlink_channel_t *channel = meshlink_channel_open(mesh_b, a, 1, NULL, NULL, 0);
+		assert(channel);
+		assert(meshlink_channel_send(mesh_b, channel, "hello", 5) == 5);
+		assert(wait_sync_flag(&recv_flag, 6));
+
+		meshlink_channel_close(mesh_b, channel);
+		meshlink_stop(mesh_a);
+		meshlink_stop(mesh_b);
+	}
+
+	close_meshlink_pair(mesh_a, mesh_b);
+}
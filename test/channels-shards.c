@@ -0,0 +1,247 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+#define TOTAL_SIZE 2000000
+#define NPEERS 12
+
+static struct sync_flag done_flag;
+static size_t received;
+static bool corrupt;
+
+static meshlink_handle_t *meshes[2];
+static pthread_t main_thread;
+static pthread_t loop_thread[2];
+static bool loop_thread_seen[2];
+static bool wrong_thread;
+static int pmtu_updates;
+
+// All callbacks should be called from MeshLink's own thread, never from a shard.
+static void check_thread(meshlink_handle_t *mesh) {
+	int idx = mesh == meshes[1];
+
+	if(pthread_equal(pthread_self(), main_thread)) {
+		return;
+	}
+
+	if(!loop_thread_seen[idx]) {
+		loop_thread[idx] = pthread_self();
+		loop_thread_seen[idx] = true;
+	} else if(!pthread_equal(pthread_self(), loop_thread[idx])) {
+		wrong_thread = true;
+	}
+}
+
+static void status_cb(meshlink_handle_t *mesh, meshlink_node_t *node, bool reachable) {
+	(void)node;
+	(void)reachable;
+
+	check_thread(mesh);
+}
+
+static void pmtu_cb(meshlink_handle_t *mesh, meshlink_node_t *node, uint16_t pmtu) {
+	(void)node;
+	(void)pmtu;
+
+	check_thread(mesh);
+	__atomic_add_fetch(&pmtu_updates, 1, __ATOMIC_RELAXED);
+}
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)channel;
+
+	check_thread(mesh);
+
+	const unsigned char *p = data;
+
+	for(size_t j = 0; j < len; j++) {
+		if(p[j] != (unsigned char)((received + j) * 13)) {
+			corrupt = true;
+		}
+	}
+
+	received += len;
+
+	if(received == TOTAL_SIZE) {
+		set_sync_flag(&done_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	check_thread(mesh);
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	return true;
+}
+
+static void stream(meshlink_handle_t *mesh, meshlink_node_t *peer) {
+	reset_sync_flag(&done_flag);
+	received = 0;
+	corrupt = false;
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh, peer, 1, NULL, NULL, 0);
+	assert(channel);
+	meshlink_set_channel_sndbuf(mesh, channel, 100000);
+
+	unsigned char buf[10000];
+
+	for(size_t sent = 0; sent < TOTAL_SIZE;) {
+		size_t len = TOTAL_SIZE - sent < sizeof(buf) ? TOTAL_SIZE - sent : sizeof(buf);
+
+		for(size_t j = 0; j < len; j++) {
+			buf[j] = (sent + j) * 13;
+		}
+
+		ssize_t result = meshlink_channel_send(mesh, channel, buf, len);
+		assert(result >= 0);
+
+		if(!result) {
+			const struct timespec req = {0, 1000000};
+			nanosleep(&req, NULL);
+		}
+
+		sent += result;
+	}
+
+	assert(wait_sync_flag(&done_flag, 30));
+	assert(!corrupt);
+
+	meshlink_channel_close(mesh, channel);
+}
+
+static meshlink_handle_t *open_sharded(const char *confbase, const char *name) {
+	assert(meshlink_destroy(confbase));
+
+	meshlink_open_params_t *params = meshlink_open_params_init(confbase, name, "channels_shards", DEV_CLASS_BACKBONE);
+	assert(params);
+	assert(!meshlink_open_params_set_udp_shards(params, -1));
+	assert(!meshlink_open_params_set_udp_shards(params, 65));
+	assert(meshlink_open_params_set_udp_shards(params, 4));
+
+	meshlink_handle_t *mesh = meshlink_open_ex(params);
+	assert(mesh);
+	meshlink_open_params_free(params);
+
+	meshlink_set_node_pmtu_cb(mesh, pmtu_cb);
+	meshlink_enable_discovery(mesh, false);
+	return mesh;
+}
+
+// Count the shards that decrypted packets themselves.
+static int active_shards(meshlink_handle_t *mesh) {
+	size_t nshards;
+	devtool_shard_stats_t *stats = devtool_get_shard_stats(mesh, &nshards);
+	assert(stats);
+	assert(nshards >= 4);
+
+	int active = 0;
+
+	for(size_t j = 0; j < nshards; j++) {
+		assert(stats[j].handled_packets <= stats[j].in_packets);
+
+		if(stats[j].handled_packets) {
+			active++;
+		}
+	}
+
+	free(stats);
+	return active;
+}
+
+int main(void) {
+	init_sync_flag(&done_flag);
+	main_thread = pthread_self();
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open two new meshlink instances with UDP shards.
+
+	meshlink_handle_t *mesh_a = meshes[0] = open_sharded("channels_shards_conf.1", "a");
+	meshlink_handle_t *mesh_b = meshes[1] = open_sharded("channels_shards_conf.2", "b");
+	link_meshlink_pair(mesh_a, mesh_b);
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+	start_meshlink_pair(mesh_a, mesh_b);
+	meshlink_set_node_status_cb(mesh_a, status_cb);
+	meshlink_set_node_status_cb(mesh_b, status_cb);
+
+	// Wait for PMTU discovery, so data is sent via UDP.
+
+	meshlink_node_t *b = meshlink_get_node(mesh_a, "b");
+	assert(b);
+	assert_after(meshlink_get_pmtu(mesh_a, b) > 0, 15);
+
+	stream(mesh_a, b);
+
+	// Combine the shards with the crypto worker pool.
+
+	assert(meshlink_set_crypto_threads(mesh_a, 2));
+	assert(meshlink_set_crypto_threads(mesh_b, 2));
+	stream(mesh_a, b);
+
+	// Key renewals are handled while the shards are decrypting.
+
+	meshlink_node_t *a = meshlink_get_self(mesh_a);
+	meshlink_node_t *b_a = meshlink_get_node(mesh_b, a->name);
+	assert(b_a);
+	devtool_force_sptps_renewal(mesh_a, b);
+	devtool_force_sptps_renewal(mesh_b, b_a);
+	stream(mesh_a, b);
+
+	// Restarting should stop and start the shards, and redo the handshake and PMTU discovery.
+
+	meshlink_stop(mesh_b);
+	loop_thread_seen[1] = false;
+	__atomic_store_n(&pmtu_updates, 0, __ATOMIC_RELAXED);
+	assert(meshlink_start(mesh_b));
+	assert_after(meshlink_get_pmtu(mesh_a, b) > 0, 15);
+	assert_after(meshlink_get_pmtu(mesh_b, b_a) > 0, 15);
+	assert(__atomic_load_n(&pmtu_updates, __ATOMIC_RELAXED) > 0);
+	stream(mesh_a, b);
+	assert(!wrong_thread);
+
+	// Packets from more peers should be spread over the shards.
+
+	meshlink_handle_t *peers[NPEERS];
+
+	for(int j = 0; j < NPEERS; j++) {
+		char name[10];
+		snprintf(name, sizeof(name), "peer%d", j);
+		peers[j] = meshlink_open_ephemeral(name, "channels_shards", DEV_CLASS_BACKBONE);
+		assert(peers[j]);
+		meshlink_enable_discovery(peers[j], false);
+		link_meshlink_pair(mesh_a, peers[j]);
+		assert(meshlink_start(peers[j]));
+	}
+
+	for(int j = 0; j < NPEERS; j++) {
+		meshlink_node_t *peer_a = meshlink_get_node(peers[j], a->name);
+		assert(peer_a);
+		assert_after(meshlink_get_pmtu(peers[j], peer_a) > 0, 15);
+	}
+
+	assert(active_shards(mesh_a) > 1);
+	assert(!wrong_thread);
+
+	// Clean up.
+
+	for(int j = 0; j < NPEERS; j++) {
+		meshlink_close(peers[j]);
+	}
+
+	close_meshlink_pair(mesh_a, mesh_b);
+}
@@ -0,0 +1,221 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "meshlink.h"
+#include "utils.h"
+
+#define NCHANNELS 3
+#define TOTAL_SIZE 1000000
+
+static struct sync_flag done_flag;
+
+static struct {
+	meshlink_channel_t *channel;
+	size_t received;
+	bool corrupt;
+	pthread_t thread;
+} channels[NCHANNELS];
+
+static int finished;
+
+static struct sync_flag accept_flag;
+static struct sync_flag error_flag;
+static meshlink_channel_t *accepted;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+
+	int i = (intptr_t)channel->priv;
+	const unsigned char *p = data;
+
+	if(!len) {
+		return;
+	}
+
+	for(size_t j = 0; j < len; j++) {
+		if(p[j] != (unsigned char)(channels[i].received + j + i)) {
+			channels[i].corrupt = true;
+		}
+	}
+
+	channels[i].received += len;
+
+	if(channels[i].received == TOTAL_SIZE && ++finished == NCHANNELS) {
+		set_sync_flag(&done_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)data;
+	(void)len;
+
+	if(port == NCHANNELS + 1) {
+		accepted = channel;
+		set_sync_flag(&accept_flag, true);
+		return true;
+	}
+
+	channel->priv = (void *)(intptr_t)(port - 1);
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	return true;
+}
+
+static void poll_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, size_t len) {
+	(void)mesh;
+	(void)channel;
+
+	if(!len) {
+		set_sync_flag(&error_flag, true);
+	}
+}
+
+static meshlink_handle_t *mesh_a;
+
+static void *send_thread(void *arg) {
+	int i = (intptr_t)arg;
+	meshlink_channel_t *channel = channels[i].channel;
+	unsigned char buf[10000];
+	size_t sent = 0;
+
+	while(sent < TOTAL_SIZE) {
+		size_t len = TOTAL_SIZE - sent < sizeof(buf) ? TOTAL_SIZE - sent : sizeof(buf);
+
+		for(size_t j = 0; j < len; j++) {
+			buf[j] = sent + j + i;
+		}
+
+		ssize_t result = meshlink_channel_send(mesh_a, channel, buf, len);
+		assert(result >= 0);
+
+		if(!result) {
+			const struct timespec req = {0, 1000000};
+			nanosleep(&req, NULL);
+		}
+
+		sent += result;
+	}
+
+	return NULL;
+}
+
+int main(void) {
+	init_sync_flag(&done_flag);
+	init_sync_flag(&accept_flag);
+	init_sync_flag(&error_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Start two new meshlink instance.
+
+	meshlink_handle_t *mesh_b;
+
+	open_meshlink_pair(&mesh_a, &mesh_b, "channels_staging");
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+	start_meshlink_pair(mesh_a, mesh_b);
+
+	meshlink_node_t *b = meshlink_get_node(mesh_a, "b");
+	assert(b);
+
+	// Send staging is not supported on UDP and framed channels.
+
+	meshlink_channel_t *udp = meshlink_channel_open_ex(mesh_a, b, 10, NULL, NULL, 0, MESHLINK_CHANNEL_UDP);
+	assert(udp);
+	assert(!meshlink_set_channel_send_staging(mesh_a, udp, 4096));
+	meshlink_channel_close(mesh_a, udp);
+
+	meshlink_channel_t *framed = meshlink_channel_open_ex(mesh_a, b, 11, NULL, NULL, 0, MESHLINK_CHANNEL_TCP | MESHLINK_CHANNEL_FRAMED);
+	assert(framed);
+	assert(!meshlink_set_channel_send_staging(mesh_a, framed, 4096));
+	meshlink_channel_close(mesh_a, framed);
+
+	// Open channels with send staging enabled.
+
+	for(int i = 0; i < NCHANNELS; i++) {
+		channels[i].channel = meshlink_channel_open(mesh_a, b, i + 1, NULL, NULL, 0);
+		assert(channels[i].channel);
+		assert(meshlink_set_channel_send_staging(mesh_a, channels[i].channel, 30000));
+	}
+
+	// AIO cannot be combined with send staging.
+
+	char dummy[10] = "";
+	assert(!meshlink_channel_aio_send(mesh_a, channels[0].channel, dummy, sizeof(dummy), NULL, NULL));
+
+	// Stream data on all channels in parallel.
+
+	for(int i = 0; i < NCHANNELS; i++) {
+		assert(!pthread_create(&channels[i].thread, NULL, send_thread, (void *)(intptr_t)i));
+	}
+
+	for(int i = 0; i < NCHANNELS; i++) {
+		pthread_join(channels[i].thread, NULL);
+	}
+
+	assert(wait_sync_flag(&done_flag, 30));
+
+	for(int c = 0; c < NCHANNELS; c++) {
+		assert(channels[c].received == TOTAL_SIZE);
+		assert(!channels[c].corrupt);
+		assert_after(!meshlink_channel_get_sendq(mesh_a, channels[c].channel), 5);
+	}
+
+	// Staged data is flushed when the channel is closed.
+
+	reset_sync_flag(&done_flag);
+	finished = NCHANNELS - 1;
+	channels[0].received = 0;
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh_a, b, 1, NULL, NULL, 0);
+	assert(channel);
+	assert(meshlink_set_channel_send_staging(mesh_a, channel, TOTAL_SIZE));
+
+	char *buf = malloc(TOTAL_SIZE);
+	assert(buf);
+
+	for(size_t j = 0; j < TOTAL_SIZE; j++) {
+		buf[j] = j;
+	}
+
+	assert(meshlink_channel_send(mesh_a, channel, buf, TOTAL_SIZE) == TOTAL_SIZE);
+	meshlink_channel_close(mesh_a, channel);
+	assert(wait_sync_flag(&done_flag, 30));
+	assert(!channels[0].corrupt);
+	free(buf);
+
+	// Staged data that can no longer be sent is kept, and the error is reported via the poll callback.
+
+	channel = meshlink_channel_open(mesh_a, b, NCHANNELS + 1, NULL, NULL, 0);
+	assert(channel);
+	meshlink_set_channel_poll_cb(mesh_a, channel, poll_cb);
+	assert(meshlink_set_channel_send_staging(mesh_a, channel, 4096));
+	assert(meshlink_channel_send(mesh_a, channel, "hello", 5) == 5);
+	assert(wait_sync_flag(&accept_flag, 10));
+
+	meshlink_channel_abort(mesh_b, accepted);
+	assert(wait_sync_flag(&error_flag, 10));
+	reset_sync_flag(&error_flag);
+
+	assert(meshlink_channel_send(mesh_a, channel, "world", 5) == 5);
+	assert(wait_sync_flag(&error_flag, 10));
+	assert(meshlink_channel_get_sendq(mesh_a, channel) == 5);
+	assert(meshlink_channel_send(mesh_a, channel, "again", 5) == -1);
+	assert(meshlink_errno == MESHLINK_ENETWORK);
+	meshlink_channel_close(mesh_a, channel);
+
+	// Clean up.
+
+	for(int i = 0; i < NCHANNELS; i++) {
+		meshlink_channel_close(mesh_a, channels[i].channel);
+	}
+
+	close_meshlink_pair(mesh_a, mesh_b);
+}
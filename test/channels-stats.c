@@ -0,0 +1,101 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meshlink.h"
+#include "utils.h"
+
+#define TOTAL_SIZE 1000000
+
+static struct sync_flag done_flag;
+static size_t received;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+	(void)channel;
+	(void)data;
+
+	received += len;
+
+	if(received == TOTAL_SIZE) {
+		set_sync_flag(&done_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	return true;
+}
+
+int main(void) {
+	init_sync_flag(&done_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Start two new meshlink instance.
+
+	meshlink_handle_t *mesh_a;
+	meshlink_handle_t *mesh_b;
+
+	open_meshlink_pair(&mesh_a, &mesh_b, "channels_stats");
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+	start_meshlink_pair(mesh_a, mesh_b);
+
+	meshlink_node_t *b = meshlink_get_node(mesh_a, "b");
+	assert(b);
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh_a, b, 1, NULL, NULL, 0);
+	assert(channel);
+
+	// Check the initial statistics.
+
+	meshlink_channel_stats_t stats;
+	assert(!meshlink_channel_get_stats(mesh_a, channel, NULL, sizeof(stats)));
+	assert(!meshlink_channel_get_stats(mesh_a, channel, &stats, 0));
+
+	assert(meshlink_channel_get_stats(mesh_a, channel, &stats, sizeof(stats)));
+	assert(stats.version == MESHLINK_CHANNEL_STATS_VERSION);
+	assert(stats.segments_sent == 0);
+	assert(stats.bytes_sent == 0);
+	assert(stats.bytes_acked == 0);
+
+	// Send some data and wait until it has all been acknowledged.
+
+	char *buf = calloc(1, TOTAL_SIZE);
+	assert(buf);
+
+	assert(meshlink_channel_aio_send(mesh_a, channel, buf, TOTAL_SIZE, NULL, NULL));
+	assert(wait_sync_flag(&done_flag, 20));
+	assert_after(!meshlink_channel_get_sendq(mesh_a, channel), 5);
+
+	assert(meshlink_channel_get_stats(mesh_a, channel, &stats, sizeof(stats)));
+	assert(stats.bytes_acked == TOTAL_SIZE);
+	assert(stats.bytes_sent >= TOTAL_SIZE);
+	assert(stats.segments_sent > 0 && stats.segments_sent <= stats.bytes_sent);
+	assert(stats.flight == 0);
+	assert(stats.cwnd > 0);
+	assert(stats.rto > 0);
+
+	// Only the requested part of the struct should be written to.
+
+	memset(&stats, 0xff, sizeof(stats));
+	assert(meshlink_channel_get_stats(mesh_a, channel, &stats, sizeof(stats.version)));
+	assert(stats.version == MESHLINK_CHANNEL_STATS_VERSION);
+	assert(stats.cwnd == 0xffffffff);
+
+	// Clean up.
+
+	meshlink_channel_close(mesh_a, channel);
+	free(buf);
+	close_meshlink_pair(mesh_a, mesh_b);
+}
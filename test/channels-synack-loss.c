@@ -0,0 +1,191 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+/* Lose the SYNACK of a new channel and the retransmitted SYN, so only the retransmitted SYNACK arrives. */
+
+static meshlink_handle_t *meshes[2];
+static bool drop_from[2];
+static struct sync_flag established_flag;
+static struct sync_flag a_received;
+static struct sync_flag b_received;
+static bool failed;
+
+static void index_to_address(int index, struct sockaddr_in *sin) {
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x0a000001 + index);
+	sin->sin_port = htons(655);
+}
+
+static int address_to_index(const struct sockaddr *sa) {
+	if(sa->sa_family != AF_INET) {
+		return -1;
+	}
+
+	uint32_t index = ntohl(((const struct sockaddr_in *)sa)->sin_addr.s_addr) - 0x0a000001;
+	return index < 2 ? (int)index : -1;
+}
+
+static bool transport_send(meshlink_handle_t *mesh, const struct sockaddr *to, const void *data, size_t len) {
+	int index = address_to_index(to);
+
+	int self = mesh == meshes[1];
+
+	if(index < 0 || __atomic_load_n(&drop_from[self], __ATOMIC_RELAXED)) {
+		return true;
+	}
+
+	struct sockaddr_in from;
+	index_to_address(self, &from);
+	return devtool_transport_receive(meshes[index], (struct sockaddr *)&from, data, len);
+}
+
+static int transport_connect(meshlink_handle_t *mesh, const struct sockaddr *to) {
+	int index = address_to_index(to);
+	int fds[2];
+
+	if(index < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		return -1;
+	}
+
+	struct sockaddr_in from;
+	index_to_address(mesh == meshes[1], &from);
+
+	if(!devtool_transport_accept(meshes[index], fds[1], (struct sockaddr *)&from)) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	return fds[0];
+}
+
+static const devtool_transport_t transport = {
+	.send = transport_send,
+	.connect = transport_connect,
+};
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)channel;
+	(void)data;
+
+	if(!len) {
+		failed = true;
+		return;
+	}
+
+	set_sync_flag(mesh == meshes[0] ? &a_received : &b_received, true);
+}
+
+static devtool_node_status_t get_status(meshlink_handle_t *mesh, const char *name) {
+	devtool_node_status_t status;
+	devtool_get_node_status(mesh, meshlink_get_node(mesh, name), &status);
+	return status;
+}
+
+static void poll_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, size_t len) {
+	if(len) {
+		meshlink_set_channel_poll_cb(mesh, channel, NULL);
+		set_sync_flag(&established_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	assert(meshlink_channel_send(mesh, channel, "world", 5) == 5);
+	return true;
+}
+
+int main(void) {
+	init_sync_flag(&established_flag);
+	init_sync_flag(&a_received);
+	init_sync_flag(&b_received);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open two instances that talk via a virtual transport.
+
+	static const char *names[2] = {"a", "b"};
+
+	for(int j = 0; j < 2; j++) {
+		struct sockaddr_in sin;
+		char address[INET_ADDRSTRLEN];
+		index_to_address(j, &sin);
+		inet_ntop(AF_INET, &sin.sin_addr, address, sizeof(address));
+
+		meshes[j] = meshlink_open_ephemeral(names[j], "channels_synack_loss", DEV_CLASS_BACKBONE);
+		assert(meshes[j]);
+		meshlink_enable_discovery(meshes[j], false);
+		assert(meshlink_set_canonical_address(meshes[j], meshlink_get_self(meshes[j]), address, "655"));
+		devtool_set_transport(meshes[j], &transport);
+	}
+
+	char *data = meshlink_export(meshes[0]);
+	assert(data);
+	assert(meshlink_import(meshes[1], data));
+	free(data);
+
+	data = meshlink_export(meshes[1]);
+	assert(data);
+	assert(meshlink_import(meshes[0], data));
+	free(data);
+
+	meshlink_set_channel_accept_cb(meshes[1], accept_cb);
+	start_meshlink_pair(meshes[0], meshes[1]);
+
+	// Wait until UDP works in both directions, so the channel's packets are sent via UDP.
+
+	meshlink_node_t *b = meshlink_get_node(meshes[0], "b");
+	assert(b);
+	assert_after(get_status(meshes[0], "b").udp_status == DEVTOOL_UDP_WORKING && get_status(meshes[1], "a").udp_status == DEVTOOL_UDP_WORKING, 15);
+	sleep(1);
+
+	// Drop everything b sends via UDP until it has received the SYN, so its SYNACK is lost.
+
+	uint64_t in_data = get_status(meshes[1], "a").in_data;
+	__atomic_store_n(&drop_from[1], true, __ATOMIC_RELAXED);
+
+	meshlink_channel_t *channel = meshlink_channel_open(meshes[0], b, 1, receive_cb, NULL, 0);
+	assert(channel);
+	meshlink_set_channel_poll_cb(meshes[0], channel, poll_cb);
+	assert(meshlink_channel_send(meshes[0], channel, "hello", 5) == 5);
+	assert_after(get_status(meshes[1], "a").in_data > in_data, 10);
+
+	// Then drop everything a sends, so the retransmitted SYNACK establishes the channel instead of a retransmitted SYN.
+
+	__atomic_store_n(&drop_from[0], true, __ATOMIC_RELAXED);
+	__atomic_store_n(&drop_from[1], false, __ATOMIC_RELAXED);
+	assert(wait_sync_flag(&established_flag, 15));
+	__atomic_store_n(&drop_from[0], false, __ATOMIC_RELAXED);
+
+	// The channel should now work in both directions.
+
+	assert(wait_sync_flag(&b_received, 15));
+	assert(wait_sync_flag(&a_received, 15));
+	assert(!failed);
+
+	// Clean up. Stop both instances first, so neither tries to reach the other after it is closed.
+
+	meshlink_channel_close(meshes[0], channel);
+	meshlink_stop(meshes[0]);
+	meshlink_stop(meshes[1]);
+	close_meshlink_pair(meshes[0], meshes[1]);
+}
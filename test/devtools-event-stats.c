@@ -0,0 +1,129 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+static struct sync_flag received_flag;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+	(void)channel;
+	(void)data;
+
+	if(len) {
+		set_sync_flag(&received_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	return true;
+}
+
+static bool write_cb(meshlink_handle_t *mesh, const char *text, size_t len, void *priv) {
+	(void)mesh;
+	char **data = priv;
+	size_t oldlen = *data ? strlen(*data) : 0;
+
+	*data = realloc(*data, oldlen + len + 1);
+	assert(*data);
+	memcpy(*data + oldlen, text, len);
+	(*data)[oldlen + len] = 0;
+	return true;
+}
+
+int main(void) {
+	init_sync_flag(&received_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Check the kind names.
+
+	assert(!strcmp(devtool_event_kind_name(DEVTOOL_EVENT_WAIT), "wait"));
+	assert(!strcmp(devtool_event_kind_name(DEVTOOL_EVENT_META_IO), "meta_io"));
+	assert(!devtool_event_kind_name(DEVTOOL_EVENT_KINDS));
+
+	// Start two new meshlink instance and send some data over a channel.
+
+	meshlink_handle_t *mesh_a;
+	meshlink_handle_t *mesh_b;
+
+	open_meshlink_pair(&mesh_a, &mesh_b, "devtools_event_stats");
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+	start_meshlink_pair(mesh_a, mesh_b);
+
+	meshlink_node_t *b = meshlink_get_node(mesh_a, "b");
+	assert(b);
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh_a, b, 1, NULL, NULL, 0);
+	assert(channel);
+	assert(meshlink_channel_send(mesh_a, channel, "Hello", 5) == 5);
+	assert(wait_sync_flag(&received_flag, 10));
+
+	devtool_event_stats_t stats;
+	assert(!devtool_get_event_stats(NULL, &stats, false));
+	assert(meshlink_errno == MESHLINK_EINVAL);
+	assert(!devtool_get_event_stats(mesh_a, NULL, false));
+	assert(meshlink_errno == MESHLINK_EINVAL);
+
+	char *text = NULL;
+	assert(devtool_export_metrics(mesh_a, write_cb, &text));
+	assert(text);
+
+	if(!devtool_get_event_stats(mesh_a, &stats, false)) {
+		// MeshLink was built without --enable-event-stats.
+		assert(meshlink_errno == MESHLINK_ENOTSUP);
+		assert(!strstr(text, "meshlink_loop_seconds"));
+	} else {
+		assert(stats.iterations > 0);
+		assert(stats.kinds[DEVTOOL_EVENT_WAIT].count > 0);
+		assert(stats.kinds[DEVTOOL_EVENT_HOLD].count > 0);
+		assert(stats.kinds[DEVTOOL_EVENT_META_IO].count > 0);
+		assert(stats.kinds[DEVTOOL_EVENT_SIGNAL].count > 0);
+		assert(stats.stall_kind != DEVTOOL_EVENT_WAIT);
+
+		for(int i = 0; i < DEVTOOL_EVENT_KINDS; i++) {
+			uint64_t total = 0;
+
+			for(int j = 0; j < DEVTOOL_EVENT_STATS_BUCKETS; j++) {
+				total += stats.kinds[i].buckets[j];
+			}
+
+			assert(total == stats.kinds[i].count);
+			assert(stats.kinds[i].max_usec <= stats.kinds[i].total_usec);
+
+			if(i != DEVTOOL_EVENT_WAIT) {
+				assert(stats.kinds[i].max_usec <= stats.stall_usec);
+			}
+		}
+
+		assert(strstr(text, "# TYPE meshlink_loop_seconds histogram\n"));
+		assert(strstr(text, "meshlink_loop_seconds_bucket{mesh=\"a\",kind=\"meta_io\",le=\"+Inf\"} "));
+		assert(strstr(text, "meshlink_loop_seconds_count{mesh=\"a\",kind=\"wait\"} "));
+
+		// Resetting clears the histograms.
+
+		assert(devtool_get_event_stats(mesh_a, &stats, true));
+		assert(devtool_get_event_stats(mesh_a, &stats, false));
+		assert(stats.kinds[DEVTOOL_EVENT_META_IO].count < 10);
+	}
+
+	free(text);
+
+	// Clean up.
+
+	meshlink_channel_close(mesh_a, channel);
+	close_meshlink_pair(mesh_a, mesh_b);
+}
@@ -0,0 +1,145 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+static struct sync_flag received_flag;
+static volatile bool polling;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+	(void)channel;
+	(void)data;
+
+	if(len) {
+		set_sync_flag(&received_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	return true;
+}
+
+static void *poll_thread(void *arg) {
+	meshlink_handle_t *mesh = arg;
+	meshlink_node_t *b = meshlink_get_node(mesh, "b");
+	assert(b);
+
+	while(polling) {
+		time_t last_reachable;
+		assert(meshlink_get_node_reachability(mesh, b, &last_reachable, NULL));
+		assert(last_reachable);
+		assert(meshlink_get_pmtu(mesh, b) > 0);
+		assert(meshlink_get_node_dev_class(mesh, b) == DEV_CLASS_BACKBONE);
+	}
+
+	return NULL;
+}
+
+static const devtool_lock_stats_t *find_lock_stats(const devtool_lock_stats_t *stats, size_t nmemb, const char *function) {
+	for(size_t i = 0; i < nmemb; i++) {
+		if(!strcmp(stats[i].function, function)) {
+			return &stats[i];
+		}
+	}
+
+	return NULL;
+}
+
+int main(void) {
+	init_sync_flag(&received_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Start two new meshlink instance.
+
+	meshlink_handle_t *mesh_a;
+	meshlink_handle_t *mesh_b;
+
+	open_meshlink_pair(&mesh_a, &mesh_b, "devtools_lock_stats");
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+	start_meshlink_pair(mesh_a, mesh_b);
+
+	meshlink_node_t *b = meshlink_get_node(mesh_a, "b");
+	assert(b);
+
+	// Poll the state of b from another thread while sending data to it.
+
+	polling = true;
+	pthread_t thread;
+	assert(!pthread_create(&thread, NULL, poll_thread, mesh_a));
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh_a, b, 1, NULL, NULL, 0);
+	assert(channel);
+	assert(meshlink_channel_send(mesh_a, channel, "Hello", 5) == 5);
+	assert(wait_sync_flag(&received_flag, 10));
+
+	polling = false;
+	pthread_join(thread, NULL);
+
+	// Changes made through the API are immediately visible in the getters.
+
+	assert(!meshlink_get_node_blacklisted(mesh_a, b));
+	assert(meshlink_blacklist(mesh_a, b));
+	assert(meshlink_get_node_blacklisted(mesh_a, b));
+	assert(!meshlink_get_node_reachability(mesh_a, b, NULL, NULL));
+	assert(meshlink_whitelist(mesh_a, b));
+	assert(!meshlink_get_node_blacklisted(mesh_a, b));
+
+	// Check the lock statistics.
+
+	size_t nmemb = 0;
+	assert(!devtool_get_lock_stats(NULL, &nmemb, false));
+	assert(meshlink_errno == MESHLINK_EINVAL);
+
+	devtool_lock_stats_t *stats = devtool_get_lock_stats(mesh_a, &nmemb, false);
+
+	if(!stats) {
+		// MeshLink was built without --enable-lock-stats.
+		assert(meshlink_errno == MESHLINK_ENOTSUP);
+		assert(!nmemb);
+	} else {
+		const devtool_lock_stats_t *ls = find_lock_stats(stats, nmemb, "meshlink_get_node");
+		assert(ls);
+		assert(ls->count >= 2);
+		assert(ls->max_wait_usec <= ls->wait_usec);
+		assert(ls->max_hold_usec <= ls->hold_usec);
+
+		ls = find_lock_stats(stats, nmemb, "event_loop_run");
+		assert(ls);
+		assert(ls->count > 0);
+
+		// The getters that use the snapshot don't take the lock.
+		assert(!find_lock_stats(stats, nmemb, "meshlink_get_node_reachability"));
+		assert(!find_lock_stats(stats, nmemb, "meshlink_get_pmtu"));
+
+		free(stats);
+
+		// After a reset, only the call to the getter itself is left.
+
+		free(devtool_get_lock_stats(mesh_a, &nmemb, true));
+		stats = devtool_get_lock_stats(mesh_a, &nmemb, false);
+		assert(stats);
+		assert(!find_lock_stats(stats, nmemb, "meshlink_get_node"));
+		free(stats);
+	}
+
+	// Clean up.
+
+	meshlink_channel_close(mesh_a, channel);
+	close_meshlink_pair(mesh_a, mesh_b);
+}
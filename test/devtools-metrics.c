@@ -0,0 +1,141 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+static struct sync_flag received_flag;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+	(void)channel;
+	(void)data;
+
+	if(len) {
+		set_sync_flag(&received_flag, true);
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)port;
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_receive_cb(mesh, channel, receive_cb);
+	return true;
+}
+
+struct text {
+	char *data;
+	size_t len;
+	int chunks;
+};
+
+static bool write_cb(meshlink_handle_t *mesh, const char *text, size_t len, void *priv) {
+	(void)mesh;
+	struct text *t = priv;
+
+	t->data = realloc(t->data, t->len + len + 1);
+	assert(t->data);
+	memcpy(t->data + t->len, text, len);
+	t->len += len;
+	t->data[t->len] = 0;
+	t->chunks++;
+	return true;
+}
+
+static bool abort_cb(meshlink_handle_t *mesh, const char *text, size_t len, void *priv) {
+	(void)mesh;
+	(void)text;
+	(void)len;
+	(*(int *)priv)++;
+	return false;
+}
+
+int main(void) {
+	init_sync_flag(&received_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Start two new meshlink instance.
+
+	meshlink_handle_t *mesh_a;
+	meshlink_handle_t *mesh_b;
+
+	open_meshlink_pair(&mesh_a, &mesh_b, "devtools_metrics");
+	meshlink_set_channel_accept_cb(mesh_b, accept_cb);
+	start_meshlink_pair(mesh_a, mesh_b);
+
+	// Send some data over a channel.
+
+	meshlink_node_t *b = meshlink_get_node(mesh_a, "b");
+	assert(b);
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh_a, b, 1, NULL, NULL, 0);
+	assert(channel);
+	assert(meshlink_channel_send(mesh_a, channel, "Hello", 5) == 5);
+	assert(wait_sync_flag(&received_flag, 10));
+
+	// Check the snapshot.
+
+	assert(!devtool_get_metrics(NULL));
+
+	devtool_metrics_t *metrics = devtool_get_metrics(mesh_a);
+	assert(metrics);
+	assert(metrics->loop_iterations > 0);
+	assert(metrics->loop_max_busy_usec <= metrics->loop_busy_usec);
+	assert(metrics->nnodes == 2);
+
+	devtool_node_metrics_t *nm = NULL;
+
+	for(size_t i = 0; i < metrics->nnodes; i++) {
+		if(metrics->nodes[i].node == b) {
+			nm = &metrics->nodes[i];
+		}
+	}
+
+	assert(nm);
+	assert(nm->reachable);
+	assert(nm->status.out_data > 0);
+	assert(nm->out_udp + nm->out_relayed > 0);
+	assert(nm->out_packets <= nm->out_udp);
+	assert(nm->decrypt_failures == 0);
+
+	assert(metrics->nconnections == 1);
+	assert(metrics->connections[0].node == b);
+	assert(metrics->connections[0].active);
+	assert(metrics->connections[0].address.ss_family != AF_UNSPEC);
+
+	free(metrics);
+
+	// Check the text export.
+
+	struct text text = {NULL, 0, 0};
+	assert(devtool_export_metrics(mesh_a, write_cb, &text));
+	assert(text.chunks > 1);
+	assert(strstr(text.data, "# TYPE meshlink_loop_iterations_total counter\n"));
+	assert(strstr(text.data, "meshlink_loop_iterations_total{mesh=\"a\"} "));
+	assert(strstr(text.data, "meshlink_node_out_data_bytes_total{mesh=\"a\",node=\"b\"} "));
+	assert(strstr(text.data, "meshlink_node_reachable{mesh=\"a\",node=\"b\"} 1\n"));
+	assert(text.data[text.len - 1] == '\n');
+	free(text.data);
+
+	// The export stops as soon as the callback returns false.
+
+	int calls = 0;
+	assert(!devtool_export_metrics(mesh_a, abort_cb, &calls));
+	assert(calls == 1);
+
+	// Clean up.
+
+	meshlink_channel_close(mesh_a, channel);
+	close_meshlink_pair(mesh_a, mesh_b);
+}
@@ -0,0 +1,251 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+/* Check devtool_get_all_edges() while a node knows about edges of which the reverse has not arrived yet.
+   Both b and c connect to a, but are held in their meta-connection status callback,
+   which runs before they add their own edge to a and tell a about it. */
+
+static meshlink_handle_t *meshes[3];
+static bool connected[3];
+static struct sync_flag a_connected;
+static struct sync_flag held[2];
+static struct sync_flag release_flag;
+
+static void index_to_address(int index, struct sockaddr_in *sin) {
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x0a000001 + index);
+	sin->sin_port = htons(655);
+}
+
+static int mesh_to_index(meshlink_handle_t *mesh) {
+	for(int j = 0; j < 3; j++) {
+		if(mesh == meshes[j]) {
+			return j;
+		}
+	}
+
+	abort();
+}
+
+/* Forward a meta-connection, but trickle what a sends in small pieces. That way, b and c have sent their ACK
+   to a by the time the ACK from a is complete, and they are held only after a has seen theirs. */
+
+static void *forward(void *arg) {
+	int *fds = arg;
+	char buf[4096];
+
+	while(true) {
+		struct pollfd pfds[2] = {{fds[0], POLLIN, 0}, {fds[1], POLLIN, 0}};
+
+		if(poll(pfds, 2, -1) <= 0) {
+			break;
+		}
+
+		int from = pfds[0].revents ? 0 : 1;
+		ssize_t len = read(fds[from], buf, from ? sizeof(buf) : 16);
+
+		if(len <= 0) {
+			break;
+		}
+
+		if(from == 0) {
+			usleep(10000);
+		}
+
+		if(send(fds[!from], buf, len, MSG_NOSIGNAL) != len) {
+			break;
+		}
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	free(fds);
+	return NULL;
+}
+
+static bool transport_send(meshlink_handle_t *mesh, const struct sockaddr *to, const void *data, size_t len) {
+	(void)mesh;
+	(void)to;
+	(void)data;
+	(void)len;
+
+	return true;
+}
+
+static int transport_connect(meshlink_handle_t *mesh, const struct sockaddr *to) {
+	(void)to;
+
+	int self = mesh_to_index(mesh);
+	int a_fds[2], b_fds[2];
+
+	// Only b and c connect, to a.
+
+	if(!self || socketpair(AF_UNIX, SOCK_STREAM, 0, a_fds)) {
+		return -1;
+	}
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, b_fds)) {
+		close(a_fds[0]);
+		close(a_fds[1]);
+		return -1;
+	}
+
+	struct sockaddr_in from;
+	index_to_address(self, &from);
+
+	if(!devtool_transport_accept(meshes[0], a_fds[1], (struct sockaddr *)&from)) {
+		close(a_fds[0]);
+		close(a_fds[1]);
+		close(b_fds[0]);
+		close(b_fds[1]);
+		return -1;
+	}
+
+	int *fds = malloc(2 * sizeof(*fds));
+	assert(fds);
+	fds[0] = a_fds[0];
+	fds[1] = b_fds[1];
+
+	pthread_t thread;
+	assert(!pthread_create(&thread, NULL, forward, fds));
+	assert(!pthread_detach(thread));
+
+	return b_fds[0];
+}
+
+static const devtool_transport_t transport = {
+	.send = transport_send,
+	.connect = transport_connect,
+};
+
+static void hub_meta_status_cb(meshlink_handle_t *mesh, meshlink_node_t *node, bool reachable) {
+	(void)mesh;
+
+	if(!reachable) {
+		return;
+	}
+
+	for(int j = 1; j < 3; j++) {
+		if(!strcmp(node->name, meshlink_get_self(meshes[j])->name)) {
+			connected[j] = true;
+		}
+	}
+
+	if(connected[1] && connected[2]) {
+		set_sync_flag(&a_connected, true);
+	}
+}
+
+static void held_meta_status_cb(meshlink_handle_t *mesh, meshlink_node_t *node, bool reachable) {
+	(void)node;
+
+	if(!reachable || check_sync_flag(&release_flag)) {
+		return;
+	}
+
+	set_sync_flag(&held[mesh_to_index(mesh) - 1], true);
+	assert(wait_sync_flag(&release_flag, 30));
+}
+
+static size_t count_edges(meshlink_handle_t *mesh) {
+	size_t nedges = 0;
+	devtool_edge_t *edges = devtool_get_all_edges(mesh, NULL, &nedges);
+	free(edges);
+	return nedges;
+}
+
+int main(void) {
+	init_sync_flag(&a_connected);
+	init_sync_flag(&held[0]);
+	init_sync_flag(&held[1]);
+	init_sync_flag(&release_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open three instances that talk via a virtual transport.
+
+	static const char *names[3] = {"a", "b", "c"};
+
+	for(int j = 0; j < 3; j++) {
+		struct sockaddr_in sin;
+		char address[INET_ADDRSTRLEN];
+		index_to_address(j, &sin);
+		inet_ntop(AF_INET, &sin.sin_addr, address, sizeof(address));
+
+		meshes[j] = meshlink_open_ephemeral(names[j], "get_all_edges", DEV_CLASS_BACKBONE);
+		assert(meshes[j]);
+		meshlink_enable_discovery(meshes[j], false);
+		assert(meshlink_set_canonical_address(meshes[j], meshlink_get_self(meshes[j]), address, "655"));
+		devtool_set_transport(meshes[j], &transport);
+	}
+
+	// b and c only know about a.
+
+	char *data = meshlink_export(meshes[0]);
+	assert(data);
+
+	for(int j = 1; j < 3; j++) {
+		assert(meshlink_import(meshes[j], data));
+		char *other = meshlink_export(meshes[j]);
+		assert(other);
+		assert(meshlink_import(meshes[0], other));
+		free(other);
+	}
+
+	free(data);
+
+	// Without any edges, we should get an empty result.
+
+	assert(count_edges(meshes[0]) == 0);
+
+	// Hold b and c before they send their edge to a.
+
+	devtool_set_meta_status_cb(meshes[0], hub_meta_status_cb);
+	devtool_set_meta_status_cb(meshes[1], held_meta_status_cb);
+	devtool_set_meta_status_cb(meshes[2], held_meta_status_cb);
+
+	for(int j = 0; j < 3; j++) {
+		assert(meshlink_start(meshes[j]));
+	}
+
+	assert(wait_sync_flag(&held[0], 15));
+	assert(wait_sync_flag(&held[1], 15));
+	assert(wait_sync_flag(&a_connected, 15));
+
+	// a now has its own edges to b and c, but not their reverse edges.
+
+	size_t nedges = 0;
+	devtool_edge_t *edges = devtool_get_all_edges(meshes[0], NULL, &nedges);
+	assert(!edges);
+	assert(nedges == 0);
+
+	// Once b and c continue, both edges should show up.
+
+	set_sync_flag(&release_flag, true);
+	assert_after(count_edges(meshes[0]) == 2, 15);
+
+	for(int j = 0; j < 3; j++) {
+		meshlink_stop(meshes[j]);
+	}
+
+	for(int j = 0; j < 3; j++) {
+		meshlink_close(meshes[j]);
+	}
+}
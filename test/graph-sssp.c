@@ -0,0 +1,223 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "meshlink_internal.h"
+#include "connection.h"
+#include "edge.h"
+#include "graph.h"
+#include "node.h"
+#include "protocol.h"
+#include "splay_tree.h"
+#include "xalloc.h"
+
+#include <assert.h>
+
+/* Apply random sequences of edge additions, deletions and weight changes to the graph,
+   and compare the incrementally maintained shortest path tree with a full recompute after every step.
+   This uses the internal graph functions, so it is linked against the static library. */
+
+#define NNODES 10
+#define SEEDS 20
+#define STEPS 2000
+
+static node_t *nodes[NNODES];
+static int distance[NNODES];
+static uint64_t state;
+static bool old_node;
+
+static uint32_t next_random(void) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state >> 32;
+}
+
+static int random_weight(void) {
+	switch(next_random() % 20) {
+	case 0:
+		return 0;
+
+	case 1:
+		return 0x10000 + next_random() % 10;
+
+	default:
+		return 1 + next_random() % 10;
+	}
+}
+
+/* The same cost as graph.c uses */
+static int cost(const meshlink_handle_t *mesh, const edge_t *e) {
+	if(mesh->hop_routing) {
+		return 1;
+	} else if(e->weight < 1) {
+		return 1;
+	} else if(e->weight > 0xffff) {
+		return 0xffff;
+	} else {
+		return e->weight;
+	}
+}
+
+static int node_index(const node_t *n) {
+	for(int i = 0; i < NNODES; i++) {
+		if(nodes[i] == n) {
+			return i;
+		}
+	}
+
+	abort();
+}
+
+/* Plain Dijkstra over all bidirectional edges */
+static void recompute(const meshlink_handle_t *mesh) {
+	bool done[NNODES] = {false};
+
+	for(int i = 0; i < NNODES; i++) {
+		distance[i] = -1;
+	}
+
+	distance[0] = 0;
+
+	while(true) {
+		int u = -1;
+
+		for(int i = 0; i < NNODES; i++) {
+			if(!done[i] && distance[i] >= 0 && (u < 0 || distance[i] < distance[u])) {
+				u = i;
+			}
+		}
+
+		if(u < 0) {
+			break;
+		}
+
+		done[u] = true;
+
+		for splay_each(edge_t, e, nodes[u]->edge_tree) {
+			int v = node_index(e->to);
+
+			if(e->reverse && (distance[v] < 0 || distance[u] + cost(mesh, e) < distance[v])) {
+				distance[v] = distance[u] + cost(mesh, e);
+			}
+		}
+	}
+}
+
+/* Check that every node has the right distance, and that its path is a valid shortest path
+   whose last edge has the lowest weight of all the possible ones, with the right nexthop and options. */
+static void check_paths(meshlink_handle_t *mesh) {
+	recompute(mesh);
+
+	for(int i = 0; i < NNODES; i++) {
+		node_t *n = nodes[i];
+		assert(n->distance == distance[i]);
+
+		if(!i) {
+			continue;
+		}
+
+		if(distance[i] < 0) {
+			assert(!n->prevedge);
+			continue;
+		}
+
+		edge_t *e = n->prevedge;
+		assert(e);
+		assert(e->to == n);
+		assert(lookup_edge(e->from, n) == e);
+		assert(e->reverse);
+		assert(distance[node_index(e->from)] + cost(mesh, e) == distance[i]);
+		assert(n->nexthop == (e->from == mesh->self ? n : e->from->nexthop));
+		assert(n->options == e->options);
+
+		for(int j = 0; j < NNODES; j++) {
+			edge_t *other = j != i ? lookup_edge(nodes[j], n) : NULL;
+
+			if(other && other->reverse && distance[j] >= 0 && distance[j] + cost(mesh, other) == distance[i]) {
+				assert(other->weight >= e->weight);
+			}
+		}
+	}
+}
+
+static void check_reachability(void) {
+	for(int i = 1; i < NNODES; i++) {
+		assert(nodes[i]->status.reachable == (distance[i] >= 0));
+	}
+}
+
+static void random_step(meshlink_handle_t *mesh) {
+	node_t *from = nodes[next_random() % NNODES];
+	node_t *to = nodes[next_random() % NNODES];
+
+	if(from == to) {
+		return;
+	}
+
+	edge_t *e = lookup_edge(from, to);
+
+	if(!e) {
+		e = new_edge();
+		e->from = from;
+		e->to = to;
+		e->address.in.sin_family = AF_INET;
+		e->address.in.sin_addr.s_addr = htonl(0x7f000001);
+		e->address.in.sin_port = htons(655);
+		e->weight = random_weight();
+
+		/* The options are those of the node the edge points to. The last node does not route on edge weights in some sequences,
+		   which makes us switch to routing on hop counts while it is reachable. */
+		e->options = (to == nodes[NNODES - 1] && old_node ? PROT_MINOR_RTT - 1 : PROT_MINOR_RTT) << 24;
+		edge_add(mesh, e);
+	} else if(next_random() % 3) {
+		edge_set_weight(mesh, e, random_weight());
+	} else {
+		edge_del(mesh, e);
+	}
+}
+
+int main(void) {
+	meshlink_handle_t *mesh = meshlink_open_ephemeral("node0", "graph-sssp", DEV_CLASS_BACKBONE);
+	assert(mesh);
+
+	nodes[0] = mesh->self;
+
+	for(int i = 1; i < NNODES; i++) {
+		nodes[i] = new_node();
+		xasprintf(&nodes[i]->name, "node%d", i);
+		node_add(mesh, nodes[i]);
+	}
+
+	for(int seed = 1; seed <= SEEDS; seed++) {
+		state = 0x9e3779b97f4a7c15ULL * seed;
+		old_node = seed % 2;
+
+		for(int step = 0; step < STEPS; step++) {
+			random_step(mesh);
+			check_paths(mesh);
+
+			/* Let graph() update the reachability of several changes at once now and then */
+
+			if(next_random() % 4 == 0) {
+				graph(mesh);
+				check_paths(mesh);
+				check_reachability();
+			}
+		}
+
+		/* Start the next sequence with an empty graph */
+
+		for(int i = 0; i < NNODES; i++) {
+			for splay_each(edge_t, e, nodes[i]->edge_tree) {
+				edge_del(mesh, e);
+			}
+		}
+
+		graph(mesh);
+		check_paths(mesh);
+		check_reachability();
+	}
+
+	meshlink_close(mesh);
+}
@@ -0,0 +1,582 @@
+/*
+    meshlink-bench -- Run many MeshLink instances in one process over simulated links
+
+    This program opens N ephemeral meshes, links them together in a tree,
+    and replaces their sockets with a virtual transport (see devtool_set_transport()).
+    UDP packets are passed between meshes in memory, optionally after a fixed delay
+    and with random loss, and meta-connections use socketpairs.
+    No special privileges or network namespaces are needed.
+
+    It reports:
+    - the time until every node sees every other node as reachable,
+    - the rate of meta-connection handshakes during that time,
+    - the throughput of a channel between the first and the last node, and its transport statistics,
+    - the round-trip latency percentiles of small messages on a channel.
+
+    Usage: meshlink-bench [-n nodes] [-d delay_ms] [-l loss_percent] [-m mtu] [-s bytes] [-p pings] [-v]
+
+    Note that every node uses several file descriptors, so the number of nodes is limited by RLIMIT_NOFILE.
+*/
+
+#define _GNU_SOURCE
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+#define BASE_ADDRESS 0x0a000001 // 10.0.0.1
+#define PORT 655
+
+static int nnodes = 10;
+static int delay_ms = 0;
+static double loss = 0;
+static size_t mtu = 1500;
+static size_t bulk_size = 10000000;
+static int npings = 1000;
+
+static meshlink_handle_t **meshes;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Mapping between meshes and their virtual addresses
+
+static void index_to_address(int index, struct sockaddr_in *sin) {
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(BASE_ADDRESS + index);
+	sin->sin_port = htons(PORT);
+}
+
+static int address_to_index(const struct sockaddr *sa) {
+	if(sa->sa_family != AF_INET) {
+		return -1;
+	}
+
+	uint32_t index = ntohl(((const struct sockaddr_in *)sa)->sin_addr.s_addr) - BASE_ADDRESS;
+	return index < (uint32_t)nnodes ? (int)index : -1;
+}
+
+static int mesh_index(meshlink_handle_t *mesh) {
+	return (int)(intptr_t)mesh->priv;
+}
+
+// Random packet loss
+
+static __thread uint64_t rng_state;
+
+static double random_uniform(void) {
+	if(!rng_state) {
+		rng_state = (uint64_t)(uintptr_t)&rng_state ^ 0x9e3779b97f4a7c15ULL;
+	}
+
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (rng_state >> 11) * 0x1.0p-53;
+}
+
+// Delay line
+
+struct delayed_packet {
+	struct delayed_packet *next;
+	struct timespec deliver_at;
+	meshlink_handle_t *to;
+	struct sockaddr_in from;
+	size_t len;
+	uint8_t data[];
+};
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct delayed_packet *head;
+	struct delayed_packet *tail;
+	bool stop;
+} delay_line = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void *delay_thread(void *arg) {
+	(void)arg;
+
+	assert(pthread_mutex_lock(&delay_line.mutex) == 0);
+
+	while(!delay_line.stop) {
+		struct delayed_packet *p = delay_line.head;
+
+		if(!p) {
+			pthread_cond_wait(&delay_line.cond, &delay_line.mutex);
+			continue;
+		}
+
+		if(pthread_cond_timedwait(&delay_line.cond, &delay_line.mutex, &p->deliver_at) == 0) {
+			continue;
+		}
+
+		// The delay is fixed, so packets are always delivered in FIFO order.
+
+		delay_line.head = p->next;
+
+		if(!delay_line.head) {
+			delay_line.tail = NULL;
+		}
+
+		pthread_mutex_unlock(&delay_line.mutex);
+		devtool_transport_receive(p->to, (struct sockaddr *)&p->from, p->data, p->len);
+		free(p);
+		assert(pthread_mutex_lock(&delay_line.mutex) == 0);
+	}
+
+	while(delay_line.head) {
+		struct delayed_packet *p = delay_line.head;
+		delay_line.head = p->next;
+		free(p);
+	}
+
+	pthread_mutex_unlock(&delay_line.mutex);
+	return NULL;
+}
+
+static void delay_packet(meshlink_handle_t *to, const struct sockaddr_in *from, const void *data, size_t len) {
+	struct delayed_packet *p = malloc(sizeof(*p) + len);
+	assert(p);
+	p->next = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &p->deliver_at);
+	p->deliver_at.tv_nsec += delay_ms * 1000000L;
+	p->deliver_at.tv_sec += p->deliver_at.tv_nsec / 1000000000L;
+	p->deliver_at.tv_nsec %= 1000000000L;
+	p->to = to;
+	p->from = *from;
+	p->len = len;
+	memcpy(p->data, data, len);
+
+	assert(pthread_mutex_lock(&delay_line.mutex) == 0);
+
+	if(delay_line.tail) {
+		delay_line.tail->next = p;
+	} else {
+		delay_line.head = p;
+		pthread_cond_signal(&delay_line.cond);
+	}
+
+	delay_line.tail = p;
+	pthread_mutex_unlock(&delay_line.mutex);
+}
+
+// Virtual transport
+
+static bool transport_send(meshlink_handle_t *mesh, const struct sockaddr *to, const void *data, size_t len) {
+	int index = address_to_index(to);
+
+	if(index < 0 || len > mtu || (loss && random_uniform() * 100 < loss)) {
+		// Silently drop the packet, like a real network would.
+		return true;
+	}
+
+	struct sockaddr_in from;
+	index_to_address(mesh_index(mesh), &from);
+
+	if(delay_ms) {
+		delay_packet(meshes[index], &from, data, len);
+		return true;
+	}
+
+	return devtool_transport_receive(meshes[index], (struct sockaddr *)&from, data, len);
+}
+
+static int transport_connect(meshlink_handle_t *mesh, const struct sockaddr *to) {
+	int index = address_to_index(to);
+
+	if(index < 0) {
+		return -1;
+	}
+
+	int fds[2];
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		return -1;
+	}
+
+	struct sockaddr_in from;
+	index_to_address(mesh_index(mesh), &from);
+
+	if(!devtool_transport_accept(meshes[index], fds[1], (struct sockaddr *)&from)) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	return fds[0];
+}
+
+static const devtool_transport_t transport = {
+	.send = transport_send,
+	.connect = transport_connect,
+};
+
+// Convergence and handshake tracking
+
+static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sync_flag converged_flag;
+static long reachable_count;
+static long handshake_count;
+
+static void node_status_cb(meshlink_handle_t *mesh, meshlink_node_t *node, bool reachable) {
+	if(node == meshlink_get_self(mesh)) {
+		return;
+	}
+
+	assert(pthread_mutex_lock(&count_mutex) == 0);
+	reachable_count += reachable ? 1 : -1;
+
+	if(reachable_count == (long)nnodes * (nnodes - 1)) {
+		set_sync_flag(&converged_flag, true);
+	}
+
+	pthread_mutex_unlock(&count_mutex);
+}
+
+static void meta_status_cb(meshlink_handle_t *mesh, meshlink_node_t *node, bool reachable) {
+	(void)mesh;
+	(void)node;
+
+	if(reachable) {
+		assert(pthread_mutex_lock(&count_mutex) == 0);
+		handshake_count++;
+		pthread_mutex_unlock(&count_mutex);
+	}
+}
+
+// Channels
+
+enum {
+	PORT_BULK = 1,
+	PORT_ECHO = 2,
+};
+
+static struct sync_flag bulk_flag;
+static size_t bulk_received;
+
+static struct sync_flag ping_flag;
+static double ping_sent_at;
+static double *rtts;
+static int rtt_count;
+
+static void bulk_receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+	(void)channel;
+	(void)data;
+
+	bulk_received += len;
+
+	if(bulk_received == bulk_size) {
+		set_sync_flag(&bulk_flag, true);
+	}
+}
+
+static void echo_receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	if(len) {
+		assert(meshlink_channel_send(mesh, channel, data, len) == (ssize_t)len);
+	}
+}
+
+static void ping_receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)data;
+
+	if(!len) {
+		return;
+	}
+
+	double t = now();
+	rtts[rtt_count++] = t - ping_sent_at;
+
+	if(rtt_count == npings) {
+		set_sync_flag(&ping_flag, true);
+		return;
+	}
+
+	ping_sent_at = t;
+	assert(meshlink_channel_send(mesh, channel, &rtt_count, sizeof(rtt_count)) == sizeof(rtt_count));
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)data;
+	(void)len;
+
+	switch(port) {
+	case PORT_BULK:
+		meshlink_set_channel_receive_cb(mesh, channel, bulk_receive_cb);
+		return true;
+
+	case PORT_ECHO:
+		meshlink_set_channel_receive_cb(mesh, channel, echo_receive_cb);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static int compare_double(const void *va, const void *vb) {
+	double a = *(const double *)va;
+	double b = *(const double *)vb;
+	return a < b ? -1 : a > b;
+}
+
+static double percentile(const double *sorted, int count, double p) {
+	int i = (int)(p / 100 * (count - 1) + 0.5);
+	return sorted[i];
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-n nodes] [-d delay_ms] [-l loss_percent] [-m mtu] [-s bytes] [-p pings] [-v]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+	meshlink_log_level_t log_level = MESHLINK_CRITICAL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:d:l:m:s:p:v")) != -1) {
+		switch(opt) {
+		case 'n':
+			nnodes = atoi(optarg);
+			break;
+
+		case 'd':
+			delay_ms = atoi(optarg);
+			break;
+
+		case 'l':
+			loss = atof(optarg);
+			break;
+
+		case 'm':
+			mtu = atoi(optarg);
+			break;
+
+		case 's':
+			bulk_size = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'p':
+			npings = atoi(optarg);
+			break;
+
+		case 'v':
+			log_level = MESHLINK_DEBUG;
+			break;
+
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(nnodes < 2 || nnodes > 1000 || delay_ms < 0 || loss < 0 || loss >= 100 || npings < 1 || !bulk_size) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Every node uses several file descriptors, so raise the limit as far as we are allowed.
+
+	struct rlimit rl = {RLIM_INFINITY, RLIM_INFINITY};
+
+	if(!getrlimit(RLIMIT_NOFILE, &rl)) {
+		rl.rlim_cur = rl.rlim_max;
+
+		if(setrlimit(RLIMIT_NOFILE, &rl)) {
+			getrlimit(RLIMIT_NOFILE, &rl);
+		}
+	}
+
+	init_sync_flag(&converged_flag);
+	init_sync_flag(&bulk_flag);
+	init_sync_flag(&ping_flag);
+
+	pthread_condattr_t condattr;
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&delay_line.cond, &condattr);
+	assert(pthread_create(&delay_line.thread, NULL, delay_thread, NULL) == 0);
+
+	meshlink_set_log_cb(NULL, log_level, log_cb);
+
+	// Open all nodes and link each to its parent in a binary tree.
+
+	meshes = calloc(nnodes, sizeof(*meshes));
+	assert(meshes);
+
+	int first_fd = -1;
+
+	for(int i = 0; i < nnodes; i++) {
+		// Each node needs some descriptors for itself, and two per meta-connection, of which it makes a few.
+		// Stop before we would run out of them.
+		int fd = dup(0);
+		close(fd);
+
+		if(i == 0) {
+			first_fd = fd;
+		} else if(rl.rlim_cur != RLIM_INFINITY) {
+			int per_node = (fd - first_fd) / i + 8;
+
+			if((rlim_t)first_fd + (rlim_t)per_node * nnodes >= rl.rlim_cur) {
+				fprintf(stderr, "Cannot run %d nodes with a limit of %lu file descriptors, try -n %lu\n", nnodes, (unsigned long)rl.rlim_cur, (unsigned long)((rl.rlim_cur - first_fd) / per_node));
+				return 1;
+			}
+		}
+
+		char name[16];
+		char address[INET_ADDRSTRLEN];
+		struct sockaddr_in sin;
+		index_to_address(i, &sin);
+		snprintf(name, sizeof(name), "node%d", i);
+		inet_ntop(AF_INET, &sin.sin_addr, address, sizeof(address));
+
+		meshes[i] = meshlink_open_ephemeral(name, "bench", DEV_CLASS_STATIONARY);
+		assert(meshes[i]);
+		meshes[i]->priv = (void *)(intptr_t)i;
+
+		meshlink_set_log_cb(meshes[i], log_level, log_cb);
+		meshlink_enable_discovery(meshes[i], false);
+		assert(meshlink_set_canonical_address(meshes[i], meshlink_get_self(meshes[i]), address, "655"));
+		devtool_set_transport(meshes[i], &transport);
+		devtool_set_meta_status_cb(meshes[i], meta_status_cb);
+		meshlink_set_node_status_cb(meshes[i], node_status_cb);
+		meshlink_set_channel_accept_cb(meshes[i], accept_cb);
+
+		if(i) {
+			int parent = (i - 1) / 2;
+			char *data = meshlink_export(meshes[parent]);
+			assert(data);
+			assert(meshlink_import(meshes[i], data));
+			free(data);
+
+			data = meshlink_export(meshes[i]);
+			assert(data);
+			assert(meshlink_import(meshes[parent], data));
+			free(data);
+		}
+	}
+
+	// Start all nodes and wait until every node can reach every other node.
+
+	double start = now();
+
+	for(int i = 0; i < nnodes; i++) {
+		assert(meshlink_start(meshes[i]));
+	}
+
+	if(!wait_sync_flag(&converged_flag, 60 + nnodes)) {
+		fprintf(stderr, "Nodes did not converge, %ld of %ld reachable\n", reachable_count, (long)nnodes * (nnodes - 1));
+		return 1;
+	}
+
+	double converged = now() - start;
+
+	assert(pthread_mutex_lock(&count_mutex) == 0);
+	long handshakes = handshake_count;
+	pthread_mutex_unlock(&count_mutex);
+
+	printf("nodes: %d\n", nnodes);
+	printf("convergence: %.3f s\n", converged);
+	printf("handshakes: %ld (%.1f/s)\n", handshakes, handshakes / converged);
+
+	// Measure the throughput of a channel from the first to the last node.
+
+	meshlink_node_t *peer = meshlink_get_node(meshes[0], meshes[nnodes - 1]->name);
+	assert(peer);
+
+	char *buf = calloc(1, bulk_size);
+	assert(buf);
+
+	meshlink_channel_t *channel = meshlink_channel_open(meshes[0], peer, PORT_BULK, NULL, NULL, 0);
+	assert(channel);
+
+	start = now();
+	assert(meshlink_channel_aio_send(meshes[0], channel, buf, bulk_size, NULL, NULL));
+
+	if(!wait_sync_flag(&bulk_flag, 600)) {
+		fprintf(stderr, "Bulk transfer did not finish, %zu of %zu bytes received\n", bulk_received, bulk_size);
+		return 1;
+	}
+
+	double elapsed = now() - start;
+	printf("throughput: %.3f MB/s (%zu bytes in %.3f s)\n", bulk_size / elapsed / 1e6, bulk_size, elapsed);
+
+	meshlink_channel_stats_t stats;
+
+	if(meshlink_channel_get_stats(meshes[0], channel, &stats, sizeof(stats))) {
+		printf("channel: cwnd %u, srtt %u us, rto %u us, %llu retransmits, %llu fast retransmits, %llu bytes retransmitted\n",
+		       stats.cwnd, stats.srtt, stats.rto,
+		       (unsigned long long)stats.retransmits, (unsigned long long)stats.fast_retransmits, (unsigned long long)stats.bytes_retransmitted);
+	}
+
+	meshlink_channel_close(meshes[0], channel);
+
+	// Measure the round-trip latency of small messages on a channel.
+
+	rtts = calloc(npings, sizeof(*rtts));
+	assert(rtts);
+
+	channel = meshlink_channel_open(meshes[0], peer, PORT_ECHO, ping_receive_cb, NULL, 0);
+	assert(channel);
+
+	ping_sent_at = now();
+	assert(meshlink_channel_send(meshes[0], channel, &rtt_count, sizeof(rtt_count)) == sizeof(rtt_count));
+
+	if(!wait_sync_flag(&ping_flag, 600)) {
+		fprintf(stderr, "Ping-pong did not finish, %d of %d round trips\n", rtt_count, npings);
+		return 1;
+	}
+
+	qsort(rtts, npings, sizeof(*rtts), compare_double);
+	printf("latency: p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+	       percentile(rtts, npings, 50) * 1e6,
+	       percentile(rtts, npings, 90) * 1e6,
+	       percentile(rtts, npings, 99) * 1e6,
+	       rtts[npings - 1] * 1e6);
+
+	meshlink_channel_close(meshes[0], channel);
+
+	// Clean up.
+
+	for(int i = 0; i < nnodes; i++) {
+		meshlink_stop(meshes[i]);
+	}
+
+	assert(pthread_mutex_lock(&delay_line.mutex) == 0);
+	delay_line.stop = true;
+	pthread_cond_signal(&delay_line.cond);
+	pthread_mutex_unlock(&delay_line.mutex);
+	pthread_join(delay_line.thread, NULL);
+
+	for(int i = 0; i < nnodes; i++) {
+		meshlink_close(meshes[i]);
+	}
+
+	free(rtts);
+	free(buf);
+	free(meshes);
+}
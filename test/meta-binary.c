@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+static struct sync_flag received;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	(void)mesh;
+	(void)source;
+
+	if(len == 5 && !memcmp(data, "Hello", 5)) {
+		set_sync_flag(&received, true);
+	}
+}
+
+static size_t count_edges(meshlink_handle_t *mesh) {
+	size_t nedges = 0;
+	devtool_edge_t *edges = devtool_get_all_edges(mesh, NULL, &nedges);
+	free(edges);
+	return nedges;
+}
+
+int main(void) {
+	init_sync_flag(&received);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Create three instances, the second one only speaks the text protocol.
+
+	const char *name[3] = {"foo", "bar", "baz"};
+	meshlink_handle_t *mesh[3];
+	char *data[3];
+
+	for(int j = 0; j < 3; j++) {
+		char *path = NULL;
+		assert(asprintf(&path, "meta_binary_conf.%d", j) != -1 && path);
+
+		assert(meshlink_destroy(path));
+		mesh[j] = meshlink_open(path, name[j], "meta-binary", DEV_CLASS_BACKBONE);
+		assert(mesh[j]);
+		free(path);
+
+		meshlink_enable_discovery(mesh[j], false);
+		assert(meshlink_set_canonical_address(mesh[j], meshlink_get_self(mesh[j]), "localhost", NULL));
+
+		data[j] = meshlink_export(mesh[j]);
+		assert(data[j]);
+	}
+
+	devtool_set_meta_text_only(mesh[1], true);
+
+	// The first node knows the two other nodes, and forwards edges between the binary and text peers.
+
+	for(int j = 1; j < 3; j++) {
+		assert(meshlink_import(mesh[j], data[0]));
+		assert(meshlink_import(mesh[0], data[j]));
+	}
+
+	for(int j = 0; j < 3; j++) {
+		free(data[j]);
+		assert(meshlink_start(mesh[j]));
+	}
+
+	// All nodes should learn the full graph.
+
+	assert_after(meshlink_get_node(mesh[1], name[2]) && meshlink_get_node(mesh[2], name[1]), 15);
+
+	for(int j = 0; j < 3; j++) {
+		assert_after(count_edges(mesh[j]) == 3, 15);
+	}
+
+	// Send a packet between the text and binary nodes.
+
+	meshlink_set_receive_cb(mesh[1], receive_cb);
+
+	for(int j = 0; j < 15; j++) {
+		assert(meshlink_send(mesh[2], meshlink_get_node(mesh[2], name[1]), "Hello", 5));
+
+		if(wait_sync_flag(&received, 1)) {
+			break;
+		}
+	}
+
+	assert(wait_sync_flag(&received, 15));
+
+	// Edges should also be removed again when a node leaves.
+
+	meshlink_stop(mesh[2]);
+
+	for(int j = 0; j < 2; j++) {
+		assert_after(count_edges(mesh[j]) == 1, 15);
+	}
+
+	// Clean up.
+
+	for(int j = 0; j < 3; j++) {
+		meshlink_close(mesh[j]);
+	}
+}
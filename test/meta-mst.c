@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+#define NMESHES 4
+
+static size_t count_edges(meshlink_handle_t *mesh) {
+	size_t nedges = 0;
+	devtool_edge_t *edges = devtool_get_all_edges(mesh, NULL, &nedges);
+	free(edges);
+	return nedges;
+}
+
+// Count the nodes a mesh can reach, and the connections it floods requests over once the topology has settled.
+static void count_metrics(meshlink_handle_t *mesh, size_t *reachable, size_t *mst) {
+	devtool_metrics_t *metrics = devtool_get_metrics(mesh);
+	assert(metrics);
+
+	*reachable = 0;
+	*mst = 0;
+
+	for(size_t j = 0; j < metrics->nnodes; j++) {
+		*reachable += metrics->nodes[j].reachable;
+	}
+
+	for(size_t j = 0; j < metrics->nconnections; j++) {
+		*mst += metrics->connections[j].active && metrics->connections[j].mst;
+	}
+
+	free(metrics);
+}
+
+// Check that all running meshes can reach each other and agree on the topology.
+static bool all_converged(meshlink_handle_t **mesh, int nmeshes) {
+	size_t nedges = count_edges(mesh[0]);
+
+	for(int j = 0; j < nmeshes; j++) {
+		size_t reachable, mst;
+		count_metrics(mesh[j], &reachable, &mst);
+
+		if(reachable != (size_t)nmeshes || count_edges(mesh[j]) != nedges) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Count the connections of all running meshes that are part of the spanning tree, or 0 if a node is not part of it.
+static size_t count_mst(meshlink_handle_t **mesh, int nmeshes) {
+	size_t total = 0;
+
+	for(int j = 0; j < nmeshes; j++) {
+		size_t reachable, mst;
+		count_metrics(mesh[j], &reachable, &mst);
+
+		if(!mst) {
+			return 0;
+		}
+
+		total += mst;
+	}
+
+	return total;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Create a number of backbone nodes that all know each other, so they form a mesh with cycles.
+
+	meshlink_handle_t *mesh[NMESHES];
+	char *data[NMESHES];
+
+	for(int j = 0; j < NMESHES; j++) {
+		char *path = NULL;
+		char *name = NULL;
+		assert(asprintf(&path, "meta_mst_conf.%d", j) != -1 && path);
+		assert(asprintf(&name, "mst%d", j) != -1 && name);
+
+		assert(meshlink_destroy(path));
+		mesh[j] = meshlink_open(path, name, "meta-mst", DEV_CLASS_BACKBONE);
+		assert(mesh[j]);
+		free(path);
+		free(name);
+
+		meshlink_enable_discovery(mesh[j], false);
+		assert(meshlink_set_canonical_address(mesh[j], meshlink_get_self(mesh[j]), "localhost", NULL));
+
+		data[j] = meshlink_export(mesh[j]);
+		assert(data[j]);
+	}
+
+	for(int j = 0; j < NMESHES; j++) {
+		for(int k = 0; k < NMESHES; k++) {
+			if(j != k) {
+				assert(meshlink_import(mesh[j], data[k]));
+			}
+		}
+	}
+
+	for(int j = 0; j < NMESHES; j++) {
+		free(data[j]);
+		assert(meshlink_start(mesh[j]));
+	}
+
+	assert_after(all_converged(mesh, NMESHES), 15);
+	assert(count_edges(mesh[0]) > NMESHES - 1);
+
+	// Once the topology has settled, every node should only flood over the edges of the same spanning tree.
+	// Each edge of the tree is counted once at both ends.
+
+	assert_after(count_mst(mesh, NMESHES) == 2 * (NMESHES - 1), 30);
+
+	// Changes to the topology should still reach every node.
+
+	meshlink_stop(mesh[NMESHES - 1]);
+	assert_after(all_converged(mesh, NMESHES - 1), 15);
+
+	assert(meshlink_start(mesh[NMESHES - 1]));
+	assert_after(all_converged(mesh, NMESHES), 15);
+
+	assert_after(count_mst(mesh, NMESHES) == 2 * (NMESHES - 1), 30);
+
+	// Clean up.
+
+	for(int j = 0; j < NMESHES; j++) {
+		meshlink_close(mesh[j]);
+	}
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+static struct sync_flag received;
+static int forwarded;
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_node_t *source, const void *data, size_t len) {
+	(void)mesh;
+	(void)source;
+
+	if(len == 5 && !memcmp(data, "Hello", 5)) {
+		set_sync_flag(&received, true);
+	}
+}
+
+// Count the SPTPS records the relay forwards in binary form.
+static void relay_log_cb(meshlink_handle_t *mesh, meshlink_log_level_t level, const char *text) {
+	if(strstr(text, "Forwarding RELAY_SPTPS")) {
+		__atomic_add_fetch(&forwarded, 1, __ATOMIC_RELAXED);
+	}
+
+	log_cb(mesh, level, text);
+}
+
+// Get the number of bytes of SPTPS data a mesh received from a node via meta-connections.
+static uint64_t relayed_from(meshlink_handle_t *mesh, const char *name) {
+	uint64_t relayed = 0;
+	devtool_metrics_t *metrics = devtool_get_metrics(mesh);
+	assert(metrics);
+
+	for(size_t j = 0; j < metrics->nnodes; j++) {
+		if(!strcmp(metrics->nodes[j].node->name, name)) {
+			relayed = metrics->nodes[j].in_relayed;
+		}
+	}
+
+	free(metrics);
+	return relayed;
+}
+
+int main(void) {
+	init_sync_flag(&received);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Create three instances, the first one relays between the other two.
+	// The other two only want a single meta-connection, so they will not connect to each other directly.
+
+	const char *name[3] = {"foo", "bar", "baz"};
+	meshlink_handle_t *mesh[3];
+	char *data[3];
+
+	for(int j = 0; j < 3; j++) {
+		char *path = NULL;
+		assert(asprintf(&path, "meta_relay_conf.%d", j) != -1 && path);
+
+		assert(meshlink_destroy(path));
+		mesh[j] = meshlink_open(path, name[j], "meta-relay", j ? DEV_CLASS_UNKNOWN : DEV_CLASS_BACKBONE);
+		assert(mesh[j]);
+		free(path);
+
+		meshlink_enable_discovery(mesh[j], false);
+		assert(meshlink_set_canonical_address(mesh[j], meshlink_get_self(mesh[j]), "localhost", NULL));
+
+		data[j] = meshlink_export(mesh[j]);
+		assert(data[j]);
+	}
+
+	meshlink_set_log_cb(mesh[0], MESHLINK_DEBUG, relay_log_cb);
+
+	for(int j = 1; j < 3; j++) {
+		assert(meshlink_import(mesh[j], data[0]));
+		assert(meshlink_import(mesh[0], data[j]));
+	}
+
+	for(int j = 0; j < 3; j++) {
+		free(data[j]);
+		assert(meshlink_start(mesh[j]));
+	}
+
+	assert_after(meshlink_get_node(mesh[1], name[2]) && meshlink_get_node(mesh[2], name[1]), 15);
+
+	// Send a packet between the outer nodes, so they set up an SPTPS session.
+
+	meshlink_set_receive_cb(mesh[1], receive_cb);
+
+	for(int j = 0; j < 15; j++) {
+		assert(meshlink_send(mesh[2], meshlink_get_node(mesh[2], name[1]), "Hello", 5));
+
+		if(wait_sync_flag(&received, 1)) {
+			break;
+		}
+	}
+
+	assert(wait_sync_flag(&received, 15));
+
+	// Handshake records are always relayed over the meta-connections, the relay should forward them in binary form.
+
+	uint64_t relayed = relayed_from(mesh[1], name[2]);
+	devtool_force_sptps_renewal(mesh[2], meshlink_get_node(mesh[2], name[1]));
+
+	assert_after(__atomic_load_n(&forwarded, __ATOMIC_RELAXED) > 0, 15);
+	assert_after(relayed_from(mesh[1], name[2]) > relayed, 15);
+
+	// The renewed session should still work.
+
+	reset_sync_flag(&received);
+
+	for(int j = 0; j < 15; j++) {
+		assert(meshlink_send(mesh[2], meshlink_get_node(mesh[2], name[1]), "Hello", 5));
+
+		if(wait_sync_flag(&received, 1)) {
+			break;
+		}
+	}
+
+	assert(wait_sync_flag(&received, 15));
+
+	// Clean up.
+
+	for(int j = 0; j < 3; j++) {
+		meshlink_close(mesh[j]);
+	}
+}
@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+// Edge weights of the device classes used below, see dev_class_traits in meshlink.c
+#define BACKBONE_WEIGHT 1
+#define STATIONARY_WEIGHT 3
+
+static int connection_rtt(meshlink_handle_t *mesh) {
+	int rtt = 0;
+	devtool_metrics_t *metrics = devtool_get_metrics(mesh);
+	assert(metrics);
+
+	if(metrics->nconnections == 1 && metrics->connections[0].active) {
+		rtt = metrics->connections[0].rtt;
+	}
+
+	free(metrics);
+	return rtt;
+}
+
+// Check that the weight of the edge between the two nodes, as seen by mesh, includes the RTT measured by its owner.
+static bool weight_includes_rtt(meshlink_handle_t *mesh, meshlink_handle_t *other) {
+	size_t nedges = 0;
+	devtool_edge_t *edges = devtool_get_all_edges(mesh, NULL, &nedges);
+	bool result = nedges == 1;
+
+	if(result) {
+		// The base weight depends on the device class of the node the edge points to
+		bool mine = edges[0].from == meshlink_get_self(mesh);
+		int base = strcmp(edges[0].to->name, "rtt1") ? STATIONARY_WEIGHT : BACKBONE_WEIGHT;
+		int rtt = connection_rtt(mine ? mesh : other);
+		result = rtt > 0 && edges[0].weight > base;
+	}
+
+	free(edges);
+	return result;
+}
+
+// Check that the weights of all edges mesh knows about are just those of the device classes.
+static bool weights_are_base(meshlink_handle_t *mesh) {
+	size_t nedges = 0;
+	devtool_edge_t *edges = devtool_get_all_edges(mesh, NULL, &nedges);
+	bool result = nedges > 0;
+
+	for(size_t j = 0; j < nedges; j++) {
+		int base = strcmp(edges[j].to->name, "rtt1") ? STATIONARY_WEIGHT : BACKBONE_WEIGHT;
+
+		if(edges[j].weight != base) {
+			result = false;
+		}
+	}
+
+	free(edges);
+	return result;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open two new meshlink instances with different device classes, so the base weights of their edges differ.
+
+	assert(meshlink_destroy("meta_rtt_conf.1"));
+	assert(meshlink_destroy("meta_rtt_conf.2"));
+	meshlink_handle_t *mesh1 = meshlink_open("meta_rtt_conf.1", "rtt1", "meta-rtt", DEV_CLASS_BACKBONE);
+	meshlink_handle_t *mesh2 = meshlink_open("meta_rtt_conf.2", "rtt2", "meta-rtt", DEV_CLASS_STATIONARY);
+	assert(mesh1);
+	assert(mesh2);
+
+	meshlink_enable_discovery(mesh1, false);
+	meshlink_enable_discovery(mesh2, false);
+	assert(meshlink_set_canonical_address(mesh1, meshlink_get_self(mesh1), "localhost", NULL));
+
+	char *data = meshlink_export(mesh1);
+	assert(data);
+	assert(meshlink_import(mesh2, data));
+	free(data);
+
+	data = meshlink_export(mesh2);
+	assert(data);
+	assert(meshlink_import(mesh1, data));
+	free(data);
+
+	// Start both instances, the RTT should be measured as soon as the connection is established.
+
+	assert(meshlink_start(mesh1));
+	assert(meshlink_start(mesh2));
+
+	assert_after(connection_rtt(mesh1) > 0 && connection_rtt(mesh2) > 0, 15);
+
+	// Both nodes should learn the weights the other advertised for its edge.
+
+	assert_after(weight_includes_rtt(mesh1, mesh2) && weight_includes_rtt(mesh2, mesh1), 15);
+
+	// A node that behaves like an older version does not route on edge weights, so the RTT should not be added to them.
+
+	meshlink_stop(mesh2);
+	devtool_set_meta_text_only(mesh2, true);
+	assert(meshlink_start(mesh2));
+
+	assert_after(connection_rtt(mesh1) > 0 && connection_rtt(mesh2) > 0, 15);
+	sleep(1);
+	assert(weights_are_base(mesh1));
+	assert(weights_are_base(mesh2));
+
+	// Clean up.
+
+	meshlink_close(mesh2);
+	meshlink_close(mesh1);
+}
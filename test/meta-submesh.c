@@ -0,0 +1,105 @@
+#define _GNU_SOURCE
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+#define NMESHES 4
+
+static const char *names[NMESHES] = {"core", "a1", "a2", "b1"};
+static const char *submeshes[NMESHES] = {NULL, "a", "a", "b"};
+
+static size_t count_nodes(meshlink_handle_t *mesh) {
+	size_t nnodes = 0;
+	meshlink_node_t **nodes = meshlink_get_all_nodes(mesh, NULL, &nnodes);
+	free(nodes);
+	return nnodes;
+}
+
+static size_t count_reachable(meshlink_handle_t *mesh) {
+	size_t reachable = 0;
+	devtool_metrics_t *metrics = devtool_get_metrics(mesh);
+	assert(metrics);
+
+	for(size_t j = 0; j < metrics->nnodes; j++) {
+		reachable += metrics->nodes[j].reachable;
+	}
+
+	free(metrics);
+	return reachable;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Open a core node, two nodes in submesh a and one node in submesh b.
+
+	meshlink_handle_t *mesh[NMESHES];
+
+	for(int j = 0; j < NMESHES; j++) {
+		char *path = NULL;
+		assert(asprintf(&path, "meta_submesh_conf.%d", j) != -1 && path);
+		assert(meshlink_destroy(path));
+		mesh[j] = meshlink_open(path, names[j], "meta-submesh", DEV_CLASS_BACKBONE);
+		assert(mesh[j]);
+		free(path);
+
+		meshlink_enable_discovery(mesh[j], false);
+	}
+
+	assert(meshlink_set_canonical_address(mesh[0], meshlink_get_self(mesh[0]), "localhost", NULL));
+	assert(meshlink_start(mesh[0]));
+
+	// Have the other nodes join the core node in their submeshes.
+
+	for(int j = 1; j < NMESHES; j++) {
+		meshlink_submesh_t *s = meshlink_get_submesh(mesh[0], submeshes[j]);
+
+		if(!s) {
+			s = meshlink_submesh_open(mesh[0], submeshes[j]);
+			assert(s);
+		}
+
+		char *url = meshlink_invite(mesh[0], s, names[j]);
+		assert(url);
+		assert(meshlink_join(mesh[j], url));
+		free(url);
+
+		assert(meshlink_start(mesh[j]));
+	}
+
+	// The core node sees everyone, the nodes in a submesh only see the core node and the other nodes in their own submesh.
+
+	assert_after(count_reachable(mesh[0]) == 4 && count_reachable(mesh[1]) == 3 && count_reachable(mesh[2]) == 3 && count_reachable(mesh[3]) == 2, 15);
+
+	assert(count_nodes(mesh[1]) == 3);
+	assert(count_nodes(mesh[2]) == 3);
+	assert(count_nodes(mesh[3]) == 2);
+	assert(!meshlink_get_node(mesh[3], "a1"));
+	assert(!meshlink_get_node(mesh[1], "b1"));
+
+	// Changes in a submesh should still reach the other nodes in that submesh.
+
+	meshlink_stop(mesh[2]);
+	assert_after(count_reachable(mesh[0]) == 3 && count_reachable(mesh[1]) == 2, 15);
+
+	assert(meshlink_start(mesh[2]));
+	assert_after(count_reachable(mesh[0]) == 4 && count_reachable(mesh[1]) == 3 && count_reachable(mesh[2]) == 3, 15);
+	assert(count_nodes(mesh[3]) == 2);
+
+	// Clean up.
+
+	for(int j = NMESHES - 1; j >= 0; j--) {
+		meshlink_close(mesh[j]);
+	}
+}
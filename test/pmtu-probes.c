@@ -0,0 +1,150 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+/* Restart a pair of nodes several times, and check that UDP works in both directions right after the key exchange.
+   The node that completes the key exchange first sends its first MTU probes before the other node can decrypt them.
+   Once it receives probes from the other node, it should send new ones right away instead of waiting for its timer. */
+
+#define ITERATIONS 10
+
+static meshlink_handle_t *meshes[2];
+
+static void index_to_address(int index, struct sockaddr_in *sin) {
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x0a000001 + index);
+	sin->sin_port = htons(655);
+}
+
+static int address_to_index(const struct sockaddr *sa) {
+	if(sa->sa_family != AF_INET) {
+		return -1;
+	}
+
+	uint32_t index = ntohl(((const struct sockaddr_in *)sa)->sin_addr.s_addr) - 0x0a000001;
+	return index < 2 ? (int)index : -1;
+}
+
+static bool transport_send(meshlink_handle_t *mesh, const struct sockaddr *to, const void *data, size_t len) {
+	int index = address_to_index(to);
+
+	if(index < 0) {
+		return true;
+	}
+
+	struct sockaddr_in from;
+	index_to_address(mesh == meshes[1], &from);
+	return devtool_transport_receive(meshes[index], (struct sockaddr *)&from, data, len);
+}
+
+static int transport_connect(meshlink_handle_t *mesh, const struct sockaddr *to) {
+	int index = address_to_index(to);
+	int fds[2];
+
+	if(index < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		return -1;
+	}
+
+	struct sockaddr_in from;
+	index_to_address(mesh == meshes[1], &from);
+
+	if(!devtool_transport_accept(meshes[index], fds[1], (struct sockaddr *)&from)) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	return fds[0];
+}
+
+static const devtool_transport_t transport = {
+	.send = transport_send,
+	.connect = transport_connect,
+};
+
+static int get_udp_status(meshlink_handle_t *mesh, const char *name) {
+	devtool_node_status_t status;
+	devtool_get_node_status(mesh, meshlink_get_node(mesh, name), &status);
+	return status.udp_status;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_WARNING, log_cb);
+
+	// Open two instances that talk via a virtual transport.
+
+	static const char *names[2] = {"a", "b"};
+
+	for(int j = 0; j < 2; j++) {
+		struct sockaddr_in sin;
+		char address[INET_ADDRSTRLEN];
+		index_to_address(j, &sin);
+		inet_ntop(AF_INET, &sin.sin_addr, address, sizeof(address));
+
+		meshes[j] = meshlink_open_ephemeral(names[j], "pmtu_probes", DEV_CLASS_BACKBONE);
+		assert(meshes[j]);
+		meshlink_enable_discovery(meshes[j], false);
+		assert(meshlink_set_canonical_address(meshes[j], meshlink_get_self(meshes[j]), address, "655"));
+		devtool_set_transport(meshes[j], &transport);
+	}
+
+	char *data = meshlink_export(meshes[0]);
+	assert(data);
+	assert(meshlink_import(meshes[1], data));
+	free(data);
+
+	data = meshlink_export(meshes[1]);
+	assert(data);
+	assert(meshlink_import(meshes[0], data));
+	free(data);
+
+	for(int j = 0; j < ITERATIONS; j++) {
+		assert(meshlink_start(meshes[0]));
+		assert(meshlink_start(meshes[1]));
+
+		// Wait until both sides have a valid key and started probing.
+
+		double deadline = now() + 15;
+
+		while(get_udp_status(meshes[0], "b") < DEVTOOL_UDP_TRYING || get_udp_status(meshes[1], "a") < DEVTOOL_UDP_TRYING) {
+			assert(now() < deadline);
+			usleep(1000);
+		}
+
+		// UDP should work in both directions well before the next round of probes is due.
+
+		deadline = now() + 0.5;
+
+		while(get_udp_status(meshes[0], "b") != DEVTOOL_UDP_WORKING || get_udp_status(meshes[1], "a") != DEVTOOL_UDP_WORKING) {
+			assert(now() < deadline);
+			usleep(1000);
+		}
+
+		meshlink_stop(meshes[0]);
+		meshlink_stop(meshes[1]);
+	}
+
+	meshlink_close(meshes[0]);
+	meshlink_close(meshes[1]);
+}
@@ -0,0 +1,215 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "meshlink.h"
+#include "utils.h"
+
+#define TOTAL_SIZE 200000
+
+static struct sync_flag done_flag;
+static size_t received;
+static bool corrupt;
+static meshlink_handle_t *instances[4];
+static pthread_t loop_thread[4];
+static bool wrong_thread;
+
+static pthread_t *get_loop_thread(meshlink_handle_t *handle) {
+	for(int j = 0; j < 4; j++) {
+		if(instances[j] == handle) {
+			return &loop_thread[j];
+		}
+	}
+
+	abort();
+}
+
+static void thread_status_cb(meshlink_handle_t *handle, bool status) {
+	if(status) {
+		*get_loop_thread(handle) = pthread_self();
+	}
+}
+
+static void receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)channel;
+
+	if(!pthread_equal(*get_loop_thread(mesh), pthread_self())) {
+		wrong_thread = true;
+	}
+
+	const unsigned char *p = data;
+
+	for(size_t j = 0; j < len; j++) {
+		if(p[j] != (unsigned char)((received + j) * 7)) {
+			corrupt = true;
+		}
+	}
+
+	received += len;
+
+	if(received == TOTAL_SIZE) {
+		set_sync_flag(&done_flag, true);
+	}
+}
+
+static meshlink_handle_t *other_mesh;
+static struct sync_flag other_flag;
+
+static void other_receive_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, const void *data, size_t len) {
+	(void)mesh;
+	(void)channel;
+
+	// Runs on the shared thread, stopping or starting another instance on it must not wait for ourself.
+	if(len == 4 && !memcmp(data, "stop", 4)) {
+		meshlink_stop(other_mesh);
+		set_sync_flag(&other_flag, true);
+	} else if(len == 5 && !memcmp(data, "start", 5)) {
+		set_sync_flag(&other_flag, meshlink_start(other_mesh));
+	}
+}
+
+static bool accept_cb(meshlink_handle_t *mesh, meshlink_channel_t *channel, uint16_t port, const void *data, size_t len) {
+	(void)data;
+	(void)len;
+
+	meshlink_set_channel_receive_cb(mesh, channel, port == 2 ? other_receive_cb : receive_cb);
+	return true;
+}
+
+static void stream(meshlink_handle_t *mesh, const char *peer_name) {
+	reset_sync_flag(&done_flag);
+	received = 0;
+	corrupt = false;
+
+	meshlink_node_t *peer = meshlink_get_node(mesh, peer_name);
+	assert(peer);
+
+	meshlink_channel_t *channel = meshlink_channel_open(mesh, peer, 1, NULL, NULL, 0);
+	assert(channel);
+
+	unsigned char buf[10000];
+
+	for(size_t sent = 0; sent < TOTAL_SIZE;) {
+		size_t len = TOTAL_SIZE - sent < sizeof(buf) ? TOTAL_SIZE - sent : sizeof(buf);
+
+		for(size_t j = 0; j < len; j++) {
+			buf[j] = (sent + j) * 7;
+		}
+
+		ssize_t result = meshlink_channel_send(mesh, channel, buf, len);
+		assert(result >= 0);
+
+		if(!result) {
+			const struct timespec req = {0, 1000000};
+			nanosleep(&req, NULL);
+		}
+
+		sent += result;
+	}
+
+	assert(wait_sync_flag(&done_flag, 15));
+	assert(!corrupt);
+	assert(!wrong_thread);
+
+	meshlink_channel_close(mesh, channel);
+}
+
+int main(void) {
+	init_sync_flag(&done_flag);
+	init_sync_flag(&other_flag);
+
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	meshlink_shared_loop_t *shared = meshlink_shared_loop_new();
+	assert(shared);
+
+	// Open two pairs of instances that all run on the shared loop.
+
+	static const char *names[4] = {"a", "b", "c", "d"};
+	meshlink_handle_t **mesh = instances;
+
+	for(int j = 0; j < 4; j++) {
+		mesh[j] = meshlink_open_ephemeral(names[j], "shared_loop", DEV_CLASS_BACKBONE);
+		assert(mesh[j]);
+		meshlink_enable_discovery(mesh[j], false);
+		assert(meshlink_set_shared_loop(mesh[j], shared));
+		meshlink_set_thread_status_cb(mesh[j], thread_status_cb);
+		meshlink_set_channel_accept_cb(mesh[j], accept_cb);
+	}
+
+	link_meshlink_pair(mesh[0], mesh[1]);
+	link_meshlink_pair(mesh[2], mesh[3]);
+
+	start_meshlink_pair(mesh[0], mesh[1]);
+	start_meshlink_pair(mesh[2], mesh[3]);
+
+	// The loop cannot be changed or freed while it is in use.
+
+	assert(!meshlink_set_shared_loop(mesh[0], NULL));
+	assert(!meshlink_shared_loop_free(shared));
+
+	stream(mesh[0], "b");
+	stream(mesh[3], "c");
+
+	// Stopping one instance should not affect the others.
+
+	meshlink_node_t *b = meshlink_get_node(mesh[0], "b");
+	assert(b);
+
+	meshlink_stop(mesh[1]);
+	stream(mesh[2], "d");
+	assert_after(!meshlink_get_node_reachability(mesh[0], b, NULL, NULL), 15);
+
+	assert(meshlink_start(mesh[1]));
+	assert_after(meshlink_get_node_reachability(mesh[0], b, NULL, NULL), 15);
+	stream(mesh[0], "b");
+
+	// Another instance can be stopped and started from within a callback running on the shared thread.
+
+	meshlink_node_t *d = meshlink_get_node(mesh[2], "d");
+	assert(d);
+
+	other_mesh = mesh[3];
+
+	meshlink_channel_t *control = meshlink_channel_open(mesh[1], meshlink_get_node(mesh[1], "a"), 2, NULL, NULL, 0);
+	assert(control);
+
+	assert(meshlink_channel_send(mesh[1], control, "stop", 4) == 4);
+	assert(wait_sync_flag(&other_flag, 15));
+	assert_after(!meshlink_get_node_reachability(mesh[2], d, NULL, NULL), 15);
+
+	reset_sync_flag(&other_flag);
+	assert(meshlink_channel_send(mesh[1], control, "start", 5) == 5);
+	assert(wait_sync_flag(&other_flag, 15));
+	assert_after(meshlink_get_node_reachability(mesh[2], d, NULL, NULL), 15);
+	stream(mesh[2], "d");
+
+	meshlink_channel_close(mesh[1], control);
+
+	// An instance can go back to its own thread.
+
+	meshlink_node_t *c = meshlink_get_node(mesh[3], "c");
+	assert(c);
+
+	meshlink_stop(mesh[2]);
+	assert_after(!meshlink_get_node_reachability(mesh[3], c, NULL, NULL), 15);
+	assert(meshlink_set_shared_loop(mesh[2], NULL));
+	assert(meshlink_start(mesh[2]));
+	assert_after(meshlink_get_node_reachability(mesh[3], c, NULL, NULL), 15);
+	stream(mesh[3], "c");
+
+	// Clean up.
+
+	close_meshlink_pair(mesh[0], mesh[1]);
+	assert(!meshlink_shared_loop_free(shared));
+	close_meshlink_pair(mesh[2], mesh[3]);
+	assert(meshlink_shared_loop_free(shared));
+}
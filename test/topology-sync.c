@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "meshlink.h"
+#include "devtools.h"
+#include "utils.h"
+
+#define NMESHES 5
+#define NEDGES (NMESHES - 1) // as counted by devtool_get_all_edges(), which only counts bidirectional edges once
+
+static size_t count_edges(meshlink_handle_t *mesh) {
+	size_t nedges = 0;
+	devtool_edge_t *edges = devtool_get_all_edges(mesh, NULL, &nedges);
+	free(edges);
+	return nedges;
+}
+
+static uint64_t edges_sent(meshlink_handle_t *mesh) {
+	devtool_metrics_t *metrics = devtool_get_metrics(mesh);
+	assert(metrics);
+	uint64_t result = metrics->topology_edges_sent;
+	free(metrics);
+	return result;
+}
+
+static bool all_converged(meshlink_handle_t **mesh) {
+	for(int j = 0; j < NMESHES; j++) {
+		if(count_edges(mesh[j]) != NEDGES) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Restart a leaf node, and return how many edges the hub sent it to bring it up to date.
+static uint64_t reconnect_leaf(meshlink_handle_t **mesh, int leaf) {
+	meshlink_stop(mesh[leaf]);
+	assert_after(count_edges(mesh[0]) == NEDGES - 1, 15);
+
+	uint64_t before = edges_sent(mesh[0]);
+	assert(meshlink_start(mesh[leaf]));
+	assert_after(all_converged(mesh), 15);
+
+	return edges_sent(mesh[0]) - before;
+}
+
+int main(void) {
+	meshlink_set_log_cb(NULL, MESHLINK_DEBUG, log_cb);
+
+	// Create a hub with a number of leaf nodes, which only ever connect to the hub.
+
+	const char *name[NMESHES] = {"hub", "leaf1", "leaf2", "leaf3", "leaf4"};
+	meshlink_handle_t *mesh[NMESHES];
+	char *data[NMESHES];
+
+	for(int j = 0; j < NMESHES; j++) {
+		char *path = NULL;
+		assert(asprintf(&path, "topology_sync_conf.%d", j) != -1 && path);
+
+		assert(meshlink_destroy(path));
+		mesh[j] = meshlink_open(path, name[j], "topology-sync", j ? DEV_CLASS_UNKNOWN : DEV_CLASS_BACKBONE);
+		assert(mesh[j]);
+		free(path);
+
+		meshlink_enable_discovery(mesh[j], false);
+		assert(meshlink_set_canonical_address(mesh[j], meshlink_get_self(mesh[j]), "localhost", NULL));
+
+		data[j] = meshlink_export(mesh[j]);
+		assert(data[j]);
+	}
+
+	for(int j = 1; j < NMESHES; j++) {
+		assert(meshlink_import(mesh[j], data[0]));
+		assert(meshlink_import(mesh[0], data[j]));
+	}
+
+	for(int j = 0; j < NMESHES; j++) {
+		free(data[j]);
+		assert(meshlink_start(mesh[j]));
+	}
+
+	// All nodes start without knowing anything, and should learn the whole topology.
+
+	assert_after(all_converged(mesh), 15);
+
+	// A leaf that reconnects already knows most of the topology, so the hub should send it fewer edges than with a full dump.
+
+	uint64_t synced = reconnect_leaf(mesh, 1);
+
+	devtool_set_meta_text_only(mesh[1], true);
+	uint64_t full = reconnect_leaf(mesh, 1);
+
+	fprintf(stderr, "Edges sent with topology sync: %lu, without: %lu\n", (unsigned long)synced, (unsigned long)full);
+	// The full dump contains both directions of the edges of the other leaves.
+	assert(full >= 2 * (NEDGES - 1));
+	assert(synced < full);
+
+	// Clean up.
+
+	for(int j = 0; j < NMESHES; j++) {
+		meshlink_close(mesh[j]);
+	}
+}